@@ -35,3 +35,54 @@ vec3 ACESFilm(vec3 x) {
     float e = 0.14;
     return clamp((x*(a*x + b)) / (x*(c*x + d) + e), 0.0, 1.0);
 }
+
+vec3 Reinhard(vec3 x) {
+    x = max(x, 0.0);
+    return x / (1.0 + x);
+}
+
+// NOTE: source/postprocess.cpp mirrors the operators, dithering and false colors below
+#define TONEMAP_LINEAR   0
+#define TONEMAP_ACES     1
+#define TONEMAP_REINHARD 2
+
+vec3 Tonemap(vec3 x, int op) {
+    if (op == TONEMAP_ACES) {
+        return ACESFilm(x);
+    } else if (op == TONEMAP_REINHARD) {
+        return Reinhard(x);
+    }
+    return x;
+}
+
+// lowbias32, https://nullprogram.com/blog/2018/07/31/
+uint DitherHash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// quantizes to 8 bit with a per pixel offset instead of rounding to nearest,
+// the result is exactly representable so the unorm8 conversion keeps it
+vec3 Dither(vec3 color, uvec2 pixel) {
+    float offset = float(DitherHash(pixel.x ^ DitherHash(pixel.y)) >> 8) * (1.0 / 16777216.0);
+    return floor(color * 255.0 + offset) / 255.0;
+}
+
+// blue to red ramp for the heat map
+vec3 HeatColor(float t) {
+    float x = 4.0 * clamp(t, 0.0, 1.0);
+    return clamp(vec3(1.5) - abs(vec3(x - 3.0, x - 2.0, x - 1.0)), 0.0, 1.0);
+}
+
+// stable false color per material or primitive id, black for -1
+vec3 IdColor(float id) {
+    if (id < 0.0) {
+        return vec3(0.0);
+    }
+    uint hash = DitherHash(uint(id) + 1u);
+    return vec3(uvec3(hash, hash >> 8, hash >> 16) & 255u) / 255.0;
+}
@@ -9,11 +9,25 @@
 #define RAY_T_MAX 9999999.0
 #define TRIANGLE_KIND 1
 #define SPHERE_KIND 2
+#define QUAD_KIND 3
+#define DISK_KIND 4
+#define BOX_KIND 5
+// Integrator in constant_cache.h
+#define INTEGRATOR_PATH 0
+#define INTEGRATOR_AO 1
 
 // #extension GL_EXT_texture_array : enable
 
 layout (local_size_x = 1, local_size_y = 1) in;
 layout (rgba32f, binding = 0) uniform image2D outImage;
+// first hit feature buffers for the denoiser, only written when writeAovs != 0
+// albedoImage.a holds the hit distance and normalImage.a the sample count,
+// both are accumulated like outImage
+layout (rgba32f, binding = 1) uniform image2D albedoImage;
+layout (rgba32f, binding = 2) uniform image2D normalImage;
+// material (r) and primitive (g) of the first hit of the latest sample, -1 on a miss,
+// bvh nodes (b) and primitives (a) tested by the camera rays, accumulated like outImage
+layout (rgba32f, binding = 7) uniform image2D idImage;
 uniform sampler2D envTexture;
 // uniform sampler2D albedoTexture;
 uniform sampler2DArray albedoTexture;
@@ -26,6 +40,36 @@ struct Ray {
     vec3 hitNormal;
     vec2 hitUv;
     float hasAlbedoMap;
+    int geomId;
+    vec2 hitBary;        // weights of B and C, the attributes are interpolated once the closest hit is known
+    vec3 hitGeomNormal;  // normal of the surface itself facing the ray, hitNormal may be interpolated
+};
+
+// see RayShear in source/cpu/trace.h
+struct RayShear {
+    int kx;
+    int ky;
+    int kz;
+    vec3 S;
+};
+
+// what the traversal loops carry, see TraversalRay in source/cpu/trace.h
+struct TraversalRay {
+    vec3 origin;
+    float t;
+    vec3 direction;
+    int geomId;
+    vec3 invD;
+    vec3 originInvD;
+    vec2 bary;
+    RayShear shear;
+};
+
+// work done by HitScene calls, for the heat map and traversal stats
+struct TraversalCost {
+    int nodes;       // nodes fetched
+    int boxes;       // ray box tests
+    int primitives;  // ray primitive tests
 };
 
 struct Geometry {
@@ -45,6 +89,16 @@ struct Geometry {
     float hasAlbedoMap;
 };
 
+// the part of a Geometry the intersection tests read, see GpuPrimitive in scene.h
+struct Primitive {
+    vec3 A;
+    int kind;
+    vec3 B;
+    float radius;
+    vec3 C;
+    int _padding0;
+};
+
 struct Bvh {
     vec3 min;
     int missIdx;
@@ -57,6 +111,14 @@ struct Bvh {
     int _padding1;
 };
 
+// child pair layout, see BvhNode in bvh.h
+struct BvhNode {
+    vec3 min;
+    int firstChild;
+    vec3 max;
+    int geomIdx;
+};
+
 struct Material {
     vec3 albedo;
     float reflectChance;
@@ -83,9 +145,13 @@ layout (std140, binding = 0) uniform Constant
     int _padding0;
 
     ivec2 tileOffset;
+    int samplerKind;
+    int sampleIndex;
 
-    int _padding1;
-    int _padding2;
+    int writeAovs;
+    int integrator;
+    float aoRadius;
+    int _padding3;
 };
 
 layout (std140, binding = 1) buffer Geoms
@@ -93,40 +159,72 @@ layout (std140, binding = 1) buffer Geoms
     Geometry g_geoms[GEOM_COUNT];
 };
 
+#ifdef BVH_PAIRS
+layout (std140, binding = 2) buffer Bvhs
+{
+    BvhNode g_nodes[BVH_COUNT];
+};
+
+// matches BVH_STACK_SIZE in bvh.h, a work group is a single invocation so the
+// stack in shared memory belongs to one ray
+#define BVH_STACK_SIZE 64
+shared int s_stackIdx[BVH_STACK_SIZE];
+shared float s_stackTmin[BVH_STACK_SIZE];
+#else
 layout (std140, binding = 2) buffer Bvhs
 {
     Bvh g_bvhs[BVH_COUNT];
 };
+#endif
 
 layout (std140, binding = 3) buffer Materials
 {
     Material g_materials[MATERIAL_COUNT];
 };
 
-//------------------------------------------------------------------------------
-// Random function
-//------------------------------------------------------------------------------
-// https://blog.demofox.org/2020/05/25/casual-shadertoy-path-tracing-1-basic-camera-diffuse-emissive/
-uint WangHash(inout uint seed) {
-    seed = uint(seed ^ uint(61)) ^ uint(seed >> uint(16));
-    seed *= uint(9);
-    seed = seed ^ (seed >> 4);
-    seed *= uint(0x27d4eb2d);
-    seed = seed ^ (seed >> 15);
-    return seed;
-}
-
-// random number between 0 and 1
-float Random(inout uint state)
+layout (std140, binding = 5) buffer Prims
+{
+    Primitive g_prims[GEOM_COUNT];
+};
+
+#ifdef TRAVERSAL_STATS
+// NOTE: matches TraversalCounters in source/traversal_stats.h
+#define TRAVERSAL_BUCKETS 32
+
+layout (std430, binding = 4) buffer TraversalStats
 {
-    return float(WangHash(state)) / 4294967296.0;
+    uint g_rays;
+    uint g_nodes;
+    uint g_boxes;
+    uint g_primitives;
+    uint g_hits;
+    uint g_nodeHistogram[TRAVERSAL_BUCKETS];
+    uint g_primitiveHistogram[TRAVERSAL_BUCKETS];
+};
+
+// 0, 1, 2-3, 4-7, ...
+int TraversalBucket(int value) {
+    return min(findMSB(uint(value)) + 1, TRAVERSAL_BUCKETS - 1);
+}
+
+void RecordTraversal(TraversalCost cost, bool hit) {
+    atomicAdd(g_rays, 1u);
+    atomicAdd(g_nodes, uint(cost.nodes));
+    atomicAdd(g_boxes, uint(cost.boxes));
+    atomicAdd(g_primitives, uint(cost.primitives));
+    atomicAdd(g_hits, hit ? 1u : 0u);
+    atomicAdd(g_nodeHistogram[TraversalBucket(cost.nodes)], 1u);
+    atomicAdd(g_primitiveHistogram[TraversalBucket(cost.primitives)], 1u);
 }
+#endif
 
-// random unit vector
-vec3 RandomUnitVector(inout uint state)
+#include "sampler.glsl"
+
+// uniformly distributed unit vector from a 2D sample
+vec3 SampleUnitVector(vec2 u)
 {
-    float z = Random(state) * 2.0 - 1.0;
-    float a = Random(state) * TWO_PI;
+    float z = u.x * 2.0 - 1.0;
+    float a = u.y * TWO_PI;
     float r = sqrt(1.0 - z * z);
     float x = r * cos(a);
     float y = r * sin(a);
@@ -136,96 +234,394 @@ vec3 RandomUnitVector(inout uint state)
 //------------------------------------------------------------------------------
 // Common Ray Trace Functions
 //------------------------------------------------------------------------------
-// https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
-bool HitTriangle(inout Ray ray, in Geometry triangle) {
-    // P = A + u(B - A) + v(C - A) => O - A = -tD + u(B - A) + v(C - A)
-    // -tD + uAB + vAC = AO
-    vec3 AB = triangle.B - triangle.A;
-    vec3 AC = triangle.C - triangle.A;
-
-    vec3 P = cross(ray.direction, AC);
-    float det = dot(AB, P);
+RayShear ShearRay(in vec3 direction) {
+    vec3 absDir = abs(direction);
+
+    RayShear shear;
+    shear.kz = absDir.x > absDir.y ? (absDir.x > absDir.z ? 0 : 2) : (absDir.y > absDir.z ? 1 : 2);
+    shear.kx = (shear.kz + 1) % 3;
+    shear.ky = (shear.kx + 1) % 3;
+    // keeps the winding, so U, V and W share their sign for front faces
+    if (direction[shear.kz] < 0.0) {
+        int tmp = shear.kx;
+        shear.kx = shear.ky;
+        shear.ky = tmp;
+    }
 
-    if (det < EPSILON)
-        return false;
+    shear.S = vec3(direction[shear.kx], direction[shear.ky], 1.0) / direction[shear.kz];
+    return shear;
+}
 
-    float invDet = 1.0 / det;
-    vec3 AO = ray.origin - triangle.A;
+TraversalRay MakeTraversalRay(in vec3 origin, in vec3 direction, float t) {
+    TraversalRay ray;
+    ray.origin = origin;
+    ray.t = t;
+    ray.direction = direction;
+    ray.geomId = -1;
+    // clamped away from 0 so invD stays finite and origin * invD never turns into inf - inf
+    vec3 safeDir = mix(direction, mix(vec3(1e-20), vec3(-1e-20), lessThan(direction, vec3(0.0))), lessThan(abs(direction), vec3(1e-20)));
+    ray.invD = vec3(1.0) / safeDir;
+    ray.originInvD = origin * ray.invD;
+    ray.bary = vec2(0.0);
+    ray.shear = ShearRay(direction);
+    return ray;
+}
 
-    vec3 Q = cross(AO, AB);
-    float u = dot(AO, P) * invDet;
-    float v = dot(ray.direction, Q) * invDet;
+// http://jcgt.org/published/0002/01/05/
+// watertight and two sided, bary are the weights of B and C
+bool IntersectTriangle(in TraversalRay ray, in Primitive triangle, out float t, out vec2 bary) {
+    RayShear shear = ray.shear;
+    vec3 A = triangle.A - ray.origin;
+    vec3 B = triangle.B - ray.origin;
+    vec3 C = triangle.C - ray.origin;
+
+    float Ax = A[shear.kx] - shear.S.x * A[shear.kz];
+    float Ay = A[shear.ky] - shear.S.y * A[shear.kz];
+    float Bx = B[shear.kx] - shear.S.x * B[shear.kz];
+    float By = B[shear.ky] - shear.S.y * B[shear.kz];
+    float Cx = C[shear.kx] - shear.S.x * C[shear.kz];
+    float Cy = C[shear.ky] - shear.S.y * C[shear.kz];
+
+    // edge functions, a neighbour sharing the edge computes the same value with the opposite sign
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+
+    if ((U < 0.0 || V < 0.0 || W < 0.0) && (U > 0.0 || V > 0.0 || W > 0.0))
+        return false;
 
-    if (u < 0.0 || v < 0.0 || u + v > 1.0)
+    float det = U + V + W;
+    if (det == 0.0)
         return false;
 
-    float t = dot(AC, Q) * invDet;
+    float invDet = 1.0 / det;
+    t = shear.S.z * (U * A[shear.kz] + V * B[shear.kz] + W * C[shear.kz]) * invDet;
     if (t >= ray.t || t < EPSILON)
         return false;
 
-    ray.t = t;
-    ray.materialId = triangle.materialId;
-    ray.hasAlbedoMap = triangle.hasAlbedoMap;
-    vec3 norm = triangle.normal1 + u * (triangle.normal2 - triangle.normal1) + v * (triangle.normal3 - triangle.normal1);
-    ray.hitNormal = norm;
-    vec2 uv3 = vec2(triangle.uv3x, triangle.uv3y);
-    ray.hitUv = triangle.uv1 + u * (triangle.uv2 - triangle.uv1) + v * (uv3 - triangle.uv1);
-
+    bary = vec2(V, W) * invDet;
     return true;
 }
 
-bool HitSphere(inout Ray ray, in Geometry sphere) {
+bool IntersectSphere(in TraversalRay ray, in Primitive sphere, out float t) {
     vec3 oc = ray.origin - sphere.A;
     float a = dot(ray.direction, ray.direction);
     float half_b = dot(oc, ray.direction);
     float c = dot(oc, oc) - sphere.radius * sphere.radius;
     float discriminant = half_b * half_b - a * c;
 
-    float t = -half_b - sqrt(discriminant) / a;
+    t = -half_b - sqrt(discriminant) / a;
     if (discriminant < EPSILON || t >= ray.t || t < EPSILON)
         return false;
 
-    ray.t = t;
-    vec3 p = ray.origin + t * ray.direction;
-    ray.hitNormal = normalize(p - sphere.A);
-    ray.materialId = sphere.materialId;
+    return true;
+}
+
+// the plane through A spanned by B and C, uv are the coordinates of the hit along B and C
+bool IntersectPlane(in TraversalRay ray, in Primitive plane, out float t, out vec2 uv) {
+    vec3 n = cross(plane.B, plane.C);
+    float denom = dot(n, ray.direction);
+    if (denom == 0.0)
+        return false;
+
+    t = dot(n, plane.A - ray.origin) / denom;
+    if (t >= ray.t || t < EPSILON)
+        return false;
+
+    // p = u * B + v * C, crossing with C or B leaves a multiple of n
+    vec3 p = ray.origin + t * ray.direction - plane.A;
+    uv = vec2(dot(cross(p, plane.C), n), dot(cross(plane.B, p), n)) / dot(n, n);
+    return true;
+}
+
+// two sided, uv is the hit point in -1..1 along the half axes B and C
+bool IntersectQuad(in TraversalRay ray, in Primitive quad, out float t, out vec2 uv) {
+    return IntersectPlane(ray, quad, t, uv) && abs(uv.x) <= 1.0 && abs(uv.y) <= 1.0;
+}
+
+bool IntersectDisk(in TraversalRay ray, in Primitive disk, out float t, out vec2 uv) {
+    return IntersectPlane(ray, disk, t, uv) && dot(uv, uv) <= 1.0;
+}
+
+// the third half axis of a box, perpendicular to B and C
+vec3 BoxAxisW(in vec3 B, in vec3 C, float halfW) {
+    return normalize(cross(B, C)) * halfW;
+}
+
+// p in units of the half axes, the box is -1..1 on every axis
+vec3 ToBoxSpace(in vec3 p, in vec3 B, in vec3 C, in vec3 W) {
+    return vec3(dot(p, B) / dot(B, B), dot(p, C) / dot(C, C), dot(p, W) / dot(W, W));
+}
+
+// slab test in the frame of the box, a ray starting inside hits the far side
+bool IntersectBox(in TraversalRay ray, in Primitive box, out float t) {
+    vec3 W = BoxAxisW(box.B, box.C, box.radius);
+    vec3 o = ToBoxSpace(ray.origin - box.A, box.B, box.C, W);
+    vec3 d = ToBoxSpace(ray.direction, box.B, box.C, W);
+
+    // the frame is linear, so t along the local ray is t along the world ray
+    vec3 t0s = (vec3(-1.0) - o) / d;
+    vec3 t1s = (vec3(+1.0) - o) / d;
+
+    vec3 tsmaller = min(t0s, t1s);
+    vec3 tbigger = max(t0s, t1s);
+    float tnear = max(tsmaller.x, max(tsmaller.y, tsmaller.z));
+    float tfar = min(tbigger.x, min(tbigger.y, tbigger.z));
+    if (tnear > tfar)
+        return false;
+
+    t = tnear >= EPSILON ? tnear : tfar;
+    if (t >= ray.t || t < EPSILON)
+        return false;
 
     return true;
 }
 
+// material, normal and uv of the closest hit, the normal of a triangle, quad or disk
+// hit from behind is flipped, the one of a box hit from inside too
+void SetHitAttributes(inout Ray ray) {
+    Geometry geom = g_geoms[ray.geomId];
+    ray.materialId = geom.materialId;
+    if (geom.kind == SPHERE_KIND) {
+        vec3 p = ray.origin + ray.t * ray.direction;
+        ray.hitNormal = normalize(p - geom.A);
+        ray.hitGeomNormal = ray.hitNormal;
+        ray.hitUv = vec2(0.0);
+        ray.hasAlbedoMap = 0.0;
+        return;
+    }
+
+    if (geom.kind == QUAD_KIND || geom.kind == DISK_KIND) {
+        ray.hitNormal = normalize(cross(geom.B, geom.C));
+        ray.hitUv = 0.5 * ray.hitBary + 0.5;
+        ray.hasAlbedoMap = 0.0;
+    } else if (geom.kind == BOX_KIND) {
+        // the face is the axis the hit point lies furthest along
+        vec3 W = BoxAxisW(geom.B, geom.C, geom.radius);
+        vec3 p = ToBoxSpace(ray.origin + ray.t * ray.direction - geom.A, geom.B, geom.C, W);
+        vec3 absP = abs(p);
+        int axis = absP.x > absP.y ? (absP.x > absP.z ? 0 : 2) : (absP.y > absP.z ? 1 : 2);
+        vec3 N = axis == 0 ? geom.B : (axis == 1 ? geom.C : W);
+        ray.hitNormal = normalize(N) * (p[axis] < 0.0 ? -1.0 : 1.0);
+        ray.hitUv = vec2(0.0);
+        ray.hasAlbedoMap = 0.0;
+    } else {
+        float u = ray.hitBary.x;
+        float v = ray.hitBary.y;
+        ray.hasAlbedoMap = geom.hasAlbedoMap;
+        ray.hitNormal = geom.normal1 + u * (geom.normal2 - geom.normal1) + v * (geom.normal3 - geom.normal1);
+        vec2 uv3 = vec2(geom.uv3x, geom.uv3y);
+        ray.hitUv = geom.uv1 + u * (geom.uv2 - geom.uv1) + v * (uv3 - geom.uv1);
+        // the interpolated normal may lean past the face, the side is the geometric one
+        vec3 faceNormal = normalize(cross(geom.B - geom.A, geom.C - geom.A));
+        ray.hitGeomNormal = faceNormal;
+        if (dot(faceNormal, ray.direction) > 0.0) {
+            ray.hitNormal = -ray.hitNormal;
+            ray.hitGeomNormal = -faceNormal;
+        }
+        return;
+    }
+
+    if (dot(ray.hitNormal, ray.direction) > 0.0) {
+        ray.hitNormal = -ray.hitNormal;
+    }
+    ray.hitGeomNormal = ray.hitNormal;
+}
+
+// see OffsetRayOrigin in source/cpu/trace.h, ulps of p and a fixed distance close to 0
+vec3 OffsetRayOrigin(vec3 p, vec3 geomNormal, vec3 direction) {
+    const float ORIGIN_NEAR = 1.0 / 32.0;
+    const float FLOAT_OFFSET = 1.0 / 65536.0;
+    const float INT_OFFSET = 256.0;
+
+    vec3 n = dot(geomNormal, direction) < 0.0 ? -geomNormal : geomNormal;
+    ivec3 ulps = ivec3(INT_OFFSET * n);
+    vec3 pi = intBitsToFloat(floatBitsToInt(p) + mix(ulps, -ulps, lessThan(p, vec3(0.0))));
+    return mix(pi, p + FLOAT_OFFSET * n, lessThan(abs(p), vec3(ORIGIN_NEAR)));
+}
+
 // https://medium.com/@bromanz/another-view-on-the-classic-ray-aabb-intersection-algorithm-for-bvh-traversal-41125138b525
-bool HitBvh(in Ray ray, in Bvh bvh) {
-    vec3 invD = vec3(1.) / (ray.direction);
-    vec3 t0s = (bvh.min - ray.origin) * invD;
-    vec3 t1s = (bvh.max - ray.origin) * invD;
+// slab test against [RAY_T_MIN, ray.t), tmin is where the ray enters the box
+bool HitBox(in TraversalRay ray, in vec3 boxMin, in vec3 boxMax, out float tmin) {
+    vec3 t0s = fma(boxMin, ray.invD, -ray.originInvD);
+    vec3 t1s = fma(boxMax, ray.invD, -ray.originInvD);
 
     vec3 tsmaller = min(t0s, t1s);
     vec3 tbigger  = max(t0s, t1s);
 
-    float tmin = max(RAY_T_MIN, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
-    float tmax = min(RAY_T_MAX, min(tbigger.x, min(tbigger.y, tbigger.z)));
+    tmin = max(RAY_T_MIN, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
+    // ray.t never exceeds RAY_T_MAX, the factor keeps the rounding of the planes from
+    // dropping boxes the watertight triangle test would still hit
+    float tmax = min(ray.t, min(tbigger.x, min(tbigger.y, tbigger.z)) * 1.00000024);
 
-    return (tmin < tmax) && (ray.t > tmin);
+    return tmin < tmax;
 }
 
-bool HitScene(inout Ray ray) {
+bool IntersectPrimitive(in TraversalRay ray, in Primitive prim, out float t, out vec2 bary) {
+    if (prim.kind == TRIANGLE_KIND) {
+        return IntersectTriangle(ray, prim, t, bary);
+    } else if (prim.kind == SPHERE_KIND) {
+        return IntersectSphere(ray, prim, t);
+    } else if (prim.kind == QUAD_KIND) {
+        return IntersectQuad(ray, prim, t, bary);
+    } else if (prim.kind == DISK_KIND) {
+        return IntersectDisk(ray, prim, t, bary);
+    } else if (prim.kind == BOX_KIND) {
+        return IntersectBox(ray, prim, t);
+    }
+    return false;
+}
+
+bool HitGeometry(inout TraversalRay ray, int geomIdx, inout TraversalCost cost) {
+    float t;
+    // out parameters are written back even on a miss, so the closest hit keeps its own copy
+    vec2 bary = vec2(0.0);
+    ++cost.primitives;
+    if (!IntersectPrimitive(ray, g_prims[geomIdx], t, bary))
+        return false;
+
+    ray.t = t;
+    ray.geomId = geomIdx;
+    ray.bary = bary;
+    return true;
+}
+
+bool OccludedGeometry(in TraversalRay ray, int geomIdx, inout TraversalCost cost) {
+    float t;
+    vec2 bary;
+    ++cost.primitives;
+    return IntersectPrimitive(ray, g_prims[geomIdx], t, bary);
+}
+
+#ifdef BVH_PAIRS
+// both children are tested at once, the nearer one is visited first and the other one
+// is pushed with its entry distance, so it is skipped if a closer hit was found meanwhile
+bool TraverseBvh(inout TraversalRay ray, inout TraversalCost cost) {
+    float tmin;
+    ++cost.nodes;
+    ++cost.boxes;
+    if (!HitBox(ray, g_nodes[0].min, g_nodes[0].max, tmin)) {
+        return false;
+    }
+
+    bool anyHit = false;
+    int stackSize = 0;
+    int nodeIdx = 0;
+    while (true) {
+        BvhNode node = g_nodes[nodeIdx];
+        if (node.geomIdx != -1) {
+            anyHit = HitGeometry(ray, node.geomIdx, cost) || anyHit;
+        } else {
+            int first = node.firstChild;
+            float tLeft, tRight;
+            cost.nodes += 2;
+            cost.boxes += 2;
+            bool hitLeft = HitBox(ray, g_nodes[first].min, g_nodes[first].max, tLeft);
+            bool hitRight = HitBox(ray, g_nodes[first + 1].min, g_nodes[first + 1].max, tRight);
+            if (hitLeft && hitRight) {
+                bool leftFirst = tLeft <= tRight;
+                s_stackIdx[stackSize] = leftFirst ? first + 1 : first;
+                s_stackTmin[stackSize] = leftFirst ? tRight : tLeft;
+                // SetBvhLayout only picks this layout when the bvh height fits the stack
+                ++stackSize;
+                nodeIdx = leftFirst ? first : first + 1;
+                continue;
+            }
+            if (hitLeft || hitRight) {
+                nodeIdx = hitLeft ? first : first + 1;
+                continue;
+            }
+        }
+
+        // the next pushed node the closest hit so far does not rule out
+        while (stackSize > 0 && s_stackTmin[stackSize - 1] >= ray.t) {
+            --stackSize;
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        nodeIdx = s_stackIdx[--stackSize];
+    }
+
+    return anyHit;
+}
+
+// any hit ends the traversal, so the children are visited in storage order
+bool TraverseBvhAny(in TraversalRay ray, inout TraversalCost cost) {
+    float tmin;
+    ++cost.nodes;
+    ++cost.boxes;
+    if (!HitBox(ray, g_nodes[0].min, g_nodes[0].max, tmin)) {
+        return false;
+    }
+
+    int stackSize = 0;
+    int nodeIdx = 0;
+    while (true) {
+        BvhNode node = g_nodes[nodeIdx];
+        if (node.geomIdx != -1) {
+            if (OccludedGeometry(ray, node.geomIdx, cost)) {
+                return true;
+            }
+        } else {
+            int first = node.firstChild;
+            cost.nodes += 2;
+            cost.boxes += 2;
+            bool hitLeft = HitBox(ray, g_nodes[first].min, g_nodes[first].max, tmin);
+            bool hitRight = HitBox(ray, g_nodes[first + 1].min, g_nodes[first + 1].max, tmin);
+            if (hitLeft && hitRight) {
+                s_stackIdx[stackSize] = first + 1;
+                ++stackSize;
+                nodeIdx = first;
+                continue;
+            }
+            if (hitLeft || hitRight) {
+                nodeIdx = hitLeft ? first : first + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+        nodeIdx = s_stackIdx[--stackSize];
+    }
+
+    return false;
+}
+#else
+bool TraverseBvh(inout TraversalRay ray, inout TraversalCost cost) {
     bool anyHit = false;
 
     int bvhIdx = 0;
     while (bvhIdx != -1) {
         Bvh bvh = g_bvhs[bvhIdx];
-        if (HitBvh(ray, bvh)) {
+        float tmin;
+        ++cost.nodes;
+        ++cost.boxes;
+        if (HitBox(ray, bvh.min, bvh.max, tmin)) {
             if (bvh.geomIdx != -1) {
-                Geometry geom = g_geoms[bvh.geomIdx];
-                if (geom.kind == TRIANGLE_KIND) {
-                    if (HitTriangle(ray, geom)) {
-                        anyHit = true;
-                    }
-                } else if (geom.kind == SPHERE_KIND) {
-                    if (HitSphere(ray, geom)) {
-                        anyHit = true;
-                    }
-                }
+                anyHit = HitGeometry(ray, bvh.geomIdx, cost) || anyHit;
+            }
+            bvhIdx = bvh.hitIdx;
+        } else {
+            bvhIdx = bvh.missIdx;
+        }
+    }
+
+    return anyHit;
+}
+
+bool TraverseBvhAny(in TraversalRay ray, inout TraversalCost cost) {
+    int bvhIdx = 0;
+    while (bvhIdx != -1) {
+        Bvh bvh = g_bvhs[bvhIdx];
+        float tmin;
+        ++cost.nodes;
+        ++cost.boxes;
+        if (HitBox(ray, bvh.min, bvh.max, tmin)) {
+            if (bvh.geomIdx != -1 && OccludedGeometry(ray, bvh.geomIdx, cost)) {
+                return true;
             }
             bvhIdx = bvh.hitIdx;
         } else {
@@ -233,9 +629,44 @@ bool HitScene(inout Ray ray) {
         }
     }
 
+    return false;
+}
+#endif
+
+// adds the work done to cost, with TRAVERSAL_STATS every call is also recorded
+bool HitScene(inout Ray ray, inout TraversalCost cost) {
+    TraversalCost local = TraversalCost(0, 0, 0);
+    TraversalRay traversal = MakeTraversalRay(ray.origin, ray.direction, ray.t);
+    bool anyHit = TraverseBvh(traversal, local);
+    if (anyHit) {
+        ray.t = traversal.t;
+        ray.geomId = traversal.geomId;
+        ray.hitBary = traversal.bary;
+        SetHitAttributes(ray);
+    }
+
+#ifdef TRAVERSAL_STATS
+    RecordTraversal(local, anyHit);
+#endif
+    cost.nodes += local.nodes;
+    cost.boxes += local.boxes;
+    cost.primitives += local.primitives;
     return anyHit;
 }
 
+bool HitScene(inout Ray ray) {
+    TraversalCost cost = TraversalCost(0, 0, 0);
+    return HitScene(ray, cost);
+}
+
+// true if anything lies between EPSILON and tmax along the ray, stops at the first hit it finds
+// and leaves the hit attributes alone, for shadow and ambient occlusion rays, not counted by
+// TRAVERSAL_STATS
+bool OccludedScene(in Ray ray, float tmax) {
+    TraversalCost cost = TraversalCost(0, 0, 0);
+    return TraverseBvhAny(MakeTraversalRay(ray.origin, ray.direction, tmax), cost);
+}
+
 vec2 SampleSphericalMap(in vec3 v) {
     vec2 uv = vec2(atan(v.z, v.x), asin(v.y));
     uv *= vec2(0.1591, 0.3183);
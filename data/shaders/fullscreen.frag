@@ -3,16 +3,64 @@ layout (location = 0) in vec2 pass_uv;
 
 uniform sampler2D outTexture;
 uniform sampler2D envTexture;
+uniform sampler2D albedoAovTexture;
+uniform sampler2D normalAovTexture;
+uniform sampler2D idAovTexture;
+uniform float exposure;
+uniform int tonemapOperator;
+uniform int dither;
+uniform int aovView;
+uniform float depthScale;  // hit distance shown as white
+uniform float heatScale;   // nodes per camera ray shown as red
 
 #include "color.glsl"
 
-#define EXPOSURE 0.5
+// NOTE: matches AovView in source/postprocess.h
+#define AOV_COLOR     0
+#define AOV_ALBEDO    1
+#define AOV_NORMAL    2
+#define AOV_DEPTH     3
+#define AOV_MATERIAL  4
+#define AOV_PRIMITIVE 5
+#define AOV_HEAT      6
+
+// feature buffers are accumulated, normal.a holds their sample count
+vec3 AovColor(ivec2 texel) {
+    vec4 normal = texelFetch(normalAovTexture, texel, 0);
+    float weight = normal.a > 0.0 ? 1.0 / normal.a : 0.0;
+    if (aovView == AOV_ALBEDO) {
+        return LinearToSRGB(texelFetch(albedoAovTexture, texel, 0).rgb * weight);
+    } else if (aovView == AOV_NORMAL) {
+        vec3 n = normal.xyz * weight;
+        return dot(n, n) > 0.0 ? normalize(n) * 0.5 + 0.5 : vec3(0.0);
+    } else if (aovView == AOV_DEPTH) {
+        return vec3(clamp(texelFetch(albedoAovTexture, texel, 0).a * weight / depthScale, 0.0, 1.0));
+    }
+
+    vec4 ids = texelFetch(idAovTexture, texel, 0);
+    if (aovView == AOV_MATERIAL) {
+        return IdColor(ids.r);
+    } else if (aovView == AOV_PRIMITIVE) {
+        return IdColor(ids.g);
+    }
+    return HeatColor(ids.b * weight / heatScale);
+}
 
 void main() {
+    if (aovView != AOV_COLOR) {
+        ivec2 size = textureSize(normalAovTexture, 0);
+        ivec2 texel = min(ivec2(pass_uv * vec2(size)), size - 1);
+        out_color = vec4(AovColor(texel), 1.0);
+        return;
+    }
+
     vec4 color4 = texture(outTexture, pass_uv);
     vec3 color = color4.rgb / color4.a;
-    color *= EXPOSURE;
-    color = ACESFilm(color);
+    color *= exposure;
+    color = Tonemap(color, tonemapOperator);
     color = LinearToSRGB(color);
+    if (dither != 0) {
+        color = Dither(color, uvec2(gl_FragCoord.xy));
+    }
     out_color = vec4(color, 1.0);
 }
@@ -0,0 +1,158 @@
+//------------------------------------------------------------------------------
+// Sampler
+//------------------------------------------------------------------------------
+// NOTE: source/sampler.cpp mirrors this file, keep the two in sync
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL  1
+#define SAMPLER_RANK1  2
+
+// dimension layout
+// [0, 4)   camera: pixel jitter (2D), 2 spare
+// [4, ...) one block of SAMPLER_DIMS_PER_BOUNCE per bounce:
+//          lobe selection (1D), bsdf direction (2D), 1 spare
+#define SAMPLER_DIM_CAMERA      0
+#define SAMPLER_DIM_BOUNCE      4
+#define SAMPLER_DIMS_PER_BOUNCE 4
+
+struct Sampler {
+    uvec2 pixel;
+    uint index;
+    uint dimension;
+    uint seed;
+    uint state;
+    int kind;
+};
+
+// https://blog.demofox.org/2020/05/25/casual-shadertoy-path-tracing-1-basic-camera-diffuse-emissive/
+uint WangHash(inout uint seed) {
+    seed = uint(seed ^ uint(61)) ^ uint(seed >> uint(16));
+    seed *= uint(9);
+    seed = seed ^ (seed >> 4);
+    seed *= uint(0x27d4eb2d);
+    seed = seed ^ (seed >> 15);
+    return seed;
+}
+
+// random number between 0 and 1
+float Random(inout uint state)
+{
+    return float(WangHash(state)) / 4294967296.0;
+}
+
+// https://nullprogram.com/blog/2018/07/31/ (lowbias32)
+uint Hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint HashCombine(uint seed, uint v) {
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Joe-Kuo direction numbers for the first 4 dimensions, each dimension is a row of 32
+const uint SOBOL_DIRECTIONS[128] = uint[128](
+    0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+    0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+    0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+    0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+
+    0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+    0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+    0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+    0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu,
+
+    0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+    0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+    0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u, 0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+    0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u,
+
+    0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+    0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+    0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u, 0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+    0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u
+);
+
+uint SobolSample(uint index, uint dim) {
+    uint x = 0u;
+    for (uint bit = 0u; index != 0u; index >>= 1, ++bit) {
+        x ^= (index & 1u) * SOBOL_DIRECTIONS[dim * 32u + bit];
+    }
+    return x;
+}
+
+// Practical Hash-based Owen Scrambling, Burley 2020
+uint LaineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed) {
+    x = bitfieldReverse(x);
+    x = LaineKarrasPermutation(x, seed);
+    return bitfieldReverse(x);
+}
+
+// every 4 consecutive dimensions form a shuffled, Owen-scrambled 4D Sobol set,
+// sets are decorrelated from each other by hashing the set index into the seed
+uint SobolDimension(in Sampler s, uint dim) {
+    uint setSeed = Hash(HashCombine(s.seed, dim >> 2));
+    uint index = NestedUniformScramble(s.index, setSeed);
+    uint x = SobolSample(index, dim & 3u);
+    return NestedUniformScramble(x, HashCombine(setSeed, dim & 3u));
+}
+
+// R2 sequence (Roberts 2018) in 32 bit fixed point
+#define R2_ALPHA_X 0xc13fa9a9u
+#define R2_ALPHA_Y 0x91e10da6u
+
+// each dimension pair is an R2 lattice, rotated per pixel by an R2 dither mask
+// which distributes the error as blue noise in screen space
+uint Rank1Dimension(in Sampler s, uint dim) {
+    uint alpha = (dim & 1u) == 0u ? R2_ALPHA_X : R2_ALPHA_Y;
+    uint mask = s.pixel.x * R2_ALPHA_X + s.pixel.y * R2_ALPHA_Y;
+    return s.index * alpha + mask + Hash(dim >> 1);
+}
+
+Sampler SamplerInit(int kind, uvec2 pixel, uint index, uint frame) {
+    Sampler s;
+    s.kind = kind;
+    s.pixel = pixel;
+    s.index = index;
+    s.dimension = 0u;
+    s.seed = Hash(pixel.x ^ Hash(pixel.y));
+    s.state = uint(pixel.x * uint(1973) + pixel.y * uint(9277) + frame * uint(26699)) | uint(1);
+    return s;
+}
+
+void SamplerStartDimension(inout Sampler s, uint dimension) {
+    s.dimension = dimension;
+}
+
+void SamplerStartBounce(inout Sampler s, int bounce) {
+    s.dimension = uint(SAMPLER_DIM_BOUNCE + bounce * SAMPLER_DIMS_PER_BOUNCE);
+}
+
+float SamplerNext1D(inout Sampler s) {
+    uint dim = s.dimension++;
+    if (s.kind == SAMPLER_SOBOL) {
+        return float(SobolDimension(s, dim) >> 8) * (1.0 / 16777216.0);
+    } else if (s.kind == SAMPLER_RANK1) {
+        return float(Rank1Dimension(s, dim) >> 8) * (1.0 / 16777216.0);
+    }
+
+    return Random(s.state);
+}
+
+vec2 SamplerNext2D(inout Sampler s) {
+    float x = SamplerNext1D(s);
+    float y = SamplerNext1D(s);
+    return vec2(x, y);
+}
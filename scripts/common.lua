@@ -4,6 +4,7 @@ local GeometryKind = {
     Quad = 2,
     Cube = 3,
     Mesh = 4,
+    Disk = 5,
 };
 
 local Vector3 = {};
@@ -0,0 +1,90 @@
+#include "aov.h"
+
+#include "image.h"
+#include "universal/core_assert.h"
+
+namespace pt {
+
+using std::string;
+using std::vector;
+
+void ResolveIds( const vector<vec4>& ids, const vector<vec4>& normal, int width, int height, IdBuffers& outIds )
+{
+    const size_t count = static_cast<size_t>( width ) * height;
+    core_assert( ids.size() == count && normal.size() == count );
+
+    outIds.width  = width;
+    outIds.height = height;
+    outIds.material.resize( count );
+    outIds.primitive.resize( count );
+    outIds.nodes.resize( count );
+    outIds.primitives.resize( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const float weight   = normal[i].a > 0.0f ? 1.0f / normal[i].a : 0.0f;
+        outIds.material[i]   = static_cast<int>( ids[i].r );
+        outIds.primitive[i]  = static_cast<int>( ids[i].g );
+        outIds.nodes[i]      = ids[i].b * weight;
+        outIds.primitives[i] = ids[i].a * weight;
+    }
+}
+
+HeatStats GetHeatStats( const IdBuffers& ids )
+{
+    HeatStats stats;
+    double nodes = 0.0, primitives = 0.0;
+    for ( size_t i = 0; i < ids.nodes.size(); ++i )
+    {
+        nodes += ids.nodes[i];
+        primitives += ids.primitives[i];
+        stats.maxNodes      = glm::max( stats.maxNodes, ids.nodes[i] );
+        stats.maxPrimitives = glm::max( stats.maxPrimitives, ids.primitives[i] );
+    }
+
+    const double count   = static_cast<double>( glm::max( ids.nodes.size(), size_t( 1 ) ) );
+    stats.meanNodes      = static_cast<float>( nodes / count );
+    stats.meanPrimitives = static_cast<float>( primitives / count );
+    return stats;
+}
+
+template<typename Color>
+static bool WriteFalseColor( const string& path, const IdBuffers& ids, const Color& color )
+{
+    vector<unsigned char> rgb8( ids.nodes.size() * 3 );
+    for ( size_t i = 0; i < ids.nodes.size(); ++i )
+    {
+        const vec3 c    = color( i );
+        rgb8[3 * i + 0] = static_cast<unsigned char>( c.r * 255.0f + 0.5f );
+        rgb8[3 * i + 1] = static_cast<unsigned char>( c.g * 255.0f + 0.5f );
+        rgb8[3 * i + 2] = static_cast<unsigned char>( c.b * 255.0f + 0.5f );
+    }
+    return WritePng( path, rgb8.data(), ids.width, ids.height, 3 );
+}
+
+bool WriteIdAovs( const string& prefix, const IdBuffers& ids, float heatScale )
+{
+    const size_t count = ids.nodes.size();
+    vector<float> idRgb( count * 3 );
+    vector<float> heatRgb( count * 3 );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        // ids stay exact in float up to 2^24
+        idRgb[3 * i + 0]   = static_cast<float>( ids.material[i] );
+        idRgb[3 * i + 1]   = static_cast<float>( ids.primitive[i] );
+        idRgb[3 * i + 2]   = 0.0f;
+        heatRgb[3 * i + 0] = ids.nodes[i];
+        heatRgb[3 * i + 1] = ids.primitives[i];
+        heatRgb[3 * i + 2] = 0.0f;
+    }
+
+    const float invHeatScale = heatScale > 0.0f ? 1.0f / heatScale : 1.0f;
+
+    bool ok = WriteHdrImage( prefix + "_ids.pfm", HdrFormat::Pfm, idRgb.data(), ids.width, ids.height );
+    ok      = WriteHdrImage( prefix + "_heat.pfm", HdrFormat::Pfm, heatRgb.data(), ids.width, ids.height ) && ok;
+    ok      = WriteFalseColor( prefix + "_material.png", ids, [&]( size_t i ) { return IdColor( ids.material[i] ); } ) && ok;
+    ok      = WriteFalseColor( prefix + "_primitive.png", ids, [&]( size_t i ) { return IdColor( ids.primitive[i] ); } ) && ok;
+    ok      = WriteFalseColor( prefix + "_heat.png", ids, [&]( size_t i ) { return HeatColor( ids.nodes[i] * invHeatScale ); } ) && ok;
+    return ok;
+}
+
+}  // namespace pt
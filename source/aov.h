@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "postprocess.h"
+
+namespace pt {
+
+/// first hit ids and traversal cost resolved to one value per pixel, rows bottom to top
+/// like the accumulation buffer, see idImage in data/shaders/common.glsl
+struct IdBuffers {
+    int width  = 0;
+    int height = 0;
+    std::vector<int> material;      // -1 where the camera ray escaped
+    std::vector<int> primitive;     // index into GpuScene::geometries
+    std::vector<float> nodes;       // bvh nodes tested per camera ray, averaged over the samples
+    std::vector<float> primitives;  // primitives tested per camera ray
+};
+
+/// divides the traversal cost by the sample count (normal alpha)
+void ResolveIds( const std::vector<vec4>& ids, const std::vector<vec4>& normal, int width, int height, IdBuffers& outIds );
+
+struct HeatStats {
+    float meanNodes      = 0.0f;
+    float maxNodes       = 0.0f;
+    float meanPrimitives = 0.0f;
+    float maxPrimitives  = 0.0f;
+};
+
+HeatStats GetHeatStats( const IdBuffers& ids );
+
+/// writes <prefix>_ids.pfm (material, primitive, 0) and <prefix>_heat.pfm (nodes, primitives, 0)
+/// plus false color <prefix>_material.png, <prefix>_primitive.png and <prefix>_heat.png,
+/// the heat map shows heatScale nodes per camera ray as red
+bool WriteIdAovs( const std::string& prefix, const IdBuffers& ids, float heatScale );
+
+}  // namespace pt
@@ -13,7 +13,7 @@ GLFWwindow* GetInternalWindow()
     return g_Window;
 }
 
-void CreateMainWindow( int width, int height )
+static void CreateWindowInternal( int width, int height, bool visible )
 {
     glfwSetErrorCallback( []( int, const char* error ) {
         throw std::runtime_error( error );
@@ -22,10 +22,21 @@ void CreateMainWindow( int width, int height )
     glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 4 );
     glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 6 );
     glfwWindowHint( GLFW_RESIZABLE, GLFW_FALSE );
+    glfwWindowHint( GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE );
 
     g_Window = glfwCreateWindow( width, height, "GLSL path tracer", 0, 0 );
     glfwMakeContextCurrent( g_Window );
-    glfwSwapInterval( 1 );
+    glfwSwapInterval( visible ? 1 : 0 );
+}
+
+void CreateMainWindow( int width, int height )
+{
+    CreateWindowInternal( width, height, true );
+}
+
+void CreateHiddenWindow( int width, int height )
+{
+    CreateWindowInternal( width, height, false );
 }
 
 void DestroyMainWindow()
@@ -5,6 +5,8 @@ struct GLFWwindow;
 namespace pt {
 
 void CreateMainWindow( int width, int height );
+/// invisible window that only provides a GL context for headless rendering
+void CreateHiddenWindow( int width, int height );
 void CloseWindow();
 bool ShouldCloseWindow();
 void DestroyMainWindow();
@@ -0,0 +1,1198 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aov.h"
+#include "application.h"
+#include "camera.h"
+#include "checkpoint.h"
+#include "com_dvars.h"
+#include "common.h"
+#include "constant_cache.h"
+#include "cpu/cpu_renderer.h"
+#include "denoise.h"
+#include "distributed.h"
+#include "frame_capture.h"
+#include "glutil.h"
+#include "gpu_timer.h"
+#include "postprocess.h"
+#include "renderer.h"
+#include "reprojection.h"
+#include "sampler.h"
+#include "scene_loader.h"
+#include "universal/dvar_api.h"
+#include "universal/print.h"
+#include "utility/memory_stats.h"
+#include "utility/parallel.h"
+#include "utility/profiler.h"
+#include "utility/string_util.h"
+
+#ifndef DATA_DIR
+#define DATA_DIR ""
+#endif
+
+namespace pt {
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+extern ImageArray g_AlbedoMaps;
+
+static double MsSince( const Clock::time_point& start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+//------------------------------------------------------------------------------
+// Checkpoints
+//------------------------------------------------------------------------------
+struct CheckpointState {
+    CheckpointWriter* writer = nullptr;
+    Clock::time_point last;
+    double intervalMs = 0.0;
+    double stallMs    = 0.0;  // time the render loop spent taking snapshots
+};
+
+static bool CheckpointDue( const CheckpointState& state, int samplesDone, int spp )
+{
+    return state.writer && samplesDone < spp && MsSince( state.last ) >= state.intervalMs;
+}
+
+static void SubmitCheckpoint( CheckpointState& state, const BatchContext& ctx, vector<vec4>&& accumulation, int samplesDone )
+{
+    Checkpoint checkpoint;
+    checkpoint.sceneHash    = ctx.sceneHash;
+    checkpoint.width        = ctx.width;
+    checkpoint.height       = ctx.height;
+    checkpoint.samplerKind  = ctx.cache.samplerKind;
+    checkpoint.samplesDone  = samplesDone;
+    checkpoint.accumulation = std::move( accumulation );
+    state.writer->Submit( std::move( checkpoint ) );
+    state.last = Clock::now();
+}
+
+void SetCamera( ConstantBufferCache& cache, const Camera& camera )
+{
+    cache.camPos   = camera.pos;
+    cache.camFwd   = camera.fwd;
+    cache.camRight = camera.right;
+    cache.camUp    = camera.up;
+    cache.camFov   = camera.fov;
+}
+
+void SetIntegrator( ConstantBufferCache& cache, const Box3& bbox )
+{
+    const float radius = Dvar_GetFloat( ao_radius );
+    cache.integrator   = glm::clamp( Dvar_GetInt( integrator ), 0, Integrator_Count - 1 );
+    cache.aoRadius     = radius > 0.0f ? radius : 0.1f * glm::max( glm::length( bbox.max - bbox.min ), 1e-3f );
+}
+
+static void PrintProgress( const BatchContext& ctx, int sample )
+{
+    const int step = glm::max( ctx.spp / 10, 1 );
+    if ( !ctx.quiet && ( ( sample + 1 ) % step == 0 || sample + 1 == ctx.spp ) )
+    {
+        Com_Printf( "[batch] %d/%d samples", sample + 1, ctx.spp );
+    }
+}
+
+//------------------------------------------------------------------------------
+// GPU backend
+//------------------------------------------------------------------------------
+bool CreateGpuContext( int width, int height )
+{
+    try
+    {
+        CreateHiddenWindow( width, height );
+        gl::InitGraphics();
+    }
+    catch ( std::runtime_error& err )
+    {
+        Com_PrintWarning( "[batch] no GL context available (%s)", err.what() );
+        return false;
+    }
+
+    return true;
+}
+
+static void RenderGpu( BatchContext& ctx, CheckpointState& checkpoint )
+{
+    PROFILE_ZONE( "RenderGpu" );
+    Clock::time_point start   = Clock::now();
+    const int64_t uploadStart = ctx.timeline.Now();
+
+    GLuint outTexture = gl::CreateOutputTextureAndBind( ctx.width, ctx.height );
+    if ( ctx.startSample > 0 )
+    {
+        glTextureSubImage2D( outTexture, 0, 0, 0, ctx.width, ctx.height, GL_RGBA, GL_FLOAT, ctx.accumulation.data() );
+    }
+
+    // checkpoints only hold the color, after a resume the features cover the remaining samples
+    GLuint albedoAovTexture = gl::NullHandle;
+    GLuint normalAovTexture = gl::NullHandle;
+    GLuint idAovTexture     = gl::NullHandle;
+    if ( ctx.cache.writeAovs )
+    {
+        albedoAovTexture = gl::CreateFeatureTextureAndBind( ctx.width, ctx.height, 1 );
+        normalAovTexture = gl::CreateFeatureTextureAndBind( ctx.width, ctx.height, 2 );
+        idAovTexture     = gl::CreateFeatureTextureAndBind( ctx.width, ctx.height, 7 );
+    }
+
+    GLuint envTexture;
+    {
+        Image image;
+        envTexture = gl::CreateEnvTexture( DATA_DIR "env/stairs.hdr", image );
+        FreeImage( image );
+    }
+
+    GLuint albedoTexture = gl::NullHandle;
+    if ( !g_AlbedoMaps.images.empty() )
+    {
+        albedoTexture = gl::Create3DTexture( g_AlbedoMaps );
+    }
+
+    const bool traversalStats = Dvar_GetBool( traversal_stats );
+    const bool timed          = Dvar_GetString( trace_output )[0] != '\0';
+
+    const bool bvhPairs = ctx.gpuScene.layout == BvhLayout::Pairs;
+
+    gl::Program program;
+    {
+        gl::Program::CreateInfo createInfo = {};
+        createInfo.defines.push_back( Define{ "BVH_COUNT", std::any( static_cast<int>( bvhPairs ? ctx.gpuScene.nodes.size() : ctx.gpuScene.bvhs.size() ) ) } );
+        createInfo.defines.push_back( Define{ "GEOM_COUNT", std::any( static_cast<int>( ctx.gpuScene.geometries.size() ) ) } );
+        createInfo.defines.push_back( Define{ "MATERIAL_COUNT", std::any( ctx.gpuScene.materials.size() ) } );
+        if ( bvhPairs )
+        {
+            createInfo.defines.push_back( Define{ "BVH_PAIRS", std::any( 1 ) } );
+        }
+        if ( traversalStats )
+        {
+            createInfo.defines.push_back( Define{ "TRAVERSAL_STATS", std::any( 1 ) } );
+        }
+        createInfo.kind = gl::Program::Kind::Compute;
+        createInfo.comp = DATA_DIR "shaders/tiled.comp";
+        program.Create( createInfo );
+
+        program.Use();
+        glUniform1i( program.GetUniformLoc( "envTexture" ), 1 );
+        glUniform1i( program.GetUniformLoc( "albedoTexture" ), 2 );
+    }
+
+    GLuint constantBuffer;
+    glGenBuffers( 1, &constantBuffer );
+    glBindBufferBase( GL_UNIFORM_BUFFER, 0, constantBuffer );
+
+    GLuint geomSsbo = gl::CreateSSBO( ctx.gpuScene.geometries );
+    gl::BindSSBOToSlot( geomSsbo, 1 );
+    GLuint bboxSsbo = bvhPairs ? gl::CreateSSBO( ctx.gpuScene.nodes ) : gl::CreateSSBO( ctx.gpuScene.bvhs );
+    gl::BindSSBOToSlot( bboxSsbo, 2 );
+    GLuint matSsbo = gl::CreateSSBO( ctx.gpuScene.materials );
+    gl::BindSSBOToSlot( matSsbo, 3 );
+    GLuint primSsbo = gl::CreateSSBO( ctx.gpuScene.primitives );
+    gl::BindSSBOToSlot( primSsbo, 5 );
+    GLuint traversalSsbo = gl::NullHandle;
+    if ( traversalStats )
+    {
+        traversalSsbo = gl::CreateSSBO( vector<TraversalCounters>( 1 ) );
+        gl::BindSSBOToSlot( traversalSsbo, 4 );
+    }
+
+    glActiveTexture( GL_TEXTURE1 );
+    glBindTexture( GL_TEXTURE_2D, envTexture );
+    glActiveTexture( GL_TEXTURE2 );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, albedoTexture );
+    glFinish();
+    ctx.uploadMs = MsSince( start );
+    ctx.timeline.Add( "upload", TimerTrack_Cpu, ctx.timeline.GetFrame(), uploadStart, ctx.timeline.Now() - uploadStart );
+
+    // progressive dumps are read back through the pbo ring and encoded off the render thread
+    const int dumpEvery = Dvar_GetInt( dump_every );
+    gl::FrameCapture capture;
+    if ( dumpEvery > 0 )
+    {
+        capture.Initialize( 3 );
+    }
+    gl::GpuTimerRing gpuTimers;
+    if ( timed )
+    {
+        gpuTimers.Initialize( 2, 1 );
+    }
+
+    start           = Clock::now();
+    checkpoint.last = start;
+    for ( int sample = ctx.startSample; sample < ctx.spp; ++sample )
+    {
+        ctx.cache.frame       = sample + 1;
+        ctx.cache.sampleIndex = sample;
+        ctx.cache.dirty       = sample == 0;
+        ctx.timeline.BeginFrame();
+        gpuTimers.BeginFrame( ctx.timeline );
+        CpuTimer timer( ctx.timeline, "sample" );
+        gpuTimers.Begin( "trace" );
+        TraversalStats traversal;
+        for ( int y = 0; y < ctx.height; y += ctx.tileSize )
+        {
+            for ( int x = 0; x < ctx.width; x += ctx.tileSize )
+            {
+                ctx.cache.tileOffset = ivec2( x, y );
+                glNamedBufferData( constantBuffer, sizeof( ConstantBufferCache ), &ctx.cache, GL_DYNAMIC_DRAW );
+                glDispatchCompute( glm::min( ctx.tileSize, ctx.width - x ), glm::min( ctx.tileSize, ctx.height - y ), 1 );
+                if ( traversalStats )
+                {
+                    // one tile stays well below 2^32 of every counter
+                    TraversalCounters counters;
+                    glMemoryBarrier( GL_BUFFER_UPDATE_BARRIER_BIT );
+                    glGetNamedBufferSubData( traversalSsbo, 0, sizeof( TraversalCounters ), &counters );
+                    glClearNamedBufferData( traversalSsbo, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr );
+                    traversal.Add( counters );
+                }
+            }
+        }
+        gpuTimers.End();
+        if ( traversalStats )
+        {
+            ctx.traversal.push_back( traversal );
+        }
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+        if ( dumpEvery > 0 && ( sample + 1 ) % dumpEvery == 0 )
+        {
+            capture.CaptureAccumulation( outTexture, ctx.width, ctx.height, va( Dvar_GetString( dump_path ), sample + 1 ), TonemapSettingsFromDvars() );
+        }
+        if ( timed )
+        {
+            // the trace shows each sample's cpu time next to its gpu time, otherwise the loop only
+            // syncs for checkpoints and the final readback and dumps overlap with tracing
+            glFinish();
+        }
+        capture.Update();
+        PrintProgress( ctx, sample );
+
+        if ( CheckpointDue( checkpoint, sample + 1, ctx.spp ) )
+        {
+            const Clock::time_point snapshotStart = Clock::now();
+            vector<vec4> snapshot( static_cast<size_t>( ctx.width ) * ctx.height );
+            glMemoryBarrier( GL_TEXTURE_UPDATE_BARRIER_BIT );
+            glGetTextureImage( outTexture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( snapshot.size() * sizeof( vec4 ) ), snapshot.data() );
+            SubmitCheckpoint( checkpoint, ctx, std::move( snapshot ), sample + 1 );
+            checkpoint.stallMs += MsSince( snapshotStart );
+        }
+    }
+
+    ctx.accumulation.resize( static_cast<size_t>( ctx.width ) * ctx.height );
+    glMemoryBarrier( GL_TEXTURE_UPDATE_BARRIER_BIT );
+    glGetTextureImage( outTexture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( ctx.accumulation.size() * sizeof( vec4 ) ), ctx.accumulation.data() );
+    if ( ctx.cache.writeAovs )
+    {
+        ctx.albedo.resize( ctx.accumulation.size() );
+        ctx.normal.resize( ctx.accumulation.size() );
+        ctx.ids.resize( ctx.accumulation.size() );
+        glGetTextureImage( albedoAovTexture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( ctx.albedo.size() * sizeof( vec4 ) ), ctx.albedo.data() );
+        glGetTextureImage( normalAovTexture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( ctx.normal.size() * sizeof( vec4 ) ), ctx.normal.data() );
+        glGetTextureImage( idAovTexture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( ctx.ids.size() * sizeof( vec4 ) ), ctx.ids.data() );
+    }
+    ctx.renderMs = MsSince( start );
+    gpuTimers.Finalize( ctx.timeline );
+
+    if ( dumpEvery > 0 )
+    {
+        capture.Finalize();
+        const gl::FrameCapture::Stats stats = capture.GetStats();
+        Com_Printf( "[batch] dumps: %d written, %d failed, issue %.2f ms + %d stalls %.2f ms (%.2f%% of render), encoder %.2f ms",
+                    stats.encoded,
+                    stats.failed,
+                    stats.issueMs,
+                    stats.stalls,
+                    stats.stallMs,
+                    100.0 * ( stats.issueMs + stats.stallMs ) / ctx.renderMs,
+                    stats.encodeMs );
+    }
+
+    glDeleteBuffers( 1, &constantBuffer );
+    glDeleteBuffers( 1, &geomSsbo );
+    glDeleteBuffers( 1, &bboxSsbo );
+    glDeleteBuffers( 1, &matSsbo );
+    glDeleteBuffers( 1, &primSsbo );
+    glDeleteBuffers( 1, &traversalSsbo );
+    glDeleteTextures( 1, &outTexture );
+    glDeleteTextures( 1, &albedoAovTexture );
+    glDeleteTextures( 1, &normalAovTexture );
+    glDeleteTextures( 1, &idAovTexture );
+    glDeleteTextures( 1, &envTexture );
+    glDeleteTextures( 1, &albedoTexture );
+}
+
+//------------------------------------------------------------------------------
+// CPU backend
+//------------------------------------------------------------------------------
+static void RenderCpu( BatchContext& ctx, CheckpointState& checkpoint )
+{
+    PROFILE_ZONE( "RenderCpu" );
+    Clock::time_point start   = Clock::now();
+    const int64_t uploadStart = ctx.timeline.Now();
+
+    CpuRenderer renderer;
+    renderer.Initialize( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.width, ctx.height, Dvar_GetInt( threads ) );
+    const int wavefrontBatch = glm::max( Dvar_GetInt( wavefront_batch ), 0 );
+    renderer.SetWavefront( ctx.clusters && wavefrontBatch == 0 ? 65536 : wavefrontBatch, Dvar_GetBool( ray_sort ) );
+    renderer.SetClusterScene( ctx.clusters.get() );
+    if ( ctx.startSample > 0 )
+    {
+        renderer.SetImage( ctx.accumulation );
+    }
+    ctx.uploadMs = MsSince( start );
+    ctx.timeline.Add( "upload", TimerTrack_Cpu, ctx.timeline.GetFrame(), uploadStart, ctx.timeline.Now() - uploadStart );
+
+    bool traversalStats = Dvar_GetBool( traversal_stats );
+#ifndef PT_TRAVERSAL_STATS
+    if ( traversalStats )
+    {
+        Com_PrintWarning( "[batch] +set traversal_stats 1 needs a build with PT_TRAVERSAL_STATS for the cpu backend" );
+        traversalStats = false;
+    }
+#endif
+    CollectTraversalStats();
+
+    const bool perfCounters = Dvar_GetBool( perf_counters );
+    if ( perfCounters )
+    {
+        // the pool threads from loading would not be counted, let the render start new ones
+        ParallelShutdown();
+        ctx.perf.Start();
+    }
+
+    start           = Clock::now();
+    checkpoint.last = start;
+    for ( int sample = ctx.startSample; sample < ctx.spp; ++sample )
+    {
+        ctx.cache.frame       = sample + 1;
+        ctx.cache.sampleIndex = sample;
+        ctx.cache.dirty       = sample == 0;
+        ctx.cache.tileOffset  = ivec2( 0 );
+        ctx.timeline.BeginFrame();
+        {
+            CpuTimer timer( ctx.timeline, "sample" );
+            renderer.RenderTile( ctx.cache, ctx.width, ctx.height );
+        }
+        if ( traversalStats )
+        {
+            ctx.traversal.push_back( CollectTraversalStats() );
+        }
+        PrintProgress( ctx, sample );
+
+        if ( CheckpointDue( checkpoint, sample + 1, ctx.spp ) )
+        {
+            const Clock::time_point snapshotStart = Clock::now();
+            vector<vec4> snapshot                 = renderer.GetImage();
+            SubmitCheckpoint( checkpoint, ctx, std::move( snapshot ), sample + 1 );
+            checkpoint.stallMs += MsSince( snapshotStart );
+        }
+    }
+    ctx.accumulation = renderer.GetImage();
+    ctx.albedo       = renderer.GetAlbedo();
+    ctx.normal       = renderer.GetNormal();
+    ctx.ids          = renderer.GetIds();
+    ctx.renderMs     = MsSince( start );
+    ctx.wavefront    = renderer.GetWavefrontStats();
+    if ( perfCounters )
+    {
+        ctx.perf.Stop();
+    }
+}
+
+void RenderBatch( BatchContext& ctx, bool useGpu )
+{
+    CheckpointState checkpoint;
+    if ( useGpu )
+    {
+        RenderGpu( ctx, checkpoint );
+    }
+    else
+    {
+        RenderCpu( ctx, checkpoint );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Denoiser
+//------------------------------------------------------------------------------
+bool BatchWantsFeatures()
+{
+    return Dvar_GetBool( aovs ) || Dvar_GetBool( denoise );
+}
+
+static bool WriteDenoised( const string& output, HdrFormat format, const vector<float>& rgb, const FeatureBuffers& features )
+{
+    const int numThreads          = Dvar_GetInt( threads );
+    const DenoiseSettings settings = DenoiseSettingsFromDvars();
+
+    Clock::time_point start = Clock::now();
+    vector<float> denoised;
+    Denoise( rgb, features, settings, denoised, numThreads );
+    const double denoiseMs = MsSince( start );
+
+    const string hdrPath = output + "_denoised." + HdrFormatExtension( format );
+    const string pngPath = output + "_denoised.png";
+    vector<unsigned char> rgb8;
+    Tonemap( denoised, features.width, TonemapSettingsFromDvars(), rgb8, numThreads );
+    if ( !WriteHdrImage( hdrPath, format, denoised.data(), features.width, features.height ) ||
+         !WritePng( pngPath, rgb8.data(), features.width, features.height, 3 ) )
+    {
+        Com_PrintError( "[batch] failed to write '%s'", hdrPath.c_str() );
+        return false;
+    }
+
+    Com_PrintSuccess( "[batch] denoised %dx%d in %.2f ms (%d iterations), wrote '%s' and '%s'",
+                      features.width,
+                      features.height,
+                      denoiseMs,
+                      settings.iterations,
+                      hdrPath.c_str(),
+                      pngPath.c_str() );
+    return true;
+}
+
+// +set denoise_input <prefix> filters <prefix>.pfm with the feature buffers saved next to it
+static int RunDenoiseInput( const string& prefix )
+{
+    string output = Dvar_GetString( output );
+    if ( output.empty() )
+    {
+        output = prefix;
+    }
+
+    HdrFormat format;
+    if ( !HdrFormatFromString( Dvar_GetString( hdr_format ), format ) )
+    {
+        Com_PrintError( "[batch] unknown hdr_format '%s', expected pfm, hdr, exr or exr_tiled", Dvar_GetString( hdr_format ) );
+        return BatchExit_InvalidArgs;
+    }
+
+    FeatureBuffers features;
+    vector<float> rgb;
+    try
+    {
+        features          = ReadFeatures( prefix );
+        Image color       = ReadPfm( prefix + ".pfm" );
+        const float* data = reinterpret_cast<const float*>( color.data );
+        rgb.assign( data, data + static_cast<size_t>( color.width ) * color.height * 3 );
+        FreeImage( color );
+        if ( color.width != features.width || color.height != features.height )
+        {
+            throw std::runtime_error( va( "'%s.pfm' is %dx%d, the feature buffers are %dx%d", prefix.c_str(), color.width, color.height, features.width, features.height ) );
+        }
+    }
+    catch ( std::runtime_error& err )
+    {
+        Com_PrintError( "[batch] %s", err.what() );
+        return BatchExit_LoadFailed;
+    }
+
+    return WriteDenoised( output, format, rgb, features ) ? BatchExit_Ok : BatchExit_WriteFailed;
+}
+
+//------------------------------------------------------------------------------
+// Traversal stats
+//------------------------------------------------------------------------------
+static bool WriteTraversal( const string& output, const BatchContext& ctx )
+{
+    const string csvPath  = output + "_traversal.csv";
+    const string jsonPath = output + "_traversal.json";
+    const BvhStats bvh    = ComputeBvhStats( ctx.gpuScene.bvhs );
+    if ( !WriteTraversalCsv( csvPath, ctx.traversal ) || !WriteTraversalJson( jsonPath, bvh, ctx.traversal ) )
+    {
+        Com_PrintError( "[batch] failed to write '%s' and '%s'", csvPath.c_str(), jsonPath.c_str() );
+        return false;
+    }
+
+    TraversalStats total;
+    for ( const TraversalStats& frame : ctx.traversal )
+    {
+        total.Add( frame );
+    }
+    const double rays = static_cast<double>( glm::max( total.rays, uint64_t( 1 ) ) );
+    Com_PrintSuccess( "[batch] wrote '%s' and '%s', per ray: %.2f nodes (p95 %d), %.2f boxes, %.2f primitives (p95 %d), %.1f%% hit",
+                      csvPath.c_str(),
+                      jsonPath.c_str(),
+                      total.nodes / rays,
+                      HistogramPercentile( total.nodeHistogram, 0.95 ),
+                      total.boxes / rays,
+                      total.primitives / rays,
+                      HistogramPercentile( total.primitiveHistogram, 0.95 ),
+                      100.0 * total.hits / rays );
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Camera path
+//------------------------------------------------------------------------------
+static double Rmse( const vector<vec4>& accumulation, const vector<float>& reference )
+{
+    vector<float> rgb;
+    ResolveAccumulation( accumulation, rgb );
+    double sum = 0.0;
+    for ( size_t i = 0; i < rgb.size(); ++i )
+    {
+        const double diff = rgb[i] - reference[i];
+        sum += diff * diff;
+    }
+    return glm::sqrt( sum / glm::max( rgb.size(), size_t( 1 ) ) );
+}
+
+static bool SameCamera( const ConstantBufferCache& a, const ConstantBufferCache& b )
+{
+    return a.camPos == b.camPos && a.camFwd == b.camFwd && a.camRight == b.camRight && a.camUp == b.camUp && a.camFov == b.camFov;
+}
+
+// +set camera_path <file> replays a path recorded with +set record_camera on the cpu at one sample
+// per frame, once restarting on every camera move and once reprojecting, both are compared
+// against ssp samples of the same view
+static int RunCameraPath( const string& path )
+{
+    vector<Camera> cameras;
+    if ( !ReadCameraPath( path, cameras ) )
+    {
+        Com_PrintError( "[batch] failed to read camera path '%s'", path.c_str() );
+        return BatchExit_InvalidArgs;
+    }
+
+    BatchContext ctx;
+    BatchExitCode code = LoadBatchScene( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+    ctx.cache.writeAovs = 1;
+
+    string output = Dvar_GetString( output );
+    if ( output.empty() )
+    {
+        output = "render";
+    }
+    const string csvPath = output + "_reprojection.csv";
+    FILE* csv            = fopen( csvPath.c_str(), "w" );
+    if ( !csv )
+    {
+        Com_PrintError( "[batch] failed to write '%s'", csvPath.c_str() );
+        return BatchExit_WriteFailed;
+    }
+    fprintf( csv, "frame,moved,restart_rmse,reprojected_rmse,reused,disoccluded,offscreen,reproject_ms\n" );
+
+    const int numThreads                = Dvar_GetInt( threads );
+    const ReprojectionSettings settings = ReprojectionSettingsFromDvars();
+    CpuRenderer restart, reprojected, reference;
+    restart.Initialize( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.width, ctx.height, numThreads );
+    reprojected.Initialize( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.width, ctx.height, numThreads );
+    reference.Initialize( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.width, ctx.height, numThreads );
+
+    Com_PrintInfo( "[batch] replaying %d cameras from '%s' at %dx%d, reference %d spp",
+                   static_cast<int>( cameras.size() ),
+                   path.c_str(),
+                   ctx.width,
+                   ctx.height,
+                   ctx.spp );
+
+    ConstantBufferCache previous = ctx.cache;
+    vector<float> referenceRgb;
+    vector<vec4> historyColor, historyAlbedo, historyNormal, mergedColor;
+    double restartSum = 0.0, reprojectedSum = 0.0, reprojectMs = 0.0;
+    int restartSamples = 0;
+    for ( int frame = 0; frame < static_cast<int>( cameras.size() ); ++frame )
+    {
+        const Camera& camera = cameras[frame];
+        SetCamera( ctx.cache, camera );
+        const bool moved     = frame == 0 || !SameCamera( previous, ctx.cache );
+        ctx.cache.frame      = frame + 1;
+        ctx.cache.tileOffset = ivec2( 0 );
+
+        // restart: a camera move throws the accumulation away
+        restartSamples        = moved ? 0 : restartSamples + 1;
+        ctx.cache.dirty       = moved;
+        ctx.cache.sampleIndex = restartSamples;
+        restart.RenderTile( ctx.cache, ctx.width, ctx.height );
+
+        // reproject: a camera move restarts the frame and merges the history back in,
+        // the sample index keeps counting so new samples do not repeat the history
+        ReprojectionStats stats;
+        double ms             = 0.0;
+        const bool merge      = moved && frame > 0;
+        ctx.cache.dirty       = moved;
+        ctx.cache.sampleIndex = frame;
+        if ( merge )
+        {
+            historyColor  = reprojected.GetImage();
+            historyAlbedo = reprojected.GetAlbedo();
+            historyNormal = reprojected.GetNormal();
+        }
+        reprojected.RenderTile( ctx.cache, ctx.width, ctx.height );
+        if ( merge )
+        {
+            const Clock::time_point start = Clock::now();
+            stats = Reproject( historyColor, historyAlbedo, historyNormal, previous, reprojected.GetImage(), reprojected.GetAlbedo(),
+                               reprojected.GetNormal(), ctx.cache, ctx.width, ctx.height, settings, mergedColor, numThreads );
+            reprojected.SetImage( mergedColor );
+            ms = MsSince( start );
+            reprojectMs += ms;
+        }
+
+        if ( moved )
+        {
+            for ( int sample = 0; sample < ctx.spp; ++sample )
+            {
+                ctx.cache.dirty       = sample == 0;
+                ctx.cache.sampleIndex = sample;
+                reference.RenderTile( ctx.cache, ctx.width, ctx.height );
+            }
+            ResolveAccumulation( reference.GetImage(), referenceRgb );
+        }
+
+        const double restartRmse     = Rmse( restart.GetImage(), referenceRgb );
+        const double reprojectedRmse = Rmse( reprojected.GetImage(), referenceRgb );
+        restartSum += restartRmse;
+        reprojectedSum += reprojectedRmse;
+        fprintf( csv, "%d,%d,%f,%f,%d,%d,%d,%f\n", frame, moved, restartRmse, reprojectedRmse, stats.reused, stats.disoccluded, stats.offscreen, ms );
+        Com_Printf( "[batch] frame %3d%s rmse restart %.5f reprojected %.5f (%d reused, %d disoccluded, %d offscreen)",
+                    frame,
+                    moved ? " moved" : "      ",
+                    restartRmse,
+                    reprojectedRmse,
+                    stats.reused,
+                    stats.disoccluded,
+                    stats.offscreen );
+        previous = ctx.cache;
+    }
+    fclose( csv );
+
+    const int frames = static_cast<int>( cameras.size() );
+    Com_PrintSuccess( "[batch] mean rmse restart %.5f reprojected %.5f over %d frames, reprojection %.2f ms/frame, wrote '%s'",
+                      restartSum / frames,
+                      reprojectedSum / frames,
+                      frames,
+                      reprojectMs / frames,
+                      csvPath.c_str() );
+    return BatchExit_Ok;
+}
+
+//------------------------------------------------------------------------------
+// Batch
+//------------------------------------------------------------------------------
+BatchExitCode ReadBatchSettings( BatchContext& ctx )
+{
+    ctx.width    = Dvar_GetInt( wnd_width );
+    ctx.height   = Dvar_GetInt( wnd_height );
+    ctx.spp      = Dvar_GetInt( ssp );
+    ctx.tileSize = glm::max( Dvar_GetInt( tile ), 1 );
+
+    if ( !Dvar_GetString( scene )[0] || ctx.width <= 0 || ctx.height <= 0 || ctx.spp <= 0 )
+    {
+        Com_PrintError( "[batch] usage: +set batch 1 +set scene <path> +set ssp <samples> [+set output <path>] [+set hdr_format pfm|hdr|exr|exr_tiled] [+set backend auto|gl|cpu] [+set workers <n>] [+set aovs 1] [+set denoise 1] [+set camera_path <file>]" );
+        return BatchExit_InvalidArgs;
+    }
+    return BatchExit_Ok;
+}
+
+BatchExitCode LoadBatchScene( BatchContext& ctx )
+{
+    PROFILE_ZONE( "LoadBatchScene" );
+    const BatchExitCode code = ReadBatchSettings( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    const char* scenePath   = Dvar_GetString( scene );
+    Clock::time_point start = Clock::now();
+    Scene scene;
+    try
+    {
+        CpuTimer timer( ctx.timeline, "load" );
+        if ( !LuaLoadScene( scenePath, scene ) )
+        {
+            Com_PrintError( "[batch] failed to execute script %s", scenePath );
+            return BatchExit_LoadFailed;
+        }
+    }
+    catch ( std::runtime_error& err )
+    {
+        // mem_budget throws while the script adds meshes
+        Com_PrintError( "[batch] failed to load scene: %s", err.what() );
+        return BatchExit_LoadFailed;
+    }
+    ctx.loadMs = MsSince( start );
+
+    start = Clock::now();
+    try
+    {
+        CpuTimer timer( ctx.timeline, "build" );
+        ConstructScene( scene, ctx.gpuScene );
+        ctx.envMap = ReadHDRImage( DATA_DIR "env/stairs.hdr" );
+    }
+    catch ( std::runtime_error& err )
+    {
+        Com_PrintError( "[batch] failed to build scene: %s", err.what() );
+        return BatchExit_LoadFailed;
+    }
+    ctx.buildMs = MsSince( start );
+    PrintMemReport( "scene loaded" );
+
+    BvhLayout layout;
+    if ( !BvhLayoutFromString( Dvar_GetString( bvh_layout ), layout ) )
+    {
+        Com_PrintError( "[batch] unknown bvh_layout '%s', expected threaded or pairs", Dvar_GetString( bvh_layout ) );
+        return BatchExit_InvalidArgs;
+    }
+    SetBvhLayout( ctx.gpuScene, layout );
+
+    SetCamera( ctx.cache, Camera( scene.camera ) );
+    ctx.cache.samplerKind = glm::clamp( Dvar_GetInt( sampler ), 0, Sampler::Count - 1 );
+    ctx.cache.writeAovs   = BatchWantsFeatures();
+    SetIntegrator( ctx.cache, ctx.gpuScene.bbox );
+    return BatchExit_Ok;
+}
+
+BatchExitCode WriteBatchOutput( const BatchContext& ctx )
+{
+    PROFILE_ZONE( "WriteBatchOutput" );
+    string output = Dvar_GetString( output );
+    if ( output.empty() )
+    {
+        output = "render";
+    }
+
+    HdrFormat format;
+    if ( !HdrFormatFromString( Dvar_GetString( hdr_format ), format ) )
+    {
+        Com_PrintError( "[batch] unknown hdr_format '%s', expected pfm, hdr, exr or exr_tiled", Dvar_GetString( hdr_format ) );
+        return BatchExit_InvalidArgs;
+    }
+
+    // linear output is resolved and streamed one tile at a time
+    Clock::time_point start = Clock::now();
+    const string hdrPath    = output + "." + HdrFormatExtension( format );
+    HdrTileWriter writer;
+    bool written = writer.Open( hdrPath, format, ctx.width, ctx.height, ctx.tileSize );
+    vector<vec4> tileAccum;
+    vector<float> tileRgb;
+    for ( int y = 0; y < ctx.height && written; y += ctx.tileSize )
+    {
+        for ( int x = 0; x < ctx.width && written; x += ctx.tileSize )
+        {
+            const int tileWidth  = glm::min( ctx.tileSize, ctx.width - x );
+            const int tileHeight = glm::min( ctx.tileSize, ctx.height - y );
+            tileAccum.resize( static_cast<size_t>( tileWidth ) * tileHeight );
+            for ( int row = 0; row < tileHeight; ++row )
+            {
+                const vec4* src = ctx.accumulation.data() + static_cast<size_t>( y + row ) * ctx.width + x;
+                std::copy( src, src + tileWidth, tileAccum.data() + static_cast<size_t>( row ) * tileWidth );
+            }
+            ResolveAccumulation( tileAccum, tileRgb );
+            written = writer.WriteTile( x, y, tileWidth, tileHeight, tileRgb.data() );
+        }
+    }
+    written            = writer.Close() && written;
+    const double hdrMs = MsSince( start );
+    if ( !written )
+    {
+        Com_PrintError( "[batch] failed to write '%s'", hdrPath.c_str() );
+        return BatchExit_WriteFailed;
+    }
+
+    start = Clock::now();
+    vector<float> rgb;
+    ResolveAccumulation( ctx.accumulation, rgb );
+    vector<unsigned char> rgb8;
+    Tonemap( rgb, ctx.width, TonemapSettingsFromDvars(), rgb8, Dvar_GetInt( threads ) );
+
+    const string pngPath = output + ".png";
+    if ( !WritePng( pngPath, rgb8.data(), ctx.width, ctx.height, 3 ) )
+    {
+        Com_PrintError( "[batch] failed to write '%s'", pngPath.c_str() );
+        return BatchExit_WriteFailed;
+    }
+
+    Com_PrintSuccess( "[batch] wrote '%s' (%.1f MB in %.2f ms, %.1f MB/s) and '%s' in %.2f ms",
+                      hdrPath.c_str(),
+                      writer.GetFileSize() / 1.0e6,
+                      hdrMs,
+                      writer.GetFileSize() / ( 1.0e3 * hdrMs ),
+                      pngPath.c_str(),
+                      MsSince( start ) );
+
+    if ( !ctx.traversal.empty() && !WriteTraversal( output, ctx ) )
+    {
+        return BatchExit_WriteFailed;
+    }
+
+    if ( !BatchWantsFeatures() )
+    {
+        return BatchExit_Ok;
+    }
+    if ( ctx.normal.empty() )
+    {
+        Com_PrintWarning( "[batch] no feature buffers were rendered, skipping aovs and denoising" );
+        return BatchExit_Ok;
+    }
+
+    FeatureBuffers features;
+    ResolveFeatures( ctx.albedo, ctx.normal, ctx.width, ctx.height, features );
+    if ( Dvar_GetBool( aovs ) )
+    {
+        if ( !WriteFeatures( output, features ) )
+        {
+            Com_PrintError( "[batch] failed to write '%s_*.pfm'", output.c_str() );
+            return BatchExit_WriteFailed;
+        }
+        Com_PrintSuccess( "[batch] wrote '%s_albedo.pfm', '%s_normal.pfm' and '%s_depth.pfm'", output.c_str(), output.c_str(), output.c_str() );
+
+        IdBuffers ids;
+        ResolveIds( ctx.ids, ctx.normal, ctx.width, ctx.height, ids );
+        const HeatStats heat  = GetHeatStats( ids );
+        const float heatScale = Dvar_GetFloat( aov_heat_max ) > 0.0f ? Dvar_GetFloat( aov_heat_max ) : heat.maxNodes;
+        if ( !WriteIdAovs( output, ids, heatScale ) )
+        {
+            Com_PrintError( "[batch] failed to write '%s_ids.pfm' and '%s_heat.pfm'", output.c_str(), output.c_str() );
+            return BatchExit_WriteFailed;
+        }
+        Com_PrintSuccess( "[batch] wrote '%s_ids.pfm' and '%s_heat.pfm', per camera ray: %.1f bvh nodes (max %.0f), %.1f primitives (max %.0f), heat map red at %.0f nodes",
+                          output.c_str(),
+                          output.c_str(),
+                          heat.meanNodes,
+                          heat.maxNodes,
+                          heat.meanPrimitives,
+                          heat.maxPrimitives,
+                          heatScale );
+    }
+
+    if ( Dvar_GetBool( denoise ) && !WriteDenoised( output, format, rgb, features ) )
+    {
+        return BatchExit_WriteFailed;
+    }
+    return BatchExit_Ok;
+}
+
+static void PrintBvhStats( const BatchContext& ctx )
+{
+    Com_Printf( "[batch] build:  %10.2f ms (%d geometries, %d bvh nodes)",
+                ctx.buildMs,
+                static_cast<int>( ctx.gpuScene.geometries.size() ),
+                static_cast<int>( ctx.gpuScene.bvhs.size() ) );
+    const BvhStats bvh = ComputeBvhStats( ctx.gpuScene.bvhs );
+    Com_Printf( "[batch] bvh:    depth %d, mean leaf depth %.1f, sah cost %.2f, child overlap %.3f",
+                bvh.depth,
+                bvh.meanLeafDepth,
+                bvh.sahCost,
+                bvh.overlap );
+}
+
+void PrintBatchStats( const BatchContext& ctx )
+{
+    const double paths = static_cast<double>( ctx.width ) * ctx.height * ctx.spp;
+    Com_Printf( "[batch] load:   %10.2f ms", ctx.loadMs );
+    if ( ctx.clusters )
+    {
+        const ClusterScene& clusters         = *ctx.clusters;
+        const ClusterScene::CacheStats cache = clusters.GetCacheStats();
+        Com_Printf( "[batch] build:  %10.2f ms (%d geometries in %d clusters under %d top nodes, %.1f MB file)",
+                    ctx.buildMs,
+                    clusters.GetPrimitiveCount(),
+                    clusters.GetClusterCount(),
+                    clusters.GetTopNodeCount(),
+                    clusters.GetFileSize() / ( 1024.0 * 1024.0 ) );
+        Com_Printf( "[batch] ooc:    %llu lookups, %llu faults (%.1f MB read), %llu evictions, peak %.1f MB of %.1f MB, %llu rays in %llu rounds",
+                    static_cast<unsigned long long>( cache.lookups ),
+                    static_cast<unsigned long long>( cache.faults ),
+                    cache.bytesRead / ( 1024.0 * 1024.0 ),
+                    static_cast<unsigned long long>( cache.evictions ),
+                    cache.peakBytes / ( 1024.0 * 1024.0 ),
+                    clusters.GetBudget() / ( 1024.0 * 1024.0 ),
+                    static_cast<unsigned long long>( cache.rays ),
+                    static_cast<unsigned long long>( cache.rounds ) );
+    }
+    else
+    {
+        PrintBvhStats( ctx );
+    }
+    Com_Printf( "[batch] upload: %10.2f ms", ctx.uploadMs );
+    Com_Printf( "[batch] render: %10.2f ms (%.2f spp/s, %.3f Mpaths/s)",
+                ctx.renderMs,
+                1000.0 * ctx.spp / ctx.renderMs,
+                paths / ( 1000.0 * ctx.renderMs ) );
+    if ( ctx.wavefront.rays > 0 )
+    {
+        Com_Printf( "[batch] rays:   %llu traced in %.2f ms (%.3f Mrays/s), sorting %.2f ms",
+                    static_cast<unsigned long long>( ctx.wavefront.rays ),
+                    ctx.wavefront.traceMs,
+                    ctx.wavefront.rays / ( 1000.0 * ctx.wavefront.traceMs ),
+                    ctx.wavefront.sortMs );
+    }
+    if ( Dvar_GetBool( perf_counters ) )
+    {
+        for ( int i = 0; i < PerfEvent_Count; ++i )
+        {
+            const PerfEvent event = static_cast<PerfEvent>( i );
+            if ( ctx.perf.IsAvailable( event ) )
+            {
+                Com_Printf( "[batch] perf:   %-16s %14llu", PerfEventToString( event ), static_cast<unsigned long long>( ctx.perf.GetValue( event ) ) );
+            }
+            else
+            {
+                Com_Printf( "[batch] perf:   %-16s %14s", PerfEventToString( event ), "unavailable" );
+            }
+        }
+    }
+}
+
+// +set ooc_budget, the built scene goes to a cluster file and only the materials stay resident
+static BatchExitCode MoveSceneOutOfCore( BatchContext& ctx, const string& path )
+{
+    PROFILE_ZONE( "MoveSceneOutOfCore" );
+    const Clock::time_point start = Clock::now();
+    try
+    {
+        ClusterScene::Write( ctx.gpuScene, glm::max( Dvar_GetInt( ooc_cluster_size ), 1 ), path );
+        ReleaseSceneGeometry( ctx.gpuScene );
+        ctx.clusters = std::make_unique<ClusterScene>();
+        ctx.clusters->Open( path, static_cast<size_t>( Dvar_GetInt( ooc_budget ) ) * 1024 * 1024 );
+    }
+    catch ( std::runtime_error& err )
+    {
+        Com_PrintError( "[batch] failed to move the scene out of core: %s", err.what() );
+        return BatchExit_LoadFailed;
+    }
+
+    const double ms = MsSince( start );
+    ctx.buildMs += ms;
+    Com_PrintInfo( "[batch] wrote %d clusters to '%s' in %.2f ms", ctx.clusters->GetClusterCount(), path.c_str(), ms );
+    if ( Dvar_GetBool( traversal_stats ) )
+    {
+        Com_PrintWarning( "[batch] +set traversal_stats 1 is not collected for out of core scenes" );
+    }
+    PrintMemReport( "scene out of core" );
+    return BatchExit_Ok;
+}
+
+/// the cluster file only lives as long as the batch
+struct ClusterFileGuard {
+    BatchContext& ctx;
+    string path;
+
+    ~ClusterFileGuard()
+    {
+        if ( ctx.clusters )
+        {
+            ctx.clusters->Close();
+        }
+        if ( !path.empty() )
+        {
+            std::remove( path.c_str() );
+        }
+    }
+};
+
+/// the hidden window and its GL context are released however the render ends
+struct GpuContextGuard {
+    bool active;
+
+    ~GpuContextGuard()
+    {
+        if ( active )
+        {
+            gl::FinalizeGraphics();
+            DestroyMainWindow();
+        }
+    }
+};
+
+static void ResumeFromCheckpoint( BatchContext& ctx, const string& path )
+{
+    Checkpoint checkpoint;
+    if ( !ReadCheckpoint( path, checkpoint ) )
+    {
+        Com_PrintWarning( "[batch] no valid checkpoint at '%s', starting from sample 0", path.c_str() );
+        return;
+    }
+
+    if ( checkpoint.sceneHash != ctx.sceneHash || checkpoint.width != ctx.width || checkpoint.height != ctx.height )
+    {
+        Com_PrintWarning( "[batch] checkpoint '%s' was rendered from a different scene (hash %016llx, expected %016llx), starting from sample 0",
+                          path.c_str(),
+                          static_cast<unsigned long long>( checkpoint.sceneHash ),
+                          static_cast<unsigned long long>( ctx.sceneHash ) );
+        return;
+    }
+
+    ctx.startSample  = glm::min( checkpoint.samplesDone, ctx.spp );
+    ctx.accumulation = std::move( checkpoint.accumulation );
+    Com_PrintInfo( "[batch] resuming from '%s' at sample %d/%d", path.c_str(), ctx.startSample, ctx.spp );
+}
+
+int RunBatch()
+{
+    const Clock::time_point batchStart = Clock::now();
+
+    const string denoiseInput = Dvar_GetString( denoise_input );
+    if ( !denoiseInput.empty() )
+    {
+        return RunDenoiseInput( denoiseInput );
+    }
+
+    const string cameraPath = Dvar_GetString( camera_path );
+    if ( !cameraPath.empty() )
+    {
+        return RunCameraPath( cameraPath );
+    }
+
+    if ( Dvar_GetInt( workers ) > 0 )
+    {
+        return RunCoordinator();
+    }
+
+    const string backend = Dvar_GetString( backend );
+    if ( backend != "auto" && backend != "gl" && backend != "cpu" )
+    {
+        Com_PrintError( "[batch] unknown backend '%s'", backend.c_str() );
+        return BatchExit_InvalidArgs;
+    }
+
+    const string checkpointPath = Dvar_GetString( checkpoint );
+    if ( Dvar_GetBool( resume ) && checkpointPath.empty() )
+    {
+        Com_PrintError( "[batch] +set resume 1 requires +set checkpoint <path>" );
+        return BatchExit_InvalidArgs;
+    }
+
+    if ( Dvar_GetInt( dump_every ) > 0 && !IsIntFormat( Dvar_GetString( dump_path ) ) )
+    {
+        Com_PrintError( "[batch] dump_path '%s' needs exactly one integer conversion, such as frame_%%05d.png", Dvar_GetString( dump_path ) );
+        return BatchExit_InvalidArgs;
+    }
+
+    const bool outOfCore = Dvar_GetInt( ooc_budget ) > 0;
+    if ( outOfCore && backend == "gl" )
+    {
+        Com_PrintError( "[batch] +set ooc_budget needs the cpu backend" );
+        return BatchExit_InvalidArgs;
+    }
+
+    BatchContext ctx;
+    BatchExitCode code = LoadBatchScene( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    std::unique_ptr<CheckpointWriter> writer;
+    CheckpointState checkpoint;
+    if ( !checkpointPath.empty() )
+    {
+        ctx.sceneHash = HashScene( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.cache, ctx.width, ctx.height );
+        if ( Dvar_GetBool( resume ) )
+        {
+            ResumeFromCheckpoint( ctx, checkpointPath );
+        }
+
+        writer                = std::make_unique<CheckpointWriter>( checkpointPath );
+        checkpoint.writer     = writer.get();
+        checkpoint.intervalMs = 1000.0 * glm::max( Dvar_GetInt( checkpoint_interval ), 0 );
+    }
+
+    // after the scene hash, which reads the resident geometry
+    ClusterFileGuard clusterFile{ ctx, "" };
+    if ( outOfCore )
+    {
+        clusterFile.path = Dvar_GetString( ooc_path );
+        if ( clusterFile.path.empty() )
+        {
+            const string output = Dvar_GetString( output );
+            clusterFile.path    = ( output.empty() ? string( "render" ) : output ) + ".clusters";
+        }
+        code = MoveSceneOutOfCore( ctx, clusterFile.path );
+        if ( code != BatchExit_Ok )
+        {
+            return code;
+        }
+    }
+
+    // render
+    bool useGpu = backend != "cpu" && !outOfCore && CreateGpuContext( ctx.width, ctx.height );
+    if ( !useGpu && backend == "gl" )
+    {
+        return BatchExit_RenderFailed;
+    }
+
+    {
+        GpuContextGuard gpuContext{ useGpu };
+        try
+        {
+            Com_PrintInfo( "[batch] rendering %dx%d at %d spp with %s backend (%s sampler)",
+                           ctx.width,
+                           ctx.height,
+                           ctx.spp,
+                           useGpu ? "gl" : "cpu",
+                           SamplerKindToString( static_cast<Sampler::Kind>( ctx.cache.samplerKind ) ) );
+            if ( useGpu )
+            {
+                RenderGpu( ctx, checkpoint );
+            }
+            else
+            {
+                RenderCpu( ctx, checkpoint );
+            }
+        }
+        catch ( std::runtime_error& err )
+        {
+            Com_PrintError( "[batch] render failed: %s", err.what() );
+            return BatchExit_RenderFailed;
+        }
+    }
+
+    // the final checkpoint lets a later run add samples with a higher ssp
+    if ( writer )
+    {
+        SubmitCheckpoint( checkpoint, ctx, vector<vec4>( ctx.accumulation ), ctx.spp );
+    }
+
+    {
+        CpuTimer timer( ctx.timeline, "write" );
+        code = WriteBatchOutput( ctx );
+    }
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    PrintBatchStats( ctx );
+    const char* tracePath = Dvar_GetString( trace_output );
+    if ( tracePath[0] )
+    {
+        if ( !ctx.timeline.WriteChromeTrace( tracePath ) )
+        {
+            Com_PrintError( "[batch] failed to write '%s'", tracePath );
+            return BatchExit_WriteFailed;
+        }
+        Com_PrintSuccess( "[batch] wrote '%s'", tracePath );
+    }
+    if ( writer )
+    {
+        writer->Flush();
+        Com_Printf( "[batch] checkpoint: %d written, %d failed, stall %.2f ms (%.2f%% of render), background write %.2f ms (%.2f%% of render)",
+                    writer->GetWriteCount(),
+                    writer->GetFailCount(),
+                    checkpoint.stallMs,
+                    100.0 * checkpoint.stallMs / ctx.renderMs,
+                    writer->GetWriteMs(),
+                    100.0 * writer->GetWriteMs() / ctx.renderMs );
+    }
+    Com_Printf( "[batch] total:  %10.2f ms", MsSince( batchStart ) );
+    return BatchExit_Ok;
+}
+
+}  // namespace pt
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "constant_cache.h"
+#include "cpu/cluster_scene.h"
+#include "cpu/cpu_renderer.h"
+#include "frame_timer.h"
+#include "image.h"
+#include "scene.h"
+#include "traversal_stats.h"
+#include "utility/perf_counters.h"
+
+namespace pt {
+
+/// process exit codes of batch mode
+enum BatchExitCode {
+    BatchExit_Ok           = 0,
+    BatchExit_InvalidArgs  = 1,
+    BatchExit_LoadFailed   = 2,
+    BatchExit_RenderFailed = 3,
+    BatchExit_WriteFailed  = 4,
+};
+
+struct BatchContext {
+    int width;
+    int height;
+    int spp;
+    int tileSize;
+    GpuScene gpuScene;
+    std::unique_ptr<ClusterScene> clusters;  // +set ooc_budget, gpuScene then only keeps the materials
+    Image envMap;
+    ConstantBufferCache cache;
+    std::vector<vec4> accumulation;
+    std::vector<vec4> albedo;  // feature buffers, empty unless cache.writeAovs is set
+    std::vector<vec4> normal;
+    std::vector<vec4> ids;
+    std::vector<TraversalStats> traversal;  // one entry per sample with +set traversal_stats 1
+    uint64_t sceneHash = 0;
+    int startSample    = 0;      // > 0 when resuming, accumulation then holds the checkpoint
+    bool quiet         = false;  // no per sample progress
+
+    FrameTimeline timeline;  // one frame per sample, written to +set trace_output
+    CpuRenderer::WavefrontStats wavefront;
+    PerfCounters perf;  // cpu render loop with +set perf_counters 1
+
+    double loadMs   = 0.0;
+    double buildMs  = 0.0;
+    double uploadMs = 0.0;
+    double renderMs = 0.0;
+};
+
+/// feature buffers are rendered for +set aovs 1 and +set denoise 1
+bool BatchWantsFeatures();
+
+/// renders the scene without a visible window and writes linear <output>.<hdr_format>
+/// and tone mapped <output>.png, enabled with +set batch 1
+int RunBatch();
+
+/// resolution, sample count and tile size from the dvars, checks a scene is given
+BatchExitCode ReadBatchSettings( BatchContext& ctx );
+
+/// ReadBatchSettings, then loads the scene from the dvars and fills everything but the
+/// accumulation buffer
+BatchExitCode LoadBatchScene( BatchContext& ctx );
+
+void SetCamera( ConstantBufferCache& cache, const Camera& camera );
+
+/// +set integrator and +set ao_radius, the default radius scales with the scene bounds
+void SetIntegrator( ConstantBufferCache& cache, const Box3& bbox );
+
+/// opens a hidden window for the gl backend, false if there is no GL 4.5 context
+bool CreateGpuContext( int width, int height );
+
+/// renders ctx.spp samples from ctx.startSample without checkpoints and fills
+/// the accumulation and feature buffers, uploadMs and renderMs,
+/// throws std::runtime_error when the gl backend fails
+void RenderBatch( BatchContext& ctx, bool useGpu );
+
+/// writes the resolved accumulation buffer to <output>.<hdr_format> and <output>.png,
+/// the feature buffers to <output>_albedo/_normal/_depth.pfm, the ids and heat map to
+/// <output>_ids/_heat.pfm and _material/_primitive/_heat.png with +set aovs 1 and
+/// the denoised image to <output>_denoised.<hdr_format> and .png with +set denoise 1 and
+/// the traversal counters to <output>_traversal.csv and .json with +set traversal_stats 1
+BatchExitCode WriteBatchOutput( const BatchContext& ctx );
+
+void PrintBatchStats( const BatchContext& ctx );
+
+}  // namespace pt
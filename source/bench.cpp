@@ -0,0 +1,396 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "application.h"
+#include "batch.h"
+#include "com_dvars.h"
+#include "renderer.h"
+#include "reprojection.h"
+#include "sampler.h"
+#include "scene_loader.h"
+#include "universal/dvar_api.h"
+#include "universal/print.h"
+#include "utility/clock.h"
+#include "utility/memory_stats.h"
+
+#ifndef DATA_DIR
+#define DATA_DIR ""
+#endif
+
+#ifndef ROOT_FOLDER
+#define ROOT_FOLDER ""
+#endif
+
+namespace pt {
+
+using std::string;
+using std::vector;
+
+extern ImageArray g_AlbedoMaps;
+
+namespace {
+
+/// resolution and samples per camera of the bundled scenes, changing them
+/// invalidates every result recorded so far
+struct BenchSettings {
+    const char* name;
+    int width;
+    int height;
+    int spp;
+};
+
+constexpr BenchSettings s_canonical[] = {
+    { "cornell-box", 512, 512, 16 },
+    { "monkey", 512, 512, 8 },
+    { "room", 512, 512, 8 },
+    { "sibenik", 512, 512, 4 },
+    { "sponza", 512, 512, 4 },
+};
+
+// used for scripts that are not in the table
+constexpr BenchSettings s_fallback = { "", 512, 512, 4 };
+
+struct BenchResult {
+    string name;
+    int width         = 0;
+    int height        = 0;
+    int spp           = 0;
+    int cameras       = 0;
+    int geometries    = 0;
+    int bvhNodes      = 0;
+    int64_t peakBytes = 0;  // largest peak of the memory counters over the runs
+    vector<int64_t> load;  // nanoseconds per run
+    vector<int64_t> build;
+    vector<int64_t> upload;  // summed over the camera path
+    vector<int64_t> trace;
+};
+
+}  // namespace
+
+int64_t Percentile( vector<int64_t> values, double fraction )
+{
+    if ( values.empty() )
+    {
+        return 0;
+    }
+
+    std::sort( values.begin(), values.end() );
+    const size_t rank = static_cast<size_t>( std::ceil( fraction * values.size() ) );
+    return values[glm::clamp( rank, size_t( 1 ), values.size() ) - 1];
+}
+
+vector<Camera> OrbitCameraPath( const SceneCamera& camera, int count )
+{
+    vector<Camera> cameras;
+    const vec3 up     = glm::normalize( camera.up );
+    const vec3 offset = camera.eye - camera.lookAt;
+    for ( int i = 0; i < count; ++i )
+    {
+        const float t     = count > 1 ? static_cast<float>( i ) / ( count - 1 ) : 0.5f;
+        const float angle = glm::radians( glm::mix( -15.0f, 15.0f, t ) );
+        SceneCamera orbit = camera;
+        orbit.eye         = camera.lookAt + vec3( glm::rotate( mat4( 1.0f ), angle, up ) * vec4( offset, 0.0f ) );
+        cameras.push_back( Camera( orbit ) );
+    }
+    return cameras;
+}
+
+static vector<string> SplitList( const string& list )
+{
+    vector<string> items;
+    size_t begin = 0;
+    while ( begin <= list.size() )
+    {
+        size_t end = list.find( ',', begin );
+        if ( end == string::npos )
+        {
+            end = list.size();
+        }
+        if ( end > begin )
+        {
+            items.push_back( list.substr( begin, end - begin ) );
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+static const BenchSettings& FindSettings( const string& name )
+{
+    for ( const BenchSettings& settings : s_canonical )
+    {
+        if ( name == settings.name )
+        {
+            return settings;
+        }
+    }
+    return s_fallback;
+}
+
+static void FreeAlbedoMaps()
+{
+    for ( Image& image : g_AlbedoMaps.images )
+    {
+        FreeImage( image );
+    }
+    g_AlbedoMaps = ImageArray();
+}
+
+static BatchExitCode BenchScene( const string& name, const Image& envMap, const vector<Camera>& cameraPath, bool useGpu, int runs, BenchResult& result )
+{
+    const BenchSettings& settings = FindSettings( name );
+    const string path             = ROOT_FOLDER "scripts/" + name + ".lua";
+
+    result.name   = name;
+    result.width  = settings.width;
+    result.height = settings.height;
+    result.spp    = Dvar_GetInt( bench_spp ) > 0 ? Dvar_GetInt( bench_spp ) : settings.spp;
+
+    for ( int run = 0; run < runs; ++run )
+    {
+        ResetMemPeaks();
+        BatchContext ctx;
+        ctx.width             = result.width;
+        ctx.height            = result.height;
+        ctx.spp               = result.spp;
+        ctx.tileSize          = glm::max( Dvar_GetInt( tile ), 1 );
+        ctx.envMap            = envMap;
+        ctx.quiet             = true;
+        ctx.cache.samplerKind = glm::clamp( Dvar_GetInt( sampler ), 0, Sampler::Count - 1 );
+
+        SteadyClock::time_point start = SteadyClock::now();
+        Scene scene;
+        if ( !LuaLoadScene( path.c_str(), scene ) )
+        {
+            Com_PrintError( "[bench] failed to execute script %s", path.c_str() );
+            return BatchExit_LoadFailed;
+        }
+        result.load.push_back( NsSince( start ) );
+
+        start = SteadyClock::now();
+        try
+        {
+            ConstructScene( scene, ctx.gpuScene );
+        }
+        catch ( std::runtime_error& err )
+        {
+            Com_PrintError( "[bench] failed to build %s: %s", name.c_str(), err.what() );
+            FreeAlbedoMaps();
+            return BatchExit_LoadFailed;
+        }
+        result.build.push_back( NsSince( start ) );
+
+        BvhLayout layout;
+        if ( !BvhLayoutFromString( Dvar_GetString( bvh_layout ), layout ) )
+        {
+            Com_PrintError( "[bench] unknown bvh_layout '%s', expected threaded or pairs", Dvar_GetString( bvh_layout ) );
+            FreeAlbedoMaps();
+            return BatchExit_InvalidArgs;
+        }
+        SetBvhLayout( ctx.gpuScene, layout );
+        SetIntegrator( ctx.cache, ctx.gpuScene.bbox );
+
+        const vector<Camera> cameras = cameraPath.empty() ? OrbitCameraPath( scene.camera, glm::max( Dvar_GetInt( bench_cameras ), 1 ) ) : cameraPath;
+        int64_t uploadNs             = 0;
+        int64_t traceNs              = 0;
+        for ( const Camera& camera : cameras )
+        {
+            SetCamera( ctx.cache, camera );
+            ctx.accumulation.clear();
+            RenderBatch( ctx, useGpu );
+            // batch times with the same steady clock, in milliseconds
+            uploadNs += static_cast<int64_t>( ctx.uploadMs * 1.0e6 );
+            traceNs += static_cast<int64_t>( ctx.renderMs * 1.0e6 );
+        }
+        result.upload.push_back( uploadNs );
+        result.trace.push_back( traceNs );
+        result.cameras    = static_cast<int>( cameras.size() );
+        result.geometries = static_cast<int>( ctx.gpuScene.geometries.size() );
+        result.bvhNodes   = static_cast<int>( ctx.gpuScene.bvhs.size() );
+        result.peakBytes  = glm::max( result.peakBytes, GetMemTotal().peak );
+        FreeAlbedoMaps();
+
+        Com_Printf( "[bench] %s run %d/%d: load %.2f ms, build %.2f ms, upload %.2f ms, trace %.2f ms",
+                    name.c_str(),
+                    run + 1,
+                    runs,
+                    result.load.back() * 1.0e-6,
+                    result.build.back() * 1.0e-6,
+                    uploadNs * 1.0e-6,
+                    traceNs * 1.0e-6 );
+    }
+
+    return BatchExit_Ok;
+}
+
+static double PathsPerSecond( const BenchResult& result, int64_t traceNs )
+{
+    const double paths = static_cast<double>( result.width ) * result.height * result.spp * result.cameras;
+    return traceNs > 0 ? paths / ( traceNs * 1.0e-9 ) : 0.0;
+}
+
+static void WritePhase( FILE* file, const char* name, const vector<int64_t>& values, bool last )
+{
+    fprintf( file, "      \"%s\": { \"median\": %lld, \"p95\": %lld, \"min\": %lld, \"max\": %lld, \"runs\": [",
+             name,
+             static_cast<long long>( Percentile( values, 0.5 ) ),
+             static_cast<long long>( Percentile( values, 0.95 ) ),
+             static_cast<long long>( Percentile( values, 0.0 ) ),
+             static_cast<long long>( Percentile( values, 1.0 ) ) );
+    for ( size_t i = 0; i < values.size(); ++i )
+    {
+        fprintf( file, "%s%lld", i ? ", " : "", static_cast<long long>( values[i] ) );
+    }
+    fprintf( file, "] }%s\n", last ? "" : "," );
+}
+
+static bool WriteBenchJson( const string& path, const vector<BenchResult>& results, bool useGpu, int runs )
+{
+    FILE* file = fopen( path.c_str(), "w" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    const int threads = Dvar_GetInt( threads ) > 0 ? Dvar_GetInt( threads ) : static_cast<int>( std::thread::hardware_concurrency() );
+    fprintf( file, "{\n" );
+    fprintf( file, "  \"backend\": \"%s\",\n", useGpu ? "gl" : "cpu" );
+    fprintf( file, "  \"threads\": %d,\n", useGpu ? 0 : threads );
+    fprintf( file, "  \"sampler\": \"%s\",\n", SamplerKindToString( static_cast<Sampler::Kind>( glm::clamp( Dvar_GetInt( sampler ), 0, Sampler::Count - 1 ) ) ) );
+    fprintf( file, "  \"integrator\": \"%s\",\n", glm::clamp( Dvar_GetInt( integrator ), 0, Integrator_Count - 1 ) == Integrator_Path ? "path" : "ao" );
+    fprintf( file, "  \"runs\": %d,\n", runs );
+    fprintf( file, "  \"unit\": \"ns\",\n" );
+    fprintf( file, "  \"scenes\": [\n" );
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const BenchResult& result = results[i];
+        fprintf( file, "    {\n" );
+        fprintf( file, "      \"name\": \"%s\",\n", result.name.c_str() );
+        fprintf( file, "      \"width\": %d,\n", result.width );
+        fprintf( file, "      \"height\": %d,\n", result.height );
+        fprintf( file, "      \"spp\": %d,\n", result.spp );
+        fprintf( file, "      \"cameras\": %d,\n", result.cameras );
+        fprintf( file, "      \"geometries\": %d,\n", result.geometries );
+        fprintf( file, "      \"bvh_nodes\": %d,\n", result.bvhNodes );
+        fprintf( file, "      \"peak_bytes\": %lld,\n", static_cast<long long>( result.peakBytes ) );
+        fprintf( file, "      \"paths_per_second\": %.1f,\n", PathsPerSecond( result, Percentile( result.trace, 0.5 ) ) );
+        WritePhase( file, "load", result.load, false );
+        WritePhase( file, "build", result.build, false );
+        WritePhase( file, "upload", result.upload, false );
+        WritePhase( file, "trace", result.trace, true );
+        fprintf( file, "    }%s\n", i + 1 < results.size() ? "," : "" );
+    }
+    fprintf( file, "  ]\n" );
+    fprintf( file, "}\n" );
+    return fclose( file ) == 0;
+}
+
+int RunBench()
+{
+    const string backend = Dvar_GetString( backend );
+    if ( backend != "auto" && backend != "gl" && backend != "cpu" )
+    {
+        Com_PrintError( "[bench] unknown backend '%s'", backend.c_str() );
+        return BatchExit_InvalidArgs;
+    }
+
+    const vector<string> names = SplitList( Dvar_GetString( bench_scenes ) );
+    const int runs             = glm::max( Dvar_GetInt( bench_runs ), 1 );
+    if ( names.empty() )
+    {
+        Com_PrintError( "[bench] usage: pt-bench [+set bench_scenes <name,...>] [+set bench_runs <n>] [+set bench_cameras <n>] [+set bench_spp <n>] [+set bench_output <path>] [+set backend auto|gl|cpu] [+set camera_path <file>]" );
+        return BatchExit_InvalidArgs;
+    }
+
+    vector<Camera> cameraPath;
+    const string cameraFile = Dvar_GetString( camera_path );
+    if ( !cameraFile.empty() && !ReadCameraPath( cameraFile, cameraPath ) )
+    {
+        Com_PrintError( "[bench] failed to read camera path '%s'", cameraFile.c_str() );
+        return BatchExit_InvalidArgs;
+    }
+
+    Image envMap;
+    try
+    {
+        envMap = ReadHDRImage( DATA_DIR "env/stairs.hdr" );
+    }
+    catch ( std::runtime_error& err )
+    {
+        Com_PrintError( "[bench] %s", err.what() );
+        return BatchExit_LoadFailed;
+    }
+
+    const bool useGpu = backend != "cpu" && CreateGpuContext( s_fallback.width, s_fallback.height );
+    if ( !useGpu && backend == "gl" )
+    {
+        FreeImage( envMap );
+        return BatchExit_RenderFailed;
+    }
+
+    int code = BatchExit_Ok;
+    vector<BenchResult> results;
+    for ( const string& name : names )
+    {
+        Com_PrintInfo( "[bench] %s, %d runs with %s backend", name.c_str(), runs, useGpu ? "gl" : "cpu" );
+        BenchResult result;
+        try
+        {
+            code = BenchScene( name, envMap, cameraPath, useGpu, runs, result );
+        }
+        catch ( std::runtime_error& err )
+        {
+            Com_PrintError( "[bench] render failed: %s", err.what() );
+            code = BatchExit_RenderFailed;
+        }
+        if ( code != BatchExit_Ok )
+        {
+            break;
+        }
+
+        const int64_t trace = Percentile( result.trace, 0.5 );
+        Com_PrintSuccess( "[bench] %s median (p95): load %.2f (%.2f) ms, build %.2f (%.2f) ms, upload %.2f (%.2f) ms, trace %.2f (%.2f) ms, %.3f Mpaths/s, peak %.1f MB",
+                          name.c_str(),
+                          Percentile( result.load, 0.5 ) * 1.0e-6,
+                          Percentile( result.load, 0.95 ) * 1.0e-6,
+                          Percentile( result.build, 0.5 ) * 1.0e-6,
+                          Percentile( result.build, 0.95 ) * 1.0e-6,
+                          Percentile( result.upload, 0.5 ) * 1.0e-6,
+                          Percentile( result.upload, 0.95 ) * 1.0e-6,
+                          trace * 1.0e-6,
+                          Percentile( result.trace, 0.95 ) * 1.0e-6,
+                          PathsPerSecond( result, trace ) * 1.0e-6,
+                          result.peakBytes / ( 1024.0 * 1024.0 ) );
+        results.push_back( std::move( result ) );
+    }
+
+    if ( useGpu )
+    {
+        gl::FinalizeGraphics();
+        DestroyMainWindow();
+    }
+    FreeImage( envMap );
+
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    const string output = Dvar_GetString( bench_output );
+    if ( !WriteBenchJson( output, results, useGpu, runs ) )
+    {
+        Com_PrintError( "[bench] failed to write '%s'", output.c_str() );
+        return BatchExit_WriteFailed;
+    }
+    Com_PrintSuccess( "[bench] wrote '%s'", output.c_str() );
+    return BatchExit_Ok;
+}
+
+}  // namespace pt
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "camera.h"
+
+namespace pt {
+
+/// nearest rank percentile of a list of timings, fraction in (0, 1]
+int64_t Percentile( std::vector<int64_t> values, double fraction );
+
+/// canonical camera path of a scene: count cameras orbiting the scene camera
+/// around its look at point from -15 to +15 degrees
+std::vector<Camera> OrbitCameraPath( const SceneCamera& camera, int count );
+
+/// loads, builds and renders each of +set bench_scenes +set bench_runs times along its camera
+/// path and writes the median and p95 of every phase to +set bench_output as json,
+/// entry point of pt-bench
+int RunBench();
+
+}  // namespace pt
@@ -0,0 +1,28 @@
+#include "batch.h"
+#include "bench.h"
+#include "com_dvars.h"
+#include "com_misc.h"
+#include "universal/dvar_api.h"
+#include "utility/memory_stats.h"
+#include "utility/profiler.h"
+
+using namespace pt;
+
+int main( int argc, const char** argv )
+{
+    Com_RegisterDvars();
+    if ( !Com_ProcessCmdLine( argc - 1, argv + 1 ) )
+    {
+        return BatchExit_InvalidArgs;
+    }
+
+    if ( Dvar_GetString( profile )[0] )
+    {
+        ProfilerStart( Dvar_GetString( profile ) );
+    }
+    SetMemBudget( static_cast<int64_t>( Dvar_GetInt( mem_budget ) ) << 20 );
+
+    const int code = RunBench();
+    ProfilerFinalize();
+    return code;
+}
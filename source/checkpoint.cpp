@@ -0,0 +1,243 @@
+#include "checkpoint.h"
+
+#include <chrono>
+#include <cstdio>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "universal/print.h"
+
+namespace pt {
+
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t CHECKPOINT_MAGIC   = 0x4b435450;  // 'PTCK'
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sceneHash;
+    int width;
+    int height;
+    int samplerKind;
+    int samplesDone;
+};
+
+//------------------------------------------------------------------------------
+// Scene hash
+//------------------------------------------------------------------------------
+// FNV-1a 64
+static void HashBytes( uint64_t& hash, const void* data, size_t size )
+{
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>( data );
+    for ( size_t i = 0; i < size; ++i )
+    {
+        hash ^= ptr[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+template<typename T>
+static void HashValue( uint64_t& hash, const T& value )
+{
+    HashBytes( hash, &value, sizeof( T ) );
+}
+
+static void HashImage( uint64_t& hash, const Image& image )
+{
+    HashValue( hash, image.width );
+    HashValue( hash, image.height );
+    HashValue( hash, image.channel );
+    if ( image.data )
+    {
+        const size_t size = static_cast<size_t>( image.width ) * image.height * image.channel * ( image.type == Image::Float ? sizeof( float ) : 1 );
+        HashBytes( hash, image.data, size );
+    }
+}
+
+uint64_t HashScene( const GpuScene& scene, const Image& envMap, const ImageArray& albedoMaps,
+                    const ConstantBufferCache& cache, int width, int height )
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    // Geometry is tightly packed, materials and bvh nodes are hashed per field
+    // because their padding is not always initialized
+    HashBytes( hash, scene.geometries.data(), scene.geometries.size() * sizeof( Geometry ) );
+    for ( const GpuMaterial& mat : scene.materials )
+    {
+        HashValue( hash, mat.albedo );
+        HashValue( hash, mat.reflect );
+        HashValue( hash, mat.emissive );
+        HashValue( hash, mat.roughness );
+        HashValue( hash, mat.albedoMapLevel );
+    }
+    for ( const GpuBvh& bvh : scene.bvhs )
+    {
+        HashValue( hash, bvh.min );
+        HashValue( hash, bvh.max );
+        HashValue( hash, bvh.missIdx );
+        HashValue( hash, bvh.hitIdx );
+        HashValue( hash, bvh.leaf );
+        HashValue( hash, bvh.geomIdx );
+    }
+
+    HashImage( hash, envMap );
+    for ( const Image& image : albedoMaps.images )
+    {
+        HashImage( hash, image );
+    }
+
+    HashValue( hash, cache.camPos );
+    HashValue( hash, cache.camFwd );
+    HashValue( hash, cache.camRight );
+    HashValue( hash, cache.camUp );
+    HashValue( hash, cache.camFov );
+    HashValue( hash, cache.samplerKind );
+    HashValue( hash, cache.integrator );
+    HashValue( hash, cache.aoRadius );
+    HashValue( hash, width );
+    HashValue( hash, height );
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+// File io
+//------------------------------------------------------------------------------
+bool WriteCheckpoint( const string& path, const Checkpoint& checkpoint )
+{
+    const string tmpPath = path + ".tmp";
+    FILE* file           = fopen( tmpPath.c_str(), "wb" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    CheckpointHeader header;
+    header.magic       = CHECKPOINT_MAGIC;
+    header.version     = CHECKPOINT_VERSION;
+    header.sceneHash   = checkpoint.sceneHash;
+    header.width       = checkpoint.width;
+    header.height      = checkpoint.height;
+    header.samplerKind = checkpoint.samplerKind;
+    header.samplesDone = checkpoint.samplesDone;
+
+    const size_t count = checkpoint.accumulation.size();
+    bool ok            = fwrite( &header, sizeof( header ), 1, file ) == 1;
+    ok                 = ok && fwrite( checkpoint.accumulation.data(), sizeof( vec4 ), count, file ) == count;
+    ok                 = ( fclose( file ) == 0 ) && ok;
+    if ( !ok )
+    {
+        remove( tmpPath.c_str() );
+        return false;
+    }
+
+#if defined( _WIN32 )
+    // rename fails there when the previous checkpoint exists
+    return MoveFileExA( tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+#else
+    return rename( tmpPath.c_str(), path.c_str() ) == 0;
+#endif
+}
+
+bool ReadCheckpoint( const string& path, Checkpoint& checkpoint )
+{
+    FILE* file = fopen( path.c_str(), "rb" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    CheckpointHeader header;
+    bool ok = fread( &header, sizeof( header ), 1, file ) == 1;
+    ok      = ok && header.magic == CHECKPOINT_MAGIC && header.version == CHECKPOINT_VERSION;
+    ok      = ok && header.width > 0 && header.height > 0 && header.samplesDone >= 0;
+    if ( ok )
+    {
+        checkpoint.sceneHash   = header.sceneHash;
+        checkpoint.width       = header.width;
+        checkpoint.height      = header.height;
+        checkpoint.samplerKind = header.samplerKind;
+        checkpoint.samplesDone = header.samplesDone;
+        checkpoint.accumulation.resize( static_cast<size_t>( header.width ) * header.height );
+        const size_t count = checkpoint.accumulation.size();
+        ok                 = fread( checkpoint.accumulation.data(), sizeof( vec4 ), count, file ) == count;
+    }
+
+    fclose( file );
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+// CheckpointWriter
+//------------------------------------------------------------------------------
+CheckpointWriter::CheckpointWriter( const string& path )
+    : m_path( path )
+{
+    m_thread = std::thread( &CheckpointWriter::ThreadMain, this );
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_quit = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+void CheckpointWriter::Submit( Checkpoint&& checkpoint )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_queued    = std::move( checkpoint );
+        m_hasQueued = true;
+    }
+    m_cv.notify_all();
+}
+
+void CheckpointWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_cv.wait( lock, [this] { return !m_hasQueued && !m_writing; } );
+}
+
+void CheckpointWriter::ThreadMain()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    for ( ;; )
+    {
+        m_cv.wait( lock, [this] { return m_hasQueued || m_quit; } );
+        if ( !m_hasQueued )
+        {
+            return;
+        }
+
+        Checkpoint checkpoint = std::move( m_queued );
+        m_hasQueued           = false;
+        m_writing             = true;
+        lock.unlock();
+
+        const Clock::time_point start = Clock::now();
+        const bool ok                 = WriteCheckpoint( m_path, checkpoint );
+        const double ms               = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+        if ( !ok )
+        {
+            Com_PrintError( "[checkpoint] failed to write '%s'", m_path.c_str() );
+        }
+
+        lock.lock();
+        m_writing = false;
+        m_writeMs += ms;
+        ++( ok ? m_writeCount : m_failCount );
+        m_cv.notify_all();
+    }
+}
+
+}  // namespace pt
@@ -0,0 +1,69 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "constant_cache.h"
+#include "image.h"
+#include "scene.h"
+
+namespace pt {
+
+/// state needed to continue a progressive render, the accumulation buffer holds
+/// summed radiance in rgb and the sample count in alpha like the rgba32f texture
+struct Checkpoint {
+    uint64_t sceneHash = 0;
+    int width          = 0;
+    int height         = 0;
+    int samplerKind    = 0;
+    int samplesDone    = 0;  // next sample index, cache.frame is samplesDone + 1
+    std::vector<vec4> accumulation;
+};
+
+/// hashes everything that changes the converged image: geometry, bvh, materials,
+/// textures, camera, resolution, sampler and integrator, but not the sample count. The
+/// dvars behind it reach the render workers through SceneDvarArgs in distributed.cpp
+uint64_t HashScene( const GpuScene& scene, const Image& envMap, const ImageArray& albedoMaps,
+                    const ConstantBufferCache& cache, int width, int height );
+
+/// writes to <path>.tmp first and renames it, so a crash never leaves a torn checkpoint
+bool WriteCheckpoint( const std::string& path, const Checkpoint& checkpoint );
+
+bool ReadCheckpoint( const std::string& path, Checkpoint& checkpoint );
+
+/// writes checkpoints on a background thread, a snapshot submitted while the
+/// previous one is still being written replaces the queued one
+class CheckpointWriter {
+   public:
+    CheckpointWriter( const std::string& path );
+    ~CheckpointWriter();
+
+    void Submit( Checkpoint&& checkpoint );
+    /// blocks until the queued checkpoint is on disk
+    void Flush();
+
+    inline int GetWriteCount() const { return m_writeCount; }
+    inline int GetFailCount() const { return m_failCount; }
+    inline double GetWriteMs() const { return m_writeMs; }
+
+   private:
+    void ThreadMain();
+
+    std::string m_path;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Checkpoint m_queued;
+    bool m_hasQueued = false;
+    bool m_writing   = false;
+    bool m_quit      = false;
+
+    int m_writeCount = 0;
+    int m_failCount  = 0;
+    double m_writeMs = 0.0;
+};
+
+}  // namespace pt
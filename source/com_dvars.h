@@ -5,5 +5,91 @@ DVAR_INT( wnd_width, 960 );
 DVAR_INT( wnd_height, 960 );
 DVAR_INT( ssp, 0 );
 DVAR_INT( tile, 320 );
+// 0 random, 1 sobol, 2 rank-1 lattice
+DVAR_INT( sampler, 0 );
+// 0 path tracing, 1 ambient occlusion, ao_radius 0 uses a tenth of the scene diagonal
+DVAR_INT( integrator, 0 );
+DVAR_FLOAT( ao_radius, 0.0f );
+// tone mapping, shared by the viewer and batch output
+DVAR_FLOAT( exposure, 0.5f );
+DVAR_INT( tonemap, 1 );
+// off keeps the output bit identical to before, +set dither 1 breaks up banding in 8 bit output
+DVAR_INT( dither, 0 );
+// denoiser, aovs writes the first hit feature, id and heat map buffers in batch mode,
+// denoise_input denoises <prefix>.pfm with <prefix>_albedo/_normal/_depth.pfm without rendering
+DVAR_INT( aovs, 0 );
+// aov shown by the viewer (color, albedo, normal, depth, material, primitive or heat),
+// aov_heat_max is the number of bvh nodes per camera ray shown as red, 0 picks one from the scene
+DVAR_STRING( aov_view, "color" );
+DVAR_FLOAT( aov_heat_max, 0.0f );
+DVAR_INT( denoise, 0 );
+DVAR_INT( denoise_iterations, 5 );
+DVAR_FLOAT( denoise_sigma, 4.0f );
+DVAR_STRING( denoise_input, "" );
+// viewer, preview 1 path traces while the camera moves instead of the phong preview,
+// reproject keeps the samples that are still visible after a camera move
+DVAR_INT( preview, 0 );
+DVAR_INT( reproject, 1 );
+DVAR_INT( reproject_max_history, 16 );
+DVAR_FLOAT( reproject_clamp, 3.0f );
+DVAR_STRING( record_camera, "" );
+// viewer, hot_reload watches the scene script folder, the shaders and the mesh folders. An edited
+// material is written to the material buffer, a moved geometry refits the bvh and anything else
+// builds the scene again. Off by default, it keeps the scene and its cpu buffers resident
+DVAR_INT( hot_reload, 0 );
+// frame dumps, every n frames in the viewer or n samples in batch mode, dump_path is a printf
+// pattern with exactly one integer conversion for the frame or sample number
+DVAR_INT( dump_every, 0 );
+DVAR_STRING( dump_path, "frame_%05d.png" );
+// batch mode
+DVAR_INT( batch, 0 );
+DVAR_STRING( output, "" );
+DVAR_STRING( hdr_format, "pfm" );
+DVAR_STRING( backend, "auto" );
+DVAR_INT( threads, 0 );
+DVAR_STRING( checkpoint, "" );
+DVAR_INT( checkpoint_interval, 60 );
+DVAR_INT( resume, 0 );
+// replays a recorded camera path on the cpu and compares reprojection with restarting
+DVAR_STRING( camera_path, "" );
+// writes the bvh traversal counters of every sample to <output>_traversal.csv/.json in batch mode,
+// the gl backend compiles a counting variant of tiled.comp, the cpu backend needs a PT_TRAVERSAL_STATS build
+DVAR_INT( traversal_stats, 0 );
+// chrome://tracing json of the cpu and gpu pass timings, written when the viewer exits
+// and at the end of batch mode
+DVAR_STRING( trace_output, "" );
+// chrome://tracing and Perfetto json of the PROFILE_ZONE scopes of every thread, written on exit,
+// the zones are compiled out without the PT_PROFILER CMake option
+DVAR_STRING( profile, "" );
+// bvh memory layout the renderers traverse: threaded (stackless, 48 byte nodes) or
+// pairs (32 byte nodes, siblings side by side, nearest child first with a stack)
+DVAR_STRING( bvh_layout, "threaded" );
+// megabytes of scene data (scene buffers, bvh build, images) loading may use before it fails, 0 is unlimited
+DVAR_INT( mem_budget, 0 );
+// megabytes of bvh clusters the cpu backend keeps resident in batch mode, 0 keeps the whole scene
+// in memory. Otherwise the built scene is cut into clusters of ooc_cluster_size primitives, written
+// to ooc_path (<output>.clusters when empty) and paged in while the wavefront traces a bounce
+DVAR_INT( ooc_budget, 0 );
+DVAR_INT( ooc_cluster_size, 4096 );
+DVAR_STRING( ooc_path, "" );
+// paths the cpu backend advances a bounce at a time, 0 traces every pixel to the end on its own
+// (out of core scenes then use 65536). ray_sort 1 orders the bounce rays of a batch by direction
+// octant and origin Morton code before they are traced
+DVAR_INT( wavefront_batch, 0 );
+DVAR_INT( ray_sort, 0 );
+// cycles, instructions and cache misses of the cpu render loop in batch mode, where the kernel
+// exposes hardware counters (perf_event_open on Linux)
+DVAR_INT( perf_counters, 0 );
+// pt-bench, scenes are names of scripts/*.lua, bench_spp 0 keeps the canonical sample counts
+// and +set camera_path <file> replaces the canonical camera path
+DVAR_STRING( bench_scenes, "cornell-box,monkey,room,sibenik,sponza" );
+DVAR_INT( bench_runs, 5 );
+DVAR_INT( bench_cameras, 4 );
+DVAR_INT( bench_spp, 0 );
+DVAR_STRING( bench_output, "bench.json" );
+// distributed rendering
+DVAR_INT( workers, 0 );
+DVAR_INT( worker, 0 );
+DVAR_INT( job_spp, 0 );
 
 #include "universal/dvar_end.h"
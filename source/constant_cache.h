@@ -3,6 +3,13 @@
 
 namespace pt {
 
+/// what tiled.comp and CpuRenderer compute per sample, +set integrator
+enum Integrator {
+    Integrator_Path,              // path tracing
+    Integrator_AmbientOcclusion,  // 1 if a cosine weighted ray from the first hit escapes aoRadius
+    Integrator_Count,
+};
+
 struct ConstantBufferCache {
     vec3 camPos;
     float camFov;
@@ -15,7 +22,13 @@ struct ConstantBufferCache {
     int envTexture;
 
     ivec2 tileOffset;
-    int padding[2];
+    int samplerKind;
+    int sampleIndex;
+
+    int writeAovs;
+    int integrator;
+    float aoRadius;
+    int _padding3;
 
     ConstantBufferCache()
         : camPos(vec3(0, 0, 1)),
@@ -25,6 +38,12 @@ struct ConstantBufferCache {
           frame(0),
           dirty(0),
           tileOffset(ivec2(0)),
+          samplerKind(0),
+          sampleIndex(0),
+          writeAovs(0),
+          integrator(Integrator_Path),
+          aoRadius(1.f),
+          _padding3(0),
           camFov(60.f),
           envTexture(1) {}
 };
@@ -0,0 +1,554 @@
+#include "cluster_scene.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "universal/core_assert.h"
+#include "utility/parallel.h"
+#include "utility/profiler.h"
+#include "utility/string_util.h"
+
+namespace pt {
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace {
+
+constexpr uint32_t CLUSTER_FILE_MAGIC   = 0x4c435450;  // "PTCL"
+constexpr uint32_t CLUSTER_FILE_VERSION = 1;
+
+// clusters start on a page of their own, so each one can be released on its own
+constexpr uint64_t CLUSTER_ALIGNMENT = 4096;
+
+// rays per task of the top level traversal
+constexpr int RAY_BLOCK_SIZE = 1024;
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    int clusterCount;
+    int topNodeCount;
+    int primitiveCount;
+    int padding;
+};
+
+uint64_t AlignCluster( uint64_t offset )
+{
+    return ( offset + CLUSTER_ALIGNMENT - 1 ) & ~( CLUSTER_ALIGNMENT - 1 );
+}
+
+bool WriteBytes( FILE* file, const void* data, size_t size )
+{
+    return size == 0 || fwrite( data, size, 1, file ) == 1;
+}
+
+bool WriteZeros( FILE* file, uint64_t size )
+{
+    static const char s_zeros[CLUSTER_ALIGNMENT] = {};
+    return WriteBytes( file, s_zeros, static_cast<size_t>( size ) );
+}
+
+}  // namespace
+
+//------------------------------------------------------------------------------
+// Cluster file
+//------------------------------------------------------------------------------
+// header | top nodes | clusters directory | padding | cluster 0 | padding | cluster 1 ...
+// and every cluster is nodes | primitives | geometries | geometry ids
+void ClusterScene::Write( const GpuScene& scene, int clusterSize, const string& path )
+{
+    PROFILE_ZONE( "ClusterScene::Write" );
+    core_assert( clusterSize > 0 );
+    const vector<BvhNode>& nodes = scene.nodes;
+    if ( nodes.empty() )
+    {
+        throw runtime_error( "the scene has no geometry" );
+    }
+    if ( scene.height >= BVH_STACK_SIZE )
+    {
+        throw runtime_error( va( "bvh depth %d does not fit the traversal stack of %d", scene.height, BVH_STACK_SIZE ) );
+    }
+
+    // primitives below every node, children always come after their parent
+    vector<int> leafCounts( nodes.size(), 0 );
+    for ( int i = static_cast<int>( nodes.size() ) - 1; i >= 0; --i )
+    {
+        const BvhNode& node = nodes[i];
+        if ( node.geomIdx != -1 )
+        {
+            leafCounts[i] = 1;
+        }
+        else if ( node.firstChild != -1 )
+        {
+            leafCounts[i] = leafCounts[node.firstChild] + leafCounts[node.firstChild + 1];
+        }
+    }
+
+    // the top keeps the child pair layout, a node whose subtree fits becomes a cluster
+    struct Pending {
+        int src;
+        int dst;
+    };
+    vector<BvhNode> topNodes( 2 );
+    topNodes[1] = BvhNode{ vec3( 0.0f ), -1, vec3( 0.0f ), -1 };
+    vector<int> clusterRoots;
+    vector<Pending> stack = { { 0, 0 } };
+    while ( !stack.empty() )
+    {
+        const Pending pending = stack.back();
+        stack.pop_back();
+
+        const BvhNode& node = nodes[pending.src];
+        BvhNode top         = { node.min, -1, node.max, -1 };
+        if ( leafCounts[pending.src] <= clusterSize )
+        {
+            top.geomIdx = static_cast<int>( clusterRoots.size() );
+            clusterRoots.push_back( pending.src );
+        }
+        else
+        {
+            top.firstChild = static_cast<int>( topNodes.size() );
+            topNodes.resize( topNodes.size() + 2 );
+            stack.push_back( { node.firstChild + 1, top.firstChild + 1 } );
+            stack.push_back( { node.firstChild, top.firstChild } );
+        }
+        topNodes[pending.dst] = top;
+    }
+
+    // a cluster of n primitives has the root, the padding node and a pair per inner node
+    vector<Cluster> clusters( clusterRoots.size() );
+    uint64_t offset = AlignCluster( sizeof( FileHeader ) + topNodes.size() * sizeof( BvhNode ) + clusters.size() * sizeof( Cluster ) );
+    for ( size_t i = 0; i < clusters.size(); ++i )
+    {
+        Cluster& cluster       = clusters[i];
+        const int count        = leafCounts[clusterRoots[i]];
+        cluster.offset         = offset;
+        cluster.nodeCount      = 2 * count;
+        cluster.primitiveCount = count;
+        cluster.size           = cluster.nodeCount * sizeof( BvhNode ) + count * ( sizeof( GpuPrimitive ) + sizeof( Geometry ) + sizeof( int ) );
+        offset                 = AlignCluster( offset + cluster.size );
+    }
+
+    FILE* file = fopen( path.c_str(), "wb" );
+    if ( !file )
+    {
+        throw runtime_error( va( "failed to open '%s' for writing", path.c_str() ) );
+    }
+
+    const FileHeader header = { CLUSTER_FILE_MAGIC, CLUSTER_FILE_VERSION, static_cast<int>( clusters.size() ), static_cast<int>( topNodes.size() ), static_cast<int>( scene.geometries.size() ), 0 };
+    bool written = WriteBytes( file, &header, sizeof( header ) ) &&
+                   WriteBytes( file, topNodes.data(), topNodes.size() * sizeof( BvhNode ) ) &&
+                   WriteBytes( file, clusters.data(), clusters.size() * sizeof( Cluster ) );
+    uint64_t end = sizeof( header ) + topNodes.size() * sizeof( BvhNode ) + clusters.size() * sizeof( Cluster );
+
+    // one cluster at a time, the scratch vectors are reused
+    vector<BvhNode> clusterNodes;
+    vector<GpuPrimitive> primitives;
+    vector<Geometry> geometries;
+    vector<int> geometryIds;
+    for ( size_t i = 0; i < clusters.size() && written; ++i )
+    {
+        clusterNodes.assign( 2, BvhNode{ vec3( 0.0f ), -1, vec3( 0.0f ), -1 } );
+        primitives.clear();
+        geometries.clear();
+        geometryIds.clear();
+
+        stack = { { clusterRoots[i], 0 } };
+        while ( !stack.empty() )
+        {
+            const Pending pending = stack.back();
+            stack.pop_back();
+
+            const BvhNode& node = nodes[pending.src];
+            BvhNode local       = { node.min, -1, node.max, -1 };
+            if ( node.geomIdx != -1 )
+            {
+                local.geomIdx = static_cast<int>( primitives.size() );
+                primitives.push_back( scene.primitives[node.geomIdx] );
+                geometries.push_back( scene.geometries[node.geomIdx] );
+                geometryIds.push_back( node.geomIdx );
+            }
+            else
+            {
+                local.firstChild = static_cast<int>( clusterNodes.size() );
+                clusterNodes.resize( clusterNodes.size() + 2 );
+                stack.push_back( { node.firstChild + 1, local.firstChild + 1 } );
+                stack.push_back( { node.firstChild, local.firstChild } );
+            }
+            clusterNodes[pending.dst] = local;
+        }
+        core_assert( static_cast<int>( clusterNodes.size() ) == clusters[i].nodeCount );
+
+        written = WriteZeros( file, clusters[i].offset - end ) &&
+                  WriteBytes( file, clusterNodes.data(), clusterNodes.size() * sizeof( BvhNode ) ) &&
+                  WriteBytes( file, primitives.data(), primitives.size() * sizeof( GpuPrimitive ) ) &&
+                  WriteBytes( file, geometries.data(), geometries.size() * sizeof( Geometry ) ) &&
+                  WriteBytes( file, geometryIds.data(), geometryIds.size() * sizeof( int ) );
+        end = clusters[i].offset + clusters[i].size;
+    }
+
+    if ( fclose( file ) != 0 || !written )
+    {
+        throw runtime_error( va( "failed to write '%s'", path.c_str() ) );
+    }
+}
+
+//------------------------------------------------------------------------------
+// Cache
+//------------------------------------------------------------------------------
+ClusterScene::~ClusterScene()
+{
+    Close();
+}
+
+void ClusterScene::Open( const string& path, size_t budget )
+{
+    Close();
+    m_file.Open( path );
+
+    FileHeader header;
+    if ( m_file.GetSize() < sizeof( header ) )
+    {
+        throw runtime_error( va( "'%s' is not a cluster file", path.c_str() ) );
+    }
+    memcpy( &header, m_file.GetData(), sizeof( header ) );
+    if ( header.magic != CLUSTER_FILE_MAGIC || header.version != CLUSTER_FILE_VERSION )
+    {
+        throw runtime_error( va( "'%s' is not a cluster file of version %d", path.c_str(), CLUSTER_FILE_VERSION ) );
+    }
+
+    const uint64_t headerSize = sizeof( header ) + header.topNodeCount * sizeof( BvhNode ) + header.clusterCount * sizeof( Cluster );
+    if ( m_file.GetSize() < headerSize )
+    {
+        throw runtime_error( va( "'%s' is truncated", path.c_str() ) );
+    }
+    const BvhNode* topNodes = reinterpret_cast<const BvhNode*>( m_file.GetData() + sizeof( header ) );
+    const Cluster* clusters = reinterpret_cast<const Cluster*>( topNodes + header.topNodeCount );
+    m_topNodes.assign( topNodes, topNodes + header.topNodeCount );
+    m_clusters.assign( clusters, clusters + header.clusterCount );
+    if ( !m_clusters.empty() && m_clusters.back().offset + m_clusters.back().size > m_file.GetSize() )
+    {
+        throw runtime_error( va( "'%s' is truncated", path.c_str() ) );
+    }
+    m_file.Release( 0, headerSize );
+
+    m_primitiveCount = header.primitiveCount;
+    m_budget         = budget;
+    m_bufferSize     = 0;
+    for ( const Cluster& cluster : m_clusters )
+    {
+        m_bufferSize = std::max( m_bufferSize, static_cast<size_t>( cluster.size ) );
+    }
+    m_slots          = vector<Slot>( m_clusters.size() );
+    m_topMemory.Set( m_topNodes.capacity() * sizeof( BvhNode ) + m_clusters.capacity() * sizeof( Cluster ) );
+}
+
+void ClusterScene::Close()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_slots.clear();
+    m_lru.clear();
+    m_residentBytes = 0;
+    m_bufferSize    = 0;
+    m_residentMemory.Set( 0 );
+    m_stats = CacheStats();
+
+    m_topNodes.clear();
+    m_clusters.clear();
+    m_topMemory.Set( 0 );
+    m_primitiveCount = 0;
+    m_file.Close();
+}
+
+ClusterScene::CacheStats ClusterScene::GetCacheStats() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+ClusterScene::View ClusterScene::Acquire( int cluster )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    const Cluster& info = m_clusters[cluster];
+    Slot& slot          = m_slots[cluster];
+    ++m_stats.lookups;
+    ++slot.pins;
+    m_loaded.wait( lock, [&]() { return !slot.loading; } );
+
+    if ( slot.data )
+    {
+        m_lru.splice( m_lru.begin(), m_lru, slot.lru );
+    }
+    else
+    {
+        // buffers are recycled rather than freed, the heap would keep the freed ones anyway.
+        // The copy runs without the lock so the other threads keep tracing their clusters
+        slot.loading = true;
+        std::unique_ptr<char[]> data;
+        if ( m_residentBytes + m_bufferSize > m_budget )
+        {
+            data = EvictLocked();
+        }
+        if ( !data )
+        {
+            m_residentBytes += m_bufferSize;
+            m_residentMemory.Set( m_residentBytes );
+        }
+        lock.unlock();
+
+        if ( !data )
+        {
+            data.reset( new char[m_bufferSize] );
+        }
+        memcpy( data.get(), m_file.GetData() + info.offset, info.size );
+        m_file.Release( info.offset, info.size );
+
+        lock.lock();
+        slot.data    = std::move( data );
+        slot.loading = false;
+        m_lru.push_front( cluster );
+        slot.lru = m_lru.begin();
+        ++m_stats.faults;
+        m_stats.bytesRead += info.size;
+        m_stats.peakBytes = std::max( m_stats.peakBytes, m_residentBytes );
+        m_loaded.notify_all();
+    }
+
+    const char* data = slot.data.get();
+    View view;
+    view.nodes       = reinterpret_cast<const BvhNode*>( data );
+    view.primitives  = reinterpret_cast<const GpuPrimitive*>( view.nodes + info.nodeCount );
+    view.geometries  = reinterpret_cast<const Geometry*>( view.primitives + info.primitiveCount );
+    view.geometryIds = reinterpret_cast<const int*>( view.geometries + info.primitiveCount );
+    return view;
+}
+
+void ClusterScene::Unpin( int cluster )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    --m_slots[cluster].pins;
+
+    // buffers allocated over the budget while every cluster was in use
+    while ( m_residentBytes > m_budget && EvictLocked() )
+    {
+        m_residentBytes -= m_bufferSize;
+    }
+    m_residentMemory.Set( m_residentBytes );
+}
+
+std::unique_ptr<char[]> ClusterScene::EvictLocked()
+{
+    for ( auto it = m_lru.rbegin(); it != m_lru.rend(); ++it )
+    {
+        Slot& slot = m_slots[*it];
+        if ( slot.pins == 0 )
+        {
+            ++m_stats.evictions;
+            m_lru.erase( std::next( it ).base() );
+            return std::move( slot.data );
+        }
+    }
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// Batched traversal
+//------------------------------------------------------------------------------
+void ClusterScene::FindClusters( const Ray* rays, const float* tmax, int count, int numThreads, TraversalCost* costs,
+                                 vector<Entry>& outEntries, vector<int>& outOffsets ) const
+{
+    PROFILE_ZONE( "FindClusters" );
+    const int blockCount = ( count + RAY_BLOCK_SIZE - 1 ) / RAY_BLOCK_SIZE;
+    vector<vector<Entry>> blocks( blockCount );
+    outOffsets.assign( count + 1, 0 );
+
+    ParallelFor( blockCount, numThreads, [&]( int block ) {
+        vector<Entry>& entries = blocks[block];
+        Entry stack[BVH_STACK_SIZE];
+        const int end = std::min( ( block + 1 ) * RAY_BLOCK_SIZE, count );
+        for ( int i = block * RAY_BLOCK_SIZE; i < end; ++i )
+        {
+            const TraversalRay ray( rays[i].origin, rays[i].direction, tmax ? tmax[i] : rays[i].t );
+            const size_t first = entries.size();
+            TraversalCost cost;
+
+            // all leaves the ray enters, the order is fixed up below
+            int stackSize = 0;
+            float tmin;
+            ++cost.nodes;
+            ++cost.boxes;
+            if ( HitBox( ray, m_topNodes[0].min, m_topNodes[0].max, tmin ) )
+            {
+                stack[stackSize++] = Entry{ 0, tmin };
+            }
+            while ( stackSize > 0 )
+            {
+                const Entry entry   = stack[--stackSize];
+                const BvhNode& node = m_topNodes[entry.cluster];
+                if ( node.geomIdx != -1 )
+                {
+                    entries.push_back( Entry{ node.geomIdx, entry.tmin } );
+                    continue;
+                }
+
+                cost.nodes += 2;
+                cost.boxes += 2;
+                for ( int child = node.firstChild; child < node.firstChild + 2; ++child )
+                {
+                    if ( HitBox( ray, m_topNodes[child].min, m_topNodes[child].max, tmin ) )
+                    {
+                        core_assert( stackSize < BVH_STACK_SIZE );
+                        stack[stackSize++] = Entry{ child, tmin };
+                    }
+                }
+            }
+
+            std::sort( entries.begin() + first, entries.end(), []( const Entry& a, const Entry& b ) { return a.tmin < b.tmin; } );
+            outOffsets[i + 1] = static_cast<int>( entries.size() - first );
+            if ( costs )
+            {
+                costs[i].nodes += cost.nodes;
+                costs[i].boxes += cost.boxes;
+            }
+        }
+    } );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        outOffsets[i + 1] += outOffsets[i];
+    }
+    outEntries.clear();
+    outEntries.reserve( outOffsets[count] );
+    for ( const vector<Entry>& entries : blocks )
+    {
+        outEntries.insert( outEntries.end(), entries.begin(), entries.end() );
+    }
+}
+
+template<typename Func>
+void ClusterScene::ProcessVisits( vector<Visit>& visits, int numThreads, const Func& func )
+{
+    PROFILE_ZONE( "ProcessVisits" );
+    // rays keep their order within a cluster, neighbouring pixels traverse one after the other
+    std::sort( visits.begin(), visits.end(), []( const Visit& a, const Visit& b ) {
+        return a.cluster != b.cluster ? a.cluster < b.cluster : a.ray < b.ray;
+    } );
+
+    vector<int> groups;  // first visit of every cluster
+    for ( size_t i = 0; i < visits.size(); ++i )
+    {
+        if ( i == 0 || visits[i].cluster != visits[i - 1].cluster )
+        {
+            groups.push_back( static_cast<int>( i ) );
+        }
+    }
+    groups.push_back( static_cast<int>( visits.size() ) );
+
+    ParallelFor( static_cast<int>( groups.size() ) - 1, numThreads, [&]( int group ) {
+        const int cluster = visits[groups[group]].cluster;
+        const View view   = Acquire( cluster );
+        for ( int i = groups[group]; i < groups[group + 1]; ++i )
+        {
+            func( view, visits[i].ray );
+        }
+        Unpin( cluster );
+    } );
+}
+
+void ClusterScene::HitRays( Ray* rays, int count, int numThreads, TraversalCost* costs )
+{
+    PROFILE_ZONE( "HitRays" );
+    vector<Entry> entries;
+    vector<int> offsets;
+    FindClusters( rays, nullptr, count, numThreads, costs, entries, offsets );
+
+    // every round visits the nearest cluster each ray has left that can still hold a closer
+    // hit, so the hits found in near clusters cull the far ones
+    vector<int> next( offsets.begin(), offsets.end() - 1 );
+    vector<Visit> visits;
+    uint64_t rounds = 0;
+    for ( ;; )
+    {
+        visits.clear();
+        for ( int i = 0; i < count; ++i )
+        {
+            int& entry = next[i];
+            if ( entry < offsets[i + 1] && entries[entry].tmin >= rays[i].t )
+            {
+                entry = offsets[i + 1];
+            }
+            if ( entry < offsets[i + 1] )
+            {
+                visits.push_back( Visit{ entries[entry++].cluster, i } );
+            }
+        }
+        if ( visits.empty() )
+        {
+            break;
+        }
+
+        ++rounds;
+        ProcessVisits( visits, numThreads, [&]( const View& view, int i ) {
+            Ray& ray = rays[i];
+            TraversalCost unused;
+            TraversalRay traversal( ray.origin, ray.direction, ray.t );
+            if ( HitBvhNodes( traversal, view.nodes, view.primitives, costs ? costs[i] : unused ) )
+            {
+                // set right away, the cluster may be gone by the time the batch is done
+                ray.t       = traversal.t;
+                ray.geomId  = view.geometryIds[traversal.geomId];
+                ray.hitBary = traversal.bary;
+                SetHitAttributes( ray, view.geometries[traversal.geomId] );
+            }
+        } );
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats.rays += count;
+    m_stats.rounds += rounds;
+}
+
+void ClusterScene::OccludedRays( const Ray* rays, const float* tmax, int count, int numThreads, bool* outOccluded )
+{
+    PROFILE_ZONE( "OccludedRays" );
+    vector<Entry> entries;
+    vector<int> offsets;
+    FindClusters( rays, tmax, count, numThreads, nullptr, entries, offsets );
+
+    std::fill( outOccluded, outOccluded + count, false );
+    vector<int> next( offsets.begin(), offsets.end() - 1 );
+    vector<Visit> visits;
+    uint64_t rounds = 0;
+    for ( ;; )
+    {
+        visits.clear();
+        for ( int i = 0; i < count; ++i )
+        {
+            if ( !outOccluded[i] && next[i] < offsets[i + 1] )
+            {
+                visits.push_back( Visit{ entries[next[i]++].cluster, i } );
+            }
+        }
+        if ( visits.empty() )
+        {
+            break;
+        }
+
+        ++rounds;
+        ProcessVisits( visits, numThreads, [&]( const View& view, int i ) {
+            TraversalCost unused;
+            const TraversalRay shadow( rays[i].origin, rays[i].direction, tmax[i] );
+            outOccluded[i] = OccludedBvhNodes( shadow, view.nodes, view.primitives, unused );
+        } );
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats.rays += count;
+    m_stats.rounds += rounds;
+}
+
+}  // namespace pt
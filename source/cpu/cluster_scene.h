@@ -0,0 +1,126 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cpu/trace.h"
+#include "utility/mapped_file.h"
+#include "utility/memory_stats.h"
+
+namespace pt {
+
+/// out of core geometry for the cpu backend. The child pair bvh is cut into clusters of
+/// at most clusterSize primitives, the nodes above them stay resident and the clusters
+/// (nodes, primitives and geometries) live in a mapped file. An LRU cache copies them in
+/// on demand and evicts the least recently used ones once the budget is exceeded.
+/// Rays are traced in batches that are sorted by cluster, so every cluster a batch needs
+/// is looked up once per round instead of once per ray
+class ClusterScene {
+   public:
+    struct CacheStats {
+        uint64_t lookups   = 0;  // cluster visits of the batches, one per cluster and round
+        uint64_t faults    = 0;  // lookups that read the cluster from the file
+        uint64_t evictions = 0;
+        uint64_t bytesRead = 0;
+        uint64_t rays      = 0;
+        uint64_t rounds    = 0;
+        size_t peakBytes   = 0;  // resident clusters, may exceed the budget while they are in use
+    };
+
+    ClusterScene() = default;
+    ~ClusterScene();
+
+    ClusterScene( const ClusterScene& ) = delete;
+    ClusterScene& operator=( const ClusterScene& ) = delete;
+
+    /// cuts the child pair bvh of scene into clusters and writes them to path,
+    /// throws a runtime_error when the tree is too deep or the file cannot be written
+    static void Write( const GpuScene& scene, int clusterSize, const std::string& path );
+
+    /// maps a file written by Write, budget is the number of bytes of resident clusters
+    void Open( const std::string& path, size_t budget );
+    void Close();
+
+    /// closest hit of every ray, fills the hit attributes like HitScene. costs is null
+    /// or holds one entry per ray that the work is added to
+    void HitRays( Ray* rays, int count, int numThreads, TraversalCost* costs = nullptr );
+
+    /// OccludedScene for every ray, the rays are tested up to their own tmax
+    void OccludedRays( const Ray* rays, const float* tmax, int count, int numThreads, bool* outOccluded );
+
+    inline int GetClusterCount() const { return static_cast<int>( m_clusters.size() ); }
+    inline int GetTopNodeCount() const { return static_cast<int>( m_topNodes.size() ); }
+    inline int GetPrimitiveCount() const { return m_primitiveCount; }
+    inline size_t GetFileSize() const { return m_file.GetSize(); }
+    inline size_t GetBudget() const { return m_budget; }
+    CacheStats GetCacheStats() const;
+
+   private:
+    /// where a cluster lives in the file
+    struct Cluster {
+        uint64_t offset;
+        uint64_t size;
+        int nodeCount;
+        int primitiveCount;
+    };
+
+    struct View {
+        const BvhNode* nodes;  // node 0 is the root, leaves index primitives
+        const GpuPrimitive* primitives;
+        const Geometry* geometries;
+        const int* geometryIds;  // index of each primitive in the resident scene it was cut from
+    };
+
+    struct Slot {
+        std::unique_ptr<char[]> data;  // null while the cluster is not resident
+        int pins     = 0;
+        bool loading = false;
+        std::list<int>::iterator lru;
+    };
+
+    /// a ray waiting for a cluster
+    struct Visit {
+        int cluster;
+        int ray;
+    };
+
+    struct Entry {
+        int cluster;
+        float tmin;
+    };
+
+    View Acquire( int cluster );
+    void Unpin( int cluster );
+    /// buffer of the least recently used cluster nobody uses, null if there is none
+    std::unique_ptr<char[]> EvictLocked();
+
+    /// every cluster each ray enters before its tmax, nearest first per ray
+    void FindClusters( const Ray* rays, const float* tmax, int count, int numThreads, TraversalCost* costs,
+                       std::vector<Entry>& outEntries, std::vector<int>& outOffsets ) const;
+    /// sorts the visits by cluster and calls func( view, ray ) for each of them, the
+    /// clusters are spread over the threads and every ray appears at most once
+    template<typename Func>
+    void ProcessVisits( std::vector<Visit>& visits, int numThreads, const Func& func );
+
+    MappedFile m_file;
+    std::vector<BvhNode> m_topNodes;  // leaves index m_clusters
+    std::vector<Cluster> m_clusters;
+    int m_primitiveCount = 0;
+    size_t m_budget      = 0;
+    size_t m_bufferSize  = 0;  // largest cluster, every resident cluster takes a buffer of this size
+    MemTracker m_topMemory{ MemTag_GpuScene };
+
+    mutable std::mutex m_mutex;  // guards everything below
+    std::condition_variable m_loaded;
+    std::vector<Slot> m_slots;
+    std::list<int> m_lru;  // resident clusters, most recently used first
+    size_t m_residentBytes = 0;  // all buffers
+    MemTracker m_residentMemory{ MemTag_Clusters };
+    CacheStats m_stats;
+};
+
+}  // namespace pt
@@ -0,0 +1,554 @@
+#include "cpu_renderer.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "cpu/cluster_scene.h"
+#include "universal/core_assert.h"
+#include "utility/parallel.h"
+#include "utility/profiler.h"
+
+namespace pt {
+
+static constexpr float PI     = 3.14159265359f;
+static constexpr float TWO_PI = 6.28318530718f;
+
+static int Wrap( int x, int size )
+{
+    x %= size;
+    return x < 0 ? x + size : x;
+}
+
+/// GL_LINEAR + GL_REPEAT lookup, fetch( x, y ) returns the texel at integer coordinates
+template<typename Fetch>
+static vec3 SampleBilinear( const vec2& uv, int width, int height, const Fetch& fetch )
+{
+    const float x  = uv.x * width - 0.5f;
+    const float y  = uv.y * height - 0.5f;
+    const float fx = glm::floor( x );
+    const float fy = glm::floor( y );
+    const float tx = x - fx;
+    const float ty = y - fy;
+    const int x0   = Wrap( static_cast<int>( fx ), width );
+    const int y0   = Wrap( static_cast<int>( fy ), height );
+    const int x1   = Wrap( x0 + 1, width );
+    const int y1   = Wrap( y0 + 1, height );
+
+    const vec3 bottom = glm::mix( fetch( x0, y0 ), fetch( x1, y0 ), tx );
+    const vec3 top    = glm::mix( fetch( x0, y1 ), fetch( x1, y1 ), tx );
+    return glm::mix( bottom, top, ty );
+}
+
+static vec3 SampleUnitVector( const vec2& u )
+{
+    const float z = u.x * 2.0f - 1.0f;
+    const float a = u.y * TWO_PI;
+    const float r = glm::sqrt( 1.0f - z * z );
+    const float x = r * glm::cos( a );
+    const float y = r * glm::sin( a );
+    return vec3( x, y, z );
+}
+
+// interleaves the low 10 bits of every axis
+static uint32_t MortonCode( const uvec3& cell )
+{
+    auto expand = []( uint32_t v ) {
+        v = ( v * 0x00010001u ) & 0xff0000ffu;
+        v = ( v * 0x00000101u ) & 0x0f00f00fu;
+        v = ( v * 0x00000011u ) & 0xc30c30c3u;
+        v = ( v * 0x00000005u ) & 0x49249249u;
+        return v;
+    };
+    return ( expand( cell.x ) << 2 ) | ( expand( cell.y ) << 1 ) | expand( cell.z );
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double MsSince( const Clock::time_point& start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+static vec2 SampleSphericalMap( const vec3& v )
+{
+    vec2 uv = vec2( glm::atan( v.z, v.x ), glm::asin( v.y ) );
+    uv *= vec2( 0.1591f, 0.3183f );
+    uv += 0.5f;
+    uv.y = 1.0f - uv.y;
+    return uv;
+}
+
+CpuRenderer::CpuRenderer()
+    : m_scene( nullptr ), m_envMap( nullptr ), m_albedoMaps( nullptr ), m_clusters( nullptr ), m_batchSize( 0 ), m_sortRays( false ), m_width( 0 ), m_height( 0 ), m_numThreads( 0 )
+{
+}
+
+void CpuRenderer::Initialize( const GpuScene& scene, const Image& envMap, const ImageArray& albedoMaps, int width, int height, int numThreads )
+{
+    core_assert( envMap.type == Image::Float );
+    core_assert( width > 0 && height > 0 );
+
+    m_scene      = &scene;
+    m_envMap     = &envMap;
+    m_albedoMaps = &albedoMaps;
+    m_width      = width;
+    m_height     = height;
+    m_numThreads = numThreads;
+    Clear();
+}
+
+void CpuRenderer::SetWavefront( int batchSize, bool sortRays )
+{
+    core_assert( batchSize >= 0 );
+    m_batchSize = batchSize;
+    m_sortRays  = sortRays;
+}
+
+void CpuRenderer::SetClusterScene( ClusterScene* clusters )
+{
+    m_clusters = clusters;
+}
+
+void CpuRenderer::Clear()
+{
+    m_image.assign( static_cast<size_t>( m_width ) * m_height, vec4( 0.0f ) );
+    m_albedo.clear();
+    m_normal.clear();
+    m_ids.clear();
+}
+
+void CpuRenderer::SetImage( const std::vector<vec4>& image )
+{
+    core_assert( image.size() == static_cast<size_t>( m_width ) * m_height );
+    m_image = image;
+}
+
+vec3 CpuRenderer::SampleEnvMap( const vec3& direction ) const
+{
+    const Image& env  = *m_envMap;
+    const float* data = reinterpret_cast<const float*>( env.data );
+    const vec2 uv     = SampleSphericalMap( glm::normalize( direction ) );
+    return SampleBilinear( uv, env.width, env.height, [&]( int x, int y ) {
+        const float* texel = data + ( static_cast<size_t>( y ) * env.width + x ) * env.channel;
+        // gl::CreateEnvTexture uploads to an unsized GL_RGBA texture, which clamps to [0, 1]
+        return glm::clamp( vec3( texel[0], texel[1], texel[2] ), 0.0f, 1.0f );
+    } );
+}
+
+vec3 CpuRenderer::SampleAlbedoMap( const vec2& uv, float level ) const
+{
+    const ImageArray& maps = *m_albedoMaps;
+    if ( maps.images.empty() )
+    {
+        return vec3( 0.0f );
+    }
+
+    const int layer    = glm::clamp( static_cast<int>( glm::floor( level + 0.5f ) ), 0, static_cast<int>( maps.images.size() ) - 1 );
+    const Image& image = maps.images[layer];
+    const auto* data   = reinterpret_cast<const unsigned char*>( image.data );
+    // gl::Create3DTexture pads every layer to maxWidth x maxHeight, uv spans the padded layer
+    return SampleBilinear( uv, maps.maxWidth, maps.maxHeight, [&]( int x, int y ) {
+        if ( x >= image.width || y >= image.height )
+        {
+            return vec3( 0.0f );
+        }
+        const unsigned char* texel = data + ( static_cast<size_t>( y ) * image.width + x ) * 3;
+        return vec3( texel[0], texel[1], texel[2] ) / 255.0f;
+    } );
+}
+
+vec3 CpuRenderer::RayColor( Ray& ray, Sampler& sampler, FirstHit& firstHit ) const
+{
+    vec3 radiance   = vec3( 0.0f );
+    vec3 throughput = vec3( 1.0f );
+
+    for ( int i = 0; i < MAX_BOUNCE; ++i )
+    {
+        const bool hit = i == 0 ? HitScene( ray, *m_scene, firstHit.cost ) : HitScene( ray, *m_scene );
+        if ( !ShadeBounce( ray, hit, i, sampler, radiance, throughput, firstHit ) )
+        {
+            break;
+        }
+    }
+
+    return radiance;
+}
+
+bool CpuRenderer::ShadeBounce( Ray& ray, bool hit, int bounce, Sampler& sampler, vec3& radiance, vec3& throughput, FirstHit& firstHit ) const
+{
+    if ( !hit )
+    {
+        const vec3 envColor = SampleEnvMap( ray.direction );
+        radiance += envColor * throughput;
+        if ( bounce == 0 )
+        {
+            firstHit.albedo = envColor;
+        }
+        return false;
+    }
+
+    if ( bounce == 0 )
+    {
+        firstHit.depth       = ray.t;
+        firstHit.normal      = ray.hitNormal;
+        firstHit.materialId  = ray.materialId;
+        firstHit.primitiveId = ray.geomId;
+    }
+
+    // geometries without material read out of bounds on the GPU, treat them as black
+    if ( ray.materialId < 0 )
+    {
+        return false;
+    }
+
+    const vec3 hitPoint    = ray.origin + ray.t * ray.direction;
+    ray.t                  = RAY_T_MAX;
+    const GpuMaterial& mat = m_scene->materials[ray.materialId];
+    sampler.StartBounce( bounce );
+    const float specularChance = sampler.Next1D() > mat.reflect ? 0.0f : 1.0f;
+
+    const vec3 diffuseDir = glm::normalize( ray.hitNormal + SampleUnitVector( sampler.Next2D() ) );
+    vec3 reflectDir       = glm::reflect( ray.direction, ray.hitNormal );
+    reflectDir            = glm::normalize( glm::mix( reflectDir, diffuseDir, mat.roughness * mat.roughness ) );
+    ray.direction         = glm::normalize( glm::mix( diffuseDir, reflectDir, specularChance ) );
+    ray.origin            = OffsetRayOrigin( hitPoint, ray.hitGeomNormal, ray.direction );
+
+    vec3 diffuseColor = SampleAlbedoMap( ray.hitUv, mat.albedoMapLevel );
+    diffuseColor      = glm::mix( vec3( 1.0f ), diffuseColor, ray.hasAlbedoMap );
+    diffuseColor *= mat.albedo;
+    if ( bounce == 0 )
+    {
+        firstHit.albedo = diffuseColor;
+    }
+
+    radiance += mat.emissive * throughput;
+    throughput *= diffuseColor;
+    return true;
+}
+
+vec3 CpuRenderer::AmbientOcclusion( Ray& ray, Sampler& sampler, float radius, FirstHit& firstHit ) const
+{
+    const bool hit = HitScene( ray, *m_scene, firstHit.cost );
+    if ( !OcclusionRay( ray, hit, sampler, firstHit ) )
+    {
+        return vec3( 1.0f );
+    }
+    return OccludedScene( ray, radius, *m_scene ) ? vec3( 0.0f ) : vec3( 1.0f );
+}
+
+bool CpuRenderer::OcclusionRay( Ray& ray, bool hit, Sampler& sampler, FirstHit& firstHit ) const
+{
+    firstHit.albedo = vec3( 1.0f );
+    if ( !hit )
+    {
+        return false;
+    }
+
+    firstHit.depth       = ray.t;
+    firstHit.normal      = ray.hitNormal;
+    firstHit.materialId  = ray.materialId;
+    firstHit.primitiveId = ray.geomId;
+
+    sampler.StartBounce( 0 );
+    const vec3 direction = glm::normalize( ray.hitNormal + SampleUnitVector( sampler.Next2D() ) );
+    const vec3 origin    = OffsetRayOrigin( ray.origin + ray.t * ray.direction, ray.hitGeomNormal, direction );
+    ray                  = Ray( origin, direction );
+    return true;
+}
+
+Ray CpuRenderer::CameraRay( const ConstantBufferCache& cache, const ivec2& iPixelCoords, Sampler& sampler ) const
+{
+    const vec2 fPixelCoords = vec2( static_cast<float>( iPixelCoords.x ), static_cast<float>( iPixelCoords.y ) );
+    const vec2 dims         = vec2( static_cast<float>( m_width ), static_cast<float>( m_height ) );
+
+    // [-0.5, 0.5]
+    sampler.StartDimension( Sampler::DimCamera );
+    const vec2 jitter = sampler.Next2D() - 0.5f;
+
+    // screen position from [-1, 1]
+    const vec2 uvJitter = ( fPixelCoords + jitter ) / dims;
+    vec2 screen         = 2.0f * uvJitter - 1.0f;
+
+    // adjust for aspect ratio
+    const float aspectRatio = dims.x / dims.y;
+    screen.y /= aspectRatio;
+    const float halfFov     = cache.camFov;
+    const float camDistance = glm::tan( halfFov * PI / 180.0f );
+    vec3 rayDir             = vec3( screen, camDistance );
+    rayDir                  = glm::normalize( mat3( cache.camRight, cache.camUp, cache.camFwd ) * rayDir );
+    return Ray( cache.camPos, rayDir );
+}
+
+vec3 CpuRenderer::TracePixel( const ConstantBufferCache& cache, const ivec2& iPixelCoords, FirstHit& firstHit ) const
+{
+    Sampler sampler( static_cast<Sampler::Kind>( cache.samplerKind ), uvec2( iPixelCoords ), cache.sampleIndex, cache.frame );
+    Ray ray = CameraRay( cache, iPixelCoords, sampler );
+    if ( cache.integrator == Integrator_AmbientOcclusion )
+    {
+        return AmbientOcclusion( ray, sampler, cache.aoRadius, firstHit );
+    }
+    return RayColor( ray, sampler, firstHit );
+}
+
+void CpuRenderer::RenderTile( const ConstantBufferCache& cache, int tileWidth, int tileHeight )
+{
+    PROFILE_ZONE( "RenderTile" );
+    const int x0 = glm::max( cache.tileOffset.x, 0 );
+    const int y0 = glm::max( cache.tileOffset.y, 0 );
+    const int x1 = glm::min( cache.tileOffset.x + tileWidth, m_width );
+    const int y1 = glm::min( cache.tileOffset.y + tileHeight, m_height );
+    if ( x0 >= x1 || y0 >= y1 )
+    {
+        return;
+    }
+
+    const bool writeAovs = cache.writeAovs != 0;
+    if ( writeAovs && m_albedo.empty() )
+    {
+        m_albedo.assign( m_image.size(), vec4( 0.0f ) );
+        m_normal.assign( m_image.size(), vec4( 0.0f ) );
+        m_ids.assign( m_image.size(), vec4( 0.0f ) );
+    }
+
+    core_assert( !m_clusters || m_batchSize > 0 );
+    if ( m_batchSize > 0 )
+    {
+        RenderTileWavefront( cache, x0, y0, x1, y1, writeAovs );
+        return;
+    }
+
+    ParallelFor( y1 - y0, m_numThreads, [&]( int row ) {
+        const int y = y0 + row;
+        for ( int x = x0; x < x1; ++x )
+        {
+            FirstHit firstHit;
+            const vec3 color = TracePixel( cache, ivec2( x, y ), firstHit );
+            StorePixel( cache, static_cast<size_t>( y ) * m_width + x, color, firstHit, writeAovs );
+        }
+    } );
+}
+
+// the paths of a batch advance one bounce at a time, so a bounce traces all rays of the batch
+// together: out of core clusters are paged in once per batch instead of once per ray, and
+// sorted rays visit the same bvh nodes one after the other
+void CpuRenderer::RenderTileWavefront( const ConstantBufferCache& cache, int x0, int y0, int x1, int y1, bool writeAovs )
+{
+    PROFILE_ZONE( "RenderTileWavefront" );
+    const int width             = x1 - x0;
+    const int pixelCount        = width * ( y1 - y0 );
+    const bool ambientOcclusion = cache.integrator == Integrator_AmbientOcclusion;
+    const Sampler::Kind kind    = static_cast<Sampler::Kind>( cache.samplerKind );
+
+    for ( int first = 0; first < pixelCount; first += m_batchSize )
+    {
+        const int count = std::min( m_batchSize, pixelCount - first );
+        std::vector<Ray> rays( count, Ray( vec3( 0.0f ), vec3( 0.0f ) ) );
+        std::vector<Sampler> samplers( count, Sampler( kind, uvec2( 0 ), 0, 0 ) );
+        std::vector<FirstHit> firstHits( count );
+        std::vector<vec3> colors( count, vec3( 0.0f ) );
+        std::vector<vec3> throughputs( count, vec3( 1.0f ) );
+        std::vector<TraversalCost> costs( count );
+
+        ParallelFor( count, m_numThreads, [&]( int i ) {
+            const ivec2 pixel = ivec2( x0 + ( first + i ) % width, y0 + ( first + i ) / width );
+            samplers[i]       = Sampler( kind, uvec2( pixel ), cache.sampleIndex, cache.frame );
+            rays[i]           = CameraRay( cache, pixel, samplers[i] );
+        } );
+
+        // the paths still going, camera rays are coherent in pixel order already
+        std::vector<int> paths( count );
+        for ( int i = 0; i < count; ++i )
+        {
+            paths[i] = i;
+        }
+        TracePaths( rays, paths, costs.data() );
+
+        if ( ambientOcclusion )
+        {
+            std::vector<char> pending( count );
+            ParallelFor( count, m_numThreads, [&]( int i ) {
+                firstHits[i].cost = costs[i];
+                pending[i]        = OcclusionRay( rays[i], rays[i].geomId != -1, samplers[i], firstHits[i] );
+                colors[i]         = vec3( 1.0f );
+            } );
+            paths.erase( std::remove_if( paths.begin(), paths.end(), [&]( int path ) { return !pending[path]; } ), paths.end() );
+
+            if ( m_sortRays )
+            {
+                SortPaths( paths, rays );
+            }
+            std::unique_ptr<bool[]> occluded( new bool[count] );
+            OccludePaths( rays, paths, cache.aoRadius, occluded.get() );
+            for ( int path : paths )
+            {
+                colors[path] = occluded[path] ? vec3( 0.0f ) : vec3( 1.0f );
+            }
+        }
+        else
+        {
+            std::vector<char> alive( count );
+            for ( int bounce = 0; bounce < MAX_BOUNCE && !paths.empty(); ++bounce )
+            {
+                if ( bounce > 0 )
+                {
+                    if ( m_sortRays )
+                    {
+                        SortPaths( paths, rays );
+                    }
+                    TracePaths( rays, paths, nullptr );
+                }
+
+                ParallelFor( static_cast<int>( paths.size() ), m_numThreads, [&]( int i ) {
+                    const int path = paths[i];
+                    if ( bounce == 0 )
+                    {
+                        firstHits[path].cost = costs[path];
+                    }
+                    alive[path] = ShadeBounce( rays[path], rays[path].geomId != -1, bounce, samplers[path], colors[path], throughputs[path], firstHits[path] );
+                } );
+                paths.erase( std::remove_if( paths.begin(), paths.end(), [&]( int path ) { return !alive[path]; } ), paths.end() );
+            }
+        }
+
+        ParallelFor( count, m_numThreads, [&]( int i ) {
+            const int x = x0 + ( first + i ) % width;
+            const int y = y0 + ( first + i ) / width;
+            StorePixel( cache, static_cast<size_t>( y ) * m_width + x, colors[i], firstHits[i], writeAovs );
+        } );
+    }
+}
+
+// bounce rays leave in random directions. Sorted by direction octant and then by origin along
+// a Morton curve over the scene bounds, neighbouring rays start in the same part of the bvh
+// and visit the children of a node in the same order
+void CpuRenderer::SortPaths( std::vector<int>& paths, const std::vector<Ray>& rays )
+{
+    PROFILE_ZONE( "SortPaths" );
+    const Clock::time_point start = Clock::now();
+    const Box3& bbox              = m_scene->bbox;
+    const vec3 scale              = vec3( 1023.0f ) / glm::max( bbox.max - bbox.min, vec3( 1e-6f ) );
+
+    // octant and Morton code above the path index, one integer sort moves both
+    std::vector<uint64_t> keys( paths.size() );
+    for ( size_t i = 0; i < paths.size(); ++i )
+    {
+        const Ray& ray        = rays[paths[i]];
+        const uvec3 cell      = uvec3( glm::clamp( ( ray.origin - bbox.min ) * scale, vec3( 0.0f ), vec3( 1023.0f ) ) );
+        const uint32_t octant = ( ray.direction.x < 0.0f ? 4u : 0u ) | ( ray.direction.y < 0.0f ? 2u : 0u ) | ( ray.direction.z < 0.0f ? 1u : 0u );
+        const uint64_t key    = ( static_cast<uint64_t>( octant ) << 30 ) | MortonCode( cell );
+        keys[i]               = ( key << 31 ) | static_cast<uint32_t>( paths[i] );
+    }
+    std::sort( keys.begin(), keys.end() );
+    for ( size_t i = 0; i < paths.size(); ++i )
+    {
+        paths[i] = static_cast<int>( keys[i] & 0x7fffffffu );
+    }
+    m_stats.sortMs += MsSince( start );
+}
+
+void CpuRenderer::TracePaths( std::vector<Ray>& rays, const std::vector<int>& paths, TraversalCost* costs )
+{
+    const Clock::time_point start = Clock::now();
+    const int count               = static_cast<int>( paths.size() );
+    if ( m_clusters )
+    {
+        // packed, the clusters take one contiguous batch
+        std::vector<Ray> packed;
+        std::vector<TraversalCost> packedCosts( costs ? count : 0 );
+        packed.reserve( count );
+        for ( int path : paths )
+        {
+            packed.push_back( rays[path] );
+            packed.back().geomId = -1;
+        }
+        m_clusters->HitRays( packed.data(), count, m_numThreads, costs ? packedCosts.data() : nullptr );
+        for ( int i = 0; i < count; ++i )
+        {
+            rays[paths[i]] = packed[i];
+            if ( costs )
+            {
+                costs[paths[i]] = packedCosts[i];
+            }
+        }
+    }
+    else
+    {
+        ParallelFor( count, m_numThreads, [&]( int i ) {
+            Ray& ray   = rays[paths[i]];
+            ray.geomId = -1;
+            if ( costs )
+            {
+                HitScene( ray, *m_scene, costs[paths[i]] );
+            }
+            else
+            {
+                HitScene( ray, *m_scene );
+            }
+        } );
+    }
+    m_stats.rays += count;
+    m_stats.traceMs += MsSince( start );
+}
+
+void CpuRenderer::OccludePaths( const std::vector<Ray>& rays, const std::vector<int>& paths, float tmax, bool* outOccluded )
+{
+    const Clock::time_point start = Clock::now();
+    const int count               = static_cast<int>( paths.size() );
+    if ( m_clusters )
+    {
+        std::vector<Ray> packed;
+        packed.reserve( count );
+        for ( int path : paths )
+        {
+            packed.push_back( rays[path] );
+        }
+        const std::vector<float> packedTmax( count, tmax );
+        std::unique_ptr<bool[]> packedOccluded( new bool[count] );
+        m_clusters->OccludedRays( packed.data(), packedTmax.data(), count, m_numThreads, packedOccluded.get() );
+        for ( int i = 0; i < count; ++i )
+        {
+            outOccluded[paths[i]] = packedOccluded[i];
+        }
+    }
+    else
+    {
+        ParallelFor( count, m_numThreads, [&]( int i ) {
+            outOccluded[paths[i]] = OccludedScene( rays[paths[i]], tmax, *m_scene );
+        } );
+    }
+    m_stats.rays += count;
+    m_stats.traceMs += MsSince( start );
+}
+
+void CpuRenderer::StorePixel( const ConstantBufferCache& cache, size_t index, const vec3& color, const FirstHit& firstHit, bool writeAovs )
+{
+    vec4 pixel   = vec4( color, 1.0f );
+    vec4& stored = m_image[index];
+    if ( cache.dirty == 0 )
+    {
+        pixel += stored;
+    }
+    stored = pixel;
+
+    if ( writeAovs )
+    {
+        vec4 albedo = vec4( firstHit.albedo, firstHit.depth );
+        vec4 normal = vec4( firstHit.normal, 1.0f );
+        vec4 ids    = vec4( static_cast<float>( firstHit.materialId ),
+                            static_cast<float>( firstHit.primitiveId ),
+                            static_cast<float>( firstHit.cost.nodes ),
+                            static_cast<float>( firstHit.cost.primitives ) );
+        if ( cache.dirty == 0 )
+        {
+            albedo += m_albedo[index];
+            normal += m_normal[index];
+            ids.z += m_ids[index].z;
+            ids.w += m_ids[index].w;
+        }
+        m_albedo[index] = albedo;
+        m_normal[index] = normal;
+        m_ids[index]    = ids;
+    }
+}
+
+}  // namespace pt
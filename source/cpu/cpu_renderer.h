@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+
+#include "constant_cache.h"
+#include "cpu/trace.h"
+#include "image.h"
+#include "sampler.h"
+#include "scene.h"
+
+namespace pt {
+
+class ClusterScene;
+
+/// CPU twin of data/shaders/tiled.comp, used when no GL context is available.
+/// Accumulates into an rgba32f buffer laid out like the output texture
+/// (row 0 is the bottom of the image, alpha holds the sample count).
+class CpuRenderer {
+   public:
+    /// first hit features written to the aov buffers when cache.writeAovs is set
+    struct FirstHit {
+        vec3 albedo     = vec3( 0.0f );
+        float depth     = 0.0f;
+        vec3 normal     = vec3( 0.0f );
+        int materialId  = -1;
+        int primitiveId = -1;
+        TraversalCost cost;  // camera ray only
+    };
+
+    /// rays the wavefront traced and where its time went
+    struct WavefrontStats {
+        uint64_t rays  = 0;
+        double traceMs = 0.0;  // closest hit and occlusion queries
+        double sortMs  = 0.0;
+    };
+
+    CpuRenderer();
+
+    void Initialize( const GpuScene& scene, const Image& envMap, const ImageArray& albedoMaps, int width, int height, int numThreads );
+    void Clear();
+
+    /// batchSize > 0 advances that many paths of a tile at a time one bounce after the other
+    /// instead of tracing every pixel to the end, sortRays reorders the rays between bounces
+    void SetWavefront( int batchSize, bool sortRays );
+    /// traces against out of core clusters instead of the resident bvh, needs the wavefront.
+    /// null goes back
+    void SetClusterScene( ClusterScene* clusters );
+
+    /// trace one sample for every pixel of the tile at cache.tileOffset
+    void RenderTile( const ConstantBufferCache& cache, int tileWidth, int tileHeight );
+
+    inline int GetWidth() const { return m_width; }
+    inline int GetHeight() const { return m_height; }
+    inline const std::vector<vec4>& GetImage() const { return m_image; }
+    /// accumulated first hit albedo (rgb) and hit distance (a), same layout as GetImage()
+    inline const std::vector<vec4>& GetAlbedo() const { return m_albedo; }
+    /// accumulated first hit normal (rgb) and sample count (a)
+    inline const std::vector<vec4>& GetNormal() const { return m_normal; }
+    /// material (r) and primitive (g) of the latest sample, bvh nodes (b) and primitives (a)
+    /// tested by the camera rays accumulated, same layout as idImage in common.glsl
+    inline const std::vector<vec4>& GetIds() const { return m_ids; }
+    inline const WavefrontStats& GetWavefrontStats() const { return m_stats; }
+    /// restores an accumulation buffer, e.g. from a checkpoint
+    void SetImage( const std::vector<vec4>& image );
+
+   private:
+    void RenderTileWavefront( const ConstantBufferCache& cache, int x0, int y0, int x1, int y1, bool writeAovs );
+    void SortPaths( std::vector<int>& paths, const std::vector<Ray>& rays );
+    /// closest hits of rays[path] for every path, costs is null or indexed by path
+    void TracePaths( std::vector<Ray>& rays, const std::vector<int>& paths, TraversalCost* costs );
+    void OccludePaths( const std::vector<Ray>& rays, const std::vector<int>& paths, float tmax, bool* outOccluded );
+    void StorePixel( const ConstantBufferCache& cache, size_t index, const vec3& color, const FirstHit& firstHit, bool writeAovs );
+
+    Ray CameraRay( const ConstantBufferCache& cache, const ivec2& pixel, Sampler& sampler ) const;
+    vec3 TracePixel( const ConstantBufferCache& cache, const ivec2& pixel, FirstHit& firstHit ) const;
+    vec3 RayColor( Ray& ray, Sampler& sampler, FirstHit& firstHit ) const;
+    /// shades the hit of bounce and turns ray into the next one, false once the path ends
+    bool ShadeBounce( Ray& ray, bool hit, int bounce, Sampler& sampler, vec3& radiance, vec3& throughput, FirstHit& firstHit ) const;
+    vec3 AmbientOcclusion( Ray& ray, Sampler& sampler, float radius, FirstHit& firstHit ) const;
+    /// turns a camera ray into its occlusion ray, false when it missed and nothing is occluded
+    bool OcclusionRay( Ray& ray, bool hit, Sampler& sampler, FirstHit& firstHit ) const;
+    vec3 SampleEnvMap( const vec3& direction ) const;
+    vec3 SampleAlbedoMap( const vec2& uv, float level ) const;
+
+    const GpuScene* m_scene;
+    const Image* m_envMap;
+    const ImageArray* m_albedoMaps;
+    ClusterScene* m_clusters;
+    int m_batchSize;
+    bool m_sortRays;
+    WavefrontStats m_stats;
+    int m_width;
+    int m_height;
+    int m_numThreads;
+    std::vector<vec4> m_image;
+    std::vector<vec4> m_albedo;
+    std::vector<vec4> m_normal;
+    std::vector<vec4> m_ids;
+};
+
+}  // namespace pt
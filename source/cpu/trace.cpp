@@ -0,0 +1,572 @@
+#include "trace.h"
+
+#include <cstring>
+#include <utility>
+
+#include "traversal_stats.h"
+#include "universal/core_assert.h"
+
+namespace pt {
+
+using glm::cross;
+using glm::dot;
+
+RayShear ShearRay( const vec3& direction )
+{
+    const vec3 absDir = glm::abs( direction );
+
+    RayShear shear;
+    shear.kz = absDir.x > absDir.y ? ( absDir.x > absDir.z ? 0 : 2 ) : ( absDir.y > absDir.z ? 1 : 2 );
+    shear.kx = ( shear.kz + 1 ) % 3;
+    shear.ky = ( shear.kx + 1 ) % 3;
+    // keeps the winding, so U, V and W share their sign for front faces
+    if ( direction[shear.kz] < 0.0f )
+    {
+        std::swap( shear.kx, shear.ky );
+    }
+
+    shear.S = vec3( direction[shear.kx], direction[shear.ky], 1.0f ) / direction[shear.kz];
+    return shear;
+}
+
+TraversalRay::TraversalRay( const vec3& origin, const vec3& direction, float t )
+    : origin( origin ), t( t ), direction( direction ), geomId( -1 ), bary( vec2( 0.0f ) ), shear( ShearRay( direction ) )
+{
+    vec3 safeDir = direction;
+    for ( int i = 0; i < 3; ++i )
+    {
+        if ( glm::abs( safeDir[i] ) < 1e-20f )
+        {
+            safeDir[i] = safeDir[i] < 0.0f ? -1e-20f : 1e-20f;
+        }
+    }
+    invD       = vec3( 1.0f ) / safeDir;
+    originInvD = origin * invD;
+}
+
+// http://jcgt.org/published/0002/01/05/
+bool IntersectTriangle( const TraversalRay& ray, const GpuPrimitive& triangle, float& outT, vec2& outBary )
+{
+    const RayShear& shear = ray.shear;
+
+    const vec3 A = triangle.A - ray.origin;
+    const vec3 B = triangle.B - ray.origin;
+    const vec3 C = triangle.C - ray.origin;
+
+    const float Ax = A[shear.kx] - shear.S.x * A[shear.kz];
+    const float Ay = A[shear.ky] - shear.S.y * A[shear.kz];
+    const float Bx = B[shear.kx] - shear.S.x * B[shear.kz];
+    const float By = B[shear.ky] - shear.S.y * B[shear.kz];
+    const float Cx = C[shear.kx] - shear.S.x * C[shear.kz];
+    const float Cy = C[shear.ky] - shear.S.y * C[shear.kz];
+
+    // edge functions, a neighbour sharing the edge computes the same value with the opposite sign
+    const float U = Cx * By - Cy * Bx;
+    const float V = Ax * Cy - Ay * Cx;
+    const float W = Bx * Ay - By * Ax;
+
+    if ( ( U < 0.0f || V < 0.0f || W < 0.0f ) && ( U > 0.0f || V > 0.0f || W > 0.0f ) )
+    {
+        return false;
+    }
+
+    const float det = U + V + W;
+    if ( det == 0.0f )
+    {
+        return false;
+    }
+
+    const float invDet = 1.0f / det;
+    const float t      = shear.S.z * ( U * A[shear.kz] + V * B[shear.kz] + W * C[shear.kz] ) * invDet;
+    if ( t >= ray.t || t < EPSILON )
+    {
+        return false;
+    }
+
+    outT    = t;
+    outBary = vec2( V, W ) * invDet;
+    return true;
+}
+
+bool IntersectSphere( const TraversalRay& ray, const GpuPrimitive& sphere, float& outT )
+{
+    const vec3 oc            = ray.origin - sphere.A;
+    const float a            = dot( ray.direction, ray.direction );
+    const float half_b       = dot( oc, ray.direction );
+    const float c            = dot( oc, oc ) - sphere.radius * sphere.radius;
+    const float discriminant = half_b * half_b - a * c;
+
+    // NOTE: same operator precedence as common.glsl, a is 1 for normalized directions
+    const float t = -half_b - glm::sqrt( discriminant ) / a;
+    if ( discriminant < EPSILON || t >= ray.t || t < EPSILON )
+    {
+        return false;
+    }
+
+    outT = t;
+    return true;
+}
+
+// the plane through A spanned by B and C, outUv are the coordinates of the hit along B and C
+static bool IntersectPlane( const TraversalRay& ray, const GpuPrimitive& plane, float& outT, vec2& outUv )
+{
+    const vec3 n      = cross( plane.B, plane.C );
+    const float denom = dot( n, ray.direction );
+    if ( denom == 0.0f )
+    {
+        return false;
+    }
+
+    const float t = dot( n, plane.A - ray.origin ) / denom;
+    if ( t >= ray.t || t < EPSILON )
+    {
+        return false;
+    }
+
+    // p = u * B + v * C, crossing with C or B leaves a multiple of n
+    const vec3 p     = ray.origin + t * ray.direction - plane.A;
+    const float invN = 1.0f / dot( n, n );
+    outT             = t;
+    outUv            = vec2( dot( cross( p, plane.C ), n ), dot( cross( plane.B, p ), n ) ) * invN;
+    return true;
+}
+
+bool IntersectQuad( const TraversalRay& ray, const GpuPrimitive& quad, float& outT, vec2& outUv )
+{
+    float t;
+    vec2 uv;
+    if ( !IntersectPlane( ray, quad, t, uv ) || glm::abs( uv.x ) > 1.0f || glm::abs( uv.y ) > 1.0f )
+    {
+        return false;
+    }
+
+    outT  = t;
+    outUv = uv;
+    return true;
+}
+
+bool IntersectDisk( const TraversalRay& ray, const GpuPrimitive& disk, float& outT, vec2& outUv )
+{
+    float t;
+    vec2 uv;
+    if ( !IntersectPlane( ray, disk, t, uv ) || dot( uv, uv ) > 1.0f )
+    {
+        return false;
+    }
+
+    outT  = t;
+    outUv = uv;
+    return true;
+}
+
+// the third half axis of a box, perpendicular to B and C
+static vec3 BoxAxisW( const vec3& B, const vec3& C, float halfW )
+{
+    return glm::normalize( cross( B, C ) ) * halfW;
+}
+
+// p in units of the half axes, the box is -1..1 on every axis
+static vec3 ToBoxSpace( const vec3& p, const vec3& B, const vec3& C, const vec3& W )
+{
+    return vec3( dot( p, B ) / dot( B, B ), dot( p, C ) / dot( C, C ), dot( p, W ) / dot( W, W ) );
+}
+
+bool IntersectBox( const TraversalRay& ray, const GpuPrimitive& box, float& outT )
+{
+    const vec3 W = BoxAxisW( box.B, box.C, box.radius );
+    const vec3 o = ToBoxSpace( ray.origin - box.A, box.B, box.C, W );
+    const vec3 d = ToBoxSpace( ray.direction, box.B, box.C, W );
+
+    // the frame is linear, so t along the local ray is t along the world ray
+    const vec3 t0s = ( vec3( -1.0f ) - o ) / d;
+    const vec3 t1s = ( vec3( +1.0f ) - o ) / d;
+
+    const vec3 tsmaller = glm::min( t0s, t1s );
+    const vec3 tbigger  = glm::max( t0s, t1s );
+    const float tnear   = glm::max( tsmaller.x, glm::max( tsmaller.y, tsmaller.z ) );
+    const float tfar    = glm::min( tbigger.x, glm::min( tbigger.y, tbigger.z ) );
+    if ( tnear > tfar )
+    {
+        return false;
+    }
+
+    const float t = tnear >= EPSILON ? tnear : tfar;
+    if ( t >= ray.t || t < EPSILON )
+    {
+        return false;
+    }
+
+    outT = t;
+    return true;
+}
+
+void SetHitAttributes( Ray& ray, const Geometry& geom )
+{
+    ray.materialId = geom.materialId;
+    switch ( geom.kind )
+    {
+        case Geometry::Kind::Sphere:
+        {
+            const vec3 p      = ray.origin + ray.t * ray.direction;
+            ray.hitNormal     = glm::normalize( p - geom.A );
+            ray.hitGeomNormal = ray.hitNormal;
+            ray.hitUv         = vec2( 0.0f );
+            ray.hasAlbedoMap  = 0.0f;
+            return;
+        }
+        case Geometry::Kind::Quad:
+        case Geometry::Kind::Disk:
+            ray.hitNormal    = glm::normalize( cross( geom.B, geom.C ) );
+            ray.hitUv        = 0.5f * ray.hitBary + 0.5f;
+            ray.hasAlbedoMap = 0.0f;
+            break;
+        case Geometry::Kind::Box:
+        {
+            // the face is the axis the hit point lies furthest along
+            const vec3 W     = BoxAxisW( geom.B, geom.C, geom.radius );
+            const vec3 p     = ToBoxSpace( ray.origin + ray.t * ray.direction - geom.A, geom.B, geom.C, W );
+            const vec3 absP  = glm::abs( p );
+            const int axis   = absP.x > absP.y ? ( absP.x > absP.z ? 0 : 2 ) : ( absP.y > absP.z ? 1 : 2 );
+            const vec3 N     = axis == 0 ? geom.B : ( axis == 1 ? geom.C : W );
+            ray.hitNormal    = glm::normalize( N ) * ( p[axis] < 0.0f ? -1.0f : 1.0f );
+            ray.hitUv        = vec2( 0.0f );
+            ray.hasAlbedoMap = 0.0f;
+            break;
+        }
+        default:
+        {
+            const float u    = ray.hitBary.x;
+            const float v    = ray.hitBary.y;
+            ray.hasAlbedoMap = geom.hasAlbedoMap;
+            ray.hitNormal    = geom.normal1 + u * ( geom.normal2 - geom.normal1 ) + v * ( geom.normal3 - geom.normal1 );
+            const vec2 uv3   = vec2( geom.uv3x, geom.uv3y );
+            ray.hitUv        = geom.uv1 + u * ( geom.uv2 - geom.uv1 ) + v * ( uv3 - geom.uv1 );
+            // the interpolated normal may lean past the face, the side is the geometric one
+            const vec3 faceNormal = glm::normalize( cross( geom.B - geom.A, geom.C - geom.A ) );
+            ray.hitGeomNormal     = faceNormal;
+            if ( dot( faceNormal, ray.direction ) > 0.0f )
+            {
+                ray.hitNormal     = -ray.hitNormal;
+                ray.hitGeomNormal = -faceNormal;
+            }
+            return;
+        }
+    }
+
+    // back faces are hit too, shade them as seen from the ray
+    if ( dot( ray.hitNormal, ray.direction ) > 0.0f )
+    {
+        ray.hitNormal = -ray.hitNormal;
+    }
+    ray.hitGeomNormal = ray.hitNormal;
+}
+
+static int FloatBitsToInt( float value )
+{
+    int bits;
+    memcpy( &bits, &value, sizeof( bits ) );
+    return bits;
+}
+
+static float IntBitsToFloat( int bits )
+{
+    float value;
+    memcpy( &value, &bits, sizeof( value ) );
+    return value;
+}
+
+vec3 OffsetRayOrigin( const vec3& p, const vec3& geomNormal, const vec3& direction )
+{
+    // ulps are too fine close to 0, a fixed distance is used there instead
+    constexpr float ORIGIN_NEAR  = 1.0f / 32.0f;
+    constexpr float FLOAT_OFFSET = 1.0f / 65536.0f;
+    constexpr float INT_OFFSET   = 256.0f;
+
+    const vec3 n = dot( geomNormal, direction ) < 0.0f ? -geomNormal : geomNormal;
+    vec3 offset;
+    for ( int i = 0; i < 3; ++i )
+    {
+        const int ulps = static_cast<int>( INT_OFFSET * n[i] );
+        const float pi = IntBitsToFloat( FloatBitsToInt( p[i] ) + ( p[i] < 0.0f ? -ulps : ulps ) );
+        offset[i]      = glm::abs( p[i] ) < ORIGIN_NEAR ? p[i] + FLOAT_OFFSET * n[i] : pi;
+    }
+    return offset;
+}
+
+bool HitBox( const TraversalRay& ray, const vec3& boxMin, const vec3& boxMax, float& outTmin )
+{
+    // written as multiply-subtract so it contracts into fma where the target has one
+    const vec3 t0s = boxMin * ray.invD - ray.originInvD;
+    const vec3 t1s = boxMax * ray.invD - ray.originInvD;
+
+    const vec3 tsmaller = glm::min( t0s, t1s );
+    const vec3 tbigger  = glm::max( t0s, t1s );
+
+    outTmin = glm::max( RAY_T_MIN, glm::max( tsmaller.x, glm::max( tsmaller.y, tsmaller.z ) ) );
+    // ray.t never exceeds RAY_T_MAX, the factor keeps the rounding of the planes from
+    // dropping boxes the watertight triangle test would still hit
+    const float tmax = glm::min( ray.t, glm::min( tbigger.x, glm::min( tbigger.y, tbigger.z ) ) * 1.00000024f );
+
+    return outTmin < tmax;
+}
+
+static bool IntersectPrimitive( const TraversalRay& ray, const GpuPrimitive& prim, float& outT, vec2& outBary )
+{
+    switch ( prim.kind )
+    {
+        case Geometry::Kind::Triangle:
+            return IntersectTriangle( ray, prim, outT, outBary );
+        case Geometry::Kind::Sphere:
+            return IntersectSphere( ray, prim, outT );
+        case Geometry::Kind::Quad:
+            return IntersectQuad( ray, prim, outT, outBary );
+        case Geometry::Kind::Disk:
+            return IntersectDisk( ray, prim, outT, outBary );
+        case Geometry::Kind::Box:
+            return IntersectBox( ray, prim, outT );
+        default:
+            return false;
+    }
+}
+
+static bool HitGeometry( TraversalRay& ray, const GpuPrimitive* prims, int geomIdx, TraversalCost& cost )
+{
+    float t;
+    vec2 bary = vec2( 0.0f );
+    ++cost.primitives;
+    if ( !IntersectPrimitive( ray, prims[geomIdx], t, bary ) )
+    {
+        return false;
+    }
+
+    ray.t      = t;
+    ray.geomId = geomIdx;
+    ray.bary   = bary;
+    return true;
+}
+
+static bool HitSceneThreaded( TraversalRay& ray, const GpuScene& scene, TraversalCost& cost )
+{
+    bool anyHit = false;
+
+    int bvhIdx = 0;
+    while ( bvhIdx != -1 )
+    {
+        const GpuBvh& bvh = scene.bvhs[bvhIdx];
+        float tmin;
+        ++cost.nodes;
+        ++cost.boxes;
+        if ( HitBox( ray, bvh.min, bvh.max, tmin ) )
+        {
+            if ( bvh.geomIdx != -1 )
+            {
+                anyHit |= HitGeometry( ray, scene.primitives.data(), bvh.geomIdx, cost );
+            }
+            bvhIdx = bvh.hitIdx;
+        }
+        else
+        {
+            bvhIdx = bvh.missIdx;
+        }
+    }
+
+    return anyHit;
+}
+
+// both children are tested at once, the nearer one is visited first and the other one
+// is pushed with its entry distance, so it is skipped if a closer hit was found meanwhile
+bool HitBvhNodes( TraversalRay& ray, const BvhNode* nodes, const GpuPrimitive* prims, TraversalCost& cost )
+{
+    float tmin;
+    ++cost.nodes;
+    ++cost.boxes;
+    if ( !HitBox( ray, nodes[0].min, nodes[0].max, tmin ) )
+    {
+        return false;
+    }
+
+    struct Entry {
+        int idx;
+        float tmin;
+    };
+    Entry stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    bool anyHit   = false;
+
+    int nodeIdx = 0;
+    for ( ;; )
+    {
+        const BvhNode& node = nodes[nodeIdx];
+        if ( node.geomIdx != -1 )
+        {
+            anyHit |= HitGeometry( ray, prims, node.geomIdx, cost );
+        }
+        else
+        {
+            const int first = node.firstChild;
+            float tLeft, tRight;
+            cost.nodes += 2;
+            cost.boxes += 2;
+            const bool hitLeft  = HitBox( ray, nodes[first].min, nodes[first].max, tLeft );
+            const bool hitRight = HitBox( ray, nodes[first + 1].min, nodes[first + 1].max, tRight );
+            if ( hitLeft && hitRight )
+            {
+                core_assert( stackSize < BVH_STACK_SIZE );
+                const bool leftFirst = tLeft <= tRight;
+                stack[stackSize++]   = leftFirst ? Entry{ first + 1, tRight } : Entry{ first, tLeft };
+                nodeIdx              = leftFirst ? first : first + 1;
+                continue;
+            }
+            if ( hitLeft || hitRight )
+            {
+                nodeIdx = hitLeft ? first : first + 1;
+                continue;
+            }
+        }
+
+        // the next pushed node the closest hit so far does not rule out
+        while ( stackSize > 0 && stack[stackSize - 1].tmin >= ray.t )
+        {
+            --stackSize;
+        }
+        if ( stackSize == 0 )
+        {
+            break;
+        }
+        nodeIdx = stack[--stackSize].idx;
+    }
+
+    return anyHit;
+}
+
+static bool OccludedGeometry( const TraversalRay& ray, const GpuPrimitive* prims, int geomIdx, TraversalCost& cost )
+{
+    float t;
+    vec2 bary;
+    ++cost.primitives;
+    return IntersectPrimitive( ray, prims[geomIdx], t, bary );
+}
+
+static bool OccludedSceneThreaded( const TraversalRay& ray, const GpuScene& scene, TraversalCost& cost )
+{
+    int bvhIdx = 0;
+    while ( bvhIdx != -1 )
+    {
+        const GpuBvh& bvh = scene.bvhs[bvhIdx];
+        float tmin;
+        ++cost.nodes;
+        ++cost.boxes;
+        if ( HitBox( ray, bvh.min, bvh.max, tmin ) )
+        {
+            if ( bvh.geomIdx != -1 && OccludedGeometry( ray, scene.primitives.data(), bvh.geomIdx, cost ) )
+            {
+                return true;
+            }
+            bvhIdx = bvh.hitIdx;
+        }
+        else
+        {
+            bvhIdx = bvh.missIdx;
+        }
+    }
+
+    return false;
+}
+
+// any hit ends the traversal, so the children are visited in storage order
+bool OccludedBvhNodes( const TraversalRay& ray, const BvhNode* nodes, const GpuPrimitive* prims, TraversalCost& cost )
+{
+    float tmin;
+    ++cost.nodes;
+    ++cost.boxes;
+    if ( !HitBox( ray, nodes[0].min, nodes[0].max, tmin ) )
+    {
+        return false;
+    }
+
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    int nodeIdx = 0;
+    for ( ;; )
+    {
+        const BvhNode& node = nodes[nodeIdx];
+        if ( node.geomIdx != -1 )
+        {
+            if ( OccludedGeometry( ray, prims, node.geomIdx, cost ) )
+            {
+                return true;
+            }
+        }
+        else
+        {
+            const int first = node.firstChild;
+            cost.nodes += 2;
+            cost.boxes += 2;
+            const bool hitLeft  = HitBox( ray, nodes[first].min, nodes[first].max, tmin );
+            const bool hitRight = HitBox( ray, nodes[first + 1].min, nodes[first + 1].max, tmin );
+            if ( hitLeft && hitRight )
+            {
+                core_assert( stackSize < BVH_STACK_SIZE );
+                stack[stackSize++] = first + 1;
+                nodeIdx            = first;
+                continue;
+            }
+            if ( hitLeft || hitRight )
+            {
+                nodeIdx = hitLeft ? first : first + 1;
+                continue;
+            }
+        }
+
+        if ( stackSize == 0 )
+        {
+            break;
+        }
+        nodeIdx = stack[--stackSize];
+    }
+
+    return false;
+}
+
+bool HitScene( Ray& ray, const GpuScene& scene, TraversalCost& cost )
+{
+    TraversalCost local;
+    TraversalRay traversal( ray.origin, ray.direction, ray.t );
+    const bool anyHit = scene.layout == BvhLayout::Pairs ? HitBvhNodes( traversal, scene.nodes.data(), scene.primitives.data(), local ) : HitSceneThreaded( traversal, scene, local );
+    if ( anyHit )
+    {
+        ray.t       = traversal.t;
+        ray.geomId  = traversal.geomId;
+        ray.hitBary = traversal.bary;
+        SetHitAttributes( ray, scene.geometries[ray.geomId] );
+    }
+
+#ifdef PT_TRAVERSAL_STATS
+    RecordTraversal( local, anyHit );
+#endif
+    cost.nodes += local.nodes;
+    cost.boxes += local.boxes;
+    cost.primitives += local.primitives;
+    return anyHit;
+}
+
+bool HitScene( Ray& ray, const GpuScene& scene )
+{
+    TraversalCost cost;
+    return HitScene( ray, scene, cost );
+}
+
+bool OccludedScene( const Ray& ray, float tmax, const GpuScene& scene, TraversalCost& cost )
+{
+    const TraversalRay shadow( ray.origin, ray.direction, tmax );
+    return scene.layout == BvhLayout::Pairs ? OccludedBvhNodes( shadow, scene.nodes.data(), scene.primitives.data(), cost ) : OccludedSceneThreaded( shadow, scene, cost );
+}
+
+bool OccludedScene( const Ray& ray, float tmax, const GpuScene& scene )
+{
+    TraversalCost cost;
+    return OccludedScene( ray, tmax, scene, cost );
+}
+
+}  // namespace pt
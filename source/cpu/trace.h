@@ -0,0 +1,108 @@
+#pragma once
+#include "scene.h"
+
+namespace pt {
+
+/// CPU twin of the ray tracing functions in data/shaders/common.glsl
+static constexpr float EPSILON   = 1e-6f;
+static constexpr float RAY_T_MIN = 1e-6f;
+static constexpr float RAY_T_MAX = 9999999.0f;
+static constexpr int MAX_BOUNCE  = 10;
+
+struct Ray {
+    vec3 origin;
+    float t;
+    vec3 direction;
+    int materialId;
+    vec3 hitNormal;
+    vec2 hitUv;
+    float hasAlbedoMap;
+    int geomId;
+    vec2 hitBary;        // weights of B and C, the attributes are interpolated once the closest hit is known.
+                         // Quads and disks keep the hit point in -1..1 along their half axes
+    vec3 hitGeomNormal;  // normal of the surface itself facing the ray, hitNormal may be interpolated
+
+    Ray( const vec3& origin, const vec3& direction )
+        : origin( origin ), t( RAY_T_MAX ), direction( direction ), materialId( -1 ), hitNormal( vec3( 0 ) ), hitUv( vec2( 0 ) ), hasAlbedoMap( 0.0f ), geomId( -1 ), hitBary( vec2( 0 ) ), hitGeomNormal( vec3( 0 ) ) {}
+};
+
+/// per ray constants of the watertight triangle test, the axis the ray mostly follows
+/// becomes z and the other two are sheared so the ray runs along +z
+struct RayShear {
+    int kx;
+    int ky;
+    int kz;
+    vec3 S;  // x and y shear, 1 / direction.z
+};
+
+/// what the traversal loops carry, everything derived from the direction is computed once
+/// per ray and the shading fields of Ray stay out of the loop until the closest hit is known
+struct TraversalRay {
+    vec3 origin;
+    float t;
+    vec3 direction;
+    int geomId;
+    vec3 invD;        // components closer to 0 than 1e-20 are clamped so invD stays finite
+    vec3 originInvD;  // origin * invD, each slab plane is then a single multiply-add
+    vec2 bary;
+    RayShear shear;
+
+    TraversalRay( const vec3& origin, const vec3& direction, float t );
+};
+
+/// work done by HitScene calls, for the heat map and traversal stats
+struct TraversalCost {
+    int nodes      = 0;  // nodes fetched
+    int boxes      = 0;  // ray box tests
+    int primitives = 0;  // ray primitive tests
+};
+
+RayShear ShearRay( const vec3& direction );
+
+/// watertight and two sided: rays through a shared edge or vertex hit one of the triangles,
+/// t in [EPSILON, ray.t), outBary are the weights of B and C
+bool IntersectTriangle( const TraversalRay& ray, const GpuPrimitive& triangle, float& outT, vec2& outBary );
+
+bool IntersectSphere( const TraversalRay& ray, const GpuPrimitive& sphere, float& outT );
+
+/// two sided, outUv is the hit point in -1..1 along the half axes B and C
+bool IntersectQuad( const TraversalRay& ray, const GpuPrimitive& quad, float& outT, vec2& outUv );
+bool IntersectDisk( const TraversalRay& ray, const GpuPrimitive& disk, float& outT, vec2& outUv );
+
+/// slab test in the frame of the box, a ray starting inside hits the far side
+bool IntersectBox( const TraversalRay& ray, const GpuPrimitive& box, float& outT );
+
+/// material, normal and uv of the hit at ray.t and ray.hitBary, the normal of a triangle,
+/// quad or disk is flipped when the ray hits its back face, the one of a box hit from inside too
+void SetHitAttributes( Ray& ray, const Geometry& geom );
+
+/// origin of a ray leaving the hit point p, moved off the surface along geomNormal to the side
+/// direction points to. The two sided tests would otherwise find the surface again a rounding
+/// error away, the offset is a few ulps of p so it grows with the scene coordinates
+/// (Ray Tracing Gems, chapter 6)
+vec3 OffsetRayOrigin( const vec3& p, const vec3& geomNormal, const vec3& direction );
+
+/// slab test against [ray.t min, ray.t), outTmin is where the ray enters the box
+bool HitBox( const TraversalRay& ray, const vec3& boxMin, const vec3& boxMax, float& outTmin );
+
+/// closest hit in a tree of the child pair layout whose leaves index prims, front to back
+/// with a stack, ray.geomId is the index into prims and the hit attributes are left alone
+bool HitBvhNodes( TraversalRay& ray, const BvhNode* nodes, const GpuPrimitive* prims, TraversalCost& cost );
+
+/// any hit in a tree of the child pair layout, see OccludedScene
+bool OccludedBvhNodes( const TraversalRay& ray, const BvhNode* nodes, const GpuPrimitive* prims, TraversalCost& cost );
+
+/// adds the work done to cost, with PT_TRAVERSAL_STATS every call is also recorded
+/// for CollectTraversalStats
+bool HitScene( Ray& ray, const GpuScene& scene, TraversalCost& cost );
+
+bool HitScene( Ray& ray, const GpuScene& scene );
+
+/// true if anything lies between EPSILON and tmax along the ray, stops at the first hit
+/// it finds and leaves the hit attributes alone, for shadow and ambient occlusion rays.
+/// The work is added to cost but not recorded for the traversal stats
+bool OccludedScene( const Ray& ray, float tmax, const GpuScene& scene, TraversalCost& cost );
+
+bool OccludedScene( const Ray& ray, float tmax, const GpuScene& scene );
+
+}  // namespace pt
@@ -0,0 +1,419 @@
+#include "denoise.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "com_dvars.h"
+#include "image.h"
+#include "postprocess_kernel.h"
+#include "universal/core_assert.h"
+#include "universal/dvar_api.h"
+#include "utility/parallel.h"
+#include "utility/profiler.h"
+#include "utility/string_util.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <xmmintrin.h>
+#endif
+
+namespace pt {
+
+using std::string;
+using std::vector;
+
+// keeps the demodulated illumination finite on black surfaces, the same value
+// is multiplied back in so unfiltered pixels come out unchanged
+static constexpr float ALBEDO_EPSILON = 1e-2f;
+
+void ResolveFeatures( const vector<vec4>& albedo, const vector<vec4>& normal, int width, int height, FeatureBuffers& outFeatures )
+{
+    const size_t count = static_cast<size_t>( width ) * height;
+    core_assert( albedo.size() == count && normal.size() == count );
+
+    outFeatures.width  = width;
+    outFeatures.height = height;
+    outFeatures.albedo.resize( count * 3 );
+    outFeatures.normal.resize( count * 3 );
+    outFeatures.depth.resize( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const float weight = normal[i].a > 0.0f ? 1.0f / normal[i].a : 0.0f;
+        const vec3 n       = vec3( normal[i] ) * weight;
+        // averaged normals are shorter than one across edges
+        const float length = glm::length( n );
+        const vec3 unit    = length > 0.0f ? n / length : vec3( 0.0f );
+        for ( int c = 0; c < 3; ++c )
+        {
+            outFeatures.albedo[3 * i + c] = albedo[i][c] * weight;
+            outFeatures.normal[3 * i + c] = unit[c];
+        }
+        outFeatures.depth[i] = albedo[i].a * weight;
+    }
+}
+
+bool WriteFeatures( const string& prefix, const FeatureBuffers& features )
+{
+    vector<float> depth( features.depth.size() * 3 );
+    for ( size_t i = 0; i < features.depth.size(); ++i )
+    {
+        depth[3 * i + 0] = depth[3 * i + 1] = depth[3 * i + 2] = features.depth[i];
+    }
+
+    bool ok = WriteHdrImage( prefix + "_albedo.pfm", HdrFormat::Pfm, features.albedo.data(), features.width, features.height );
+    ok      = WriteHdrImage( prefix + "_normal.pfm", HdrFormat::Pfm, features.normal.data(), features.width, features.height ) && ok;
+    ok      = WriteHdrImage( prefix + "_depth.pfm", HdrFormat::Pfm, depth.data(), features.width, features.height ) && ok;
+    return ok;
+}
+
+FeatureBuffers ReadFeatures( const string& prefix )
+{
+    Image albedo = ReadPfm( prefix + "_albedo.pfm" );
+    Image normal = ReadPfm( prefix + "_normal.pfm" );
+    Image depth  = ReadPfm( prefix + "_depth.pfm" );
+
+    const bool match = albedo.width == normal.width && albedo.width == depth.width &&
+                       albedo.height == normal.height && albedo.height == depth.height;
+
+    FeatureBuffers features;
+    if ( match )
+    {
+        const size_t count = static_cast<size_t>( albedo.width ) * albedo.height;
+        const float* a     = reinterpret_cast<const float*>( albedo.data );
+        const float* n     = reinterpret_cast<const float*>( normal.data );
+        const float* d     = reinterpret_cast<const float*>( depth.data );
+        features.width     = albedo.width;
+        features.height    = albedo.height;
+        features.albedo.assign( a, a + count * 3 );
+        features.normal.assign( n, n + count * 3 );
+        features.depth.resize( count );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            features.depth[i] = d[3 * i];
+        }
+    }
+
+    FreeImage( albedo );
+    FreeImage( normal );
+    FreeImage( depth );
+
+    if ( !match )
+    {
+        throw std::runtime_error( va( "Feature buffers '%s_*.pfm' differ in size", prefix.c_str() ) );
+    }
+    return features;
+}
+
+DenoiseSettings DenoiseSettingsFromDvars()
+{
+    DenoiseSettings settings;
+    settings.iterations     = glm::clamp( Dvar_GetInt( denoise_iterations ), 1, 8 );
+    settings.sigmaLuminance = Dvar_GetFloat( denoise_sigma );
+    return settings;
+}
+
+//------------------------------------------------------------------------------
+// Kernels
+//------------------------------------------------------------------------------
+namespace simd {
+
+namespace {
+
+// one lane version of the SIMD vector types, used by TonemapKernel::Reference
+struct FloatScalar {
+    static constexpr int Width = 1;
+    float v;
+
+    FloatScalar( float v )
+        : v( v )
+    {
+    }
+
+    static FloatScalar Set( float f ) { return f; }
+    static FloatScalar Load( const float* p ) { return *p; }
+    static void Store( float* p, FloatScalar x ) { *p = x.v; }
+
+    friend FloatScalar operator+( FloatScalar a, FloatScalar b ) { return a.v + b.v; }
+    friend FloatScalar operator-( FloatScalar a, FloatScalar b ) { return a.v - b.v; }
+    friend FloatScalar operator*( FloatScalar a, FloatScalar b ) { return a.v * b.v; }
+    friend FloatScalar operator/( FloatScalar a, FloatScalar b ) { return a.v / b.v; }
+
+    static FloatScalar MulAdd( FloatScalar a, FloatScalar b, FloatScalar c ) { return a.v * b.v + c.v; }
+    static FloatScalar Min( FloatScalar a, FloatScalar b ) { return a.v < b.v ? a.v : b.v; }
+    static FloatScalar Max( FloatScalar a, FloatScalar b ) { return a.v > b.v ? a.v : b.v; }
+    static bool Less( FloatScalar a, FloatScalar b ) { return a.v < b.v; }
+    static FloatScalar Select( bool mask, FloatScalar a, FloatScalar b ) { return mask ? a : b; }
+
+    static FloatScalar Mantissa( FloatScalar x )
+    {
+        int exponent;
+        return std::frexp( x.v, &exponent );
+    }
+    static FloatScalar Exponent( FloatScalar x )
+    {
+        int exponent;
+        std::frexp( x.v, &exponent );
+        return static_cast<float>( exponent );
+    }
+    static FloatScalar Round( FloatScalar x ) { return std::nearbyint( x.v ); }
+    static FloatScalar Pow2( FloatScalar n ) { return std::ldexp( 1.0f, static_cast<int>( n.v ) ); }
+};
+
+}  // namespace
+
+}  // namespace simd
+
+//------------------------------------------------------------------------------
+// Denoise
+//------------------------------------------------------------------------------
+namespace {
+
+// planar copy of the frame, see AtrousPass
+struct Planes {
+    int width;
+    int height;
+    int pad;
+    int stride;
+    vector<float> storage;
+
+    Planes( int width, int height, int iterations )
+        : width( width ), height( height )
+    {
+        // the widest pass reaches 2 * ( 1 << ( iterations - 1 ) ) pixels left and right,
+        // the last group of 8 may read that far beyond the rounded up width
+        pad    = 1 << iterations;
+        stride = pad + ( ( width + 7 ) & ~7 ) + pad;
+    }
+
+    void Allocate( vector<float*>& planes, int count )
+    {
+        const size_t planeSize = static_cast<size_t>( stride ) * height;
+        storage.assign( planeSize * count, 0.0f );
+        planes.resize( count );
+        for ( int i = 0; i < count; ++i )
+        {
+            // pointers start at the first pixel, so x = -pad is the left padding
+            planes[i] = storage.data() + planeSize * i + pad;
+        }
+    }
+
+    inline ptrdiff_t Index( int x, int y ) const { return static_cast<ptrdiff_t>( y ) * stride + x; }
+};
+
+enum PlaneIndex {
+    PLANE_VALID,
+    PLANE_NORMAL_X,
+    PLANE_NORMAL_Y,
+    PLANE_NORMAL_Z,
+    PLANE_DEPTH,
+    PLANE_DEPTH_GRADIENT,
+    PLANE_ALBEDO_R,
+    PLANE_ALBEDO_G,
+    PLANE_ALBEDO_B,
+    PLANE_ILLUMINATION_R,  // ping pong pairs
+    PLANE_ILLUMINATION_G,
+    PLANE_ILLUMINATION_B,
+    PLANE_VARIANCE,
+    PLANE_ILLUMINATION_R2,
+    PLANE_ILLUMINATION_G2,
+    PLANE_ILLUMINATION_B2,
+    PLANE_VARIANCE2,
+    PLANE_INV_SIGMA_LUMINANCE,
+    PLANE_COUNT,
+};
+
+// far away taps get weights that underflow and are then squared for the variance,
+// flush them to zero instead of taking the slow denormal path
+struct FlushDenormals {
+#if defined( __SSE2__ ) || defined( _M_X64 )
+    unsigned int csr;
+    FlushDenormals()
+        : csr( _mm_getcsr() )
+    {
+        _mm_setcsr( csr | 0x8040 );  // FTZ | DAZ
+    }
+    ~FlushDenormals() { _mm_setcsr( csr ); }
+#endif
+};
+
+inline float Luminance( const float* r, const float* g, const float* b, ptrdiff_t i )
+{
+    return 0.2126f * r[i] + 0.7152f * g[i] + 0.0722f * b[i];
+}
+
+}  // namespace
+
+void Denoise( const vector<float>& rgb, const FeatureBuffers& features, const DenoiseSettings& settings, vector<float>& outRgb,
+              int numThreads, TonemapKernel kernel )
+{
+    PROFILE_ZONE( "Denoise" );
+    const int width  = features.width;
+    const int height = features.height;
+    core_assert( rgb.size() == static_cast<size_t>( width ) * height * 3 );
+    core_assert( settings.iterations > 0 );
+
+    using RowFunc = void ( * )( const simd::AtrousPass&, int );
+    RowFunc row   = simd::AtrousRow<simd::FloatScalar>;
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    if ( kernel == TonemapKernel::Sse2 )
+    {
+        row = simd::AtrousRowSse2;
+    }
+    else if ( kernel == TonemapKernel::Avx2 )
+    {
+        row = simd::AtrousRowAvx2;
+    }
+#endif
+
+    Planes planes( width, height, settings.iterations );
+    vector<float*> p;
+    planes.Allocate( p, PLANE_COUNT );
+
+    // demodulate and transpose to planes
+    ParallelFor( height, numThreads, [&]( int y ) {
+        for ( int x = 0; x < width; ++x )
+        {
+            const size_t src    = static_cast<size_t>( y ) * width + x;
+            const ptrdiff_t dst = planes.Index( x, y );
+            p[PLANE_VALID][dst] = 1.0f;
+            p[PLANE_DEPTH][dst] = features.depth[src];
+            for ( int c = 0; c < 3; ++c )
+            {
+                const float albedo               = features.albedo[3 * src + c];
+                p[PLANE_NORMAL_X + c][dst]       = features.normal[3 * src + c];
+                p[PLANE_ALBEDO_R + c][dst]       = albedo;
+                p[PLANE_ILLUMINATION_R + c][dst] = rgb[3 * src + c] / glm::max( albedo, ALBEDO_EPSILON );
+            }
+        }
+    } );
+
+    // largest depth difference to a neighbour that was hit, scaled by the tap distance in every pass
+    // and the spatial variance of the luminance in a 3x3 window, there is no history to take it from
+    ParallelFor( height, numThreads, [&]( int y ) {
+        const float* depth = p[PLANE_DEPTH];
+        const float* r     = p[PLANE_ILLUMINATION_R];
+        const float* g     = p[PLANE_ILLUMINATION_G];
+        const float* b     = p[PLANE_ILLUMINATION_B];
+        for ( int x = 0; x < width; ++x )
+        {
+            const ptrdiff_t i = planes.Index( x, y );
+
+            float gradient  = 0.0f;
+            float sum       = 0.0f;
+            float sumSquare = 0.0f;
+            int count       = 0;
+            for ( int dy = -1; dy <= 1; ++dy )
+            {
+                for ( int dx = -1; dx <= 1; ++dx )
+                {
+                    const int xx = x + dx;
+                    const int yy = y + dy;
+                    if ( xx < 0 || xx >= width || yy < 0 || yy >= height )
+                    {
+                        continue;
+                    }
+
+                    const ptrdiff_t j = planes.Index( xx, yy );
+                    if ( depth[i] > 0.0f && depth[j] > 0.0f && ( dx == 0 || dy == 0 ) )
+                    {
+                        gradient = glm::max( gradient, glm::abs( depth[j] - depth[i] ) );
+                    }
+
+                    const float l = Luminance( r, g, b, j );
+                    sum += l;
+                    sumSquare += l * l;
+                    ++count;
+                }
+            }
+
+            const float mean           = sum / count;
+            p[PLANE_DEPTH_GRADIENT][i] = gradient;
+            p[PLANE_VARIANCE][i]       = glm::max( sumSquare / count - mean * mean, 0.0f );
+        }
+    } );
+
+    simd::AtrousPass pass;
+    pass.width          = width;
+    pass.height         = height;
+    pass.stride         = planes.stride;
+    pass.normalPower    = glm::max( static_cast<int>( std::round( std::log2( glm::max( settings.sigmaNormal, 1.0f ) ) ) ), 0 );
+    pass.sigmaDepth     = settings.sigmaDepth;
+    pass.invSigmaAlbedo = 1.0f / ( settings.sigmaAlbedo * settings.sigmaAlbedo );
+    pass.valid          = p[PLANE_VALID];
+    pass.depth          = p[PLANE_DEPTH];
+    pass.depthGradient  = p[PLANE_DEPTH_GRADIENT];
+    for ( int c = 0; c < 3; ++c )
+    {
+        pass.normal[c] = p[PLANE_NORMAL_X + c];
+        pass.albedo[c] = p[PLANE_ALBEDO_R + c];
+    }
+    pass.invSigmaLuminance = p[PLANE_INV_SIGMA_LUMINANCE];
+
+    int current = 0;
+    for ( int iteration = 0; iteration < settings.iterations; ++iteration )
+    {
+        const int in  = current == 0 ? PLANE_ILLUMINATION_R : PLANE_ILLUMINATION_R2;
+        const int out = current == 0 ? PLANE_ILLUMINATION_R2 : PLANE_ILLUMINATION_R;
+
+        // the luminance weight uses the 3x3 gaussian filtered variance
+        ParallelFor( height, numThreads, [&]( int y ) {
+            static const float gaussian[3] = { 0.25f, 0.5f, 0.25f };
+            const float* variance          = p[in + 3];
+            for ( int x = 0; x < width; ++x )
+            {
+                float sum       = 0.0f;
+                float sumWeight = 0.0f;
+                for ( int dy = -1; dy <= 1; ++dy )
+                {
+                    const int yy = y + dy;
+                    if ( yy < 0 || yy >= height )
+                    {
+                        continue;
+                    }
+                    for ( int dx = -1; dx <= 1; ++dx )
+                    {
+                        // the padding has zero variance and validity
+                        const ptrdiff_t j  = planes.Index( x + dx, yy );
+                        const float weight = gaussian[dx + 1] * gaussian[dy + 1] * p[PLANE_VALID][j];
+                        sum += weight * variance[j];
+                        sumWeight += weight;
+                    }
+                }
+                p[PLANE_INV_SIGMA_LUMINANCE][planes.Index( x, y )] = 1.0f / ( settings.sigmaLuminance * std::sqrt( sum / sumWeight ) + 1e-4f );
+            }
+        } );
+
+        pass.step = 1 << iteration;
+        for ( int c = 0; c < 3; ++c )
+        {
+            pass.illumination[c]    = p[in + c];
+            pass.outIllumination[c] = p[out + c];
+        }
+        pass.variance    = p[in + 3];
+        pass.outVariance = p[out + 3];
+        ParallelFor( height, numThreads, [&]( int y ) {
+            FlushDenormals flush;
+            row( pass, y );
+        } );
+
+        current = 1 - current;
+    }
+
+    // remodulate
+    const int result = current == 0 ? PLANE_ILLUMINATION_R : PLANE_ILLUMINATION_R2;
+    outRgb.resize( rgb.size() );
+    ParallelFor( height, numThreads, [&]( int y ) {
+        for ( int x = 0; x < width; ++x )
+        {
+            const ptrdiff_t src = planes.Index( x, y );
+            const size_t dst    = static_cast<size_t>( y ) * width + x;
+            for ( int c = 0; c < 3; ++c )
+            {
+                outRgb[3 * dst + c] = p[result + c][src] * glm::max( p[PLANE_ALBEDO_R + c][src], ALBEDO_EPSILON );
+            }
+        }
+    } );
+}
+
+}  // namespace pt
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "postprocess.h"
+
+namespace pt {
+
+/// first hit features resolved to one value per pixel, rows bottom to top like
+/// the accumulation buffer
+struct FeatureBuffers {
+    int width  = 0;
+    int height = 0;
+    std::vector<float> albedo;  // linear rgb
+    std::vector<float> normal;  // unit xyz, zero where the camera ray escaped
+    std::vector<float> depth;   // hit distance, zero where the camera ray escaped
+};
+
+/// divides the albedo and normal aov buffers by their sample count (normal alpha)
+void ResolveFeatures( const std::vector<vec4>& albedo, const std::vector<vec4>& normal, int width, int height, FeatureBuffers& outFeatures );
+
+/// writes <prefix>_albedo.pfm, <prefix>_normal.pfm and <prefix>_depth.pfm
+bool WriteFeatures( const std::string& prefix, const FeatureBuffers& features );
+
+/// reads the files written by WriteFeatures
+FeatureBuffers ReadFeatures( const std::string& prefix );
+
+struct DenoiseSettings {
+    int iterations       = 5;
+    float sigmaLuminance = 4.0f;
+    float sigmaNormal    = 128.0f;  // rounded to a power of two
+    float sigmaDepth     = 1.0f;
+    float sigmaAlbedo    = 0.1f;
+};
+
+/// reads the denoise_* dvars
+DenoiseSettings DenoiseSettingsFromDvars();
+
+/// edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the edge stopping
+/// functions of SVGF (Schied et al. 2017), without the temporal part: the illumination
+/// is demodulated by the albedo, its variance is estimated spatially and every pass
+/// weighs taps by normal, depth, albedo and luminance difference.
+/// rows are split over numThreads threads (0 means one per hardware thread)
+/// and vectorized with the same kernels as Tonemap
+void Denoise( const std::vector<float>& rgb, const FeatureBuffers& features, const DenoiseSettings& settings, std::vector<float>& outRgb,
+              int numThreads = 0, TonemapKernel kernel = GetBestTonemapKernel() );
+
+}  // namespace pt
@@ -0,0 +1,509 @@
+#include "distributed.h"
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "com_dvars.h"
+#include "cpu/cpu_renderer.h"
+#include "universal/dvar_api.h"
+#include "universal/print.h"
+#include "utility/parallel.h"
+#include "utility/string_util.h"
+
+#if defined( __linux__ )
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace pt {
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+extern ImageArray g_AlbedoMaps;
+
+static double MsSince( const Clock::time_point& start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+//------------------------------------------------------------------------------
+// Protocol
+//------------------------------------------------------------------------------
+// coordinator -> worker: JobMessage, a job with id -1 tells the worker to exit
+// worker -> coordinator: ResultMessage followed by width * height vec4 on success,
+// each vec4 holds the summed radiance of the job's samples and the sample count
+static constexpr uint32_t JOB_MAGIC    = 0x424f4a50;  // 'PJOB'
+static constexpr uint32_t RESULT_MAGIC = 0x53455250;  // 'PRES'
+static constexpr int WORKER_FD         = 3;
+
+struct JobMessage {
+    uint32_t magic;
+    int id;
+    int x;
+    int y;
+    int width;
+    int height;
+    int sampleBegin;
+    int sampleCount;
+};
+
+struct ResultMessage {
+    uint32_t magic;
+    int id;
+    int status;
+    int padding;
+};
+
+#if defined( __linux__ )
+// send instead of write, a peer that died fails the call with EPIPE instead of raising SIGPIPE
+static bool WriteAll( int fd, const void* data, size_t size )
+{
+    const char* ptr = reinterpret_cast<const char*>( data );
+    while ( size )
+    {
+        const ssize_t n = send( fd, ptr, size, MSG_NOSIGNAL );
+        if ( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if ( n <= 0 )
+        {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>( n );
+    }
+
+    return true;
+}
+
+static bool ReadAll( int fd, void* data, size_t size )
+{
+    char* ptr = reinterpret_cast<char*>( data );
+    while ( size )
+    {
+        const ssize_t n = read( fd, ptr, size );
+        if ( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if ( n <= 0 )
+        {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>( n );
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Worker
+//------------------------------------------------------------------------------
+int RunWorker()
+{
+    const int fd = Dvar_GetInt( worker );
+
+    BatchContext ctx;
+    BatchExitCode code = LoadBatchScene( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        close( fd );
+        return code;
+    }
+    // results only carry color, the coordinator writes no feature buffers
+    ctx.cache.writeAovs = 0;
+
+    CpuRenderer renderer;
+    renderer.Initialize( ctx.gpuScene, ctx.envMap, g_AlbedoMaps, ctx.width, ctx.height, Dvar_GetInt( threads ) );
+
+    vector<vec4> tile;
+    JobMessage job;
+    while ( ReadAll( fd, &job, sizeof( job ) ) && job.magic == JOB_MAGIC && job.id >= 0 )
+    {
+        ctx.cache.tileOffset = ivec2( job.x, job.y );
+        for ( int i = 0; i < job.sampleCount; ++i )
+        {
+            ctx.cache.frame       = job.sampleBegin + i + 1;
+            ctx.cache.sampleIndex = job.sampleBegin + i;
+            ctx.cache.dirty       = i == 0;
+            renderer.RenderTile( ctx.cache, job.width, job.height );
+        }
+
+        const vector<vec4>& image = renderer.GetImage();
+        tile.resize( static_cast<size_t>( job.width ) * job.height );
+        for ( int y = 0; y < job.height; ++y )
+        {
+            const vec4* src = image.data() + static_cast<size_t>( job.y + y ) * ctx.width + job.x;
+            std::copy( src, src + job.width, tile.data() + static_cast<size_t>( y ) * job.width );
+        }
+
+        ResultMessage result = { RESULT_MAGIC, job.id, 0, 0 };
+        if ( !WriteAll( fd, &result, sizeof( result ) ) || !WriteAll( fd, tile.data(), tile.size() * sizeof( vec4 ) ) )
+        {
+            break;
+        }
+    }
+
+    close( fd );
+    return BatchExit_Ok;
+}
+
+//------------------------------------------------------------------------------
+// Coordinator
+//------------------------------------------------------------------------------
+struct Job {
+    JobMessage msg;
+    int tileIndex;
+    int chunkIndex;
+};
+
+struct Tile {
+    int x;
+    int y;
+    int width;
+    int height;
+    int nextChunk = 0;
+    std::map<int, vector<vec4>> pending;
+};
+
+struct WorkerProcess {
+    pid_t pid = -1;
+    int fd    = -1;
+    int job   = -1;
+    int done  = 0;
+    Clock::time_point jobStart;
+    double busyMs = 0.0;
+    double paths  = 0.0;
+};
+
+// "+set name value" arguments for the dvars behind what HashScene covers (scene, resolution,
+// sampler, integrator) and the ones that decide how the scene is loaded and laid out. Workers
+// start with them so their tiles match a local render, a dvar that changes the hash belongs here
+static vector<string> SceneDvarArgs()
+{
+    // floats keep every digit, %f rounds small radii
+    return {
+        "+set", "scene", Dvar_GetString( scene ),
+        "+set", "wnd_width", std::to_string( Dvar_GetInt( wnd_width ) ),
+        "+set", "wnd_height", std::to_string( Dvar_GetInt( wnd_height ) ),
+        "+set", "ssp", std::to_string( Dvar_GetInt( ssp ) ),
+        "+set", "sampler", std::to_string( Dvar_GetInt( sampler ) ),
+        "+set", "integrator", std::to_string( Dvar_GetInt( integrator ) ),
+        "+set", "ao_radius", va( "%.9g", Dvar_GetFloat( ao_radius ) ),
+        "+set", "bvh_layout", Dvar_GetString( bvh_layout ),
+        "+set", "mem_budget", std::to_string( Dvar_GetInt( mem_budget ) ),
+    };
+}
+
+static bool SpawnWorker( WorkerProcess& worker, int index, int numThreads )
+{
+    int fds[2];
+    if ( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0 )
+    {
+        return false;
+    }
+
+    // build the argument list before forking, only async-signal-safe calls are allowed in the child
+    vector<string> args = {
+        "/proc/self/exe",
+        "+set", "worker", std::to_string( WORKER_FD ),
+        "+set", "threads", std::to_string( numThreads ),
+    };
+    const vector<string> sceneArgs = SceneDvarArgs();
+    args.insert( args.end(), sceneArgs.begin(), sceneArgs.end() );
+    vector<char*> argv;
+    for ( string& arg : args )
+    {
+        argv.push_back( &arg[0] );
+    }
+    argv.push_back( nullptr );
+
+    const pid_t pid = fork();
+    if ( pid < 0 )
+    {
+        close( fds[0] );
+        close( fds[1] );
+        return false;
+    }
+
+    if ( pid == 0 )
+    {
+        close( fds[0] );
+        if ( fds[1] != WORKER_FD )
+        {
+            dup2( fds[1], WORKER_FD );
+            close( fds[1] );
+        }
+        execv( argv[0], argv.data() );
+        _exit( 127 );
+    }
+
+    close( fds[1] );
+    worker.pid = pid;
+    worker.fd  = fds[0];
+    Com_PrintInfo( "[coordinator] started worker %d (pid %d)", index, static_cast<int>( pid ) );
+    return true;
+}
+
+static void StopWorker( WorkerProcess& worker )
+{
+    if ( worker.fd >= 0 )
+    {
+        close( worker.fd );
+        worker.fd = -1;
+    }
+}
+
+int RunCoordinator()
+{
+    const Clock::time_point start = Clock::now();
+
+    // only the workers load and build the scene, the coordinator splits the frame and merges tiles
+    BatchContext ctx;
+    BatchExitCode code = ReadBatchSettings( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    const int numWorkers = Dvar_GetInt( workers );
+    const int jobSpp     = glm::clamp( Dvar_GetInt( job_spp ) > 0 ? Dvar_GetInt( job_spp ) : ctx.spp, 1, ctx.spp );
+    const int numThreads = glm::max( GetHardwareThreadCount() / numWorkers, 1 );
+
+    // jobs are ordered by sample range, then by tile, so every tile gets its first samples early
+    vector<Tile> tiles;
+    std::deque<Job> queue;
+    vector<Job> jobs;
+    for ( int y = 0; y < ctx.height; y += ctx.tileSize )
+    {
+        for ( int x = 0; x < ctx.width; x += ctx.tileSize )
+        {
+            Tile tile;
+            tile.x      = x;
+            tile.y      = y;
+            tile.width  = glm::min( ctx.tileSize, ctx.width - x );
+            tile.height = glm::min( ctx.tileSize, ctx.height - y );
+            tiles.push_back( tile );
+        }
+    }
+    for ( int sample = 0, chunk = 0; sample < ctx.spp; sample += jobSpp, ++chunk )
+    {
+        for ( int i = 0; i < static_cast<int>( tiles.size() ); ++i )
+        {
+            const Tile& tile = tiles[i];
+            Job job;
+            job.msg        = { JOB_MAGIC, static_cast<int>( jobs.size() ), tile.x, tile.y, tile.width, tile.height, sample, glm::min( jobSpp, ctx.spp - sample ) };
+            job.tileIndex  = i;
+            job.chunkIndex = chunk;
+            jobs.push_back( job );
+            queue.push_back( job );
+        }
+    }
+
+    vector<WorkerProcess> workers( numWorkers );
+    for ( int i = 0; i < numWorkers; ++i )
+    {
+        if ( !SpawnWorker( workers[i], i, numThreads ) )
+        {
+            Com_PrintError( "[coordinator] failed to start worker %d", i );
+        }
+    }
+
+    Com_PrintInfo( "[coordinator] rendering %dx%d at %d spp, %d jobs (%d tiles x %d spp) on %d workers with %d threads each",
+                   ctx.width,
+                   ctx.height,
+                   ctx.spp,
+                   static_cast<int>( jobs.size() ),
+                   static_cast<int>( tiles.size() ),
+                   jobSpp,
+                   numWorkers,
+                   numThreads );
+
+    ctx.accumulation.assign( static_cast<size_t>( ctx.width ) * ctx.height, vec4( 0.0f ) );
+    const Clock::time_point renderStart = Clock::now();
+
+    // merges finished chunks of a tile in chunk order, the summation order and
+    // therefore the image is independent of the number of workers and timing
+    auto merge = [&]( Tile& tile ) {
+        for ( auto it = tile.pending.find( tile.nextChunk ); it != tile.pending.end(); it = tile.pending.find( tile.nextChunk ) )
+        {
+            for ( int y = 0; y < tile.height; ++y )
+            {
+                vec4* dst       = ctx.accumulation.data() + static_cast<size_t>( tile.y + y ) * ctx.width + tile.x;
+                const vec4* src = it->second.data() + static_cast<size_t>( y ) * tile.width;
+                for ( int x = 0; x < tile.width; ++x )
+                {
+                    dst[x] += src[x];
+                }
+            }
+            tile.pending.erase( it );
+            ++tile.nextChunk;
+        }
+    };
+
+    auto requeue = [&]( WorkerProcess& worker, int index ) {
+        Com_PrintWarning( "[coordinator] lost worker %d", index );
+        if ( worker.job >= 0 )
+        {
+            queue.push_front( jobs[worker.job] );
+            worker.job = -1;
+        }
+        StopWorker( worker );
+    };
+
+    int finished = 0;
+    while ( finished < static_cast<int>( jobs.size() ) )
+    {
+        vector<pollfd> fds;
+        vector<int> owners;
+        for ( int i = 0; i < numWorkers; ++i )
+        {
+            WorkerProcess& worker = workers[i];
+            if ( worker.fd < 0 )
+            {
+                continue;
+            }
+
+            if ( worker.job < 0 && !queue.empty() )
+            {
+                const Job job = queue.front();
+                if ( !WriteAll( worker.fd, &job.msg, sizeof( job.msg ) ) )
+                {
+                    requeue( worker, i );
+                    continue;
+                }
+                queue.pop_front();
+                worker.job      = job.msg.id;
+                worker.jobStart = Clock::now();
+            }
+
+            if ( worker.job >= 0 )
+            {
+                fds.push_back( { worker.fd, POLLIN, 0 } );
+                owners.push_back( i );
+            }
+        }
+
+        if ( fds.empty() )
+        {
+            Com_PrintError( "[coordinator] no workers left, %d of %d jobs finished", finished, static_cast<int>( jobs.size() ) );
+            code = BatchExit_RenderFailed;
+            break;
+        }
+
+        if ( poll( fds.data(), fds.size(), -1 ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            Com_PrintError( "[coordinator] poll failed" );
+            code = BatchExit_RenderFailed;
+            break;
+        }
+
+        for ( size_t i = 0; i < fds.size(); ++i )
+        {
+            if ( !fds[i].revents )
+            {
+                continue;
+            }
+
+            WorkerProcess& worker = workers[owners[i]];
+            const Job& job        = jobs[worker.job];
+            ResultMessage result;
+            vector<vec4> pixels( static_cast<size_t>( job.msg.width ) * job.msg.height );
+            if ( !ReadAll( worker.fd, &result, sizeof( result ) ) || result.magic != RESULT_MAGIC || result.id != job.msg.id ||
+                 result.status != 0 || !ReadAll( worker.fd, pixels.data(), pixels.size() * sizeof( vec4 ) ) )
+            {
+                requeue( worker, owners[i] );
+                continue;
+            }
+
+            Tile& tile = tiles[job.tileIndex];
+            tile.pending.emplace( job.chunkIndex, std::move( pixels ) );
+            merge( tile );
+
+            worker.busyMs += MsSince( worker.jobStart );
+            worker.paths += static_cast<double>( job.msg.width ) * job.msg.height * job.msg.sampleCount;
+            worker.job = -1;
+            ++worker.done;
+            ++finished;
+
+            const int step = glm::max( static_cast<int>( jobs.size() ) / 10, 1 );
+            if ( finished % step == 0 || finished == static_cast<int>( jobs.size() ) )
+            {
+                Com_Printf( "[coordinator] %d/%d jobs", finished, static_cast<int>( jobs.size() ) );
+            }
+        }
+    }
+    ctx.renderMs = MsSince( renderStart );
+
+    for ( WorkerProcess& worker : workers )
+    {
+        if ( worker.fd >= 0 )
+        {
+            const JobMessage quit = { JOB_MAGIC, -1, 0, 0, 0, 0, 0, 0 };
+            WriteAll( worker.fd, &quit, sizeof( quit ) );
+            StopWorker( worker );
+        }
+        if ( worker.pid > 0 )
+        {
+            waitpid( worker.pid, nullptr, 0 );
+        }
+    }
+
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    code = WriteBatchOutput( ctx );
+    if ( code != BatchExit_Ok )
+    {
+        return code;
+    }
+
+    for ( int i = 0; i < numWorkers; ++i )
+    {
+        const WorkerProcess& worker = workers[i];
+        Com_Printf( "[coordinator] worker %d: %4d jobs, busy %10.2f ms (%5.1f%%), %.3f Mpaths/s",
+                    i,
+                    worker.done,
+                    worker.busyMs,
+                    100.0 * worker.busyMs / ctx.renderMs,
+                    worker.busyMs > 0.0 ? worker.paths / ( 1000.0 * worker.busyMs ) : 0.0 );
+    }
+    Com_Printf( "[coordinator] render: %10.2f ms (%.2f spp/s, %.3f Mpaths/s)",
+                ctx.renderMs,
+                1000.0 * ctx.spp / ctx.renderMs,
+                static_cast<double>( ctx.width ) * ctx.height * ctx.spp / ( 1000.0 * ctx.renderMs ) );
+    Com_Printf( "[coordinator] total:  %10.2f ms", MsSince( start ) );
+    return BatchExit_Ok;
+}
+#else
+int RunWorker()
+{
+    Com_PrintError( "[worker] distributed rendering is only supported on Linux" );
+    return BatchExit_InvalidArgs;
+}
+
+int RunCoordinator()
+{
+    Com_PrintError( "[coordinator] distributed rendering is only supported on Linux" );
+    return BatchExit_InvalidArgs;
+}
+#endif
+
+}  // namespace pt
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace pt {
+
+/// splits the frame into (tile, sample range) jobs and hands them out to
+/// +set workers <n> child processes over a local socket, enabled from batch mode
+int RunCoordinator();
+
+/// entry point of a child process spawned by the coordinator, the value of the
+/// worker dvar is the file descriptor of the socket connected to the coordinator
+int RunWorker();
+
+}  // namespace pt
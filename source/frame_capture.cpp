@@ -0,0 +1,255 @@
+#include "frame_capture.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "geomath/geometry.h"
+#include "image.h"
+#include "postprocess.h"
+#include "universal/core_assert.h"
+#include "universal/print.h"
+
+namespace pt::gl {
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+static double MsSince( const Clock::time_point& start )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+}
+
+FrameCapture::~FrameCapture()
+{
+    Finalize();
+}
+
+void FrameCapture::Initialize( int ringSize )
+{
+    core_assert( ringSize > 0 );
+    m_slots.resize( ringSize );
+    for ( Slot& slot : m_slots )
+    {
+        glCreateBuffers( 1, &slot.pbo );
+    }
+
+    m_quit    = false;
+    m_encoder = std::thread( &FrameCapture::EncoderMain, this );
+}
+
+void FrameCapture::Finalize()
+{
+    if ( m_slots.empty() )
+    {
+        return;
+    }
+
+    Flush();
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_quit = true;
+    }
+    m_cv.notify_all();
+    m_encoder.join();
+
+    for ( Slot& slot : m_slots )
+    {
+        glDeleteBuffers( 1, &slot.pbo );
+    }
+    m_slots.clear();
+}
+
+FrameCapture::Slot& FrameCapture::AcquireSlot( size_t size )
+{
+    Slot& slot = m_slots[m_next];
+    m_next     = ( m_next + 1 ) % static_cast<int>( m_slots.size() );
+
+    // the ring is full, the oldest readback has to land before its buffer is reused
+    if ( slot.fence )
+    {
+        const Clock::time_point start = Clock::now();
+        while ( !Retire( slot, true ) )
+        {
+        }
+        ++m_issueStats.stalls;
+        m_issueStats.stallMs += MsSince( start );
+    }
+
+    if ( slot.capacity < size )
+    {
+        glNamedBufferData( slot.pbo, size, nullptr, GL_STREAM_READ );
+        slot.capacity = size;
+    }
+    slot.size = size;
+    return slot;
+}
+
+void FrameCapture::CaptureFramebuffer( int width, int height, const string& path )
+{
+    Slot& slot                    = AcquireSlot( static_cast<size_t>( width ) * height * 3 );
+    const Clock::time_point start = Clock::now();
+    slot.width                    = width;
+    slot.height                   = height;
+    slot.format                   = Format::RGB8;
+    slot.path                     = path;
+
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.pbo );
+    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+    glReadPixels( 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+    ++m_issueStats.captured;
+    m_issueStats.issueMs += MsSince( start );
+}
+
+void FrameCapture::CaptureAccumulation( GLuint texture, int width, int height, const string& path, const TonemapSettings& settings )
+{
+    Slot& slot                    = AcquireSlot( static_cast<size_t>( width ) * height * sizeof( vec4 ) );
+    const Clock::time_point start = Clock::now();
+    slot.width                    = width;
+    slot.height                   = height;
+    slot.format                   = Format::RGBA32F;
+    slot.path                     = path;
+    slot.settings                 = settings;
+
+    glMemoryBarrier( GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.pbo );
+    glGetTextureImage( texture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>( slot.size ), nullptr );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+    ++m_issueStats.captured;
+    m_issueStats.issueMs += MsSince( start );
+}
+
+bool FrameCapture::Retire( Slot& slot, bool wait )
+{
+    if ( !slot.fence )
+    {
+        return true;
+    }
+
+    constexpr GLuint64 timeout = 1000000000ull;  // 1 second
+    const GLenum status        = glClientWaitSync( slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? timeout : 0 );
+    if ( status == GL_TIMEOUT_EXPIRED )
+    {
+        return false;
+    }
+    glDeleteSync( slot.fence );
+    slot.fence = nullptr;
+
+    EncodeJob job;
+    job.width    = slot.width;
+    job.height   = slot.height;
+    job.format   = slot.format;
+    job.path     = std::move( slot.path );
+    job.settings = slot.settings;
+    job.pixels.resize( slot.size );
+
+    const void* mapped = status == GL_WAIT_FAILED ? nullptr : glMapNamedBufferRange( slot.pbo, 0, slot.size, GL_MAP_READ_BIT );
+    if ( !mapped )
+    {
+        Com_PrintError( "[capture] failed to read back '%s'", job.path.c_str() );
+        ++m_issueStats.failed;
+        return true;
+    }
+    memcpy( job.pixels.data(), mapped, slot.size );
+    glUnmapNamedBuffer( slot.pbo );
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_jobs.push_back( std::move( job ) );
+    }
+    m_cv.notify_all();
+    return true;
+}
+
+void FrameCapture::Update()
+{
+    // retire in issue order, stop at the first readback that has not landed yet
+    const int count = static_cast<int>( m_slots.size() );
+    for ( int i = 0; i < count; ++i )
+    {
+        Slot& slot = m_slots[( m_next + i ) % count];
+        if ( !Retire( slot, false ) )
+        {
+            break;
+        }
+    }
+}
+
+void FrameCapture::Flush()
+{
+    const int count = static_cast<int>( m_slots.size() );
+    for ( int i = 0; i < count; ++i )
+    {
+        Slot& slot = m_slots[( m_next + i ) % count];
+        while ( !Retire( slot, true ) )
+        {
+        }
+    }
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_cv.wait( lock, [this] { return m_jobs.empty() && !m_encoding; } );
+}
+
+FrameCapture::Stats FrameCapture::GetStats()
+{
+    Stats stats = m_issueStats;
+    std::lock_guard<std::mutex> lock( m_mutex );
+    stats.encoded  = m_encodeStats.encoded;
+    stats.encodeMs = m_encodeStats.encodeMs;
+    stats.failed += m_encodeStats.failed;
+    return stats;
+}
+
+void FrameCapture::EncoderMain()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    for ( ;; )
+    {
+        m_cv.wait( lock, [this] { return !m_jobs.empty() || m_quit; } );
+        if ( m_jobs.empty() )
+        {
+            return;
+        }
+
+        EncodeJob job = std::move( m_jobs.front() );
+        m_jobs.pop_front();
+        m_encoding = true;
+        lock.unlock();
+
+        const Clock::time_point start = Clock::now();
+        bool ok;
+        if ( job.format == Format::RGBA32F )
+        {
+            vector<vec4> accumulation( static_cast<size_t>( job.width ) * job.height );
+            memcpy( accumulation.data(), job.pixels.data(), job.pixels.size() );
+            vector<float> rgb;
+            ResolveAccumulation( accumulation, rgb );
+            vector<unsigned char> rgb8;
+            Tonemap( rgb, job.width, job.settings, rgb8, 1 );
+            ok = WritePng( job.path, rgb8.data(), job.width, job.height, 3 );
+        }
+        else
+        {
+            ok = WritePng( job.path, job.pixels.data(), job.width, job.height, 3 );
+        }
+        const double ms = MsSince( start );
+
+        if ( !ok )
+        {
+            Com_PrintError( "[capture] failed to write '%s'", job.path.c_str() );
+        }
+
+        lock.lock();
+        m_encoding = false;
+        m_encodeStats.encodeMs += ms;
+        ++( ok ? m_encodeStats.encoded : m_encodeStats.failed );
+        m_cv.notify_all();
+    }
+}
+
+}  // namespace pt::gl
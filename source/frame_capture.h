@@ -0,0 +1,93 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glad/glad.h"
+#include "postprocess.h"
+
+namespace pt::gl {
+
+/// non-blocking readback through a ring of pixel buffer objects, a fence marks
+/// when a readback has landed and a background thread encodes the png, so the
+/// render thread only pays for issuing the copy
+class FrameCapture {
+   public:
+    struct Stats {
+        int captured    = 0;
+        int encoded     = 0;
+        int failed      = 0;
+        int stalls      = 0;    // captures that had to wait for a ring slot
+        double issueMs  = 0.0;  // render thread: issuing readbacks
+        double stallMs  = 0.0;  // render thread: waiting on fences when the ring is full
+        double encodeMs = 0.0;  // encoder thread
+    };
+
+    ~FrameCapture();
+
+    void Initialize( int ringSize );
+    /// waits for outstanding captures and stops the encoder thread
+    void Finalize();
+
+    /// reads back the default framebuffer as 8 bit rgb
+    void CaptureFramebuffer( int width, int height, const std::string& path );
+    /// reads back an rgba32f accumulation texture, resolved and tone mapped on the encoder thread
+    void CaptureAccumulation( GLuint texture, int width, int height, const std::string& path, const TonemapSettings& settings );
+
+    /// hands finished readbacks to the encoder thread without blocking, call once per frame
+    void Update();
+    /// blocks until every capture is written
+    void Flush();
+
+    /// call from the render thread, the thread that issues the captures
+    Stats GetStats();
+
+   private:
+    enum class Format {
+        RGB8,
+        RGBA32F,
+    };
+
+    struct Slot {
+        GLuint pbo      = 0;
+        GLsync fence    = nullptr;
+        size_t capacity = 0;
+        size_t size     = 0;
+        int width       = 0;
+        int height      = 0;
+        Format format   = Format::RGB8;
+        std::string path;
+        TonemapSettings settings;
+    };
+
+    struct EncodeJob {
+        int width;
+        int height;
+        Format format;
+        std::string path;
+        TonemapSettings settings;
+        std::vector<unsigned char> pixels;
+    };
+
+    Slot& AcquireSlot( size_t size );
+    bool Retire( Slot& slot, bool wait );
+    void EncoderMain();
+
+    std::vector<Slot> m_slots;
+    int m_next = 0;  // oldest slot, captures are issued and retired in ring order
+
+    std::thread m_encoder;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<EncodeJob> m_jobs;
+    bool m_encoding = false;
+    bool m_quit     = false;
+
+    Stats m_issueStats;   // captured, stalls, issueMs, stallMs and failed readbacks, render thread only
+    Stats m_encodeStats;  // encoded, failed writes and encodeMs, guarded by m_mutex
+};
+
+}  // namespace pt::gl
@@ -0,0 +1,123 @@
+#include "frame_timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "geomath/geometry.h"
+#include "universal/core_assert.h"
+
+namespace pt {
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+static int64_t ClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now().time_since_epoch() ).count();
+}
+
+FrameTimeline::FrameTimeline( size_t maxEvents )
+    : m_epoch( ClockNs() ), m_maxEvents( maxEvents )
+{
+    core_assert( maxEvents > 0 );
+}
+
+int64_t FrameTimeline::Now() const
+{
+    return ClockNs() - m_epoch;
+}
+
+void FrameTimeline::BeginFrame()
+{
+    ++m_frame;
+}
+
+void FrameTimeline::Add( const char* name, TimerTrack track, int frame, int64_t startNs, int64_t durationNs )
+{
+    Pass* pass = nullptr;
+    for ( Pass& candidate : m_passes )
+    {
+        if ( candidate.track == track && ( candidate.name == name || strcmp( candidate.name, name ) == 0 ) )
+        {
+            pass = &candidate;
+            break;
+        }
+    }
+    if ( !pass )
+    {
+        m_passes.emplace_back();
+        pass        = &m_passes.back();
+        pass->name  = name;
+        pass->track = track;
+    }
+
+    const float ms            = static_cast<float>( durationNs * 1.0e-6 );
+    pass->history[pass->head] = ms;
+    pass->head                = ( pass->head + 1 ) % HISTORY_SIZE;
+    pass->lastMs              = ms;
+    pass->samples             = glm::min( pass->samples + 1, HISTORY_SIZE );
+    float sum                 = 0.0f;
+    for ( float value : pass->history )
+    {
+        sum += value;
+    }
+    pass->averageMs = sum / pass->samples;
+
+    const TimerEvent event = { name, track, frame, startNs, durationNs };
+    if ( m_events.size() < m_maxEvents )
+    {
+        m_events.push_back( event );
+    }
+    else
+    {
+        m_events[m_nextEvent] = event;
+        m_nextEvent           = ( m_nextEvent + 1 ) % m_maxEvents;
+    }
+}
+
+bool FrameTimeline::WriteChromeTrace( const string& path ) const
+{
+    FILE* file = fopen( path.c_str(), "w" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    static const char* s_trackNames[TimerTrack_Count] = { "cpu", "gpu" };
+    fprintf( file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+    for ( int track = 0; track < TimerTrack_Count; ++track )
+    {
+        fprintf( file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}},\n", track + 1, s_trackNames[track] );
+    }
+
+    // oldest first
+    const size_t count = m_events.size();
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const TimerEvent& event = m_events[( m_nextEvent + i ) % count];
+        fprintf( file, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %d}}%s\n",
+                 event.name,
+                 s_trackNames[event.track],
+                 event.track + 1,
+                 event.startNs * 1.0e-3,
+                 event.durationNs * 1.0e-3,
+                 event.frame,
+                 i + 1 < count ? "," : "" );
+    }
+    fprintf( file, "]}\n" );
+    return fclose( file ) == 0;
+}
+
+CpuTimer::CpuTimer( FrameTimeline& timeline, const char* name )
+    : m_timeline( timeline ), m_name( name ), m_start( timeline.Now() )
+{
+}
+
+CpuTimer::~CpuTimer()
+{
+    m_timeline.Add( m_name, TimerTrack_Cpu, m_timeline.GetFrame(), m_start, m_timeline.Now() - m_start );
+}
+
+}  // namespace pt
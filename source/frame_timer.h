@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pt {
+
+enum TimerTrack {
+    TimerTrack_Cpu,
+    TimerTrack_Gpu,
+    TimerTrack_Count,
+};
+
+/// one timed pass, names are string literals
+struct TimerEvent {
+    const char* name;
+    TimerTrack track;
+    int frame;
+    int64_t startNs;  // since the timeline was created
+    int64_t durationNs;
+};
+
+/// cpu and gpu pass timings of every frame: a rolling history per pass for the
+/// viewer graph and a ring of the most recent events for chrome://tracing,
+/// does not need a GL context. Not thread safe, time the render thread only
+class FrameTimeline {
+   public:
+    static constexpr int HISTORY_SIZE = 128;
+
+    struct Pass {
+        const char* name;
+        TimerTrack track;
+        float history[HISTORY_SIZE] = {};  // milliseconds, ring starting at head
+        int head                    = 0;
+        int samples                 = 0;
+        float lastMs                = 0.0f;
+        float averageMs             = 0.0f;  // over the history
+    };
+
+    explicit FrameTimeline( size_t maxEvents = 1 << 16 );
+
+    /// nanoseconds since the timeline was created
+    int64_t Now() const;
+
+    void BeginFrame();
+    int GetFrame() const { return m_frame; }
+
+    void Add( const char* name, TimerTrack track, int frame, int64_t startNs, int64_t durationNs );
+
+    const std::vector<Pass>& GetPasses() const { return m_passes; }
+
+    /// trace event format, one thread per track, only holds the last maxEvents events
+    bool WriteChromeTrace( const std::string& path ) const;
+
+   private:
+    int64_t m_epoch;
+    int m_frame = 0;
+    std::vector<Pass> m_passes;
+    std::vector<TimerEvent> m_events;
+    size_t m_maxEvents;
+    size_t m_nextEvent = 0;  // oldest event once the ring is full
+};
+
+/// adds the time until the end of the scope to the cpu track of the current frame
+class CpuTimer {
+   public:
+    CpuTimer( FrameTimeline& timeline, const char* name );
+    ~CpuTimer();
+
+   private:
+    FrameTimeline& m_timeline;
+    const char* m_name;
+    int64_t m_start;
+};
+
+}  // namespace pt
@@ -3,11 +3,21 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "utility/arena.h"
 
 namespace pt {
 
 using std::vector;
 
+static const char* s_bvhLayoutNames[] = { "threaded", "pairs" };
+static_assert( sizeof( s_bvhLayoutNames ) / sizeof( s_bvhLayoutNames[0] ) == static_cast<int>( BvhLayout::Count ) );
+
+// nodes live in the arena of the build, which never runs destructors
+static_assert( std::is_trivially_destructible_v<Bvh> );
+
 GpuBvh::GpuBvh()
     : missIdx( -1 ), hitIdx( -1 ), leaf( 0 ), geomIdx( -1 )
 {
@@ -15,9 +25,15 @@ GpuBvh::GpuBvh()
     padding[1] = 0;
 }
 
-static int genIdx()
+// nodes are numbered in construction order, which is the order CreateGpuBvh writes
+// them in, so every tree starts over at its root
+static int genIdx( const Bvh* parent )
 {
     static int idx = 0;
+    if ( !parent )
+    {
+        idx = 0;
+    }
     return idx++;
 }
 
@@ -37,7 +53,7 @@ static int DominantAxis( const Box3& box )
     return axis;
 }
 
-void Bvh::SplitByAxis( GeometryList& geoms )
+void Bvh::SplitByAxis( Geometry* geoms, vec3* centroids, size_t count, Scratch& scratch, Arena& arena )
 {
     class Sorter {
        public:
@@ -62,18 +78,34 @@ void Bvh::SplitByAxis( GeometryList& geoms )
 
     Sorter sorter( DominantAxis( m_box ) );
 
-    std::sort( geoms.begin(), geoms.end(), sorter );
-    const size_t mid = geoms.size() / 2;
-    GeometryList leftPartition( geoms.begin(), geoms.begin() + mid );
-    GeometryList rightPartition( geoms.begin() + mid, geoms.end() );
+    std::sort( geoms, geoms + count, sorter );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        centroids[i] = geoms[i].Centroid();
+    }
+
+    const size_t mid = count / 2;
+    m_left           = new ( arena.Allocate( sizeof( Bvh ), alignof( Bvh ) ) ) Bvh( geoms, centroids, mid, this, scratch, arena );
+    m_right          = new ( arena.Allocate( sizeof( Bvh ), alignof( Bvh ) ) ) Bvh( geoms + mid, centroids + mid, count - mid, this, scratch, arena );
+    m_leaf           = false;
+}
+
+Bvh* Bvh::Build( Geometry* geoms, size_t count, Arena& arena )
+{
+    Scratch scratch;
+    scratch.geoms     = arena.NewArray<Geometry>( count );
+    scratch.centroids = arena.NewArray<vec3>( count );
+    vec3* centroids   = arena.NewArray<vec3>( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        centroids[i] = geoms[i].Centroid();
+    }
 
-    m_left  = new Bvh( leftPartition, this );
-    m_right = new Bvh( rightPartition, this );
-    m_leaf  = false;
+    return new ( arena.Allocate( sizeof( Bvh ), alignof( Bvh ) ) ) Bvh( geoms, centroids, count, nullptr, scratch, arena );
 }
 
-Bvh::Bvh( GeometryList& geometries, Bvh* parent )
-    : m_idx( genIdx() ), m_parent( parent )
+Bvh::Bvh( Geometry* geometries, vec3* centroids, size_t nGeoms, Bvh* parent, Scratch& scratch, Arena& arena )
+    : m_idx( genIdx( parent ) ), m_parent( parent )
 {
     m_left    = nullptr;
     m_right   = nullptr;
@@ -81,24 +113,22 @@ Bvh::Bvh( GeometryList& geometries, Bvh* parent )
     m_hitIdx  = -1;
     m_missIdx = -1;
 
-    const size_t nGeoms = geometries.size();
-
     assert( nGeoms );
 
     if ( nGeoms == 1 )
     {
-        m_geom = geometries.front();
+        m_geom = geometries[0];
         m_leaf = true;
         m_box  = Box3::FromGeometry( m_geom );
         return;
     }
 
-    m_box                      = Box3::FromGeometries( geometries );
+    m_box                      = Box3::FromGeometries( geometries, nGeoms );
     const float boxSurfaceArea = m_box.SurfaceArea();
 
     if ( nGeoms <= 4 || boxSurfaceArea == 0.0f )
     {
-        SplitByAxis( geometries );
+        SplitByAxis( geometries, centroids, nGeoms, scratch, arena );
         return;
     }
 
@@ -109,12 +139,9 @@ Bvh::Bvh( GeometryList& geometries, Bvh* parent )
     };
     BucketInfo buckets[nBuckets];
 
-    vector<vec3> centroids( nGeoms );
-
     Box3 centroidBox;
     for ( size_t i = 0; i < nGeoms; ++i )
     {
-        centroids[i] = geometries.at( i ).Centroid();
         centroidBox.Expand( centroids[i] );
     }
 
@@ -124,12 +151,12 @@ Bvh::Bvh( GeometryList& geometries, Bvh* parent )
 
     for ( size_t i = 0; i < nGeoms; ++i )
     {
-        float tmp = ( ( centroids.at( i )[axis] - tmin ) * nBuckets ) / ( tmax - tmin );
+        float tmp = ( ( centroids[i][axis] - tmin ) * nBuckets ) / ( tmax - tmin );
         int slot( tmp );
         slot               = glm::clamp( slot, 0, nBuckets - 1 );
         BucketInfo& bucket = buckets[slot];
         ++bucket.count;
-        bucket.box.Expand( Box3::FromGeometry( geometries.at( i ) ) );
+        bucket.box.Expand( Box3::FromGeometry( geometries[i] ) );
     }
 
     float costs[nBuckets - 1];
@@ -148,16 +175,13 @@ Bvh::Bvh( GeometryList& geometries, Bvh* parent )
             count1 += buckets[j].count;
         }
 
-        constexpr float travCost      = 0.125f;
-        constexpr float intersectCost = 1.f;
-        costs[i]                      = travCost + ( count0 * b0.SurfaceArea() + count1 * b1.SurfaceArea() ) / boxSurfaceArea;
+        costs[i] = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * ( count0 * b0.SurfaceArea() + count1 * b1.SurfaceArea() ) / boxSurfaceArea;
     }
 
     int splitIndex = 0;
     float minCost  = costs[splitIndex];
     for ( int i = 0; i < nBuckets - 1; ++i )
     {
-        // printf("cost of split after bucket %d is %f\n", i, costs[i]);
         if ( costs[i] < minCost )
         {
             splitIndex = i;
@@ -165,42 +189,31 @@ Bvh::Bvh( GeometryList& geometries, Bvh* parent )
         }
     }
 
-    // printf("split index is %d\n", splitIndex);
-
-    GeometryList leftPartition;
-    GeometryList rightPartition;
-
-    for ( const Geometry& geom : geometries )
+    // stable partition through the scratch buffers: the left side fills them from the front,
+    // the right side from the back in reverse, the children then work on the two halves in place
+    size_t left  = 0;
+    size_t right = nGeoms;
+    for ( size_t i = 0; i < nGeoms; ++i )
     {
-        const vec3 t = geom.Centroid();
-        float tmp    = ( t[axis] - tmin ) / ( tmax - tmin );
+        float tmp = ( centroids[i][axis] - tmin ) / ( tmax - tmin );
         tmp *= nBuckets;
         int slot( tmp );
-        slot = glm::clamp( slot, 0, nBuckets - 1 );
-        if ( slot <= splitIndex )
-        {
-            leftPartition.push_back( geom );
-        }
-        else
-        {
-            rightPartition.push_back( geom );
-        }
+        slot                    = glm::clamp( slot, 0, nBuckets - 1 );
+        const size_t dest       = slot <= splitIndex ? left++ : --right;
+        scratch.geoms[dest]     = geometries[i];
+        scratch.centroids[dest] = centroids[i];
     }
+    std::copy( scratch.geoms, scratch.geoms + left, geometries );
+    std::reverse_copy( scratch.geoms + left, scratch.geoms + nGeoms, geometries + left );
+    std::copy( scratch.centroids, scratch.centroids + left, centroids );
+    std::reverse_copy( scratch.centroids + left, scratch.centroids + nGeoms, centroids + left );
 
-    // printf("left has %llu\n", leftPartition.size());
-    // printf("right has %llu\n", rightPartition.size());
-
-    m_left  = new Bvh( leftPartition, this );
-    m_right = new Bvh( rightPartition, this );
+    m_left  = new ( arena.Allocate( sizeof( Bvh ), alignof( Bvh ) ) ) Bvh( geometries, centroids, left, this, scratch, arena );
+    m_right = new ( arena.Allocate( sizeof( Bvh ), alignof( Bvh ) ) ) Bvh( geometries + left, centroids + left, nGeoms - left, this, scratch, arena );
 
     m_leaf = false;
 }
 
-Bvh::~Bvh()
-{
-    // TODO: free memory
-}
-
 void Bvh::DiscoverIdx()
 {
     // hit link (find right link)
@@ -245,4 +258,130 @@ void Bvh::CreateGpuBvh( GpuBvhList& outBvh, GeometryList& outGeometries )
     }
 }
 
+const char* BvhLayoutToString( BvhLayout layout )
+{
+    return s_bvhLayoutNames[static_cast<int>( layout )];
+}
+
+bool BvhLayoutFromString( const char* name, BvhLayout& outLayout )
+{
+    for ( int i = 0; i < static_cast<int>( BvhLayout::Count ); ++i )
+    {
+        if ( strcmp( name, s_bvhLayoutNames[i] ) == 0 )
+        {
+            outLayout = static_cast<BvhLayout>( i );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+BvhStats ComputeBvhStats( const GpuBvhList& bvhs )
+{
+    BvhStats stats;
+    if ( bvhs.empty() )
+    {
+        return stats;
+    }
+
+    const auto boxOf     = []( const GpuBvh& bvh ) { return Box3( bvh.min, bvh.max ); };
+    const float rootArea = glm::max( boxOf( bvhs.front() ).SurfaceArea(), 1e-12f );
+    double leafDepthSum  = 0.0;
+    double overlapSum    = 0.0;
+    int innerNodes       = 0;
+
+    struct Entry {
+        int idx;
+        int depth;
+    };
+    vector<Entry> stack = { { 0, 0 } };
+    while ( !stack.empty() )
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        const GpuBvh& bvh = bvhs[entry.idx];
+        const float area  = boxOf( bvh ).SurfaceArea();
+        ++stats.nodes;
+        stats.depth = glm::max( stats.depth, entry.depth );
+
+        if ( bvh.leaf )
+        {
+            const int size = bvh.geomIdx != -1 ? 1 : 0;
+            if ( static_cast<int>( stats.leafSizes.size() ) <= size )
+            {
+                stats.leafSizes.resize( size + 1 );
+            }
+            ++stats.leafSizes[size];
+            ++stats.leaves;
+            leafDepthSum += entry.depth;
+            stats.sahCost += BVH_INTERSECT_COST * size * area / rootArea;
+            continue;
+        }
+
+        const int left  = entry.idx + 1;
+        const int right = bvhs[left].missIdx;
+        assert( right > left && right < static_cast<int>( bvhs.size() ) );
+
+        const Box3 a      = boxOf( bvhs[left] );
+        const Box3 b      = boxOf( bvhs[right] );
+        const vec3 extent = glm::min( a.max, b.max ) - glm::max( a.min, b.min );
+        if ( area > 0.0f && extent.x >= 0.0f && extent.y >= 0.0f && extent.z >= 0.0f )
+        {
+            overlapSum += 2.0f * ( extent.x * extent.y + extent.y * extent.z + extent.z * extent.x ) / area;
+        }
+        ++innerNodes;
+        stats.sahCost += BVH_TRAVERSAL_COST * area / rootArea;
+
+        stack.push_back( { right, entry.depth + 1 } );
+        stack.push_back( { left, entry.depth + 1 } );
+    }
+
+    stats.meanLeafDepth = static_cast<float>( leafDepthSum / glm::max( stats.leaves, 1 ) );
+    stats.overlap       = static_cast<float>( overlapSum / glm::max( innerNodes, 1 ) );
+    return stats;
+}
+
+BvhNodeList CreateBvhNodePairs( const GpuBvhList& bvhs )
+{
+    BvhNodeList nodes;
+    if ( bvhs.empty() )
+    {
+        return nodes;
+    }
+
+    nodes.reserve( bvhs.size() + 1 );
+    nodes.resize( 2 );
+    nodes[1] = BvhNode{ vec3( 0.0f ), -1, vec3( 0.0f ), -1 };
+
+    // depth first so a subtree stays close together, right children are pushed first
+    struct Entry {
+        int src;
+        int dst;
+    };
+    vector<Entry> stack = { { 0, 0 } };
+    while ( !stack.empty() )
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        const GpuBvh& bvh = bvhs[entry.src];
+        BvhNode node      = { bvh.min, -1, bvh.max, bvh.geomIdx };
+        if ( !bvh.leaf )
+        {
+            // the left child follows its parent, the right one is where the left subtree ends
+            const int left  = entry.src + 1;
+            const int right = bvhs[left].missIdx;
+            node.firstChild = static_cast<int>( nodes.size() );
+            nodes.resize( nodes.size() + 2 );
+            stack.push_back( { right, node.firstChild + 1 } );
+            stack.push_back( { left, node.firstChild } );
+        }
+        nodes[entry.dst] = node;
+    }
+
+    return nodes;
+}
+
 }  // namespace pt
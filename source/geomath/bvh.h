@@ -22,17 +22,80 @@ using GpuBvhList = std::vector<GpuBvh>;
 
 static_assert( sizeof( GpuBvh ) % sizeof( vec4 ) == 0 );
 
+/// 32 byte node of the child pair layout. The children of an inner node sit next to each
+/// other at an even index, so one 64 byte line holds both boxes and the traversal tests
+/// them together and descends into the nearer one first
+struct BvhNode {
+    vec3 min;
+    int firstChild;  // -1 for leaves, the sibling is firstChild + 1
+    vec3 max;
+    int geomIdx;  // -1 for inner nodes
+};
+
+using BvhNodeList = std::vector<BvhNode>;
+
+static_assert( sizeof( BvhNode ) == 32 );
+
+/// ordered traversal pushes at most one node per level, deeper trees keep the threaded layout
+static constexpr int BVH_STACK_SIZE = 64;
+
+enum class BvhLayout {
+    Threaded,  // GpuBvh, stackless with hit and miss links, fixed left to right order
+    Pairs,     // BvhNode, short stack, front to back
+    Count,
+};
+
+const char* BvhLayoutToString( BvhLayout layout );
+
+/// "threaded" or "pairs"
+bool BvhLayoutFromString( const char* name, BvhLayout& outLayout );
+
+/// surface area heuristic weights used by the builder and BvhStats::sahCost
+static constexpr float BVH_TRAVERSAL_COST = 0.125f;
+static constexpr float BVH_INTERSECT_COST = 1.0f;
+
+struct BvhStats {
+    int nodes           = 0;
+    int leaves          = 0;
+    int depth           = 0;  // a lone root has depth 0
+    float meanLeafDepth = 0.0f;
+    std::vector<int> leafSizes;  // leafSizes[n] is the number of leaves with n primitives
+    float sahCost       = 0.0f;  // expected cost of a ray through the root box
+    float overlap       = 0.0f;  // mean surface area of the child overlap relative to the parent
+};
+
+/// walks the flattened hierarchy written by Bvh::CreateGpuBvh, the left child of an
+/// inner node follows it and the right child is the miss link of the left one
+BvhStats ComputeBvhStats( const GpuBvhList& bvhs );
+
+/// child pair layout of a hierarchy flattened by Bvh::CreateGpuBvh, node 0 is the root
+/// and node 1 pads the pairs to even indices, leaves index the same geometry list
+BvhNodeList CreateBvhNodePairs( const GpuBvhList& bvhs );
+
+class Arena;
+
 class Bvh {
    public:
-    Bvh() = delete;
-    explicit Bvh( GeometryList& geoms, Bvh* parent = nullptr );
-    ~Bvh();
+    /// builds the hierarchy over geoms and reorders them, the nodes and every temporary
+    /// come from arena, the tree stays valid until the arena is reset
+    static Bvh* Build( Geometry* geoms, size_t count, Arena& arena );
+
+    Bvh( const Bvh& ) = delete;
+    Bvh& operator=( const Bvh& ) = delete;
 
     void CreateGpuBvh( GpuBvhList& outBvh, GeometryList& outTriangles );
     inline const Box3& GetBox() const { return m_box; }
 
    private:
-    void SplitByAxis( GeometryList& geoms );
+    // partition buffers shared by every node of a build
+    struct Scratch {
+        Geometry* geoms;
+        vec3* centroids;
+    };
+
+    Bvh( Geometry* geoms, vec3* centroids, size_t count, Bvh* parent, Scratch& scratch, Arena& arena );
+
+    void SplitByAxis( Geometry* geoms, vec3* centroids, size_t count, Scratch& scratch, Arena& arena );
     void DiscoverIdx();
 
     Box3 m_box;
@@ -21,6 +21,12 @@ Geometry::Geometry( const vec3& center, float radius, int material )
     this->radius = glm::max( 0.01f, glm::abs( radius ) );
 }
 
+Geometry::Geometry( Kind kind, const vec3& center, const vec3& halfU, const vec3& halfV, float halfW, int material )
+    : kind( kind ), A( center ), B( halfU ), C( halfV ), radius( glm::abs( halfW ) ), materialId( material )
+{
+    assert( kind == Kind::Quad || kind == Kind::Disk || kind == Kind::Box );
+}
+
 void Geometry::CalcNormal()
 {
     using glm::cross;
@@ -40,6 +46,9 @@ vec3 Geometry::Centroid() const
         case Kind::Triangle:
             return ( A + B + C ) / 3.0f;
         case Kind::Sphere:
+        case Kind::Quad:
+        case Kind::Disk:
+        case Kind::Box:
             return A;
         default:
             assert( 0 );
@@ -125,6 +134,38 @@ static Box3 Box3FromTriangle( const Geometry& triangle )
     return ret;
 }
 
+// exact bounds, the extent along an axis is the sum of what the half axes contribute to it
+static Box3 Box3FromQuad( const Geometry& quad )
+{
+    assert( quad.kind == Geometry::Kind::Quad );
+
+    const vec3 extent = glm::abs( quad.B ) + glm::abs( quad.C );
+    Box3 ret          = Box3( quad.A - extent, quad.A + extent );
+    ret.MakeValid();
+    return ret;
+}
+
+static Box3 Box3FromDisk( const Geometry& disk )
+{
+    assert( disk.kind == Geometry::Kind::Disk );
+
+    const vec3 extent = glm::sqrt( disk.B * disk.B + disk.C * disk.C );
+    Box3 ret          = Box3( disk.A - extent, disk.A + extent );
+    ret.MakeValid();
+    return ret;
+}
+
+static Box3 Box3FromBox( const Geometry& box )
+{
+    assert( box.kind == Geometry::Kind::Box );
+
+    const vec3 W      = glm::normalize( glm::cross( box.B, box.C ) ) * box.radius;
+    const vec3 extent = glm::abs( box.B ) + glm::abs( box.C ) + glm::abs( W );
+    Box3 ret          = Box3( box.A - extent, box.A + extent );
+    ret.MakeValid();
+    return ret;
+}
+
 Box3 Box3::FromGeometry( const Geometry& geom )
 {
     switch ( geom.kind )
@@ -133,6 +174,12 @@ Box3 Box3::FromGeometry( const Geometry& geom )
             return Box3FromTriangle( geom );
         case Geometry::Kind::Sphere:
             return Box3FromSphere( geom );
+        case Geometry::Kind::Quad:
+            return Box3FromQuad( geom );
+        case Geometry::Kind::Disk:
+            return Box3FromDisk( geom );
+        case Geometry::Kind::Box:
+            return Box3FromBox( geom );
         default:
             assert( 0 );
     }
@@ -140,11 +187,16 @@ Box3 Box3::FromGeometry( const Geometry& geom )
 }
 
 Box3 Box3::FromGeometries( const GeometryList& geoms )
+{
+    return FromGeometries( geoms.data(), geoms.size() );
+}
+
+Box3 Box3::FromGeometries( const Geometry* geoms, size_t count )
 {
     Box3 box;
-    for ( const Geometry& geom : geoms )
+    for ( size_t i = 0; i < count; ++i )
     {
-        box = Box3( box, Box3::FromGeometry( geom ) );
+        box = Box3( box, Box3::FromGeometry( geoms[i] ) );
     }
 
     box.MakeValid();
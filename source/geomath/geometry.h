@@ -29,9 +29,15 @@ struct Geometry {
         Invalid,
         Triangle,
         Sphere,
+        Quad,
+        Disk,
+        Box,
         Count
     };
 
+    // triangles keep their corners in A, B and C, spheres their center in A. Quads, disks and
+    // boxes are centered at A and span -1..1 along the half axes B and C, a box also along
+    // the normalized cross( B, C ) scaled by radius
     vec3 A;
     Kind kind;
     vec3 B;
@@ -50,6 +56,8 @@ struct Geometry {
     Geometry();
     Geometry( const vec3& A, const vec3& B, const vec3& C, int material );
     Geometry( const vec3& center, float radius, int material );
+    /// a quad, disk or box, B and C must be perpendicular for a box
+    Geometry( Kind kind, const vec3& center, const vec3& halfU, const vec3& halfV, float halfW, int material );
     vec3 Centroid() const;
     void CalcNormal();
 };
@@ -77,6 +85,7 @@ struct Box3 {
 
     static Box3 FromGeometry( const Geometry& geom );
     static Box3 FromGeometries( const GeometryList& geoms );
+    static Box3 FromGeometries( const Geometry* geoms, size_t count );
     static Box3 FromGeometriesCentroid( const GeometryList& geoms );
 };
 
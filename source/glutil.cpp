@@ -2,10 +2,9 @@
 
 #include <stdexcept>
 
-#include "com_dvars.h"
 #include "geomath/geometry.h"
 #include "image.h"
-#include "universal/dvar_api.h"
+#include "utility/memory_stats.h"
 #include "utility/string_util.h"
 
 namespace pt::gl {
@@ -41,6 +40,7 @@ void CreateQuadVao( GLuint& outVao, GLuint& outVbo )
 
 GLuint Create3DTexture( const ImageArray& images )
 {
+    PROFILE_ZONE( "Create3DTexture" );
     GLuint textureId;
     glGenTextures( 1, &textureId );
     glBindTexture( GL_TEXTURE_2D_ARRAY, textureId );
@@ -51,8 +51,10 @@ GLuint Create3DTexture( const ImageArray& images )
         unsigned char r, g, b;
     };
 
+    // every layer is padded to the largest map
     const size_t perImageOffset = sizeof( RGB ) * images.maxWidth * images.maxHeight;
-    RGB* data                   = (RGB*)calloc( 1, perImageOffset * num );
+    MemTracker stagingMemory( MemTag_TextureArray, perImageOffset * num );
+    RGB* data = (RGB*)calloc( 1, perImageOffset * num );
 
     for ( size_t idx = 0; idx < images.images.size(); ++idx )
     {
@@ -62,8 +64,8 @@ GLuint Create3DTexture( const ImageArray& images )
         {
             for ( int x = 0; x < image.width; ++x )
             {
-                RGB rgb                                                                   = ( reinterpret_cast<RGB*>( image.data ) )[image.width * y + x];
-                data[idx * images.maxHeight * images.maxHeight + y * images.maxWidth + x] = rgb;
+                RGB rgb                                                                  = ( reinterpret_cast<RGB*>( image.data ) )[image.width * y + x];
+                data[idx * images.maxWidth * images.maxHeight + y * images.maxWidth + x] = rgb;
             }
         }
     }
@@ -113,23 +115,21 @@ GLuint CreateOutputTextureAndBind( int width, int height )
     return textureId;
 }
 
-void SaveScreenshot()
+GLuint CreateFeatureTextureAndBind( int width, int height, int imageUnit )
 {
-    const int w         = Dvar_GetInt( wnd_width );
-    const int h         = Dvar_GetInt( wnd_height );
-    unsigned char* data = static_cast<unsigned char*>( calloc( 1, w * h * 4 ) );
-    if ( !data )
-    {
-        return;
-    }
-
-    glReadPixels( 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, data );
-    WritePng( "my.png", data, w, h, 3 );
-    free( data );
+    GLuint textureId;
+    glCreateTextures( GL_TEXTURE_2D, 1, &textureId );
+    glTextureParameteri( textureId, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTextureParameteri( textureId, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTextureStorage2D( textureId, 1, GL_RGBA32F, width, height );
+    glClearTexImage( textureId, 0, GL_RGBA, GL_FLOAT, nullptr );
+    glBindImageTexture( imageUnit, textureId, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F );
+    return textureId;
 }
 
 GLuint CreateEnvTexture( const char* path, Image& outImage )
 {
+    PROFILE_ZONE( "CreateEnvTexture" );
     outImage = ReadHDRImage( path );
     GLenum imageFormat;
     switch ( outImage.channel )
@@ -4,12 +4,14 @@
 
 #include "glad/glad.h"
 #include "image.h"
+#include "utility/profiler.h"
 
 namespace pt::gl {
 
 template<typename T>
-GLuint CreateSSBO( const std::vector<T> buffer )
+GLuint CreateSSBO( const std::vector<T>& buffer )
 {
+    PROFILE_ZONE( "CreateSSBO" );
     const size_t sizeInByte = sizeof( T ) * buffer.size();
     GLuint ssbo;
     glGenBuffers( 1, &ssbo );
@@ -19,6 +21,13 @@ GLuint CreateSSBO( const std::vector<T> buffer )
     return ssbo;
 }
 
+/// overwrites count elements from first on of an ssbo created from a buffer of the same size
+template<typename T>
+void UpdateSSBO( GLuint ssbo, const std::vector<T>& buffer, size_t first, size_t count )
+{
+    glNamedBufferSubData( ssbo, static_cast<GLintptr>( sizeof( T ) * first ), static_cast<GLsizeiptr>( sizeof( T ) * count ), buffer.data() + first );
+}
+
 void BindSSBOToSlot( GLuint ssbo, GLuint slot );
 
 void CreateQuadVao( GLuint& outVao, GLuint& outVbo );
@@ -27,10 +36,12 @@ GLuint Create3DTexture( const ImageArray& images );
 
 GLuint CreateOutputTextureAndBind( int width, int height );
 
+/// zero initialized rgba32f image for the feature buffers, bound read-write to imageUnit
+/// without touching the texture unit bindings
+GLuint CreateFeatureTextureAndBind( int width, int height, int imageUnit );
+
 GLuint CreateEnvTexture( const char* path, Image& outImage );
 
 GLuint CreateEnvTexture( const std::string& path, Image& outImage );
 
-void SaveScreenshot();
-
 }  // namespace pt::gl
@@ -0,0 +1,132 @@
+#include "gpu_timer.h"
+
+#include "universal/core_assert.h"
+
+namespace pt::gl {
+
+GpuTimerRing::~GpuTimerRing()
+{
+    core_assert( m_slots.empty() && "Finalize() must be called while the context is alive" );
+}
+
+void GpuTimerRing::Initialize( int ringSize, int maxPasses )
+{
+    core_assert( ringSize > 0 && maxPasses > 0 );
+    m_slots.resize( ringSize );
+    for ( Slot& slot : m_slots )
+    {
+        slot.queries.resize( maxPasses );
+        slot.names.resize( maxPasses );
+        glGenQueries( maxPasses, slot.queries.data() );
+    }
+    m_current = static_cast<int>( m_slots.size() ) - 1;
+}
+
+void GpuTimerRing::Finalize( FrameTimeline& timeline )
+{
+    End();
+    m_recording     = false;
+    const int count = static_cast<int>( m_slots.size() );
+    for ( int i = 1; i <= count; ++i )
+    {
+        Collect( m_slots[( m_current + i ) % count], timeline, true );
+    }
+
+    for ( Slot& slot : m_slots )
+    {
+        glDeleteQueries( static_cast<GLsizei>( slot.queries.size() ), slot.queries.data() );
+    }
+    m_slots.clear();
+}
+
+bool GpuTimerRing::Collect( Slot& slot, FrameTimeline& timeline, bool wait )
+{
+    if ( !slot.pending )
+    {
+        return true;
+    }
+
+    // queries finish in order, the last one being available means all of them are
+    if ( !wait )
+    {
+        GLint available = 0;
+        glGetQueryObjectiv( slot.queries[slot.used - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+        if ( !available )
+        {
+            return false;
+        }
+    }
+
+    int64_t startNs = slot.startNs;
+    for ( int i = 0; i < slot.used; ++i )
+    {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v( slot.queries[i], GL_QUERY_RESULT, &elapsed );
+        timeline.Add( slot.names[i], TimerTrack_Gpu, slot.frame, startNs, static_cast<int64_t>( elapsed ) );
+        startNs += static_cast<int64_t>( elapsed );
+    }
+    slot.pending = false;
+    return true;
+}
+
+void GpuTimerRing::BeginFrame( FrameTimeline& timeline )
+{
+    if ( m_slots.empty() )
+    {
+        return;
+    }
+
+    End();
+    const int count = static_cast<int>( m_slots.size() );
+    for ( int i = 1; i <= count; ++i )
+    {
+        if ( !Collect( m_slots[( m_current + i ) % count], timeline, false ) )
+        {
+            break;
+        }
+    }
+
+    m_current   = ( m_current + 1 ) % count;
+    Slot& slot  = m_slots[m_current];
+    m_recording = !slot.pending;
+    if ( !m_recording )
+    {
+        ++m_dropped;
+        return;
+    }
+
+    slot.used    = 0;
+    slot.frame   = timeline.GetFrame();
+    slot.startNs = timeline.Now();
+}
+
+void GpuTimerRing::Begin( const char* name )
+{
+    End();
+    if ( !m_recording )
+    {
+        return;
+    }
+
+    Slot& slot = m_slots[m_current];
+    if ( slot.used == static_cast<int>( slot.queries.size() ) )
+    {
+        return;
+    }
+
+    slot.names[slot.used] = name;
+    glBeginQuery( GL_TIME_ELAPSED, slot.queries[slot.used++] );
+    slot.pending = true;
+    m_open       = true;
+}
+
+void GpuTimerRing::End()
+{
+    if ( m_open )
+    {
+        glEndQuery( GL_TIME_ELAPSED );
+        m_open = false;
+    }
+}
+
+}  // namespace pt::gl
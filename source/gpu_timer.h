@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+
+#include "frame_timer.h"
+#include "glad/glad.h"
+
+namespace pt::gl {
+
+/// GL_TIME_ELAPSED queries around the passes of a frame. Every frame records into
+/// the next slot of a ring and a slot is only read once the driver reports its last
+/// query available, so the render thread never waits on the gpu. A frame whose slot
+/// is still in flight is not timed. Elapsed queries can not nest, passes are sequential
+class GpuTimerRing {
+   public:
+    ~GpuTimerRing();
+
+    void Initialize( int ringSize, int maxPasses );
+    /// waits for the frames in flight, adds them to the timeline and deletes the queries
+    void Finalize( FrameTimeline& timeline );
+
+    /// adds every finished frame to the timeline and starts recording the current one
+    void BeginFrame( FrameTimeline& timeline );
+
+    void Begin( const char* name );
+    void End();
+
+    int GetDropped() const { return m_dropped; }
+
+   private:
+    struct Slot {
+        std::vector<GLuint> queries;
+        std::vector<const char*> names;
+        int used        = 0;
+        int frame       = 0;
+        int64_t startNs = 0;  // cpu time the frame began, gpu passes are laid out from there
+        bool pending    = false;
+    };
+
+    bool Collect( Slot& slot, FrameTimeline& timeline, bool wait );
+
+    std::vector<Slot> m_slots;
+    int m_current    = 0;
+    bool m_recording = false;
+    bool m_open      = false;
+    int m_dropped    = 0;
+};
+
+}  // namespace pt::gl
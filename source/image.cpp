@@ -1,8 +1,17 @@
 #include "image.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 #include "com_file.h"
+#include "geomath/geometry.h"
+#include "utility/memory_stats.h"
+#include "utility/profiler.h"
 #include "utility/string_util.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -14,20 +23,524 @@
 namespace pt {
 
 using std::runtime_error;
+using std::string;
+using std::vector;
 
-void WritePng( const char* path, const void* data, int width, int height, int component )
+bool WritePng( const char* path, const void* data, int width, int height, int component )
 {
     stbi_flip_vertically_on_write( true );
-    stbi_write_png( path, width, height, component, data, component * width );
+    return stbi_write_png( path, width, height, component, data, component * width ) != 0;
 }
 
-void WritePng( const std::string& path, const void* data, int width, int height, int component )
+bool WritePng( const std::string& path, const void* data, int width, int height, int component )
 {
-    WritePng( path.c_str(), data, width, height, component );
+    return WritePng( path.c_str(), data, width, height, component );
+}
+
+//------------------------------------------------------------------------------
+// HDR formats
+//------------------------------------------------------------------------------
+static const char* s_hdrFormatNames[]      = { "pfm", "hdr", "exr", "exr_tiled" };
+static const char* s_hdrFormatExtensions[] = { "pfm", "hdr", "exr", "exr" };
+static_assert( sizeof( s_hdrFormatNames ) / sizeof( s_hdrFormatNames[0] ) == static_cast<int>( HdrFormat::Count ) );
+
+bool HdrFormatFromString( const char* name, HdrFormat& outFormat )
+{
+    for ( int i = 0; i < static_cast<int>( HdrFormat::Count ); ++i )
+    {
+        if ( strcmp( name, s_hdrFormatNames[i] ) == 0 )
+        {
+            outFormat = static_cast<HdrFormat>( i );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* HdrFormatExtension( HdrFormat format )
+{
+    return s_hdrFormatExtensions[static_cast<int>( format )];
+}
+
+// round to nearest even, https://gist.github.com/rygorous/2156668
+static uint16_t FloatToHalf( float value )
+{
+    constexpr uint32_t f32Infinity = 255u << 23;
+    constexpr uint32_t f16Max      = ( 127u + 16u ) << 23;
+    constexpr uint32_t denormMagic = ( ( 127u - 15u ) + ( 23u - 10u ) + 1u ) << 23;
+
+    uint32_t f;
+    memcpy( &f, &value, sizeof( f ) );
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t half;
+    if ( f >= f16Max )
+    {
+        half = f > f32Infinity ? 0x7e00 : 0x7c00;
+    }
+    else if ( f < ( 113u << 23 ) )
+    {
+        // denormals, let the fpu do the rounding
+        float tmp, magic;
+        memcpy( &tmp, &f, sizeof( tmp ) );
+        memcpy( &magic, &denormMagic, sizeof( magic ) );
+        tmp += magic;
+        memcpy( &f, &tmp, sizeof( f ) );
+        half = static_cast<uint16_t>( f - denormMagic );
+    }
+    else
+    {
+        const uint32_t mantissaOdd = ( f >> 13 ) & 1;
+        f += ( ( 15u - 127u ) << 23 ) + 0xfff;
+        f += mantissaOdd;
+        half = static_cast<uint16_t>( f >> 13 );
+    }
+
+    return half | static_cast<uint16_t>( sign >> 16 );
+}
+
+static void FloatToRgbe( const float* rgb, unsigned char* rgbe )
+{
+    const float r = glm::max( rgb[0], 0.0f );
+    const float g = glm::max( rgb[1], 0.0f );
+    const float b = glm::max( rgb[2], 0.0f );
+    const float v = glm::max( r, glm::max( g, b ) );
+    if ( v < 1e-32f )
+    {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+
+    int exponent;
+    const float scale = frexpf( v, &exponent ) * 256.0f / v;
+    rgbe[0]           = static_cast<unsigned char>( r * scale );
+    rgbe[1]           = static_cast<unsigned char>( g * scale );
+    rgbe[2]           = static_cast<unsigned char>( b * scale );
+    rgbe[3]           = static_cast<unsigned char>( exponent + 128 );
+}
+
+//------------------------------------------------------------------------------
+// EXR header, see "The OpenEXR File Layout"
+//------------------------------------------------------------------------------
+class ExrHeader {
+   public:
+    void PutInt( int32_t value ) { PutBytes( &value, sizeof( value ) ); }
+    void PutUint( uint32_t value ) { PutBytes( &value, sizeof( value ) ); }
+    void PutFloat( float value ) { PutBytes( &value, sizeof( value ) ); }
+    void PutByte( unsigned char value ) { m_data.push_back( value ); }
+    void PutString( const char* str ) { PutBytes( str, strlen( str ) + 1 ); }
+    void PutBytes( const void* data, size_t size )
+    {
+        const unsigned char* ptr = reinterpret_cast<const unsigned char*>( data );
+        m_data.insert( m_data.end(), ptr, ptr + size );
+    }
+
+    void BeginAttribute( const char* name, const char* type, int32_t size )
+    {
+        PutString( name );
+        PutString( type );
+        PutInt( size );
+    }
+
+    void PutBox( const char* name, int32_t xMin, int32_t yMin, int32_t xMax, int32_t yMax )
+    {
+        BeginAttribute( name, "box2i", 16 );
+        PutInt( xMin );
+        PutInt( yMin );
+        PutInt( xMax );
+        PutInt( yMax );
+    }
+
+    const std::vector<unsigned char>& GetData() const { return m_data; }
+
+   private:
+    std::vector<unsigned char> m_data;
+};
+
+static constexpr int EXR_CHANNEL_COUNT = 3;
+static constexpr int EXR_HALF          = 1;
+static constexpr int EXR_ONE_LEVEL     = 0;
+static constexpr int EXR_INCREASING_Y  = 0;
+static constexpr int EXR_TILED_FLAG    = 0x200;
+
+bool HdrTileWriter::OpenExr()
+{
+    const bool tiled = m_format == HdrFormat::ExrTiled;
+
+    // tiles are laid out from the top of the data window, the data window is
+    // extended above the image so the grid lines up with the bottom-up tiles
+    // the renderer produces
+    m_paddedHeight = tiled ? ( m_height + m_tileSize - 1 ) / m_tileSize * m_tileSize : m_height;
+
+    ExrHeader header;
+    header.PutUint( 20000630 );
+    header.PutInt( 2 | ( tiled ? EXR_TILED_FLAG : 0 ) );
+
+    // channels are stored in alphabetical order
+    header.BeginAttribute( "channels", "chlist", EXR_CHANNEL_COUNT * 18 + 1 );
+    for ( const char* name : { "B", "G", "R" } )
+    {
+        header.PutString( name );
+        header.PutInt( EXR_HALF );
+        header.PutUint( 0 );  // pLinear and reserved
+        header.PutInt( 1 );   // x sampling
+        header.PutInt( 1 );   // y sampling
+    }
+    header.PutByte( 0 );
+
+    header.BeginAttribute( "compression", "compression", 1 );
+    header.PutByte( 0 );
+    header.PutBox( "dataWindow", 0, m_height - m_paddedHeight, m_width - 1, m_height - 1 );
+    header.PutBox( "displayWindow", 0, 0, m_width - 1, m_height - 1 );
+    header.BeginAttribute( "lineOrder", "lineOrder", 1 );
+    header.PutByte( EXR_INCREASING_Y );
+    header.BeginAttribute( "pixelAspectRatio", "float", 4 );
+    header.PutFloat( 1.0f );
+    header.BeginAttribute( "screenWindowCenter", "v2f", 8 );
+    header.PutFloat( 0.0f );
+    header.PutFloat( 0.0f );
+    header.BeginAttribute( "screenWindowWidth", "float", 4 );
+    header.PutFloat( 1.0f );
+    if ( tiled )
+    {
+        header.BeginAttribute( "tiles", "tiledesc", 9 );
+        header.PutUint( m_tileSize );
+        header.PutUint( m_tileSize );
+        header.PutByte( EXR_ONE_LEVEL );
+    }
+    header.PutByte( 0 );
+
+    // uncompressed chunks have a fixed size, so every offset is known up front
+    // and the chunk headers can be written before any pixel arrives
+    ExrHeader chunkHeaders;
+    size_t offset = 0;
+    if ( tiled )
+    {
+        const int tilesX = ( m_width + m_tileSize - 1 ) / m_tileSize;
+        const int tilesY = m_paddedHeight / m_tileSize;
+        m_chunkOffsets.resize( static_cast<size_t>( tilesX ) * tilesY );
+        offset = header.GetData().size() + m_chunkOffsets.size() * sizeof( uint64_t );
+        for ( int ty = 0; ty < tilesY; ++ty )
+        {
+            for ( int tx = 0; tx < tilesX; ++tx )
+            {
+                const int tileWidth = glm::min( m_tileSize, m_width - tx * m_tileSize );
+                const int dataSize  = tileWidth * m_tileSize * EXR_CHANNEL_COUNT * 2;
+
+                m_chunkOffsets[static_cast<size_t>( ty ) * tilesX + tx] = offset;
+                offset += 20 + dataSize;
+            }
+        }
+    }
+    else
+    {
+        m_chunkOffsets.resize( m_height );
+        offset = header.GetData().size() + m_chunkOffsets.size() * sizeof( uint64_t );
+        for ( int y = 0; y < m_height; ++y )
+        {
+            m_chunkOffsets[y] = offset;
+            offset += 8 + m_width * EXR_CHANNEL_COUNT * 2;
+        }
+    }
+    m_fileSize = offset;
+
+    vector<uint64_t> offsetTable( m_chunkOffsets.begin(), m_chunkOffsets.end() );
+    if ( !WriteAt( 0, header.GetData().data(), header.GetData().size() ) ||
+         !WriteAt( header.GetData().size(), offsetTable.data(), offsetTable.size() * sizeof( uint64_t ) ) )
+    {
+        return false;
+    }
+
+    const int tilesX = ( m_width + m_tileSize - 1 ) / m_tileSize;
+    for ( size_t i = 0; i < m_chunkOffsets.size(); ++i )
+    {
+        ExrHeader chunk;
+        if ( tiled )
+        {
+            const int tx        = static_cast<int>( i ) % tilesX;
+            const int tileWidth = glm::min( m_tileSize, m_width - tx * m_tileSize );
+            chunk.PutInt( tx );
+            chunk.PutInt( static_cast<int>( i ) / tilesX );
+            chunk.PutInt( 0 );  // level x
+            chunk.PutInt( 0 );  // level y
+            chunk.PutInt( tileWidth * m_tileSize * EXR_CHANNEL_COUNT * 2 );
+        }
+        else
+        {
+            chunk.PutInt( static_cast<int>( i ) );
+            chunk.PutInt( m_width * EXR_CHANNEL_COUNT * 2 );
+        }
+
+        if ( !WriteAt( m_chunkOffsets[i], chunk.GetData().data(), chunk.GetData().size() ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// HdrTileWriter
+//------------------------------------------------------------------------------
+HdrTileWriter::~HdrTileWriter()
+{
+    Close();
+}
+
+bool HdrTileWriter::Open( const std::string& path, HdrFormat format, int width, int height, int tileSize )
+{
+    Close();
+
+    m_file = fopen( path.c_str(), "wb" );
+    if ( !m_file )
+    {
+        return false;
+    }
+
+    m_format   = format;
+    m_width    = width;
+    m_height   = height;
+    m_tileSize = tileSize;
+    m_ok       = true;
+
+    string header;
+    switch ( format )
+    {
+        case HdrFormat::Pfm:
+            // negative scale means little endian, rows are stored bottom to top
+            header     = va( "PF\n%d %d\n-1.0\n", width, height );
+            m_fileSize = header.size() + static_cast<size_t>( width ) * height * 3 * sizeof( float );
+            break;
+        case HdrFormat::Rgbe:
+            // flat (not run length encoded) scanlines, rows are stored top to bottom
+            header     = va( "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width );
+            m_fileSize = header.size() + static_cast<size_t>( width ) * height * 4;
+            break;
+        case HdrFormat::ExrScanline:
+        case HdrFormat::ExrTiled:
+            m_ok = OpenExr();
+            return m_ok;
+        default:
+            m_ok = false;
+            return false;
+    }
+
+    m_dataOffset = header.size();
+    m_ok         = WriteAt( 0, header.data(), header.size() );
+    return m_ok;
+}
+
+// fseek takes a long, which is 32 bit on Windows and would wrap offsets past 2 GB
+static int SeekFile( FILE* file, size_t offset )
+{
+#if defined( _WIN32 )
+    return _fseeki64( file, static_cast<__int64>( offset ), SEEK_SET );
+#else
+    return fseeko( file, static_cast<off_t>( offset ), SEEK_SET );
+#endif
+}
+
+bool HdrTileWriter::WriteAt( size_t offset, const void* data, size_t size )
+{
+    if ( SeekFile( m_file, offset ) != 0 )
+    {
+        return false;
+    }
+
+    return fwrite( data, 1, size, m_file ) == size;
+}
+
+bool HdrTileWriter::WriteTile( int x, int y, int width, int height, const float* rgb )
+{
+    if ( !m_file || !m_ok )
+    {
+        return false;
+    }
+
+    switch ( m_format )
+    {
+        case HdrFormat::Pfm:
+            for ( int row = 0; row < height && m_ok; ++row )
+            {
+                const size_t offset = m_dataOffset + ( static_cast<size_t>( y + row ) * m_width + x ) * 3 * sizeof( float );
+                m_ok                = WriteAt( offset, rgb + static_cast<size_t>( row ) * width * 3, width * 3 * sizeof( float ) );
+            }
+            break;
+        case HdrFormat::Rgbe:
+            m_scratch.resize( static_cast<size_t>( width ) * 4 );
+            for ( int row = 0; row < height && m_ok; ++row )
+            {
+                const float* src = rgb + static_cast<size_t>( row ) * width * 3;
+                for ( int i = 0; i < width; ++i )
+                {
+                    FloatToRgbe( src + 3 * i, m_scratch.data() + 4 * i );
+                }
+
+                const size_t offset = m_dataOffset + ( static_cast<size_t>( m_height - 1 - y - row ) * m_width + x ) * 4;
+                m_ok                = WriteAt( offset, m_scratch.data(), m_scratch.size() );
+            }
+            break;
+        case HdrFormat::ExrScanline:
+            m_ok = WriteExrScanlineTile( x, y, width, height, rgb );
+            break;
+        case HdrFormat::ExrTiled:
+            m_ok = WriteExrTile( x, y, width, height, rgb );
+            break;
+        default:
+            m_ok = false;
+            break;
+    }
+
+    return m_ok;
+}
+
+bool HdrTileWriter::WriteExrScanlineTile( int x, int y, int width, int height, const float* rgb )
+{
+    // a scanline block is B[width], G[width], R[width], the tile fills a span of each
+    m_scratch.resize( static_cast<size_t>( width ) * sizeof( uint16_t ) );
+    uint16_t* span = reinterpret_cast<uint16_t*>( m_scratch.data() );
+    for ( int row = 0; row < height; ++row )
+    {
+        const float* src      = rgb + static_cast<size_t>( row ) * width * 3;
+        const size_t scanline = m_chunkOffsets[m_height - 1 - y - row] + 8;
+        for ( int channel = 0; channel < EXR_CHANNEL_COUNT; ++channel )
+        {
+            for ( int i = 0; i < width; ++i )
+            {
+                span[i] = FloatToHalf( src[3 * i + 2 - channel] );
+            }
+
+            const size_t offset = scanline + ( static_cast<size_t>( channel ) * m_width + x ) * sizeof( uint16_t );
+            if ( !WriteAt( offset, span, width * sizeof( uint16_t ) ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool HdrTileWriter::WriteExrTile( int x, int y, int width, int height, const float* rgb )
+{
+    if ( x % m_tileSize || y % m_tileSize )
+    {
+        return false;
+    }
+
+    const int tilesX = ( m_width + m_tileSize - 1 ) / m_tileSize;
+    const int tilesY = m_paddedHeight / m_tileSize;
+    const int tx     = x / m_tileSize;
+    const int ty     = tilesY - 1 - y / m_tileSize;
+
+    // the tile block covers m_tileSize lines top to bottom, lines above the image are padding
+    const int tileWidth   = glm::min( m_tileSize, m_width - x );
+    const size_t lineSize = static_cast<size_t>( tileWidth ) * EXR_CHANNEL_COUNT;
+    m_scratch.assign( lineSize * m_tileSize * sizeof( uint16_t ), 0 );
+    uint16_t* dst = reinterpret_cast<uint16_t*>( m_scratch.data() );
+    for ( int line = 0; line < m_tileSize; ++line )
+    {
+        const int row = m_tileSize - 1 - line;
+        if ( row >= height )
+        {
+            continue;
+        }
+
+        const float* src = rgb + static_cast<size_t>( row ) * width * 3;
+        uint16_t* out    = dst + line * lineSize;
+        for ( int channel = 0; channel < EXR_CHANNEL_COUNT; ++channel )
+        {
+            for ( int i = 0; i < glm::min( width, tileWidth ); ++i )
+            {
+                out[channel * tileWidth + i] = FloatToHalf( src[3 * i + 2 - channel] );
+            }
+        }
+    }
+
+    return WriteAt( m_chunkOffsets[static_cast<size_t>( ty ) * tilesX + tx] + 20, m_scratch.data(), m_scratch.size() );
+}
+
+bool HdrTileWriter::Close()
+{
+    if ( !m_file )
+    {
+        return m_ok;
+    }
+
+    m_ok   = ( fclose( m_file ) == 0 ) && m_ok;
+    m_file = nullptr;
+    m_chunkOffsets.clear();
+    m_scratch.clear();
+    return m_ok;
+}
+
+bool WriteHdrImage( const std::string& path, HdrFormat format, const float* rgb, int width, int height )
+{
+    constexpr int tileSize = 64;
+
+    HdrTileWriter writer;
+    if ( !writer.Open( path, format, width, height, tileSize ) )
+    {
+        return false;
+    }
+
+    if ( format != HdrFormat::ExrTiled )
+    {
+        writer.WriteTile( 0, 0, width, height, rgb );
+        return writer.Close();
+    }
+
+    vector<float> tile;
+    for ( int y = 0; y < height; y += tileSize )
+    {
+        for ( int x = 0; x < width; x += tileSize )
+        {
+            const int tileWidth  = glm::min( tileSize, width - x );
+            const int tileHeight = glm::min( tileSize, height - y );
+            tile.resize( static_cast<size_t>( tileWidth ) * tileHeight * 3 );
+            for ( int row = 0; row < tileHeight; ++row )
+            {
+                const float* src = rgb + ( static_cast<size_t>( y + row ) * width + x ) * 3;
+                std::copy( src, src + tileWidth * 3, tile.data() + static_cast<size_t>( row ) * tileWidth * 3 );
+            }
+            writer.WriteTile( x, y, tileWidth, tileHeight, tile.data() );
+        }
+    }
+
+    return writer.Close();
+}
+
+// counts the decoded data, which is released again when it would exceed the memory budget
+static void TrackImage( Image& image )
+{
+    try
+    {
+        MemAlloc( MemTag_Images, image.sizeInByte );
+    }
+    catch ( ... )
+    {
+        free( image.data );
+        image.data = nullptr;
+        throw;
+    }
+}
+
+void FreeImage( Image& image )
+{
+    if ( image.data )
+    {
+        MemFree( MemTag_Images, image.sizeInByte );
+        free( image.data );
+        image.data = nullptr;
+    }
 }
 
 Image ReadImage( const char* path )
 {
+    PROFILE_ZONE( "ReadImage" );
     Image image;
     unsigned char* data = stbi_load( path, &image.width, &image.height, &image.channel, 3 );
     if ( !data )
@@ -43,6 +556,7 @@ Image ReadImage( const char* path )
     image.data       = data;
     image.sizeInByte = sizeof( unsigned char ) * image.width * image.height * image.channel;
     image.type       = Image::R8G8B8;
+    TrackImage( image );
     return image;
 }
 
@@ -53,6 +567,7 @@ Image ReadImage( const std::string& path )
 
 Image ReadHDRImage( const char* path )
 {
+    PROFILE_ZONE( "ReadHDRImage" );
     Image image;
     float* data = stbi_loadf( path, &image.width, &image.height, &image.channel, 0 );
     if ( !data )
@@ -63,6 +578,7 @@ Image ReadHDRImage( const char* path )
     image.data       = data;
     image.sizeInByte = sizeof( float ) * image.width * image.height * image.channel;
     image.type       = Image::Float;
+    TrackImage( image );
     return image;
 }
 
@@ -71,4 +587,64 @@ Image ReadHDRImage( const std::string& path )
     return ReadHDRImage( path.c_str() );
 }
 
+Image ReadPfm( const std::string& path )
+{
+    FILE* file = fopen( path.c_str(), "rb" );
+    if ( !file )
+    {
+        throw runtime_error( va( "Failed to open image '%s'", path.c_str() ) );
+    }
+
+    char magic[3] = {};
+    int width = 0, height = 0;
+    float scale = 0.0f;
+    // a single whitespace character separates the header from the pixels
+    if ( fscanf( file, "%2s %d %d %f", magic, &width, &height, &scale ) != 4 || fgetc( file ) == EOF ||
+         ( strcmp( magic, "PF" ) && strcmp( magic, "Pf" ) ) || width <= 0 || height <= 0 || scale == 0.0f )
+    {
+        fclose( file );
+        throw runtime_error( va( "Failed to read pfm header of '%s'", path.c_str() ) );
+    }
+
+    const int channel  = magic[1] == 'F' ? 3 : 1;
+    const size_t count = static_cast<size_t>( width ) * height;
+    vector<float> pixels( count * channel );
+    const bool ok = fread( pixels.data(), sizeof( float ), pixels.size(), file ) == pixels.size();
+    fclose( file );
+    if ( !ok )
+    {
+        throw runtime_error( va( "Failed to read pixels of '%s'", path.c_str() ) );
+    }
+
+    // positive scale means big endian
+    if ( scale > 0.0f )
+    {
+        for ( float& value : pixels )
+        {
+            uint32_t bits;
+            memcpy( &bits, &value, sizeof( bits ) );
+            bits = ( bits >> 24 ) | ( ( bits >> 8 ) & 0xff00u ) | ( ( bits << 8 ) & 0xff0000u ) | ( bits << 24 );
+            memcpy( &value, &bits, sizeof( bits ) );
+        }
+    }
+
+    Image image;
+    image.width      = width;
+    image.height     = height;
+    image.channel    = 3;
+    image.sizeInByte = sizeof( float ) * count * 3;
+    image.type       = Image::Float;
+    image.data       = malloc( image.sizeInByte );
+    TrackImage( image );
+    float* data      = reinterpret_cast<float*>( image.data );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        for ( int c = 0; c < 3; ++c )
+        {
+            data[3 * i + c] = pixels[i * channel + ( channel == 3 ? c : 0 )];
+        }
+    }
+    return image;
+}
+
 }  // namespace pt
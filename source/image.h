@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -14,7 +15,7 @@ struct Image {
     int channel;
     size_t sizeInByte;
     Type type;
-    void* data;
+    void* data = nullptr;
     std::string debugName;
 };
 
@@ -24,10 +25,64 @@ struct ImageArray {
     int maxHeight = 0;
 };
 
-void WritePng( const char* path, const void* data, int width, int height, int component );
+bool WritePng( const char* path, const void* data, int width, int height, int component );
 
-void WritePng( const std::string& path, const void* data, int width, int height, int component );
+bool WritePng( const std::string& path, const void* data, int width, int height, int component );
 
+enum class HdrFormat {
+    Pfm,
+    Rgbe,
+    ExrScanline,
+    ExrTiled,
+    Count,
+};
+
+/// "pfm", "hdr", "exr" or "exr_tiled"
+bool HdrFormatFromString( const char* name, HdrFormat& outFormat );
+
+const char* HdrFormatExtension( HdrFormat format );
+
+/// streams linear rgb tiles straight to their place in the file, so tiles can be
+/// written in any order as they finish without keeping a copy of the frame,
+/// EXR is written uncompressed in half float, one scanline per block or one block per tile
+class HdrTileWriter {
+   public:
+    HdrTileWriter() = default;
+    ~HdrTileWriter();
+    HdrTileWriter( const HdrTileWriter& ) = delete;
+    HdrTileWriter& operator=( const HdrTileWriter& ) = delete;
+
+    bool Open( const std::string& path, HdrFormat format, int width, int height, int tileSize );
+    /// rgb holds width * height pixels, rows bottom to top like the accumulation buffer,
+    /// x and y must lie on the tile grid given to Open
+    bool WriteTile( int x, int y, int width, int height, const float* rgb );
+    bool Close();
+
+    inline size_t GetFileSize() const { return m_fileSize; }
+
+   private:
+    bool WriteAt( size_t offset, const void* data, size_t size );
+    bool OpenExr();
+    bool WriteExrScanlineTile( int x, int y, int width, int height, const float* rgb );
+    bool WriteExrTile( int x, int y, int width, int height, const float* rgb );
+
+    FILE* m_file = nullptr;
+    HdrFormat m_format;
+    int m_width         = 0;
+    int m_height        = 0;
+    int m_tileSize      = 0;
+    int m_paddedHeight  = 0;  // tiled EXR: height rounded up to whole tiles, padding is above the image
+    size_t m_dataOffset = 0;
+    size_t m_fileSize   = 0;
+    std::vector<size_t> m_chunkOffsets;
+    std::vector<unsigned char> m_scratch;
+    bool m_ok = false;
+};
+
+/// writes a whole linear rgb image with HdrTileWriter
+bool WriteHdrImage( const std::string& path, HdrFormat format, const float* rgb, int width, int height );
+
+/// the readers count their data in MemTag_Images, release it with FreeImage
 Image ReadImage( const char* path );
 
 Image ReadImage( const std::string& path );
@@ -36,4 +91,10 @@ Image ReadHDRImage( const char* path );
 
 Image ReadHDRImage( const std::string& path );
 
+/// rgb or grayscale pfm as 3 channel float, rows bottom to top like the file
+Image ReadPfm( const std::string& path );
+
+/// frees the data of an image returned by the readers above, safe to call twice
+void FreeImage( Image& image );
+
 }  // namespace pt
@@ -5,12 +5,18 @@
 
 #include "../third_party/imgui/imgui.h"
 #include "application.h"
+#include "batch.h"
 #include "camera.h"
+#include "com_dvars.h"
 #include "com_misc.h"
 #include "constant_cache.h"
+#include "distributed.h"
 #include "glutil.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "universal/dvar_api.h"
+#include "utility/memory_stats.h"
+#include "utility/profiler.h"
 #include "viewer.h"
 
 using namespace pt;
@@ -20,7 +26,27 @@ static Viewer g_viewer;
 int main( int argc, const char** argv )
 {
     Com_RegisterDvars();
-    Com_ProcessCmdLine( argc - 1, argv + 1 );
+    const bool cmdLineOk = Com_ProcessCmdLine( argc - 1, argv + 1 );
+
+    if ( Dvar_GetString( profile )[0] )
+    {
+        ProfilerStart( Dvar_GetString( profile ) );
+    }
+    SetMemBudget( static_cast<int64_t>( Dvar_GetInt( mem_budget ) ) << 20 );
+
+    if ( Dvar_GetInt( worker ) > 0 )
+    {
+        const int code = cmdLineOk ? RunWorker() : BatchExit_InvalidArgs;
+        ProfilerFinalize();
+        return code;
+    }
+
+    if ( Dvar_GetBool( batch ) )
+    {
+        const int code = cmdLineOk ? RunBatch() : BatchExit_InvalidArgs;
+        ProfilerFinalize();
+        return code;
+    }
 
     try
     {
@@ -36,8 +62,10 @@ int main( int argc, const char** argv )
     catch ( std::runtime_error& err )
     {
         printf( "Exception: %s\n", err.what() );
+        ProfilerFinalize();
         return 1;
     }
 
+    ProfilerFinalize();
     return 0;
 }
@@ -0,0 +1,236 @@
+#include "postprocess.h"
+
+#include <cstring>
+
+#include "com_dvars.h"
+#include "postprocess_kernel.h"
+#include "universal/dvar_api.h"
+#include "utility/parallel.h"
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+namespace pt {
+
+static const char* s_tonemapOperatorNames[] = { "linear", "aces", "reinhard" };
+static const char* s_tonemapKernelNames[]   = { "reference", "sse2", "avx2" };
+static const char* s_aovViewNames[]         = { "color", "albedo", "normal", "depth", "material", "primitive", "heat" };
+static_assert( sizeof( s_tonemapOperatorNames ) / sizeof( s_tonemapOperatorNames[0] ) == static_cast<int>( TonemapOperator::Count ) );
+static_assert( sizeof( s_tonemapKernelNames ) / sizeof( s_tonemapKernelNames[0] ) == static_cast<int>( TonemapKernel::Count ) );
+static_assert( sizeof( s_aovViewNames ) / sizeof( s_aovViewNames[0] ) == static_cast<int>( AovView::Count ) );
+
+TonemapSettings TonemapSettingsFromDvars()
+{
+    TonemapSettings settings;
+    settings.exposure = Dvar_GetFloat( exposure );
+    settings.op       = static_cast<TonemapOperator>( glm::clamp( Dvar_GetInt( tonemap ), 0, static_cast<int>( TonemapOperator::Count ) - 1 ) );
+    settings.dither   = Dvar_GetBool( dither );
+    return settings;
+}
+
+const char* TonemapOperatorToString( TonemapOperator op )
+{
+    return s_tonemapOperatorNames[static_cast<int>( op )];
+}
+
+const char* TonemapKernelToString( TonemapKernel kernel )
+{
+    return s_tonemapKernelNames[static_cast<int>( kernel )];
+}
+
+const char* AovViewToString( AovView view )
+{
+    return s_aovViewNames[static_cast<int>( view )];
+}
+
+bool AovViewFromString( const char* name, AovView& outView )
+{
+    for ( int i = 0; i < static_cast<int>( AovView::Count ); ++i )
+    {
+        if ( strcmp( name, s_aovViewNames[i] ) == 0 )
+        {
+            outView = static_cast<AovView>( i );
+            return true;
+        }
+    }
+    return false;
+}
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+static bool CpuSupportsAvx2()
+{
+#if defined( _MSC_VER )
+    int info[4];
+    __cpuid( info, 1 );
+    const bool fma     = ( info[2] & ( 1 << 12 ) ) != 0;
+    const bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+    __cpuidex( info, 7, 0 );
+    const bool avx2 = ( info[1] & ( 1 << 5 ) ) != 0;
+    // the os must save the ymm registers
+    return fma && osxsave && avx2 && ( _xgetbv( 0 ) & 0x6 ) == 0x6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#endif
+}
+#endif
+
+TonemapKernel GetBestTonemapKernel()
+{
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    static const TonemapKernel s_kernel = CpuSupportsAvx2() ? TonemapKernel::Avx2 : TonemapKernel::Sse2;
+    return s_kernel;
+#else
+    return TonemapKernel::Reference;
+#endif
+}
+
+// ACES tone mapping curve fit to go from HDR to LDR
+// https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+vec3 ACESFilm( const vec3& x )
+{
+    constexpr float a = 2.51f;
+    constexpr float b = 0.03f;
+    constexpr float c = 2.43f;
+    constexpr float d = 0.59f;
+    constexpr float e = 0.14f;
+    return glm::clamp( ( x * ( a * x + b ) ) / ( x * ( c * x + d ) + e ), 0.0f, 1.0f );
+}
+
+vec3 Reinhard( const vec3& x )
+{
+    const vec3 positive = glm::max( x, vec3( 0.0f ) );
+    return positive / ( vec3( 1.0f ) + positive );
+}
+
+vec3 LinearToSRGB( const vec3& rgb )
+{
+    vec3 result;
+    for ( int i = 0; i < 3; ++i )
+    {
+        const float c = glm::clamp( rgb[i], 0.0f, 1.0f );
+        result[i]     = c < 0.0031308f ? c * 12.92f : glm::pow( c, 1.0f / 2.4f ) * 1.055f - 0.055f;
+    }
+    return result;
+}
+
+// lowbias32, https://nullprogram.com/blog/2018/07/31/
+static uint32_t DitherHash( uint32_t x )
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float DitherOffset( int x, int y )
+{
+    const uint32_t hash = DitherHash( static_cast<uint32_t>( x ) ^ DitherHash( static_cast<uint32_t>( y ) ) );
+    return static_cast<float>( hash >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+vec3 HeatColor( float t )
+{
+    const float x = 4.0f * glm::clamp( t, 0.0f, 1.0f );
+    return glm::clamp( vec3( 1.5f ) - glm::abs( vec3( x - 3.0f, x - 2.0f, x - 1.0f ) ), 0.0f, 1.0f );
+}
+
+vec3 IdColor( int id )
+{
+    if ( id < 0 )
+    {
+        return vec3( 0.0f );
+    }
+    const uint32_t hash = DitherHash( static_cast<uint32_t>( id ) + 1u );
+    return vec3( static_cast<float>( hash & 255u ), static_cast<float>( ( hash >> 8 ) & 255u ), static_cast<float>( ( hash >> 16 ) & 255u ) ) / 255.0f;
+}
+
+void ResolveAccumulation( const std::vector<vec4>& accum, std::vector<float>& outRgb )
+{
+    outRgb.resize( accum.size() * 3 );
+    for ( size_t i = 0; i < accum.size(); ++i )
+    {
+        const vec4& pixel  = accum[i];
+        const float weight = pixel.a > 0.0f ? 1.0f / pixel.a : 0.0f;
+        outRgb[3 * i + 0]  = pixel.r * weight;
+        outRgb[3 * i + 1]  = pixel.g * weight;
+        outRgb[3 * i + 2]  = pixel.b * weight;
+    }
+}
+
+static void TonemapSpanReference( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out )
+{
+    for ( int i = 0; i + 2 < count; i += 3 )
+    {
+        vec3 color = exposure * vec3( rgb[i], rgb[i + 1], rgb[i + 2] );
+        switch ( op )
+        {
+            case TonemapOperator::Aces:
+                color = ACESFilm( color );
+                break;
+            case TonemapOperator::Reinhard:
+                color = Reinhard( color );
+                break;
+            default:
+                break;
+        }
+        color = LinearToSRGB( color );
+        for ( int c = 0; c < 3; ++c )
+        {
+            out[i + c] = static_cast<unsigned char>( color[c] * 255.0f + offsets[i + c] );
+        }
+    }
+}
+
+void Tonemap( const std::vector<float>& rgb, int width, const TonemapSettings& settings, std::vector<unsigned char>& outRgb8,
+              int numThreads, TonemapKernel kernel )
+{
+    using SpanFunc = void ( * )( const float*, const float*, int, float, TonemapOperator, unsigned char* );
+    SpanFunc span  = TonemapSpanReference;
+#if defined( __x86_64__ ) || defined( _M_X64 )
+    if ( kernel == TonemapKernel::Sse2 )
+    {
+        span = simd::TonemapSpanSse2;
+    }
+    else if ( kernel == TonemapKernel::Avx2 )
+    {
+        span = simd::TonemapSpanAvx2;
+    }
+#endif
+
+    outRgb8.resize( rgb.size() );
+    const int rowSize = width * 3;
+    const int height  = rowSize ? static_cast<int>( rgb.size() / rowSize ) : 0;
+
+    // without dithering every value is rounded to nearest like the unorm8 back buffer
+    std::vector<float> roundOffsets;
+    if ( !settings.dither )
+    {
+        roundOffsets.assign( rowSize, 0.5f );
+    }
+
+    ParallelFor( height, numThreads, [&]( int y ) {
+        const float* offsets = roundOffsets.data();
+        thread_local std::vector<float> ditherOffsets;
+        if ( settings.dither )
+        {
+            ditherOffsets.resize( rowSize );
+            for ( int x = 0; x < width; ++x )
+            {
+                const float offset       = DitherOffset( x, y );
+                ditherOffsets[3 * x + 0] = offset;
+                ditherOffsets[3 * x + 1] = offset;
+                ditherOffsets[3 * x + 2] = offset;
+            }
+            offsets = ditherOffsets.data();
+        }
+
+        const size_t row = static_cast<size_t>( y ) * rowSize;
+        span( rgb.data() + row, offsets, rowSize, settings.exposure, settings.op, outRgb8.data() + row );
+    } );
+}
+
+}  // namespace pt
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+
+#include "geomath/geometry.h"
+
+namespace pt {
+
+/// CPU twin of data/shaders/fullscreen.frag and color.glsl
+static constexpr float DEFAULT_EXPOSURE = 0.5f;
+
+/// matches TONEMAP_* in color.glsl
+enum class TonemapOperator {
+    Linear,
+    Aces,
+    Reinhard,
+    Count,
+};
+
+struct TonemapSettings {
+    float exposure     = DEFAULT_EXPOSURE;
+    TonemapOperator op = TonemapOperator::Aces;
+    bool dither        = false;
+};
+
+enum class TonemapKernel {
+    Reference,  // straight port of the shader formulas
+    Sse2,
+    Avx2,
+    Count,
+};
+
+/// matches AOV_* in fullscreen.frag
+enum class AovView {
+    Color,
+    Albedo,
+    Normal,
+    Depth,
+    Material,
+    Primitive,
+    Heat,  // bvh nodes tested per camera ray
+    Count,
+};
+
+/// reads the exposure, tonemap and dither dvars
+TonemapSettings TonemapSettingsFromDvars();
+
+const char* TonemapOperatorToString( TonemapOperator op );
+
+const char* TonemapKernelToString( TonemapKernel kernel );
+
+const char* AovViewToString( AovView view );
+
+/// "color", "albedo", "normal", "depth", "material", "primitive" or "heat"
+bool AovViewFromString( const char* name, AovView& outView );
+
+/// widest kernel supported by the cpu
+TonemapKernel GetBestTonemapKernel();
+
+vec3 ACESFilm( const vec3& x );
+
+vec3 Reinhard( const vec3& x );
+
+vec3 LinearToSRGB( const vec3& rgb );
+
+/// per pixel offset added before truncating to 8 bit, same hash as Dither in color.glsl
+float DitherOffset( int x, int y );
+
+/// blue to red ramp for t in [0, 1], same as HeatColor in color.glsl
+vec3 HeatColor( float t );
+
+/// stable false color per material or primitive id, black for -1 (the camera ray escaped)
+vec3 IdColor( int id );
+
+/// divides an accumulation buffer by its sample count (alpha) into linear rgb
+void ResolveAccumulation( const std::vector<vec4>& accum, std::vector<float>& outRgb );
+
+/// exposure, tone mapping, sRGB encoding and optional dithering to 8 bit rgb,
+/// rows are split over numThreads threads (0 means one per hardware thread)
+void Tonemap( const std::vector<float>& rgb, int width, const TonemapSettings& settings, std::vector<unsigned char>& outRgb8,
+              int numThreads = 0, TonemapKernel kernel = GetBestTonemapKernel() );
+
+}  // namespace pt
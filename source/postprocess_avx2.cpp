@@ -0,0 +1,74 @@
+// compiled with AVX2 and FMA enabled, only called after a cpuid check
+#include "postprocess_kernel.h"
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+
+namespace pt::simd {
+
+// internal linkage, so nothing compiled for this instruction set leaks into other translation units
+namespace {
+
+struct FloatAvx2 {
+    static constexpr int Width = 8;
+    __m256 v;
+
+    FloatAvx2( __m256 v )
+        : v( v )
+    {
+    }
+
+    static FloatAvx2 Set( float f ) { return _mm256_set1_ps( f ); }
+    static FloatAvx2 Load( const float* p ) { return _mm256_loadu_ps( p ); }
+    static void Store( float* p, FloatAvx2 x ) { _mm256_storeu_ps( p, x.v ); }
+
+    friend FloatAvx2 operator+( FloatAvx2 a, FloatAvx2 b ) { return _mm256_add_ps( a.v, b.v ); }
+    friend FloatAvx2 operator-( FloatAvx2 a, FloatAvx2 b ) { return _mm256_sub_ps( a.v, b.v ); }
+    friend FloatAvx2 operator*( FloatAvx2 a, FloatAvx2 b ) { return _mm256_mul_ps( a.v, b.v ); }
+    friend FloatAvx2 operator/( FloatAvx2 a, FloatAvx2 b ) { return _mm256_div_ps( a.v, b.v ); }
+
+    static FloatAvx2 MulAdd( FloatAvx2 a, FloatAvx2 b, FloatAvx2 c ) { return _mm256_fmadd_ps( a.v, b.v, c.v ); }
+    static FloatAvx2 Min( FloatAvx2 a, FloatAvx2 b ) { return _mm256_min_ps( a.v, b.v ); }
+    static FloatAvx2 Max( FloatAvx2 a, FloatAvx2 b ) { return _mm256_max_ps( a.v, b.v ); }
+    static __m256 Less( FloatAvx2 a, FloatAvx2 b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+    static FloatAvx2 Select( __m256 mask, FloatAvx2 a, FloatAvx2 b ) { return _mm256_blendv_ps( b.v, a.v, mask ); }
+
+    static FloatAvx2 Mantissa( FloatAvx2 x )
+    {
+        const __m256 bits = _mm256_and_ps( x.v, _mm256_castsi256_ps( _mm256_set1_epi32( 0x007fffff ) ) );
+        return _mm256_or_ps( bits, _mm256_set1_ps( 0.5f ) );
+    }
+    static FloatAvx2 Exponent( FloatAvx2 x )
+    {
+        const __m256i e = _mm256_sub_epi32( _mm256_srli_epi32( _mm256_castps_si256( x.v ), 23 ), _mm256_set1_epi32( 126 ) );
+        return _mm256_cvtepi32_ps( e );
+    }
+    static FloatAvx2 Round( FloatAvx2 x ) { return _mm256_round_ps( x.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); }
+    static FloatAvx2 Pow2( FloatAvx2 n )
+    {
+        const __m256i e = _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvtps_epi32( n.v ), _mm256_set1_epi32( 127 ) ), 23 );
+        return _mm256_castsi256_ps( e );
+    }
+
+    static void StoreU8( unsigned char* dst, FloatAvx2 x )
+    {
+        const __m256i i32 = _mm256_cvttps_epi32( x.v );
+        const __m128i i16 = _mm_packs_epi32( _mm256_castsi256_si128( i32 ), _mm256_extracti128_si256( i32, 1 ) );
+        _mm_storel_epi64( reinterpret_cast<__m128i*>( dst ), _mm_packus_epi16( i16, i16 ) );
+    }
+};
+
+}  // namespace
+
+void TonemapSpanAvx2( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out )
+{
+    TonemapSpan<FloatAvx2>( rgb, offsets, count, exposure, op, out );
+}
+
+void AtrousRowAvx2( const AtrousPass& pass, int y )
+{
+    AtrousRow<FloatAvx2>( pass, y );
+}
+
+}  // namespace pt::simd
+#endif
@@ -0,0 +1,257 @@
+#pragma once
+// tone mapping and denoising kernels shared by the SIMD translation units, each one
+// includes this file with its own vector type V, which provides
+//   Width, Set, Load, Store, + - * /, MulAdd, Min, Max, Less, Select,
+//   Exponent/Mantissa (frexp), Round and Pow2 (ldexp of 1)
+// and 8 bit truncating StoreU8
+#include <cstddef>
+
+#include "postprocess.h"
+
+namespace pt::simd {
+
+// Cephes logf, mantissa reduced to [sqrt(0.5), sqrt(2))
+template<typename V>
+inline V Log2( V x )
+{
+    V m      = V::Mantissa( x );
+    V e      = V::Exponent( x );
+    auto low = V::Less( m, V::Set( 0.707106781186547524f ) );
+    e        = V::Select( low, e - V::Set( 1.0f ), e );
+    m        = V::Select( low, m + m, m ) - V::Set( 1.0f );
+
+    const V z = m * m;
+    V y       = V::Set( 7.0376836292e-2f );
+    y         = V::MulAdd( y, m, V::Set( -1.1514610310e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( 1.1676998740e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( -1.2420140846e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( 1.4249322787e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( -1.6668057665e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( 2.0000714765e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( -2.4999993993e-1f ) );
+    y         = V::MulAdd( y, m, V::Set( 3.3333331174e-1f ) );
+    y         = y * m * z - V::Set( 0.5f ) * z;
+    return V::MulAdd( m + y, V::Set( 1.44269504088896341f ), e );
+}
+
+// Cephes exp2f, valid for |x| < 126
+template<typename V>
+inline V Exp2( V x )
+{
+    const V n = V::Round( x );
+    const V f = x - n;
+    V p       = V::Set( 1.535336188319500e-4f );
+    p         = V::MulAdd( p, f, V::Set( 1.339887440266574e-3f ) );
+    p         = V::MulAdd( p, f, V::Set( 9.618437357674640e-3f ) );
+    p         = V::MulAdd( p, f, V::Set( 5.550332471162809e-2f ) );
+    p         = V::MulAdd( p, f, V::Set( 2.402264791363012e-1f ) );
+    p         = V::MulAdd( p, f, V::Set( 6.931472028550421e-1f ) );
+    return V::MulAdd( p, f, V::Set( 1.0f ) ) * V::Pow2( n );
+}
+
+template<typename V>
+inline V Saturate( V x )
+{
+    return V::Min( V::Max( x, V::Set( 0.0f ) ), V::Set( 1.0f ) );
+}
+
+template<typename V>
+inline V ApplyOperator( V x, TonemapOperator op )
+{
+    switch ( op )
+    {
+        case TonemapOperator::Aces:
+        {
+            const V numerator   = x * V::MulAdd( V::Set( 2.51f ), x, V::Set( 0.03f ) );
+            const V denominator = V::MulAdd( x, V::MulAdd( V::Set( 2.43f ), x, V::Set( 0.59f ) ), V::Set( 0.14f ) );
+            return Saturate( numerator / denominator );
+        }
+        case TonemapOperator::Reinhard:
+            x = V::Max( x, V::Set( 0.0f ) );
+            return x / ( V::Set( 1.0f ) + x );
+        default:
+            return x;
+    }
+}
+
+template<typename V>
+inline V LinearToSRGB( V c )
+{
+    c               = Saturate( c );
+    const V encoded = V::MulAdd( Exp2( Log2( c ) * V::Set( 1.0f / 2.4f ) ), V::Set( 1.055f ), V::Set( -0.055f ) );
+    const V linear  = c * V::Set( 12.92f );
+    return V::Select( V::Less( c, V::Set( 0.0031308f ) ), linear, encoded );
+}
+
+/// rgb and offsets hold count floats, offsets are the per channel rounding offsets in [0, 1)
+template<typename V>
+void TonemapSpan( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out )
+{
+    const V scale = V::Set( exposure );
+    auto process  = [&]( const float* src, const float* offset, unsigned char* dst ) {
+        V color = V::Load( src ) * scale;
+        color   = ApplyOperator( color, op );
+        color   = LinearToSRGB( color );
+        V::StoreU8( dst, V::MulAdd( color, V::Set( 255.0f ), V::Load( offset ) ) );
+    };
+
+    int i = 0;
+    for ( ; i + V::Width <= count; i += V::Width )
+    {
+        process( rgb + i, offsets + i, out + i );
+    }
+
+    if ( i < count )
+    {
+        float src[V::Width]    = {};
+        float offset[V::Width] = {};
+        unsigned char dst[V::Width];
+        for ( int j = 0; j < count - i; ++j )
+        {
+            src[j]    = rgb[i + j];
+            offset[j] = offsets[i + j];
+        }
+        process( src, offset, dst );
+        for ( int j = 0; j < count - i; ++j )
+        {
+            out[i + j] = dst[j];
+        }
+    }
+}
+
+/// one a-trous pass of the denoiser over planar float buffers, see denoise.cpp,
+/// rows are `stride` floats with `pad` columns of zero validity on both sides,
+/// wide enough that no tap of the pass leaves its row
+struct AtrousPass {
+    int width;
+    int height;
+    int stride;
+    int step;  // 1 << iteration
+    int normalPower;  // the normal weight is cos^( 2^normalPower )
+    float sigmaDepth;
+    float invSigmaAlbedo;  // 1 / sigma_a^2
+
+    const float* valid;
+    const float* normal[3];
+    const float* depth;
+    const float* depthGradient;
+    const float* albedo[3];
+    const float* illumination[3];
+    const float* variance;
+    const float* invSigmaLuminance;  // 1 / ( sigma_l * sqrt( blurred variance ) )
+
+    float* outIllumination[3];
+    float* outVariance;
+};
+
+template<typename V>
+inline V Abs( V x )
+{
+    return V::Max( x, V::Set( 0.0f ) - x );
+}
+
+template<typename V>
+inline V Luminance( V r, V g, V b )
+{
+    return V::MulAdd( r, V::Set( 0.2126f ), V::MulAdd( g, V::Set( 0.7152f ), b * V::Set( 0.0722f ) ) );
+}
+
+/// filters row y, pixels are processed V::Width at a time and the last group may
+/// spill into the right padding, where the result is zeroed by the validity
+template<typename V>
+void AtrousRow( const AtrousPass& pass, int y )
+{
+    // B3 spline, 1/16 [1 4 6 4 1]
+    static const float kernel[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+
+    const ptrdiff_t row = static_cast<ptrdiff_t>( y ) * pass.stride;
+    for ( int x = 0; x < pass.width; x += V::Width )
+    {
+        const ptrdiff_t center = row + x;
+        const V nx             = V::Load( pass.normal[0] + center );
+        const V ny             = V::Load( pass.normal[1] + center );
+        const V nz             = V::Load( pass.normal[2] + center );
+        const V z              = V::Load( pass.depth + center );
+        const V dzdx           = V::Load( pass.depthGradient + center ) * V::Set( pass.sigmaDepth );
+        const V ar             = V::Load( pass.albedo[0] + center );
+        const V ag             = V::Load( pass.albedo[1] + center );
+        const V ab             = V::Load( pass.albedo[2] + center );
+        const V r              = V::Load( pass.illumination[0] + center );
+        const V g              = V::Load( pass.illumination[1] + center );
+        const V b              = V::Load( pass.illumination[2] + center );
+        const V l              = Luminance( r, g, b );
+        const V invSigmaL      = V::Load( pass.invSigmaLuminance + center );
+
+        // the center tap always has full weight, which keeps the sum of weights above zero
+        const V centerWeight = V::Set( kernel[2] * kernel[2] );
+        V sumWeight          = centerWeight;
+        V sumR               = r * centerWeight;
+        V sumG               = g * centerWeight;
+        V sumB               = b * centerWeight;
+        V sumVariance        = V::Load( pass.variance + center ) * centerWeight * centerWeight;
+
+        for ( int dy = -2; dy <= 2; ++dy )
+        {
+            const int yy = y + dy * pass.step;
+            if ( yy < 0 || yy >= pass.height )
+            {
+                continue;
+            }
+
+            for ( int dx = -2; dx <= 2; ++dx )
+            {
+                if ( dx == 0 && dy == 0 )
+                {
+                    continue;
+                }
+
+                const ptrdiff_t tap = static_cast<ptrdiff_t>( yy ) * pass.stride + x + dx * pass.step;
+                const float dist    = static_cast<float>( pass.step * ( glm::abs( dx ) + glm::abs( dy ) ) );
+                const V tr          = V::Load( pass.illumination[0] + tap );
+                const V tg          = V::Load( pass.illumination[1] + tap );
+                const V tb          = V::Load( pass.illumination[2] + tap );
+                const V cosNormal   = V::MulAdd( nx, V::Load( pass.normal[0] + tap ),
+                                                 V::MulAdd( ny, V::Load( pass.normal[1] + tap ), nz * V::Load( pass.normal[2] + tap ) ) );
+                const V da0         = ar - V::Load( pass.albedo[0] + tap );
+                const V da1         = ag - V::Load( pass.albedo[1] + tap );
+                const V da2         = ab - V::Load( pass.albedo[2] + tap );
+
+                // max( 0, n . n' )^sigma_n by repeated squaring
+                V normalWeight = V::Max( cosNormal, V::Set( 0.0f ) );
+                for ( int i = 0; i < pass.normalPower; ++i )
+                {
+                    normalWeight = normalWeight * normalWeight;
+                }
+
+                const V depthTerm  = Abs( z - V::Load( pass.depth + tap ) ) / V::MulAdd( dzdx, V::Set( dist ), V::Set( 1e-3f ) );
+                const V lumTerm    = Abs( l - Luminance( tr, tg, tb ) ) * invSigmaL;
+                const V albedoTerm = V::MulAdd( da0, da0, V::MulAdd( da1, da1, da2 * da2 ) ) * V::Set( pass.invSigmaAlbedo );
+                const V exponent   = V::Max( ( depthTerm + lumTerm + albedoTerm ) * V::Set( -1.44269504088896341f ), V::Set( -125.0f ) );
+                const V weight     = V::Load( pass.valid + tap ) * normalWeight * Exp2( exponent ) * V::Set( kernel[dx + 2] * kernel[dy + 2] );
+
+                sumWeight   = sumWeight + weight;
+                sumR        = V::MulAdd( tr, weight, sumR );
+                sumG        = V::MulAdd( tg, weight, sumG );
+                sumB        = V::MulAdd( tb, weight, sumB );
+                sumVariance = V::MulAdd( V::Load( pass.variance + tap ), weight * weight, sumVariance );
+            }
+        }
+
+        const V valid    = V::Load( pass.valid + center );
+        const V invSum   = valid / sumWeight;
+        V::Store( pass.outIllumination[0] + center, sumR * invSum );
+        V::Store( pass.outIllumination[1] + center, sumG * invSum );
+        V::Store( pass.outIllumination[2] + center, sumB * invSum );
+        V::Store( pass.outVariance + center, sumVariance * invSum * invSum );
+    }
+}
+
+void AtrousRowSse2( const AtrousPass& pass, int y );
+
+void AtrousRowAvx2( const AtrousPass& pass, int y );
+
+void TonemapSpanSse2( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out );
+
+void TonemapSpanAvx2( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out );
+
+}  // namespace pt::simd
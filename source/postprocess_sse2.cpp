@@ -0,0 +1,78 @@
+#include "postprocess_kernel.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+
+#include <cstring>
+
+namespace pt::simd {
+
+namespace {
+
+struct FloatSse2 {
+    static constexpr int Width = 4;
+    __m128 v;
+
+    FloatSse2( __m128 v )
+        : v( v )
+    {
+    }
+
+    static FloatSse2 Set( float f ) { return _mm_set1_ps( f ); }
+    static FloatSse2 Load( const float* p ) { return _mm_loadu_ps( p ); }
+    static void Store( float* p, FloatSse2 x ) { _mm_storeu_ps( p, x.v ); }
+
+    friend FloatSse2 operator+( FloatSse2 a, FloatSse2 b ) { return _mm_add_ps( a.v, b.v ); }
+    friend FloatSse2 operator-( FloatSse2 a, FloatSse2 b ) { return _mm_sub_ps( a.v, b.v ); }
+    friend FloatSse2 operator*( FloatSse2 a, FloatSse2 b ) { return _mm_mul_ps( a.v, b.v ); }
+    friend FloatSse2 operator/( FloatSse2 a, FloatSse2 b ) { return _mm_div_ps( a.v, b.v ); }
+
+    static FloatSse2 MulAdd( FloatSse2 a, FloatSse2 b, FloatSse2 c ) { return _mm_add_ps( _mm_mul_ps( a.v, b.v ), c.v ); }
+    static FloatSse2 Min( FloatSse2 a, FloatSse2 b ) { return _mm_min_ps( a.v, b.v ); }
+    static FloatSse2 Max( FloatSse2 a, FloatSse2 b ) { return _mm_max_ps( a.v, b.v ); }
+    static __m128 Less( FloatSse2 a, FloatSse2 b ) { return _mm_cmplt_ps( a.v, b.v ); }
+    static FloatSse2 Select( __m128 mask, FloatSse2 a, FloatSse2 b ) { return _mm_or_ps( _mm_and_ps( mask, a.v ), _mm_andnot_ps( mask, b.v ) ); }
+
+    // x = Mantissa( x ) * 2^Exponent( x ), mantissa in [0.5, 1), x must be positive and normal
+    static FloatSse2 Mantissa( FloatSse2 x )
+    {
+        const __m128 bits = _mm_and_ps( x.v, _mm_castsi128_ps( _mm_set1_epi32( 0x007fffff ) ) );
+        return _mm_or_ps( bits, _mm_set1_ps( 0.5f ) );
+    }
+    static FloatSse2 Exponent( FloatSse2 x )
+    {
+        const __m128i e = _mm_sub_epi32( _mm_srli_epi32( _mm_castps_si128( x.v ), 23 ), _mm_set1_epi32( 126 ) );
+        return _mm_cvtepi32_ps( e );
+    }
+    // round to nearest with the default rounding mode
+    static FloatSse2 Round( FloatSse2 x ) { return _mm_cvtepi32_ps( _mm_cvtps_epi32( x.v ) ); }
+    static FloatSse2 Pow2( FloatSse2 n )
+    {
+        const __m128i e = _mm_slli_epi32( _mm_add_epi32( _mm_cvtps_epi32( n.v ), _mm_set1_epi32( 127 ) ), 23 );
+        return _mm_castsi128_ps( e );
+    }
+
+    static void StoreU8( unsigned char* dst, FloatSse2 x )
+    {
+        const __m128i i32 = _mm_cvttps_epi32( x.v );
+        const __m128i i16 = _mm_packs_epi32( i32, i32 );
+        const __m128i u8  = _mm_packus_epi16( i16, i16 );
+        const int packed  = _mm_cvtsi128_si32( u8 );
+        memcpy( dst, &packed, sizeof( packed ) );
+    }
+};
+
+}  // namespace
+
+void TonemapSpanSse2( const float* rgb, const float* offsets, int count, float exposure, TonemapOperator op, unsigned char* out )
+{
+    TonemapSpan<FloatSse2>( rgb, offsets, count, exposure, op, out );
+}
+
+void AtrousRowSse2( const AtrousPass& pass, int y )
+{
+    AtrousRow<FloatSse2>( pass, y );
+}
+
+}  // namespace pt::simd
+#endif
@@ -3,8 +3,10 @@
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
+#include <utility>
 
 #include "common.h"
+#include "utility/profiler.h"
 
 namespace pt::gl {
 
@@ -86,6 +88,7 @@ Program::~Program()
 
 void Program::Create( Program::CreateInfo info )
 {
+    PROFILE_ZONE( "Program::Create" );
     assert( m_handle == NullHandle );
 
     m_handle = glCreateProgram();
@@ -112,6 +115,13 @@ void Program::Create( Program::CreateInfo info )
     }
 }
 
+void Program::Recreate( Program::CreateInfo info )
+{
+    Program program;
+    program.Create( info );
+    std::swap( m_handle, program.m_handle );
+}
+
 void Program::Link( const char *debugInfo )
 {
     glLinkProgram( m_handle );
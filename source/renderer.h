@@ -53,6 +53,8 @@ class Program : public GpuResource {
     void Use();
     void Stop();
     void Create( CreateInfo info );
+    /// replaces the program with one created from info, the current one stays when that throws
+    void Recreate( CreateInfo info );
     void Link( const char* debugInfo );
     int GetUniformLoc( const char* loc );
     int GetAttribLoc( const char* loc );
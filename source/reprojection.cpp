@@ -0,0 +1,225 @@
+#include "reprojection.h"
+
+#include <atomic>
+#include <cstdio>
+
+#include "com_dvars.h"
+#include "universal/core_assert.h"
+#include "universal/dvar_api.h"
+#include "utility/parallel.h"
+
+namespace pt {
+
+using std::string;
+using std::vector;
+
+ReprojectionSettings ReprojectionSettingsFromDvars()
+{
+    ReprojectionSettings settings;
+    settings.maxHistory = glm::max( Dvar_GetInt( reproject_max_history ), 1 );
+    settings.clampGamma = Dvar_GetFloat( reproject_clamp );
+    return settings;
+}
+
+vec3 PixelDirection( const ConstantBufferCache& camera, const vec2& pixel, int width, int height )
+{
+    const vec2 dims         = vec2( static_cast<float>( width ), static_cast<float>( height ) );
+    vec2 screen             = 2.0f * pixel / dims - 1.0f;
+    screen.y /= dims.x / dims.y;
+    const float camDistance = glm::tan( glm::radians( camera.camFov ) );
+    return glm::normalize( mat3( camera.camRight, camera.camUp, camera.camFwd ) * vec3( screen, camDistance ) );
+}
+
+bool ProjectToPixel( const ConstantBufferCache& camera, const vec3& position, int width, int height, vec2& outPixel )
+{
+    const vec3 offset = position - camera.camPos;
+    const vec3 local  = vec3( glm::dot( offset, camera.camRight ), glm::dot( offset, camera.camUp ), glm::dot( offset, camera.camFwd ) );
+    if ( local.z <= 0.0f )
+    {
+        return false;
+    }
+
+    const vec2 dims         = vec2( static_cast<float>( width ), static_cast<float>( height ) );
+    const float camDistance = glm::tan( glm::radians( camera.camFov ) );
+    vec2 screen             = vec2( local.x, local.y ) * ( camDistance / local.z );
+    screen.y *= dims.x / dims.y;
+    outPixel = ( screen + 1.0f ) * 0.5f * dims;
+    return true;
+}
+
+namespace {
+
+// first hit of an accumulated pixel, distance 0 means the camera ray escaped
+struct Surface {
+    float distance;
+    vec3 normal;
+};
+
+inline Surface GetSurface( const vec4& albedo, const vec4& normal )
+{
+    const float weight = normal.a > 0.0f ? 1.0f / normal.a : 0.0f;
+    const vec3 n       = vec3( normal ) * weight;
+    const float length = glm::length( n );
+    return Surface{ albedo.a * weight, length > 0.0f ? n / length : vec3( 0.0f ) };
+}
+
+}  // namespace
+
+ReprojectionStats Reproject( const vector<vec4>& historyColor, const vector<vec4>& historyAlbedo, const vector<vec4>& historyNormal,
+                             const ConstantBufferCache& historyCamera, const vector<vec4>& color, const vector<vec4>& albedo,
+                             const vector<vec4>& normal, const ConstantBufferCache& camera, int width, int height,
+                             const ReprojectionSettings& settings, vector<vec4>& outColor, int numThreads )
+{
+    const size_t count = static_cast<size_t>( width ) * height;
+    core_assert( historyColor.size() == count && historyAlbedo.size() == count && historyNormal.size() == count );
+    core_assert( color.size() == count && albedo.size() == count && normal.size() == count );
+
+    std::atomic<int> reused( 0 );
+    std::atomic<int> disoccluded( 0 );
+    std::atomic<int> offscreen( 0 );
+
+    outColor.resize( count );
+    ParallelFor( height, numThreads, [&]( int y ) {
+        int rowReused = 0, rowDisoccluded = 0, rowOffscreen = 0;
+        for ( int x = 0; x < width; ++x )
+        {
+            const size_t index    = static_cast<size_t>( y ) * width + x;
+            const vec4& current   = color[index];
+            const Surface surface = GetSurface( albedo[index], normal[index] );
+            const vec3 direction  = PixelDirection( camera, vec2( x, y ), width, height );
+
+            // escaped rays only depend on the direction, so they reproject as if infinitely far away
+            const vec3 position  = surface.distance > 0.0f ? camera.camPos + surface.distance * direction : historyCamera.camPos + direction;
+            const float expected = glm::length( position - historyCamera.camPos );
+
+            vec2 pixel;
+            if ( !ProjectToPixel( historyCamera, position, width, height, pixel ) ||
+                 pixel.x < -0.5f || pixel.y < -0.5f || pixel.x > width - 0.5f || pixel.y > height - 0.5f )
+            {
+                outColor[index] = current;
+                ++rowOffscreen;
+                continue;
+            }
+
+            // bilinear fetch over the taps that saw the same surface
+            const ivec2 base = ivec2( glm::floor( pixel ) );
+            const vec2 frac  = pixel - vec2( base );
+            vec3 historySum  = vec3( 0.0f );
+            float countSum   = 0.0f;
+            float weightSum  = 0.0f;
+            for ( int tap = 0; tap < 4; ++tap )
+            {
+                const ivec2 p       = glm::clamp( base + ivec2( tap & 1, tap >> 1 ), ivec2( 0 ), ivec2( width - 1, height - 1 ) );
+                const float w       = ( tap & 1 ? frac.x : 1.0f - frac.x ) * ( tap >> 1 ? frac.y : 1.0f - frac.y );
+                const size_t j      = static_cast<size_t>( p.y ) * width + p.x;
+                const vec4& history = historyColor[j];
+                if ( w <= 0.0f || history.a <= 0.0f )
+                {
+                    continue;
+                }
+
+                const Surface old = GetSurface( historyAlbedo[j], historyNormal[j] );
+                if ( ( old.distance > 0.0f ) != ( surface.distance > 0.0f ) )
+                {
+                    continue;
+                }
+                if ( surface.distance > 0.0f &&
+                     ( glm::abs( old.distance - expected ) > settings.depthTolerance * expected || glm::dot( old.normal, surface.normal ) < settings.normalCosine ) )
+                {
+                    continue;
+                }
+
+                historySum += w * vec3( history ) / history.a;
+                countSum += w * history.a;
+                weightSum += w;
+            }
+
+            if ( weightSum <= 0.0f )
+            {
+                outColor[index] = current;
+                ++rowDisoccluded;
+                continue;
+            }
+
+            vec3 history = historySum / weightSum;
+            if ( settings.clampGamma > 0.0f )
+            {
+                // variance clipping (Salvi 2016) against the new samples around the pixel
+                vec3 mean   = vec3( 0.0f );
+                vec3 square = vec3( 0.0f );
+                int samples = 0;
+                for ( int dy = -1; dy <= 1; ++dy )
+                {
+                    for ( int dx = -1; dx <= 1; ++dx )
+                    {
+                        const int xx = x + dx;
+                        const int yy = y + dy;
+                        if ( xx < 0 || xx >= width || yy < 0 || yy >= height )
+                        {
+                            continue;
+                        }
+                        const vec4& neighbour = color[static_cast<size_t>( yy ) * width + xx];
+                        const vec3 c          = vec3( neighbour ) / neighbour.a;
+                        mean += c;
+                        square += c * c;
+                        ++samples;
+                    }
+                }
+                mean /= static_cast<float>( samples );
+                const vec3 sigma = glm::sqrt( glm::max( square / static_cast<float>( samples ) - mean * mean, vec3( 0.0f ) ) );
+                history          = glm::clamp( history, mean - settings.clampGamma * sigma, mean + settings.clampGamma * sigma );
+            }
+
+            const float historyCount = glm::min( countSum / weightSum, static_cast<float>( settings.maxHistory ) );
+            outColor[index]          = vec4( history * historyCount + vec3( current ), historyCount + current.a );
+            ++rowReused;
+        }
+
+        reused += rowReused;
+        disoccluded += rowDisoccluded;
+        offscreen += rowOffscreen;
+    } );
+
+    ReprojectionStats stats;
+    stats.reused      = reused;
+    stats.disoccluded = disoccluded;
+    stats.offscreen   = offscreen;
+    return stats;
+}
+
+bool ReadCameraPath( const string& path, vector<Camera>& outCameras )
+{
+    FILE* file = fopen( path.c_str(), "r" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    outCameras.clear();
+    Camera camera = {};
+    while ( fscanf( file, "%f %f %f %f %f %f %f %f %f %f %f %f %f",
+                    &camera.pos.x, &camera.pos.y, &camera.pos.z,
+                    &camera.fwd.x, &camera.fwd.y, &camera.fwd.z,
+                    &camera.right.x, &camera.right.y, &camera.right.z,
+                    &camera.up.x, &camera.up.y, &camera.up.z,
+                    &camera.fov ) == 13 )
+    {
+        outCameras.push_back( camera );
+    }
+
+    const bool ok = feof( file ) && !outCameras.empty();
+    fclose( file );
+    return ok;
+}
+
+bool AppendCameraPath( FILE* file, const Camera& camera )
+{
+    return fprintf( file, "%.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+                    camera.pos.x, camera.pos.y, camera.pos.z,
+                    camera.fwd.x, camera.fwd.y, camera.fwd.z,
+                    camera.right.x, camera.right.y, camera.right.z,
+                    camera.up.x, camera.up.y, camera.up.z,
+                    camera.fov ) > 0;
+}
+
+}  // namespace pt
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "constant_cache.h"
+
+namespace pt {
+
+/// CPU twin of data/shaders/reproject.comp
+struct ReprojectionSettings {
+    float depthTolerance = 0.05f;  // relative difference of the hit distance
+    float normalCosine   = 0.9f;   // minimum cosine between the old and new normal
+    float clampGamma     = 3.0f;   // history is clipped to mean +- gamma * stddev of the new 3x3 neighbourhood, 0 disables
+    int maxHistory       = 16;     // samples carried over, keeps the history responsive once the camera stops
+};
+
+struct ReprojectionStats {
+    int reused      = 0;  // pixels that kept some history
+    int disoccluded = 0;  // reprojected into the old view but failed the depth or normal test
+    int offscreen   = 0;  // outside of the old view
+};
+
+/// reads the reproject_* dvars
+ReprojectionSettings ReprojectionSettingsFromDvars();
+
+/// direction of the unjittered camera ray through a pixel, same math as tiled.comp
+vec3 PixelDirection( const ConstantBufferCache& camera, const vec2& pixel, int width, int height );
+
+/// inverse of PixelDirection, returns false for points behind the camera
+bool ProjectToPixel( const ConstantBufferCache& camera, const vec3& position, int width, int height, vec2& outPixel );
+
+/// merges the previous accumulation into a frame that was just restarted with one sample per pixel,
+/// using the first hit distance of the new frame and both cameras to find every pixel in the old view,
+/// all buffers use the accumulation layout and the feature buffers of CpuRenderer
+ReprojectionStats Reproject( const std::vector<vec4>& historyColor, const std::vector<vec4>& historyAlbedo, const std::vector<vec4>& historyNormal,
+                             const ConstantBufferCache& historyCamera, const std::vector<vec4>& color, const std::vector<vec4>& albedo,
+                             const std::vector<vec4>& normal, const ConstantBufferCache& camera, int width, int height,
+                             const ReprojectionSettings& settings, std::vector<vec4>& outColor, int numThreads = 0 );
+
+/// camera paths are text files with one camera per line:
+/// pos.xyz fwd.xyz right.xyz up.xyz fov
+bool ReadCameraPath( const std::string& path, std::vector<Camera>& outCameras );
+
+bool AppendCameraPath( FILE* file, const Camera& camera );
+
+}  // namespace pt
@@ -0,0 +1,183 @@
+#include "sampler.h"
+
+#include <type_traits>
+
+namespace pt {
+
+const char* SamplerKindToString( Sampler::Kind kind )
+{
+    const char* s_map[] = {
+        "random",
+        "sobol",
+        "rank1",
+    };
+
+    static_assert( sizeof( s_map ) / sizeof( s_map[0] ) == Sampler::Count );
+    return s_map[static_cast<std::underlying_type_t<Sampler::Kind>>( kind )];
+}
+
+//------------------------------------------------------------------------------
+// Hash functions
+//------------------------------------------------------------------------------
+static uint32_t WangHash( uint32_t& seed )
+{
+    seed = ( seed ^ 61u ) ^ ( seed >> 16u );
+    seed *= 9u;
+    seed = seed ^ ( seed >> 4u );
+    seed *= 0x27d4eb2du;
+    seed = seed ^ ( seed >> 15u );
+    return seed;
+}
+
+static uint32_t Hash( uint32_t x )
+{
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+static uint32_t HashCombine( uint32_t seed, uint32_t v )
+{
+    return seed ^ ( v + 0x9e3779b9u + ( seed << 6u ) + ( seed >> 2u ) );
+}
+
+static uint32_t ReverseBits( uint32_t x )
+{
+    x = ( ( x >> 1u ) & 0x55555555u ) | ( ( x & 0x55555555u ) << 1u );
+    x = ( ( x >> 2u ) & 0x33333333u ) | ( ( x & 0x33333333u ) << 2u );
+    x = ( ( x >> 4u ) & 0x0f0f0f0fu ) | ( ( x & 0x0f0f0f0fu ) << 4u );
+    x = ( ( x >> 8u ) & 0x00ff00ffu ) | ( ( x & 0x00ff00ffu ) << 8u );
+    return ( x >> 16u ) | ( x << 16u );
+}
+
+//------------------------------------------------------------------------------
+// Sobol
+//------------------------------------------------------------------------------
+// clang-format off
+static const uint32_t s_sobolDirections[128] = {
+    0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u, 0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+    0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u, 0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+    0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u, 0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+    0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u, 0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u,
+
+    0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u, 0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+    0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u, 0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+    0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u, 0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+    0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u, 0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu,
+
+    0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u, 0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+    0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u, 0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+    0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u, 0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+    0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u, 0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u,
+
+    0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u, 0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+    0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u, 0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+    0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u, 0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+    0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u, 0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u,
+};
+// clang-format on
+
+static uint32_t SobolSample( uint32_t index, uint32_t dim )
+{
+    uint32_t x = 0u;
+    for ( uint32_t bit = 0u; index != 0u; index >>= 1u, ++bit )
+    {
+        x ^= ( index & 1u ) * s_sobolDirections[dim * 32u + bit];
+    }
+    return x;
+}
+
+static uint32_t LaineKarrasPermutation( uint32_t x, uint32_t seed )
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+static uint32_t NestedUniformScramble( uint32_t x, uint32_t seed )
+{
+    x = ReverseBits( x );
+    x = LaineKarrasPermutation( x, seed );
+    return ReverseBits( x );
+}
+
+uint32_t Sampler::SobolDimension( uint32_t dim ) const
+{
+    const uint32_t setSeed = Hash( HashCombine( m_seed, dim >> 2u ) );
+    const uint32_t index   = NestedUniformScramble( m_index, setSeed );
+    const uint32_t x       = SobolSample( index, dim & 3u );
+    return NestedUniformScramble( x, HashCombine( setSeed, dim & 3u ) );
+}
+
+//------------------------------------------------------------------------------
+// Rank-1 lattice
+//------------------------------------------------------------------------------
+static constexpr uint32_t R2_ALPHA_X = 0xc13fa9a9u;
+static constexpr uint32_t R2_ALPHA_Y = 0x91e10da6u;
+
+uint32_t Sampler::Rank1Dimension( uint32_t dim ) const
+{
+    const uint32_t alpha = ( dim & 1u ) == 0u ? R2_ALPHA_X : R2_ALPHA_Y;
+    const uint32_t mask  = m_pixel.x * R2_ALPHA_X + m_pixel.y * R2_ALPHA_Y;
+    return m_index * alpha + mask + Hash( dim >> 1u );
+}
+
+//------------------------------------------------------------------------------
+// Sampler
+//------------------------------------------------------------------------------
+Sampler::Sampler( Kind kind, const uvec2& pixel, uint32_t index, uint32_t frame )
+    : m_kind( kind ), m_pixel( pixel ), m_index( index ), m_dimension( 0 )
+{
+    m_seed  = Hash( pixel.x ^ Hash( pixel.y ) );
+    m_state = ( pixel.x * 1973u + pixel.y * 9277u + frame * 26699u ) | 1u;
+}
+
+void Sampler::StartDimension( uint32_t dimension )
+{
+    m_dimension = dimension;
+}
+
+void Sampler::StartBounce( int bounce )
+{
+    m_dimension = DimBounce + static_cast<uint32_t>( bounce ) * DimsPerBounce;
+}
+
+uint32_t Sampler::NextUint()
+{
+    const uint32_t dim = m_dimension++;
+    switch ( m_kind )
+    {
+        case Sobol:
+            return SobolDimension( dim );
+        case Rank1:
+            return Rank1Dimension( dim );
+        default:
+            return WangHash( m_state );
+    }
+}
+
+float Sampler::Next1D()
+{
+    if ( m_kind == Random )
+    {
+        ++m_dimension;
+        return static_cast<float>( WangHash( m_state ) ) / 4294967296.0f;
+    }
+
+    return static_cast<float>( NextUint() >> 8u ) * ( 1.0f / 16777216.0f );
+}
+
+vec2 Sampler::Next2D()
+{
+    const float x = Next1D();
+    const float y = Next1D();
+    return vec2( x, y );
+}
+
+}  // namespace pt
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+#include "geomath/geometry.h"
+
+namespace pt {
+
+/// CPU twin of data/shaders/sampler.glsl, produces bit-identical sequences
+class Sampler {
+   public:
+    enum Kind {
+        Random,
+        Sobol,
+        Rank1,
+        Count,
+    };
+
+    // dimension layout, see sampler.glsl
+    static constexpr uint32_t DimCamera     = 0;
+    static constexpr uint32_t DimBounce     = 4;
+    static constexpr uint32_t DimsPerBounce = 4;
+
+    Sampler( Kind kind, const uvec2& pixel, uint32_t index, uint32_t frame );
+
+    void StartDimension( uint32_t dimension );
+    void StartBounce( int bounce );
+    float Next1D();
+    vec2 Next2D();
+
+   private:
+    uint32_t NextUint();
+    uint32_t SobolDimension( uint32_t dim ) const;
+    uint32_t Rank1Dimension( uint32_t dim ) const;
+
+    Kind m_kind;
+    uvec2 m_pixel;
+    uint32_t m_index;
+    uint32_t m_dimension;
+    uint32_t m_seed;
+    uint32_t m_state;
+};
+
+const char* SamplerKindToString( Sampler::Kind kind );
+
+}  // namespace pt
@@ -1,11 +1,17 @@
 #include "scene.h"
 
+#include <cstdint>
+#include <cstring>
 #include <list>
 #include <stdexcept>
 #include <type_traits>
 #include <unordered_map>
 
+#include "glm/gtc/matrix_inverse.hpp"
 #include "image.h"
+#include "universal/print.h"
+#include "utility/arena.h"
+#include "utility/profiler.h"
 #include "utility/string_util.h"
 
 #ifdef max
@@ -39,6 +45,7 @@ const char* GeomKindToString( SceneGeometry::Kind kind )
         "quad",
         "cube",
         "mesh",
+        "disk",
     };
 
     return s_map[static_cast<std::underlying_type_t<SceneGeometry::Kind>>( kind )];
@@ -51,6 +58,7 @@ SceneGeometry::Kind StringToGeomKind( const string& kind )
         { "cube", SceneGeometry::Kind::Cube },
         { "mesh", SceneGeometry::Kind::Mesh },
         { "sphere", SceneGeometry::Kind::Sphere },
+        { "disk", SceneGeometry::Kind::Disk },
     };
 
     auto it = s_map.find( kind );
@@ -83,114 +91,72 @@ static mat4 CalcTransform( const SceneGeometry& geom )
     return translate * rotateX * rotateY * rotateZ * scale;
 }
 
-static void AddQuad( const SceneGeometry& quad, GeometryList& geoms )
+// scene construction temporaries, released together once the scene is flattened
+using ScratchGeometryList = ArenaVector<Geometry>;
+
+// quads and disks are analytic primitives spanned by the transformed x and z axes
+static Geometry MakePlanar( Geometry::Kind kind, const SceneGeometry& geom )
 {
-    static const vec3 s_points[] = {
-        vec3( -1, 0, +1 ),
-        vec3( -1, 0, -1 ),
-        vec3( +1, 0, -1 ),
-        vec3( +1, 0, +1 ),
-    };
-    const mat4 trans = CalcTransform( quad );
-
-    geoms.push_back( Geometry(
-        Mat4MulVec3( trans, s_points[0] ),
-        Mat4MulVec3( trans, s_points[1] ),
-        Mat4MulVec3( trans, s_points[2] ),
-        quad.materidId ) );
-
-    geoms.push_back( Geometry(
-        Mat4MulVec3( trans, s_points[3] ),
-        Mat4MulVec3( trans, s_points[0] ),
-        Mat4MulVec3( trans, s_points[2] ),
-        quad.materidId ) );
+    const mat4 trans = CalcTransform( geom );
+    return Geometry( kind, Mat4MulVec3( trans, vec3( 0 ) ), mat3( trans ) * vec3( 1, 0, 0 ), mat3( trans ) * vec3( 0, 0, 1 ), 0.0f, geom.materidId );
 }
 
-static void AddSphere( const SceneGeometry& sphere, GeometryList& geoms )
+// rotation and scale keep the axes perpendicular, so the transformed cube is still a box
+static Geometry MakeCube( const SceneGeometry& cube )
 {
-    geoms.push_back( Geometry( sphere.translate, sphere.scale.x, sphere.materidId ) );
+    const mat4 trans = CalcTransform( cube );
+    const mat3 axes  = mat3( trans );
+    return Geometry( Geometry::Kind::Box, Mat4MulVec3( trans, vec3( 0 ) ), axes[0], axes[1], glm::length( axes[2] ), cube.materidId );
 }
 
-/**
- *        E__________________ H
- *       /|                 /|
- *      / |                / |
- *     /  |               /  |
- *   A/___|______________/D  |
- *    |   |              |   |
- *    |   |              |   |
- *    |   |              |   |
- *    |  F|______________|___|G
- *    |  /               |  /
- *    | /                | /
- *   B|/_________________|C
- *
- */
-
-static void AddCube( const SceneGeometry& cube, GeometryList& geoms )
+static bool IsAnalytic( SceneGeometry::Kind kind )
 {
-    enum { A,
-           B,
-           C,
-           D,
-           E,
-           F,
-           G,
-           H };
-
-    const vec3& size    = cube.scale;
-    vector<vec3> points = {
-        vec3( -1, +1, +1 ),
-        vec3( -1, -1, +1 ),
-        vec3( +1, -1, +1 ),
-        vec3( +1, +1, +1 ),
-        vec3( -1, +1, -1 ),
-        vec3( -1, -1, -1 ),
-        vec3( +1, -1, -1 ),
-        vec3( +1, +1, -1 )
-    };
-
-    const mat4 trans = CalcTransform( cube );
-    for ( vec3& point : points )
+    switch ( kind )
     {
-        point = Mat4MulVec3( trans, point );
+        case SceneGeometry::Kind::Sphere:
+        case SceneGeometry::Kind::Quad:
+        case SceneGeometry::Kind::Cube:
+        case SceneGeometry::Kind::Disk:
+            return true;
+        default:
+            return false;
     }
+}
 
-    vector<uvec3> faces = {
-        { A, B, D },  // ABD
-        { D, B, C },  // DBC
-        { E, H, F },  // EHF
-        { H, G, F },  // HGF
-
-        { D, C, G },  // DCG
-        { D, G, H },  // DGH
-        { A, F, B },  // AFB
-        { A, E, F },  // AEF
-
-        { A, D, H },  // ADH
-        { A, H, E },  // AHE
-        { B, F, G },  // BFG
-        { B, G, C },  // BGC
-    };
-
-    for ( const uvec3& face : faces )
+// the single primitive of a sphere, quad, cube or disk
+static Geometry MakeAnalytic( const SceneGeometry& geom )
+{
+    switch ( geom.kind )
     {
-        Geometry geom( points[face.x], points[face.y], points[face.z], cube.materidId );
-        geoms.push_back( geom );
+        case SceneGeometry::Kind::Sphere:
+            return Geometry( geom.translate, geom.scale.x, geom.materidId );
+        case SceneGeometry::Kind::Quad:
+            return MakePlanar( Geometry::Kind::Quad, geom );
+        case SceneGeometry::Kind::Disk:
+            return MakePlanar( Geometry::Kind::Disk, geom );
+        case SceneGeometry::Kind::Cube:
+            return MakeCube( geom );
+        default:
+            throw runtime_error( va( "'%s' is not an analytic geometry", GeomKindToString( geom.kind ) ) );
     }
 }
 
+static GpuMaterial MakeMaterial( const SceneMat& mat )
+{
+    GpuMaterial gpuMat;
+    gpuMat.albedo         = mat.albedo;
+    gpuMat.emissive       = mat.emissive;
+    gpuMat.reflect        = mat.reflect;
+    gpuMat.roughness      = mat.roughness;
+    gpuMat.albedoMapLevel = 0.0f;
+    return gpuMat;
+}
+
 ImageArray g_AlbedoMaps;
 
-static void AddMesh( const SceneGeometry& mesh, GeometryList& outGeoms, vector<GpuMaterial>& inoutMats )
+static void AddMesh( const SceneGeometry& mesh, ScratchGeometryList& outGeoms, vector<GpuMaterial>& inoutMats )
 {
-    static int sCnt = 0;
-    ++sCnt;
-    if ( sCnt > 1 )
-    {
-        throw runtime_error( "At most one .obj per scene" );
-    }
-
+    PROFILE_ZONE( "AddMesh" );
     string path = DATA_DIR;
     path.append( mesh.path );
     tinyobj::ObjReaderConfig reader_config;
@@ -199,12 +165,15 @@ static void AddMesh( const SceneGeometry& mesh, GeometryList& outGeoms, vector<G
     reader_config.mtl_search_path = searchPath;  // Path to material files
 
     tinyobj::ObjReader reader;
-    if ( !reader.ParseFromFile( path, reader_config ) )
     {
-        if ( !reader.Error().empty() )
+        PROFILE_ZONE( "ParseObj" );
+        if ( !reader.ParseFromFile( path, reader_config ) )
         {
-            std::string err = "Failed to parse obj '" + path + "'";
-            throw std::runtime_error( err );
+            if ( !reader.Error().empty() )
+            {
+                std::string err = "Failed to parse obj '" + path + "'";
+                throw std::runtime_error( err );
+            }
         }
     }
 
@@ -274,6 +243,27 @@ static void AddMesh( const SceneGeometry& mesh, GeometryList& outGeoms, vector<G
 
     const mat4 trans = CalcTransform( mesh );
 
+    // whether a material has a decoded albedo map, looked up once instead of per face
+    vector<bool> materialHasAlbedo( materials.size(), false );
+    for ( size_t i = 0; i < materials.size(); ++i )
+    {
+        for ( const auto& image : g_AlbedoMaps.images )
+        {
+            if ( image.debugName == materials[i].diffuse_texname )
+            {
+                materialHasAlbedo[i] = true;
+                break;
+            }
+        }
+    }
+
+    size_t faceCount = 0;
+    for ( const tinyobj::shape_t& shape : shapes )
+    {
+        faceCount += shape.mesh.num_face_vertices.size();
+    }
+    outGeoms.reserve( outGeoms.size() + faceCount );
+
     // Loop over shapes
     for ( size_t s = 0; s < shapes.size(); s++ )
     {
@@ -287,27 +277,15 @@ static void AddMesh( const SceneGeometry& mesh, GeometryList& outGeoms, vector<G
             vec3 normals[3];
             vec2 uvs[3] = { vec2( 0.0f ), vec2( 0.0f ), vec2( 0.0f ) };
 
-            Image albedo;
             bool hasAlbedo = false;
             bool hasNormal = false;
 
             int matId = mesh.materidId;
             if ( materials.size() )
             {
-                const auto tinyobjMatId               = shapes[s].mesh.material_ids[f];
-                matId                                 = tinyobjMatId + static_cast<int>( materialOffset );
-                const tinyobj::material_t& tinyobjMat = materials.at( tinyobjMatId );
-
-                // find which image
-                for ( const auto& image : g_AlbedoMaps.images )
-                {
-                    if ( image.debugName == tinyobjMat.diffuse_texname )
-                    {
-                        albedo    = image;
-                        hasAlbedo = true;
-                        break;
-                    }
-                }
+                const auto tinyobjMatId = shapes[s].mesh.material_ids[f];
+                matId                   = tinyobjMatId + static_cast<int>( materialOffset );
+                hasAlbedo               = materialHasAlbedo.at( tinyobjMatId );
             }
 
             for ( size_t v = 0; v < fv; v++ )
@@ -368,38 +346,66 @@ static void AddMesh( const SceneGeometry& mesh, GeometryList& outGeoms, vector<G
     }
 }
 
+// meshes reserve their triangles once they are parsed
+static size_t CountPrimitives( const Scene& scene )
+{
+    size_t count = 0;
+    for ( const SceneGeometry& geom : scene.geometries )
+    {
+        count += IsAnalytic( geom.kind ) ? 1 : 0;
+    }
+    return count;
+}
+
+// boxes of flat geometries get some thickness
+static void PadFlatBoxes( GpuBvhList& bvhs )
+{
+    for ( GpuBvh& bvh : bvhs )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( glm::abs( bvh.max[i] - bvh.min[i] ) < 0.01f )
+            {
+                bvh.min[i] -= Box3::minSpan;
+                bvh.max[i] += Box3::minSpan;
+            }
+        }
+    }
+}
+
 void ConstructScene( const Scene& inScene, GpuScene& outScene )
 {
+    PROFILE_ZONE( "ConstructScene" );
     /// materials
     outScene.materials.clear();
     for ( const SceneMat& mat : inScene.materials )
     {
-        GpuMaterial gpuMat;
-        gpuMat.albedo         = mat.albedo;
-        gpuMat.emissive       = mat.emissive;
-        gpuMat.reflect        = mat.reflect;
-        gpuMat.roughness      = mat.roughness;
-        gpuMat.albedoMapLevel = 0.0f;
-        outScene.materials.push_back( gpuMat );
+        outScene.materials.push_back( MakeMaterial( mat ) );
     }
 
     /// objects
     outScene.geometries.clear();
-    GeometryList tmpGpuObjects;
+    outScene.primitives.clear();
+    outScene.bvhs.clear();
+    Arena arena( MemTag_BvhBuild );
+    ScratchGeometryList tmpGpuObjects{ ArenaAllocator<Geometry>( arena ) };
+    tmpGpuObjects.reserve( CountPrimitives( inScene ) );
+    int meshCount = 0;
     for ( const SceneGeometry& geom : inScene.geometries )
     {
         switch ( geom.kind )
         {
             case SceneGeometry::Kind::Sphere:
-                AddSphere( geom, tmpGpuObjects );
-                break;
             case SceneGeometry::Kind::Quad:
-                AddQuad( geom, tmpGpuObjects );
-                break;
+            case SceneGeometry::Kind::Disk:
             case SceneGeometry::Kind::Cube:
-                AddCube( geom, tmpGpuObjects );
+                tmpGpuObjects.push_back( MakeAnalytic( geom ) );
                 break;
             case SceneGeometry::Kind::Mesh:
+                if ( ++meshCount > 1 )
+                {
+                    throw runtime_error( "At most one .obj per scene" );
+                }
                 AddMesh( geom, tmpGpuObjects, outScene.materials );
                 break;
             default:
@@ -409,23 +415,293 @@ void ConstructScene( const Scene& inScene, GpuScene& outScene )
     }
 
     /// construct bvh
-    Bvh root( tmpGpuObjects );
-    root.CreateGpuBvh( outScene.bvhs, outScene.geometries );
+    PROFILE_ZONE( "Bvh" );
+    // a binary tree with one geometry per leaf, sized up front so the flattening does not overallocate
+    if ( !tmpGpuObjects.empty() )
+    {
+        outScene.bvhs.reserve( 2 * tmpGpuObjects.size() - 1 );
+        outScene.geometries.reserve( tmpGpuObjects.size() );
+    }
+    Bvh* root;
+    {
+        PROFILE_ZONE( "Bvh build" );
+        root = Bvh::Build( tmpGpuObjects.data(), tmpGpuObjects.size(), arena );
+    }
+    {
+        PROFILE_ZONE( "CreateGpuBvh" );
+        root->CreateGpuBvh( outScene.bvhs, outScene.geometries );
+    }
 
-    outScene.bbox = root.GetBox();
+    outScene.bbox = root->GetBox();
+    PadFlatBoxes( outScene.bvhs );
 
-    /// adjust bbox
-    for ( GpuBvh& bvh : outScene.bvhs )
+    outScene.height = ComputeBvhStats( outScene.bvhs ).depth;
+    outScene.nodes  = CreateBvhNodePairs( outScene.bvhs );
+
+    outScene.primitives.reserve( outScene.geometries.size() );
+    for ( const Geometry& geom : outScene.geometries )
     {
-        for ( int i = 0; i < 3; ++i )
+        outScene.primitives.push_back( GpuPrimitive{ geom.A, geom.kind, geom.B, geom.radius, geom.C, 0 } );
+    }
+
+    outScene.memory.Set( outScene.materials.capacity() * sizeof( GpuMaterial ) +
+                         outScene.geometries.capacity() * sizeof( Geometry ) +
+                         outScene.primitives.capacity() * sizeof( GpuPrimitive ) +
+                         outScene.bvhs.capacity() * sizeof( GpuBvh ) +
+                         outScene.nodes.capacity() * sizeof( BvhNode ) );
+}
+
+//------------------------------------------------------------------------------
+// Incremental Updates
+//------------------------------------------------------------------------------
+
+static bool SameMaterial( const SceneMat& a, const SceneMat& b )
+{
+    return a.albedo == b.albedo && a.emissive == b.emissive && a.reflect == b.reflect && a.roughness == b.roughness;
+}
+
+static bool SameCamera( const SceneCamera& a, const SceneCamera& b )
+{
+    return a.name == b.name && a.fov == b.fov && a.eye == b.eye && a.lookAt == b.lookAt && a.up == b.up;
+}
+
+SceneDiff DiffScenes( const Scene& before, const Scene& after )
+{
+    SceneDiff diff;
+    diff.camera = !SameCamera( before.camera, after.camera );
+
+    // the shaders are compiled for the material count, names only matter while the script runs
+    if ( before.materials.size() != after.materials.size() || before.geometries.size() != after.geometries.size() )
+    {
+        diff.topology = true;
+        return diff;
+    }
+    for ( size_t i = 0; i < after.materials.size(); ++i )
+    {
+        if ( !SameMaterial( before.materials[i], after.materials[i] ) )
         {
-            if ( glm::abs( bvh.max[i] - bvh.min[i] ) < 0.01f )
+            diff.materials.push_back( static_cast<int>( i ) );
+        }
+    }
+
+    for ( size_t i = 0; i < after.geometries.size(); ++i )
+    {
+        const SceneGeometry& a = before.geometries[i];
+        const SceneGeometry& b = after.geometries[i];
+        if ( a.kind != b.kind || a.path != b.path )
+        {
+            diff.topology = true;
+            return diff;
+        }
+        const bool moved = a.translate != b.translate || a.euler != b.euler || a.scale != b.scale;
+        if ( b.kind == SceneGeometry::Kind::Mesh && a.materidId != b.materidId )
+        {
+            // the faces without .mtl materials would have to be told apart from the others
+            diff.topology = true;
+            return diff;
+        }
+        if ( moved || a.materidId != b.materidId )
+        {
+            diff.geometries.push_back( static_cast<int>( i ) );
+        }
+    }
+
+    // RefitScene moves every triangle by the transform of the moved mesh, the built scene
+    // does not know which mesh a triangle came from
+    int meshes = 0, movedMeshes = 0;
+    for ( const SceneGeometry& geom : after.geometries )
+    {
+        meshes += geom.kind == SceneGeometry::Kind::Mesh;
+    }
+    for ( int i : diff.geometries )
+    {
+        movedMeshes += after.geometries[i].kind == SceneGeometry::Kind::Mesh;
+    }
+    diff.topology = movedMeshes > 0 && meshes > 1;
+    return diff;
+}
+
+void UpdateSceneMaterials( const Scene& after, const SceneDiff& diff, GpuScene& scene )
+{
+    for ( int i : diff.materials )
+    {
+        scene.materials[i] = MakeMaterial( after.materials[i] );
+    }
+}
+
+namespace {
+
+// the fields of an analytic primitive, a sphere leaves B and C unset
+struct AnalyticKey {
+    vec3 A;
+    Geometry::Kind kind;
+    vec3 B;
+    float radius;
+    vec3 C;
+    int materialId;
+
+    explicit AnalyticKey( const Geometry& geom )
+        : A( geom.A ), kind( geom.kind ), B( 0.0f ), radius( geom.radius ), C( 0.0f ), materialId( geom.materialId )
+    {
+        if ( kind != Geometry::Kind::Sphere )
+        {
+            B = geom.B;
+            C = geom.C;
+        }
+    }
+
+    bool operator==( const AnalyticKey& other ) const
+    {
+        return memcmp( this, &other, sizeof( AnalyticKey ) ) == 0;
+    }
+};
+
+static_assert( sizeof( AnalyticKey ) == 48 );
+
+struct AnalyticKeyHash {
+    size_t operator()( const AnalyticKey& key ) const
+    {
+        // FNV-1a over the bytes, every field is 4 bytes and there is no padding
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>( &key );
+        uint64_t hash              = 14695981039346656037ull;
+        for ( size_t i = 0; i < sizeof( AnalyticKey ); ++i )
+        {
+            hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+        }
+        return static_cast<size_t>( hash );
+    }
+};
+
+}  // namespace
+
+// triangles of the mesh moved by delta, the normals follow the convention of AddMesh
+static void MoveTriangle( const mat4& delta, Geometry& geom )
+{
+    const vec3 faceNormal  = glm::normalize( glm::cross( glm::normalize( geom.B - geom.A ), glm::normalize( geom.C - geom.A ) ) );
+    const bool faceNormals = geom.normal1 == faceNormal && geom.normal2 == faceNormal && geom.normal3 == faceNormal;
+    geom.A                 = Mat4MulVec3( delta, geom.A );
+    geom.B                 = Mat4MulVec3( delta, geom.B );
+    geom.C                 = Mat4MulVec3( delta, geom.C );
+    if ( faceNormals )
+    {
+        geom.CalcNormal();
+        return;
+    }
+    // the normal matrix, a non uniform scale tilts normals the other way than the surface
+    const mat3 normalMatrix = glm::inverseTranspose( mat3( delta ) );
+    geom.normal1            = glm::normalize( normalMatrix * geom.normal1 );
+    geom.normal2            = glm::normalize( normalMatrix * geom.normal2 );
+    geom.normal3            = glm::normalize( normalMatrix * geom.normal3 );
+}
+
+int RefitScene( const Scene& before, const Scene& after, const SceneDiff& diff, GpuScene& scene )
+{
+    PROFILE_ZONE( "RefitScene" );
+    if ( diff.geometries.empty() )
+    {
+        return 0;
+    }
+
+    // the build reorders the geometries, analytic ones are found by their old fields. Identical
+    // ones are interchangeable, so equal keys hand out their new geometries in any order
+    std::unordered_multimap<AnalyticKey, Geometry, AnalyticKeyHash> moved;
+    const SceneGeometry* mesh = nullptr;
+    for ( int i : diff.geometries )
+    {
+        const SceneGeometry& geom = after.geometries[i];
+        if ( geom.kind == SceneGeometry::Kind::Mesh )
+        {
+            mesh = &geom;
+        }
+        else if ( IsAnalytic( geom.kind ) )
+        {
+            moved.emplace( AnalyticKey( MakeAnalytic( before.geometries[i] ) ), MakeAnalytic( geom ) );
+        }
+    }
+
+    mat4 meshDelta = mat4( 1 );
+    if ( mesh )
+    {
+        const SceneGeometry& old = before.geometries[mesh - after.geometries.data()];
+        meshDelta                = CalcTransform( *mesh ) * glm::inverse( CalcTransform( old ) );
+    }
+
+    int changed = 0;
+    for ( size_t i = 0; i < scene.geometries.size(); ++i )
+    {
+        Geometry& geom = scene.geometries[i];
+        if ( geom.kind == Geometry::Kind::Triangle )
+        {
+            if ( !mesh )
             {
-                bvh.min[i] -= Box3::minSpan;
-                bvh.max[i] += Box3::minSpan;
+                continue;
+            }
+            MoveTriangle( meshDelta, geom );
+        }
+        else
+        {
+            auto it = moved.find( AnalyticKey( geom ) );
+            if ( it == moved.end() )
+            {
+                continue;
             }
+            geom = it->second;
+            moved.erase( it );
         }
+        scene.primitives[i] = GpuPrimitive{ geom.A, geom.kind, geom.B, geom.radius, geom.C, 0 };
+        ++changed;
     }
+
+    // children follow their parents, the left one right after it and the right one at the
+    // miss link of the left one, so walking backwards visits them first
+    vector<Box3> boxes( scene.bvhs.size() );
+    for ( size_t i = scene.bvhs.size(); i-- > 0; )
+    {
+        const GpuBvh& bvh = scene.bvhs[i];
+        if ( bvh.leaf )
+        {
+            boxes[i] = Box3::FromGeometry( scene.geometries[bvh.geomIdx] );
+        }
+        else
+        {
+            const int left = static_cast<int>( i ) + 1;
+            boxes[i]       = Box3( boxes[left], boxes[scene.bvhs[left].missIdx] );
+        }
+    }
+    for ( size_t i = 0; i < scene.bvhs.size(); ++i )
+    {
+        scene.bvhs[i].min = boxes[i].min;
+        scene.bvhs[i].max = boxes[i].max;
+    }
+    PadFlatBoxes( scene.bvhs );
+    if ( !boxes.empty() )
+    {
+        scene.bbox = boxes[0];
+    }
+    if ( !scene.nodes.empty() )
+    {
+        scene.nodes = CreateBvhNodePairs( scene.bvhs );
+    }
+    return changed;
+}
+
+void SetBvhLayout( GpuScene& scene, BvhLayout layout )
+{
+    if ( layout == BvhLayout::Pairs && scene.height >= BVH_STACK_SIZE )
+    {
+        Com_PrintWarning( "[bvh] depth %d does not fit the traversal stack of %d, using the threaded layout", scene.height, BVH_STACK_SIZE );
+        layout = BvhLayout::Threaded;
+    }
+    scene.layout = layout;
+}
+
+void ReleaseSceneGeometry( GpuScene& scene )
+{
+    std::vector<Geometry>().swap( scene.geometries );
+    std::vector<GpuPrimitive>().swap( scene.primitives );
+    std::vector<GpuBvh>().swap( scene.bvhs );
+    std::vector<BvhNode>().swap( scene.nodes );
+    scene.memory.Set( scene.materials.capacity() * sizeof( GpuMaterial ) );
 }
 
 }  // namespace pt
@@ -3,6 +3,7 @@
 
 #include "geomath/bvh.h"
 #include "geomath/geometry.h"
+#include "utility/memory_stats.h"
 
 namespace pt {
 
@@ -48,6 +49,7 @@ struct SceneGeometry {
         Quad,
         Cube,
         Mesh,
+        Disk,
     };
 
     SceneGeometry()
@@ -79,15 +81,62 @@ struct GpuMaterial {
     int padding[3];
 };
 
+/// the part of a Geometry the intersection tests read, kept in its own array so traversal
+/// reads 48 bytes per candidate and the attributes are only fetched for the closest hit
+struct GpuPrimitive {
+    vec3 A;  // sphere center
+    Geometry::Kind kind;
+    vec3 B;
+    float radius;
+    vec3 C;
+    int padding;
+};
+
+static_assert( sizeof( GpuPrimitive ) == 48 );
+
 struct GpuScene {
     std::vector<GpuMaterial> materials;
     std::vector<Geometry> geometries;
+    std::vector<GpuPrimitive> primitives;  // one per geometry
     std::vector<GpuBvh> bvhs;
+    std::vector<BvhNode> nodes;  // the same tree in the child pair layout
+    BvhLayout layout = BvhLayout::Threaded;
 
     int height;
     Box3 bbox;
+
+    MemTracker memory{ MemTag_GpuScene };  // capacity of the vectors above
 };
 
 void ConstructScene( const Scene& inScene, GpuScene& outScene );
 
+/// what changed between two loads of a scene script
+struct SceneDiff {
+    bool topology = false;  // geometries or materials were added, removed or retyped, or one of several meshes
+                            // moved, only ConstructScene applies it
+    bool camera   = false;
+    std::vector<int> materials;   // edited materials
+    std::vector<int> geometries;  // moved geometries and ones that use another material
+
+    inline bool Empty() const { return !topology && !camera && materials.empty() && geometries.empty(); }
+};
+
+SceneDiff DiffScenes( const Scene& before, const Scene& after );
+
+/// rewrites the edited materials of a scene constructed from the script before the change
+void UpdateSceneMaterials( const Scene& after, const SceneDiff& diff, GpuScene& scene );
+
+/// moves the changed geometries of a scene constructed from before and refits the boxes of both
+/// bvh layouts. The tree keeps its shape, so it gets worse the further things move. Returns the
+/// number of geometries that changed
+int RefitScene( const Scene& before, const Scene& after, const SceneDiff& diff, GpuScene& scene );
+
+/// the layout HitScene and the shaders traverse, falls back to the threaded one
+/// with a warning when the tree is too deep for the traversal stack
+void SetBvhLayout( GpuScene& scene, BvhLayout layout );
+
+/// frees the geometries and both bvh layouts once they live elsewhere (out of core clusters),
+/// the materials, bounds and height stay
+void ReleaseSceneGeometry( GpuScene& scene );
+
 }  // namespace pt
@@ -1,11 +1,18 @@
 #include "scene_loader.h"
 
+#include <climits>
+#include <cstring>
 #include <filesystem>
+#include <memory>
 #include <stdexcept>
 
+#include "com_dvars.h"
 #include "com_file.h"
 #include "universal/core_assert.h"
 #include "universal/print.h"
+#include "utility/parallel.h"
+#include "utility/profiler.h"
+#include "utility/string_util.h"
 
 // #define DEBUG_LUA_VERBOSE IN_USE
 #define DEBUG_LUA_VERBOSE NOT_IN_USE
@@ -20,8 +27,28 @@ static inline bool streq( const char* a, const char* b )
     return strcmp( a, b ) == 0;
 }
 
-static Scene* g_scene;
-static bool g_verbose = true;
+/// what the Scene functions of a lua state add to, every state (the script and each
+/// generator) has its own so they can run on different threads
+struct LuaSceneContext {
+    Scene* scene;
+    std::string directory;  // of the script, Scene.Generate paths are relative to it
+    bool verbose;
+    bool generator;  // generators cannot call Scene.Generate, every level would start its own threads
+};
+
+/// the Generator global of a generator state
+struct LuaGenerator {
+    int index;  // 1 based
+    int count;
+};
+
+static const char* FLOAT_BUFFER = "pt.FloatBuffer";
+
+static std::string DirectoryOf( const char* path )
+{
+    const char* end = strrchr( path, '/' );
+    return std::string( path, end ? end - path + 1 : 0 );
+}
 
 extern "C" {
 #include <lua/lauxlib.h>
@@ -48,9 +75,109 @@ static void LuaHelper_FillVec3( lua_State* L, vec3& outVec )
     }
 }
 
+static LuaSceneContext& GetContext( lua_State* L )
+{
+    return **static_cast<LuaSceneContext**>( lua_getextraspace( L ) );
+}
+
+static int FindMaterial( const Scene& scene, const char* name )
+{
+    for ( int i = 0; i < static_cast<int>( scene.materials.size() ); ++i )
+    {
+        if ( scene.materials[i].name == name )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// Scene.NewBuffer( n ), n floats starting at 0 that the bulk functions read in place
+/// instead of looking up every float in a table
+struct LuaFloatBuffer {
+    lua_Integer count;
+    float data[1];
+};
+
+static LuaFloatBuffer* LuaHelper_NewFloatBuffer( lua_State* L, lua_Integer count )
+{
+    const size_t size      = offsetof( LuaFloatBuffer, data ) + sizeof( float ) * static_cast<size_t>( count > 0 ? count : 1 );
+    LuaFloatBuffer* buffer = static_cast<LuaFloatBuffer*>( lua_newuserdatauv( L, size, 0 ) );
+    buffer->count          = count;
+    return buffer;
+}
+
+static int LuaFunc_FloatBufferIndex( lua_State* L )
+{
+    const LuaFloatBuffer* buffer = static_cast<const LuaFloatBuffer*>( luaL_checkudata( L, 1, FLOAT_BUFFER ) );
+    const lua_Integer index      = luaL_checkinteger( L, 2 );
+    luaL_argcheck( L, index >= 1 && index <= buffer->count, 2, "index out of range" );
+    lua_pushnumber( L, buffer->data[index - 1] );
+    return 1;
+}
+
+static int LuaFunc_FloatBufferNewIndex( lua_State* L )
+{
+    LuaFloatBuffer* buffer  = static_cast<LuaFloatBuffer*>( luaL_checkudata( L, 1, FLOAT_BUFFER ) );
+    const lua_Integer index = luaL_checkinteger( L, 2 );
+    luaL_argcheck( L, index >= 1 && index <= buffer->count, 2, "index out of range" );
+    buffer->data[index - 1] = static_cast<float>( luaL_checknumber( L, 3 ) );
+    return 0;
+}
+
+static int LuaFunc_FloatBufferLen( lua_State* L )
+{
+    const LuaFloatBuffer* buffer = static_cast<const LuaFloatBuffer*>( luaL_checkudata( L, 1, FLOAT_BUFFER ) );
+    lua_pushinteger( L, buffer->count );
+    return 1;
+}
+
+static int LuaFunc_SceneNewBuffer( lua_State* L )
+{
+    const lua_Integer count = luaL_checkinteger( L, 1 );
+    luaL_argcheck( L, count >= 0 && count <= INT_MAX, 1, "invalid size" );
+    LuaFloatBuffer* buffer = LuaHelper_NewFloatBuffer( L, count );
+    memset( buffer->data, 0, sizeof( float ) * static_cast<size_t>( count ) );
+    luaL_setmetatable( L, FLOAT_BUFFER );
+    return 1;
+}
+
+/// the floats of argument arg, a Scene.NewBuffer or a flat array { x, y, z, ... }, whose size
+/// is a multiple of stride. Arrays are copied to a buffer left on the stack, so errors raised
+/// while reading them (a longjmp past anything with a destructor) leak nothing
+static const LuaFloatBuffer* LuaHelper_CheckFloats( lua_State* L, int arg, int stride )
+{
+    const LuaFloatBuffer* buffer = static_cast<const LuaFloatBuffer*>( luaL_testudata( L, arg, FLOAT_BUFFER ) );
+    if ( !buffer )
+    {
+        luaL_checktype( L, arg, LUA_TTABLE );
+        const lua_Integer count = static_cast<lua_Integer>( lua_rawlen( L, arg ) );
+        luaL_argcheck( L, count <= INT_MAX, arg, "too many values" );
+        LuaFloatBuffer* copy = LuaHelper_NewFloatBuffer( L, count );
+        for ( lua_Integer i = 0; i < count; ++i )
+        {
+            lua_rawgeti( L, arg, i + 1 );
+            int isNumber  = 0;
+            copy->data[i] = static_cast<float>( lua_tonumberx( L, -1, &isNumber ) );
+            if ( !isNumber )
+            {
+                luaL_error( L, "value %d of argument #%d is %s, expected number", static_cast<int>( i + 1 ), arg, luaL_typename( L, -1 ) );
+            }
+            lua_pop( L, 1 );
+        }
+        buffer = copy;
+    }
+
+    if ( buffer->count % stride )
+    {
+        luaL_error( L, "argument #%d has %d values, expected a multiple of %d", arg, static_cast<int>( buffer->count ), stride );
+    }
+    return buffer;
+}
+
 static int LuaFunc_SceneAddMaterial( lua_State* L )
 {
-    core_assert( g_scene );
+    LuaSceneContext& context = GetContext( L );
 
     SceneMat material;
     material.name = luaL_checkstring( L, 1 );
@@ -89,7 +216,7 @@ static int LuaFunc_SceneAddMaterial( lua_State* L )
     }
     lua_pop( L, 1 );
 
-    if ( g_verbose )
+    if ( context.verbose )
     {
         Com_Printf( "Adding material '%s'", material.name.c_str() );
         {
@@ -104,13 +231,13 @@ static int LuaFunc_SceneAddMaterial( lua_State* L )
         Com_Printf( "\troughness: %.3f", material.roughness );
     }
 
-    g_scene->materials.emplace_back( material );
+    context.scene->materials.emplace_back( material );
     return 0;
 }
 
 static int LuaFunc_SceneAddGeometry( lua_State* L )
 {
-    core_assert( g_scene );
+    LuaSceneContext& context = GetContext( L );
 
     SceneGeometry geom;
     geom.name = luaL_checkstring( L, 1 );
@@ -131,19 +258,11 @@ static int LuaFunc_SceneAddGeometry( lua_State* L )
         }
         else if ( streq( field, "material" ) )
         {
-            const std::string material_name = lua_tostring( L, -1 );
-            for ( int i = 0; i < g_scene->materials.size(); ++i )
-            {
-                if ( g_scene->materials.at( i ).name == material_name )
-                {
-                    geom.materidId = static_cast<int>( i );
-                    break;
-                }
-            }
-
+            const char* material_name = lua_tostring( L, -1 );
+            geom.materidId            = FindMaterial( *context.scene, material_name );
             if ( geom.materidId == -1 )
             {
-                Com_PrintError( "material '%s' not found for geometry '%s'", material_name.c_str(), geom.name.c_str() );
+                Com_PrintError( "material '%s' not found for geometry '%s'", material_name, geom.name.c_str() );
             }
         }
         else if ( streq( field, "translate" ) )
@@ -170,7 +289,7 @@ static int LuaFunc_SceneAddGeometry( lua_State* L )
     }
     lua_pop( L, 1 );
 
-    if ( g_verbose )
+    if ( context.verbose )
     {
         Com_Printf( "Adding geometry '%s' (%s)", geom.name.c_str(), GeomKindToString( geom.kind ) );
         if ( !geom.path.empty() )
@@ -192,14 +311,124 @@ static int LuaFunc_SceneAddGeometry( lua_State* L )
         }
     }
 
-    g_scene->geometries.emplace_back( geom );
+    context.scene->geometries.emplace_back( geom );
     return 0;
 }
 
+/// Scene.AddSpheres( name, material, spheres ), spheres holds x, y, z, radius of each sphere
+static int LuaFunc_SceneAddSpheres( lua_State* L )
+{
+    LuaSceneContext& context = GetContext( L );
+    const char* name         = luaL_checkstring( L, 1 );
+    const char* material     = luaL_checkstring( L, 2 );
+    const int materialId     = FindMaterial( *context.scene, material );
+    if ( materialId == -1 )
+    {
+        return luaL_error( L, "material '%s' not found for spheres '%s'", material, name );
+    }
+    const LuaFloatBuffer* spheres = LuaHelper_CheckFloats( L, 3, 4 );
+    const int count               = static_cast<int>( spheres->count / 4 );
+
+    SceneGeometry geom;
+    geom.name      = name;
+    geom.kind      = SceneGeometry::Kind::Sphere;
+    geom.materidId = materialId;
+
+    std::vector<SceneGeometry>& geometries = context.scene->geometries;
+    geometries.reserve( geometries.size() + count );
+    for ( int i = 0; i < count; ++i )
+    {
+        const float* sphere = spheres->data + 4 * i;
+        geom.translate      = vec3( sphere[0], sphere[1], sphere[2] );
+        geom.scale          = vec3( sphere[3] );
+        geometries.push_back( geom );
+    }
+
+    if ( context.verbose )
+    {
+        Com_Printf( "Adding %d spheres '%s' (material %d)", count, name, materialId );
+    }
+    return 0;
+}
+
+/// Scene.AddInstances( geometry, transforms ), copies of the analytic geometry added under that name,
+/// transforms holds translate, euler and scale (9 floats) of each copy
+static int LuaFunc_SceneAddInstances( lua_State* L )
+{
+    LuaSceneContext& context = GetContext( L );
+    const char* name         = luaL_checkstring( L, 1 );
+
+    std::vector<SceneGeometry>& geometries = context.scene->geometries;
+    int source                             = -1;
+    for ( int i = 0; i < static_cast<int>( geometries.size() ); ++i )
+    {
+        if ( geometries[i].name == name )
+        {
+            source = i;
+            break;
+        }
+    }
+    if ( source == -1 )
+    {
+        return luaL_error( L, "geometry '%s' not found", name );
+    }
+    if ( geometries[source].kind == SceneGeometry::Kind::Mesh )
+    {
+        // a scene holds a single .obj, instancing it would need per instance bvhs
+        return luaL_error( L, "geometry '%s' is a mesh, only analytic geometries can be instanced", name );
+    }
+    const LuaFloatBuffer* transforms = LuaHelper_CheckFloats( L, 2, 9 );
+    const int count                  = static_cast<int>( transforms->count / 9 );
+
+    SceneGeometry geom = geometries[source];
+    geometries.reserve( geometries.size() + count );
+    for ( int i = 0; i < count; ++i )
+    {
+        const float* transform = transforms->data + 9 * i;
+        geom.translate         = vec3( transform[0], transform[1], transform[2] );
+        geom.euler             = vec3( transform[3], transform[4], transform[5] );
+        geom.scale             = vec3( transform[6], transform[7], transform[8] );
+        geometries.push_back( geom );
+    }
+
+    if ( context.verbose )
+    {
+        Com_Printf( "Adding %d instances of '%s' (%s)", count, name, GeomKindToString( geom.kind ) );
+    }
+    return 0;
+}
+
+static bool GenerateScenes( LuaSceneContext& context, const char* path, int count, std::string& outError );
+
+/// Scene.Generate( path, count ), runs the script count times in parallel, each in its own lua state
+/// with a Generator = { index, count } global, and adds what they add to this scene in index order
+static int LuaFunc_SceneGenerate( lua_State* L )
+{
+    const char* path        = luaL_checkstring( L, 1 );
+    const lua_Integer count = luaL_optinteger( L, 2, 1 );
+    luaL_argcheck( L, count >= 1 && count <= INT_MAX, 2, "invalid generator count" );
+    if ( GetContext( L ).generator )
+    {
+        return luaL_error( L, "Scene.Generate cannot be called from a generator" );
+    }
+
+    bool ok;
+    {
+        std::string error;
+        ok = GenerateScenes( GetContext( L ), path, static_cast<int>( count ), error );
+        if ( !ok )
+        {
+            lua_pushstring( L, error.c_str() );
+        }
+    }
+    // raised once the strings are gone, lua_error does not unwind c++ scopes
+    return ok ? 0 : lua_error( L );
+}
+
 static int LuaFunc_SceneAddCamera( lua_State* L )
 {
-    core_assert( g_scene );
-    SceneCamera& camera = g_scene->camera;
+    LuaSceneContext& context = GetContext( L );
+    SceneCamera& camera      = context.scene->camera;
 
     camera.name = luaL_checkstring( L, 1 );
 
@@ -236,7 +465,7 @@ static int LuaFunc_SceneAddCamera( lua_State* L )
     }
     lua_pop( L, 1 );
 
-    if ( g_verbose )
+    if ( context.verbose )
     {
         Com_Printf( "Adding camera '%s'", camera.name.c_str() );
         Com_Printf( "\tfov:      %.3f", camera.fov );
@@ -265,19 +494,162 @@ static const luaL_Reg s_funcs[] = {
     LUA_DVAR_LIB( AddMaterial ),
     LUA_DVAR_LIB( AddGeometry ),
     LUA_DVAR_LIB( AddCamera ),
+    LUA_DVAR_LIB( AddSpheres ),
+    LUA_DVAR_LIB( AddInstances ),
+    LUA_DVAR_LIB( NewBuffer ),
+    LUA_DVAR_LIB( Generate ),
+    { nullptr, nullptr }
+};
+
+static const luaL_Reg s_floatBufferMeta[] = {
+    { "__index", LuaFunc_FloatBufferIndex },
+    { "__newindex", LuaFunc_FloatBufferNewIndex },
+    { "__len", LuaFunc_FloatBufferLen },
     { nullptr, nullptr }
 };
 
 static int luaopen_MyLib( lua_State* L )
 {
+    luaL_newmetatable( L, FLOAT_BUFFER );
+    luaL_setfuncs( L, s_floatBufferMeta, 0 );
+    lua_pop( L, 1 );
+
     luaL_newlib( L, s_funcs );
     return 1;
 }
 }
 
+/// runs a preprocessed script in a new lua state that adds to context.scene
+static bool RunSceneScript( const std::string& source, LuaSceneContext& context, const LuaGenerator* generator, std::string& outError )
+{
+    // closed by the guard when a scene function throws through the script as well
+    std::unique_ptr<lua_State, decltype( &lua_close )> state( luaL_newstate(), lua_close );
+    lua_State* L = state.get();
+    core_assert( L );
+    if ( L == nullptr )
+    {
+        outError = "failed to create lua state";
+        return false;
+    }
+
+    *static_cast<LuaSceneContext**>( lua_getextraspace( L ) ) = &context;
+    luaL_openlibs( L );
+    luaL_requiref( L, "Scene", luaopen_MyLib, 1 );
+    lua_pop( L, 1 );
+    if ( generator )
+    {
+        lua_createtable( L, 0, 2 );
+        lua_pushinteger( L, generator->index );
+        lua_setfield( L, -2, "index" );
+        lua_pushinteger( L, generator->count );
+        lua_setfield( L, -2, "count" );
+        lua_setglobal( L, "Generator" );
+    }
+
+    int code;
+    // code = luaL_loadfile( L, ROOT_FOLDER "scripts/common.lua" );
+    // core_assert( code == LUA_OK );
+    {
+        PROFILE_ZONE( "lua execute" );
+        code = luaL_dostring( L, source.c_str() );
+    }
+    if ( code != LUA_OK )
+    {
+        const char* err = lua_tostring( L, -1 );
+        outError        = va( "error %d\n%s", code, err ? err : "(no message)" );
+    }
+    return code == LUA_OK;
+}
+
+/// appends what a generator added to its copy of the materials
+static void MergeScene( Scene& scene, Scene& generated, size_t seedMaterials )
+{
+    std::vector<int> remap( generated.materials.size() );
+    for ( size_t i = 0; i < generated.materials.size(); ++i )
+    {
+        int id = i < seedMaterials ? static_cast<int>( i ) : FindMaterial( scene, generated.materials[i].name.c_str() );
+        if ( id == -1 )
+        {
+            id = static_cast<int>( scene.materials.size() );
+            scene.materials.emplace_back( std::move( generated.materials[i] ) );
+        }
+        remap[i] = id;
+    }
+
+    scene.geometries.reserve( scene.geometries.size() + generated.geometries.size() );
+    for ( SceneGeometry& geom : generated.geometries )
+    {
+        if ( geom.materidId >= 0 && geom.materidId < static_cast<int>( remap.size() ) )
+        {
+            geom.materidId = remap[geom.materidId];
+        }
+        scene.geometries.emplace_back( std::move( geom ) );
+    }
+
+    if ( !generated.camera.name.empty() )
+    {
+        scene.camera = generated.camera;
+    }
+}
+
+static bool GenerateScenes( LuaSceneContext& context, const char* path, int count, std::string& outError )
+{
+    PROFILE_ZONE( "Scene.Generate" );
+    const std::string fullPath = context.directory + path;
+    if ( !std::filesystem::exists( fullPath ) )
+    {
+        outError = va( "generator '%s' does not exist", fullPath.c_str() );
+        return false;
+    }
+
+    const std::string source    = PreprocessFile( fullPath, DefineList() );
+    const std::string directory = DirectoryOf( fullPath.c_str() );
+
+    // every generator starts from the materials added so far, so it can use them by name
+    std::vector<Scene> scenes( count );
+    std::vector<std::string> errors( count );
+    ParallelFor( count, Dvar_GetInt( threads ), [&]( int index ) {
+        // caught here so the error names the generator that threw
+        try
+        {
+            scenes[index].materials = context.scene->materials;
+            LuaSceneContext generatorContext{ &scenes[index], directory, false, true };
+            const LuaGenerator generator{ index + 1, count };
+            RunSceneScript( source, generatorContext, &generator, errors[index] );
+        }
+        catch ( const std::exception& e )
+        {
+            errors[index] = e.what();
+        }
+    } );
+
+    for ( int index = 0; index < count; ++index )
+    {
+        if ( !errors[index].empty() )
+        {
+            outError = va( "generator %d of '%s' failed: %s", index + 1, path, errors[index].c_str() );
+            return false;
+        }
+    }
+
+    const size_t seedMaterials = context.scene->materials.size();
+    size_t added               = 0;
+    for ( int index = 0; index < count; ++index )
+    {
+        added += scenes[index].geometries.size();
+        MergeScene( *context.scene, scenes[index], seedMaterials );
+    }
+
+    if ( context.verbose )
+    {
+        Com_Printf( "Generated %zu geometries with %d instance(s) of '%s'", added, count, path );
+    }
+    return true;
+}
+
 bool LuaLoadScene( const char* path, Scene& outScene )
 {
-    g_scene = &outScene;
+    PROFILE_ZONE( "LuaLoadScene" );
 
     if ( !std::filesystem::exists( path ) )
     {
@@ -288,34 +660,18 @@ bool LuaLoadScene( const char* path, Scene& outScene )
     Com_PrintInfo( "[lua] executing %s", path );
 
     DefineList defines;
-    std::string source = PreprocessFile( std::string( path ), defines );
-
-    lua_State* L = luaL_newstate();
-    core_assert( L );
-    if ( L == nullptr )
+    std::string source;
     {
-        return false;
+        PROFILE_ZONE( "PreprocessFile" );
+        source = PreprocessFile( std::string( path ), defines );
     }
 
-    luaL_openlibs( L );
-    luaL_requiref( L, "Scene", luaopen_MyLib, 1 );
-
-    int code;
-    // code = luaL_loadfile( L, ROOT_FOLDER "scripts/common.lua" );
-    // core_assert( code == LUA_OK );
-    code = luaL_dostring( L, source.c_str() );
-    switch ( code )
+    LuaSceneContext context{ &outScene, DirectoryOf( path ), true, false };
+    std::string error;
+    if ( !RunSceneScript( source, context, nullptr, error ) )
     {
-        case LUA_OK:
-            break;
-        default:
-            lua_error( L );
-            const char* err = lua_tostring( L, -1 );
-            Com_PrintError( "[lua] error %d\n%s", code, err );
-            break;
+        Com_PrintError( "[lua] %s", error.c_str() );
+        return false;
     }
-
-    lua_close( L );
-    g_scene = nullptr;
-    return code == LUA_OK;
+    return true;
 }
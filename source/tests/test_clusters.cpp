@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "constant_cache.h"
+#include "cpu/cluster_scene.h"
+#include "cpu/cpu_renderer.h"
+#include "geomath/bvh.h"
+#include "tests/tests.h"
+#include "utility/arena.h"
+
+namespace pt {
+
+static constexpr int CLUSTER_TRIANGLES = 200000;
+static constexpr int CLUSTER_SIZE      = 1024;
+static constexpr int CLUSTER_THREADS   = 4;
+static constexpr int CLUSTER_IMAGE     = 128;
+static constexpr int CLUSTER_SPP       = 2;
+
+/// a slab of random triangles with two materials, built like ConstructScene builds a mesh
+static void BuildTriangleSoup( GpuScene& scene )
+{
+    std::mt19937 rng( 3 );
+    std::uniform_real_distribution<float> uniform( -20.0f, 20.0f );
+
+    Arena arena( MemTag_BvhBuild );
+    ArenaVector<Geometry> triangles{ ArenaAllocator<Geometry>( arena ) };
+    triangles.reserve( CLUSTER_TRIANGLES );
+    for ( int i = 0; i < CLUSTER_TRIANGLES; ++i )
+    {
+        const vec3 a( uniform( rng ), 0.5f * uniform( rng ), uniform( rng ) );
+        triangles.push_back( Geometry( a, a + vec3( 0.2f, 0.0f, 0.0f ), a + vec3( 0.0f, 0.2f, 0.1f ), i % 2 ) );
+    }
+
+    Bvh* root = Bvh::Build( triangles.data(), triangles.size(), arena );
+    root->CreateGpuBvh( scene.bvhs, scene.geometries );
+    scene.bbox   = root->GetBox();
+    scene.height = ComputeBvhStats( scene.bvhs ).depth;
+    scene.nodes  = CreateBvhNodePairs( scene.bvhs );
+    for ( const Geometry& geom : scene.geometries )
+    {
+        scene.primitives.push_back( GpuPrimitive{ geom.A, geom.kind, geom.B, geom.radius, geom.C, 0 } );
+    }
+
+    scene.materials.resize( 2 );
+    for ( int i = 0; i < 2; ++i )
+    {
+        GpuMaterial& material   = scene.materials[i];
+        material                = GpuMaterial{};
+        material.albedo         = vec3( 0.7f, 0.2f + 0.6f * i, 0.5f );
+        material.reflect        = 0.3f * i;
+        material.emissive       = vec3( 0.1f * i );
+        material.roughness      = 0.5f;
+        material.albedoMapLevel = 0.0f;
+    }
+    SetBvhLayout( scene, BvhLayout::Pairs );
+}
+
+static void Render( CpuRenderer& renderer, ConstantBufferCache& cache )
+{
+    for ( int sample = 0; sample < CLUSTER_SPP; ++sample )
+    {
+        cache.frame       = sample + 1;
+        cache.sampleIndex = sample;
+        cache.dirty       = sample == 0;
+        cache.tileOffset  = ivec2( 0 );
+        renderer.RenderTile( cache, CLUSTER_IMAGE, CLUSTER_IMAGE );
+    }
+}
+
+TestResult Test_Clusters()
+{
+    GpuScene scene;
+    BuildTriangleSoup( scene );
+
+    std::vector<float> envData( 16 * 8 * 4, 0.8f );
+    Image envMap;
+    envMap.width      = 16;
+    envMap.height     = 8;
+    envMap.channel    = 4;
+    envMap.type       = Image::Float;
+    envMap.data       = envData.data();
+    envMap.sizeInByte = envData.size() * sizeof( float );
+    const ImageArray albedoMaps;
+
+    ConstantBufferCache cache;
+    cache.camPos    = vec3( 0.0f, 0.0f, 35.0f );
+    cache.camFwd    = vec3( 0.0f, 0.0f, -1.0f );
+    cache.camRight  = vec3( 1.0f, 0.0f, 0.0f );
+    cache.camUp     = vec3( 0.0f, 1.0f, 0.0f );
+    cache.camFov    = 30.0f;
+    cache.aoRadius  = 3.0f;
+    cache.writeAovs = 1;
+
+    // both integrators, the path tracer bounces and ambient occlusion casts occlusion rays
+    std::vector<std::vector<vec4>> images, ids;
+    for ( int integrator : { Integrator_Path, Integrator_AmbientOcclusion } )
+    {
+        CpuRenderer renderer;
+        renderer.Initialize( scene, envMap, albedoMaps, CLUSTER_IMAGE, CLUSTER_IMAGE, CLUSTER_THREADS );
+        cache.integrator = integrator;
+        Render( renderer, cache );
+        images.push_back( renderer.GetImage() );
+        ids.push_back( renderer.GetIds() );
+    }
+
+    const std::string path = ( std::filesystem::temp_directory_path() / "pt-tests.clusters" ).string();
+    ClusterScene clusters;
+    try
+    {
+        ClusterScene::Write( scene, CLUSTER_SIZE, path );
+        ReleaseSceneGeometry( scene );
+        // a quarter of the file, still room for a cluster per thread and one to evict
+        clusters.Open( path, std::filesystem::file_size( path ) / 4 );
+    }
+    catch ( const std::runtime_error& e )
+    {
+        std::remove( path.c_str() );
+        TEST_EXPECT( false, "[test] failed to write the cluster file: %s", e.what() );
+    }
+
+    const size_t budget = clusters.GetBudget();
+    Com_Printf( "[test] %d triangles in %d clusters, %.1f MB file, %.1f MB budget",
+                clusters.GetPrimitiveCount(),
+                clusters.GetClusterCount(),
+                clusters.GetFileSize() / ( 1024.0 * 1024.0 ),
+                budget / ( 1024.0 * 1024.0 ) );
+
+    int failed = 0;
+    for ( int pass = 0; pass < 2; ++pass )
+    {
+        CpuRenderer renderer;
+        renderer.Initialize( scene, envMap, albedoMaps, CLUSTER_IMAGE, CLUSTER_IMAGE, CLUSTER_THREADS );
+        renderer.SetWavefront( 65536, false );
+        renderer.SetClusterScene( &clusters );
+        cache.integrator = pass == 0 ? Integrator_Path : Integrator_AmbientOcclusion;
+        Render( renderer, cache );
+
+        int differing = 0;
+        for ( size_t i = 0; i < images[pass].size(); ++i )
+        {
+            const vec4 d = glm::abs( images[pass][i] - renderer.GetImage()[i] );
+            differing += glm::max( glm::max( d.x, d.y ), d.z ) > 1e-5f || ids[pass][i].y != renderer.GetIds()[i].y;
+        }
+        if ( differing )
+        {
+            Com_PrintError( "[test] %d pixels of integrator %d differ from the in core render", differing, pass );
+            ++failed;
+        }
+    }
+    const ClusterScene::CacheStats stats = clusters.GetCacheStats();
+    clusters.Close();
+    std::remove( path.c_str() );
+
+    Com_Printf( "[test] %llu faults, %llu evictions, peak %.1f MB",
+                static_cast<unsigned long long>( stats.faults ),
+                static_cast<unsigned long long>( stats.evictions ),
+                stats.peakBytes / ( 1024.0 * 1024.0 ) );
+    TEST_EXPECT( failed == 0, "[test] out of core images differ" );
+    TEST_EXPECT( stats.evictions > 0, "[test] the clusters fit the budget, nothing was paged" );
+    TEST_EXPECT( stats.peakBytes <= budget, "[test] resident clusters peaked at %zu bytes, over the %zu byte budget", stats.peakBytes, budget );
+    return Test_Passed;
+}
+
+}  // namespace pt
@@ -0,0 +1,60 @@
+#include <cstring>
+
+#include "com_dvars.h"
+#include "com_misc.h"
+#include "tests/tests.h"
+#include "universal/dvar_api.h"
+
+using namespace pt;
+
+struct TestCase {
+    const char* name;
+    TestResult ( *func )();
+};
+
+static const TestCase s_tests[] = {
+    { "mem_budget", Test_MemBudget },
+    { "clusters", Test_Clusters },
+    { "watertight", Test_Watertight },
+    { "self_intersection", Test_SelfIntersection },
+    { "parallel_for", Test_ParallelFor },
+    { "triangle_bench", Test_TriangleBench },
+};
+
+// pt-tests <case> [+set <dvar> <value> ...], one process per case so the memory counters
+// and dvars start clean, ctest runs every case from the repo root
+int main( int argc, const char** argv )
+{
+    Com_RegisterDvars();
+    if ( argc < 2 || !Com_ProcessCmdLine( argc - 2, argv + 2 ) )
+    {
+        Com_PrintError( "[test] usage: pt-tests <case> [+set <dvar> <value> ...]" );
+        return Test_Failed;
+    }
+
+    for ( const TestCase& test : s_tests )
+    {
+        if ( strcmp( test.name, argv[1] ) != 0 )
+        {
+            continue;
+        }
+
+        const TestResult result = test.func();
+        switch ( result )
+        {
+            case Test_Passed:
+                Com_PrintSuccess( "[test] %s passed", test.name );
+                break;
+            case Test_Skipped:
+                Com_PrintWarning( "[test] %s skipped", test.name );
+                break;
+            default:
+                Com_PrintError( "[test] %s failed", test.name );
+                break;
+        }
+        return result;
+    }
+
+    Com_PrintError( "[test] unknown case '%s'", argv[1] );
+    return Test_Failed;
+}
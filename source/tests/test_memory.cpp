@@ -0,0 +1,85 @@
+#include <stdexcept>
+
+#include "com_dvars.h"
+#include "image.h"
+#include "scene.h"
+#include "scene_loader.h"
+#include "tests/tests.h"
+#include "universal/dvar_api.h"
+#include "utility/memory_stats.h"
+
+namespace pt {
+
+extern ImageArray g_AlbedoMaps;
+
+/// limit the monkey load (script, bvh build and the built scene) has to stay under, its
+/// measured peak of 4406352 bytes with 1 to 16 threads rounded up. +set mem_budget <MB> replaces it
+static constexpr int MONKEY_BUDGET_MB = 5;
+
+static void ReleaseAlbedoMaps()
+{
+    for ( Image& image : g_AlbedoMaps.images )
+    {
+        FreeImage( image );
+    }
+    g_AlbedoMaps = ImageArray();
+}
+
+static void LoadMonkey()
+{
+    Scene scene;
+    if ( !LuaLoadScene( ROOT_FOLDER "scripts/monkey.lua", scene ) )
+    {
+        throw std::runtime_error( "failed to execute scripts/monkey.lua" );
+    }
+
+    GpuScene gpuScene;
+    try
+    {
+        ConstructScene( scene, gpuScene );
+    }
+    catch ( ... )
+    {
+        ReleaseAlbedoMaps();
+        throw;
+    }
+    ReleaseAlbedoMaps();
+}
+
+TestResult Test_MemBudget()
+{
+    const int budgetMb   = Dvar_GetInt( mem_budget ) > 0 ? Dvar_GetInt( mem_budget ) : MONKEY_BUDGET_MB;
+    const int64_t budget = static_cast<int64_t>( budgetMb ) << 20;
+    SetMemBudget( budget );
+    ResetMemPeaks();
+    try
+    {
+        LoadMonkey();
+    }
+    catch ( const std::runtime_error& e )
+    {
+        TEST_EXPECT( false, "[test] monkey does not load within %d MB: %s", budgetMb, e.what() );
+    }
+
+    const int64_t peak = GetMemTotal().peak;
+    Com_Printf( "[test] monkey peak %.1f MB of %d MB", peak / ( 1024.0 * 1024.0 ), budgetMb );
+    TEST_EXPECT( peak <= budget, "[test] monkey peak %lld bytes is over the %lld byte budget", static_cast<long long>( peak ), static_cast<long long>( budget ) );
+
+    // the budget is enforced, not only reported
+    SetMemBudget( peak / 2 );
+    ResetMemPeaks();
+    bool threw = false;
+    try
+    {
+        LoadMonkey();
+    }
+    catch ( const std::runtime_error& )
+    {
+        threw = true;
+    }
+    TEST_EXPECT( threw, "[test] monkey loaded within half of its peak" );
+    TEST_EXPECT( GetMemTotal().peak <= peak / 2, "[test] the failed load went over its budget" );
+    return Test_Passed;
+}
+
+}  // namespace pt
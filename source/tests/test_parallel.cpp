@@ -0,0 +1,54 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include "tests/tests.h"
+#include "utility/parallel.h"
+
+namespace pt {
+
+TestResult Test_ParallelFor()
+{
+    const int count = 1000;
+    std::vector<int> visits( count, 0 );
+    ParallelFor( count, 4, [&]( int index ) {
+        // nested calls run on the thread that makes them
+        ParallelFor( 2, 4, [&]( int ) { ++visits[index]; } );
+    } );
+    for ( int index = 0; index < count; ++index )
+    {
+        TEST_EXPECT( visits[index] == 2, "[test] index %d visited %d times instead of 2", index, visits[index] );
+    }
+
+    // thrown on a pool thread or on the caller, whichever gets the index
+    for ( int thrower : { 0, count / 2, count - 1 } )
+    {
+        std::atomic_int done( 0 );
+        bool caught = false;
+        try
+        {
+            ParallelFor( count, 4, [&]( int index ) {
+                if ( index == thrower )
+                {
+                    throw std::runtime_error( "thrown" );
+                }
+                ++done;
+            } );
+        }
+        catch ( const std::runtime_error& )
+        {
+            caught = true;
+        }
+        TEST_EXPECT( caught, "[test] the exception from index %d did not reach the caller", thrower );
+        TEST_EXPECT( done < count, "[test] more items ran than were handed out" );
+    }
+
+    // the pool starts again after a shutdown
+    ParallelShutdown();
+    std::atomic_int sum( 0 );
+    ParallelFor( count, 4, [&]( int index ) { sum += index; } );
+    TEST_EXPECT( sum == count * ( count - 1 ) / 2, "[test] sum %d after the restart", sum.load() );
+    return Test_Passed;
+}
+
+}  // namespace pt
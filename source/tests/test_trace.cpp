@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "constant_cache.h"
+#include "cpu/cpu_renderer.h"
+#include "cpu/trace.h"
+#include "geomath/bvh.h"
+#include "tests/tests.h"
+#include "utility/arena.h"
+
+namespace pt {
+
+using glm::cross;
+using glm::dot;
+
+static constexpr int GRID_CELLS      = 256;
+static constexpr int SELF_HIT_RAYS   = 65536;
+static constexpr int SELF_HIT_IMAGE  = 64;
+static constexpr int BENCH_RAYS      = 4096;
+static constexpr int BENCH_TRIANGLES = 1024;
+static constexpr int BENCH_RUNS      = 5;
+
+/// the one sided Moller-Trumbore test IntersectTriangle replaced, kept as the reference
+/// the watertight and bench cases report against
+static bool MollerTrumbore( const Ray& ray, const Geometry& triangle, float& outT )
+{
+    const vec3 AB   = triangle.B - triangle.A;
+    const vec3 AC   = triangle.C - triangle.A;
+    const vec3 P    = cross( ray.direction, AC );
+    const float det = dot( AB, P );
+    if ( det < EPSILON )
+    {
+        return false;
+    }
+
+    const float invDet = 1.0f / det;
+    const vec3 AO      = ray.origin - triangle.A;
+    const vec3 Q       = cross( AO, AB );
+    const float u      = dot( AO, P ) * invDet;
+    const float v      = dot( ray.direction, Q ) * invDet;
+    if ( u < 0.0f || v < 0.0f || u + v > 1.0f )
+    {
+        return false;
+    }
+
+    const float t = dot( AC, Q ) * invDet;
+    if ( t >= ray.t || t < EPSILON )
+    {
+        return false;
+    }
+    outT = t;
+    return true;
+}
+
+static GpuPrimitive ToPrimitive( const Geometry& geom )
+{
+    return GpuPrimitive{ geom.A, geom.kind, geom.B, geom.radius, geom.C, 0 };
+}
+
+TestResult Test_Watertight()
+{
+    // a jittered height field far from the origin, two triangles per cell
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<float> uniform( 0.0f, 1.0f );
+    const int stride = GRID_CELLS + 1;
+    std::vector<vec3> vertices( stride * stride );
+    for ( int y = 0; y <= GRID_CELLS; ++y )
+    {
+        for ( int x = 0; x <= GRID_CELLS; ++x )
+        {
+            vertices[y * stride + x] = vec3( x * 0.37f + 0.1f, y * 0.29f - 3.0f, 0.05f * uniform( rng ) + 100.0f );
+        }
+    }
+
+    std::vector<Geometry> geoms;
+    for ( int y = 0; y < GRID_CELLS; ++y )
+    {
+        for ( int x = 0; x < GRID_CELLS; ++x )
+        {
+            const vec3& a = vertices[y * stride + x];
+            const vec3& b = vertices[y * stride + x + 1];
+            const vec3& c = vertices[( y + 1 ) * stride + x];
+            const vec3& d = vertices[( y + 1 ) * stride + x + 1];
+            geoms.push_back( Geometry( a, c, b, 0 ) );
+            geoms.push_back( Geometry( b, c, d, 0 ) );
+        }
+    }
+
+    // slanted rays aimed exactly at the interior vertices and edge midpoints, only the
+    // triangles of the cells around the target can be hit
+    int rays = 0, misses = 0, referenceMisses = 0;
+    for ( int y = 1; y < GRID_CELLS - 1; ++y )
+    {
+        for ( int x = 1; x < GRID_CELLS - 1; ++x )
+        {
+            const vec3& v00       = vertices[y * stride + x];
+            const vec3& v10       = vertices[y * stride + x + 1];
+            const vec3& v01       = vertices[( y + 1 ) * stride + x];
+            const vec3 targets[4] = { v00, 0.5f * ( v00 + v10 ), 0.5f * ( v00 + v01 ), 0.5f * ( v10 + v01 ) };
+            for ( const vec3& target : targets )
+            {
+                const vec3 origin = target - vec3( ( uniform( rng ) - 0.5f ) * 20.0f, ( uniform( rng ) - 0.5f ) * 20.0f, 100.0f );
+                const Ray ray( origin, glm::normalize( target - origin ) );
+                const TraversalRay traversal( ray.origin, ray.direction, RAY_T_MAX );
+
+                int hits = 0, referenceHits = 0;
+                for ( int cy = y - 1; cy <= y + 1; ++cy )
+                {
+                    for ( int cx = x - 1; cx <= x + 1; ++cx )
+                    {
+                        for ( int i = 2 * ( cy * GRID_CELLS + cx ); i < 2 * ( cy * GRID_CELLS + cx ) + 2; ++i )
+                        {
+                            float t;
+                            vec2 bary;
+                            hits += IntersectTriangle( traversal, ToPrimitive( geoms[i] ), t, bary );
+
+                            // both windings, the reference is one sided
+                            Geometry flipped = geoms[i];
+                            std::swap( flipped.B, flipped.C );
+                            referenceHits += MollerTrumbore( ray, geoms[i], t ) || MollerTrumbore( ray, flipped, t );
+                        }
+                    }
+                }
+                ++rays;
+                misses += hits == 0;
+                referenceMisses += referenceHits == 0;
+            }
+        }
+    }
+
+    Com_Printf( "[test] %d rays through shared vertices and edges, %d misses, %d with Moller-Trumbore", rays, misses, referenceMisses );
+    TEST_EXPECT( misses == 0, "[test] %d rays went through a crack between triangles", misses );
+    return Test_Passed;
+}
+
+/// a square of two triangles centered on center, tilted so none of its coordinates are
+/// exactly representable in every vertex
+static void BuildTiltedQuad( GpuScene& scene, const vec3& center, float halfSize, vec3& outNormal, vec3& outU, vec3& outV )
+{
+    outNormal     = glm::normalize( vec3( 0.3f, 1.0f, 0.2f ) );
+    outU          = glm::normalize( cross( outNormal, vec3( 0.0f, 0.0f, 1.0f ) ) );
+    outV          = cross( outU, outNormal );
+    const vec3 du = halfSize * outU;
+    const vec3 dv = halfSize * outV;
+
+    Arena arena( MemTag_BvhBuild );
+    ArenaVector<Geometry> triangles{ ArenaAllocator<Geometry>( arena ) };
+    triangles.push_back( Geometry( center - du - dv, center + du - dv, center + du + dv, 0 ) );
+    triangles.push_back( Geometry( center - du - dv, center + du + dv, center - du + dv, 0 ) );
+
+    Bvh* root = Bvh::Build( triangles.data(), triangles.size(), arena );
+    root->CreateGpuBvh( scene.bvhs, scene.geometries );
+    scene.bbox   = root->GetBox();
+    scene.height = ComputeBvhStats( scene.bvhs ).depth;
+    scene.nodes  = CreateBvhNodePairs( scene.bvhs );
+    for ( const Geometry& geom : scene.geometries )
+    {
+        scene.primitives.push_back( ToPrimitive( geom ) );
+    }
+
+    scene.materials.resize( 1 );
+    GpuMaterial& material   = scene.materials[0];
+    material                = GpuMaterial{};
+    material.albedo         = vec3( 0.5f );
+    material.reflect        = 0.0f;
+    material.emissive       = vec3( 0.0f );
+    material.roughness      = 1.0f;
+    material.albedoMapLevel = 0.0f;
+    SetBvhLayout( scene, BvhLayout::Pairs );
+}
+
+static vec3 RandomUnitVector( std::mt19937& rng )
+{
+    std::uniform_real_distribution<float> uniform( -1.0f, 1.0f );
+    for ( ;; )
+    {
+        const vec3 v       = vec3( uniform( rng ), uniform( rng ), uniform( rng ) );
+        const float length = glm::length( v );
+        if ( length > 0.01f && length <= 1.0f )
+        {
+            return v / length;
+        }
+    }
+}
+
+/// rays leaving a plane to either side can not hit anything, counts those that find the plane again
+static int CountSelfHits( const GpuScene& scene, const vec3& center, float halfSize, const vec3& N, const vec3& U, const vec3& V, bool offset )
+{
+    std::mt19937 rng( 7 );
+    std::uniform_real_distribution<float> uniform( -0.9f, 0.9f );
+    int selfHits = 0;
+    for ( int i = 0; i < SELF_HIT_RAYS; ++i )
+    {
+        // half of the rays come from behind, the triangles are hit on their back faces
+        const float side  = i % 2 ? -1.0f : 1.0f;
+        const vec3 target = center + halfSize * ( uniform( rng ) * U + uniform( rng ) * V );
+        const vec3 origin = center + halfSize * ( side * N + uniform( rng ) * U + uniform( rng ) * V );
+        Ray ray( origin, glm::normalize( target - origin ) );
+        if ( !HitScene( ray, scene ) )
+        {
+            continue;
+        }
+
+        // a diffuse bounce and a shadow ray to a light on the side the ray came from
+        const vec3 hitPoint  = ray.origin + ray.t * ray.direction;
+        const vec3 bounceDir = glm::normalize( ray.hitNormal + RandomUnitVector( rng ) );
+        const vec3 lightDir  = glm::normalize( ray.hitNormal + 0.5f * U );
+        Ray bounce( offset ? OffsetRayOrigin( hitPoint, ray.hitGeomNormal, bounceDir ) : hitPoint, bounceDir );
+        const Ray shadow( offset ? OffsetRayOrigin( hitPoint, ray.hitGeomNormal, lightDir ) : hitPoint, lightDir );
+        selfHits += HitScene( bounce, scene ) || OccludedScene( shadow, RAY_T_MAX, scene );
+    }
+    return selfHits;
+}
+
+TestResult Test_SelfIntersection()
+{
+    struct PlaneCase {
+        vec3 center;
+        float halfSize;
+    };
+    // around the origin where the offset is a fixed distance, then the scale of sponza and
+    // of a terrain tens of kilometers wide
+    const PlaneCase cases[] = {
+        { vec3( 0.013f, -0.021f, 0.007f ), 4.0f },
+        { vec3( 1234.5f, 321.7f, -876.3f ), 400.0f },
+        { vec3( 61234.5f, 20321.7f, -50876.3f ), 4000.0f },
+    };
+
+    std::vector<float> envData( 16 * 8 * 4, 0.8f );
+    Image envMap;
+    envMap.width      = 16;
+    envMap.height     = 8;
+    envMap.channel    = 4;
+    envMap.type       = Image::Float;
+    envMap.data       = envData.data();
+    envMap.sizeInByte = envData.size() * sizeof( float );
+    const ImageArray albedoMaps;
+
+    int failed = 0;
+    for ( const PlaneCase& plane : cases )
+    {
+        GpuScene scene;
+        vec3 N, U, V;
+        BuildTiltedQuad( scene, plane.center, plane.halfSize, N, U, V );
+
+        const int rawSelfHits = CountSelfHits( scene, plane.center, plane.halfSize, N, U, V, false );
+        const int selfHits    = CountSelfHits( scene, plane.center, plane.halfSize, N, U, V, true );
+
+        // the renderer looking straight at the plane, every path bounces once into the constant
+        // environment and every occlusion ray escapes
+        ConstantBufferCache cache;
+        cache.camPos      = plane.center + 1.5f * plane.halfSize * N;
+        cache.camFwd      = -N;
+        cache.camRight    = U;
+        cache.camUp       = V;
+        cache.camFov      = 30.0f;
+        cache.aoRadius    = plane.halfSize;
+        cache.frame       = 1;
+        cache.sampleIndex = 0;
+        cache.dirty       = 1;
+        cache.tileOffset  = ivec2( 0 );
+
+        int darkPixels = 0;
+        for ( int integrator : { Integrator_Path, Integrator_AmbientOcclusion } )
+        {
+            CpuRenderer renderer;
+            renderer.Initialize( scene, envMap, albedoMaps, SELF_HIT_IMAGE, SELF_HIT_IMAGE, 1 );
+            cache.integrator = integrator;
+            renderer.RenderTile( cache, SELF_HIT_IMAGE, SELF_HIT_IMAGE );
+
+            const float expected = integrator == Integrator_Path ? 0.5f * 0.8f : 1.0f;
+            for ( const vec4& pixel : renderer.GetImage() )
+            {
+                darkPixels += pixel.x < expected - 1e-4f;
+            }
+        }
+
+        Com_Printf( "[test] plane at %.0f: %d of %d secondary rays hit it again from the hit point, %d from the offset origin, %d dark pixels",
+                    glm::length( plane.center ), rawSelfHits, SELF_HIT_RAYS, selfHits, darkPixels );
+        failed += selfHits != 0 || darkPixels != 0;
+    }
+
+    TEST_EXPECT( failed == 0, "[test] secondary rays hit their own surface in %d of %d scenes", failed, static_cast<int>( std::size( cases ) ) );
+    return Test_Passed;
+}
+
+TestResult Test_TriangleBench()
+{
+    std::mt19937 rng( 1 );
+    std::uniform_real_distribution<float> uniform( -1.0f, 1.0f );
+
+    std::vector<Ray> rays;
+    std::vector<TraversalRay> traversals;
+    for ( int i = 0; i < BENCH_RAYS; ++i )
+    {
+        const Ray ray( 0.5f * vec3( uniform( rng ), uniform( rng ), uniform( rng ) ), glm::normalize( vec3( uniform( rng ), uniform( rng ), uniform( rng ) ) ) );
+        rays.push_back( ray );
+        traversals.push_back( TraversalRay( ray.origin, ray.direction, RAY_T_MAX ) );
+    }
+
+    std::vector<Geometry> geoms;
+    std::vector<GpuPrimitive> prims;
+    for ( int i = 0; i < BENCH_TRIANGLES; ++i )
+    {
+        const vec3 a = vec3( uniform( rng ), uniform( rng ), uniform( rng ) );
+        const vec3 b = a + 0.8f * vec3( uniform( rng ), uniform( rng ), uniform( rng ) );
+        const vec3 c = a + 0.8f * vec3( uniform( rng ), uniform( rng ), uniform( rng ) );
+        geoms.push_back( Geometry( a, b, c, 0 ) );
+        prims.push_back( ToPrimitive( geoms.back() ) );
+    }
+
+    // best of a few runs, the reference reads the full Geometry as it did before the split
+    using Clock          = std::chrono::steady_clock;
+    double referenceBest = 1e30, watertightBest = 1e30;
+    int referenceHits = 0, watertightHits = 0;
+    for ( int run = 0; run < BENCH_RUNS; ++run )
+    {
+        float t;
+        vec2 bary;
+        Clock::time_point start = Clock::now();
+        referenceHits           = 0;
+        for ( const Ray& ray : rays )
+        {
+            for ( const Geometry& geom : geoms )
+            {
+                referenceHits += MollerTrumbore( ray, geom, t );
+            }
+        }
+        referenceBest = std::min( referenceBest, std::chrono::duration<double>( Clock::now() - start ).count() );
+
+        start          = Clock::now();
+        watertightHits = 0;
+        for ( const TraversalRay& ray : traversals )
+        {
+            for ( const GpuPrimitive& prim : prims )
+            {
+                watertightHits += IntersectTriangle( ray, prim, t, bary );
+            }
+        }
+        watertightBest = std::min( watertightBest, std::chrono::duration<double>( Clock::now() - start ).count() );
+    }
+
+    const double tests = static_cast<double>( BENCH_RAYS ) * BENCH_TRIANGLES;
+    Com_Printf( "[test] %d rays x %d triangles, best of %d", BENCH_RAYS, BENCH_TRIANGLES, BENCH_RUNS );
+    Com_Printf( "[test] Moller-Trumbore %.1f M tests/s, %d hits, one sided", tests / referenceBest * 1e-6, referenceHits );
+    Com_Printf( "[test] watertight      %.1f M tests/s, %d hits, two sided", tests / watertightBest * 1e-6, watertightHits );
+    return Test_Passed;
+}
+
+}  // namespace pt
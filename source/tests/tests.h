@@ -0,0 +1,48 @@
+#pragma once
+
+#include "universal/print.h"
+
+namespace pt {
+
+/// exit code of pt-tests <case>, Test_Skipped is the SKIP_RETURN_CODE of the ctest entries
+enum TestResult {
+    Test_Passed  = 0,
+    Test_Failed  = 1,
+    Test_Skipped = 77,
+};
+
+/// fails the running case with a message when cond is false
+#define TEST_EXPECT( cond, ... )           \
+    do                                     \
+    {                                      \
+        if ( !( cond ) )                   \
+        {                                  \
+            Com_PrintError( __VA_ARGS__ ); \
+            return Test_Failed;            \
+        }                                  \
+    } while ( 0 )
+
+/// loads monkey under a fixed mem_budget and checks the peak stays below it, then checks a
+/// budget below that peak makes the load fail
+TestResult Test_MemBudget();
+
+/// writes a generated mesh to a cluster file, traces it with a budget of a quarter of the file
+/// and compares the images with the in core traversal, the resident clusters stay in the budget
+TestResult Test_Clusters();
+
+/// rays aimed exactly at shared vertices and edges of a height field all hit a triangle
+TestResult Test_Watertight();
+
+/// bounce, shadow and occlusion rays leaving a plane near the origin and far from it do not
+/// hit it again, traced directly and through the cpu renderer
+TestResult Test_SelfIntersection();
+
+/// every index runs exactly once, nested calls complete, an exception thrown on any thread
+/// reaches the caller and the pool starts again after ParallelShutdown
+TestResult Test_ParallelFor();
+
+/// triangle tests per second of IntersectTriangle against the Moller-Trumbore test it
+/// replaced, only printed so it is not a ctest entry: pt-tests triangle_bench
+TestResult Test_TriangleBench();
+
+}  // namespace pt
@@ -0,0 +1,215 @@
+#include "traversal_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+
+namespace pt {
+
+using std::string;
+using std::vector;
+
+int TraversalBucket( int value )
+{
+    int bucket = 0;
+    for ( unsigned int v = static_cast<unsigned int>( glm::max( value, 0 ) ); v; v >>= 1 )
+    {
+        ++bucket;
+    }
+    return glm::min( bucket, TRAVERSAL_BUCKETS - 1 );
+}
+
+void TraversalStats::Add( const TraversalStats& other )
+{
+    rays += other.rays;
+    nodes += other.nodes;
+    boxes += other.boxes;
+    primitives += other.primitives;
+    hits += other.hits;
+    for ( int i = 0; i < TRAVERSAL_BUCKETS; ++i )
+    {
+        nodeHistogram[i] += other.nodeHistogram[i];
+        primitiveHistogram[i] += other.primitiveHistogram[i];
+    }
+}
+
+void TraversalStats::Add( const TraversalCounters& counters )
+{
+    rays += counters.rays;
+    nodes += counters.nodes;
+    boxes += counters.boxes;
+    primitives += counters.primitives;
+    hits += counters.hits;
+    for ( int i = 0; i < TRAVERSAL_BUCKETS; ++i )
+    {
+        nodeHistogram[i] += counters.nodeHistogram[i];
+        primitiveHistogram[i] += counters.primitiveHistogram[i];
+    }
+}
+
+int HistogramPercentile( const uint64_t* histogram, double fraction )
+{
+    uint64_t total = 0;
+    for ( int i = 0; i < TRAVERSAL_BUCKETS; ++i )
+    {
+        total += histogram[i];
+    }
+
+    const double target = fraction * static_cast<double>( total );
+    uint64_t count      = 0;
+    for ( int i = 0; i < TRAVERSAL_BUCKETS; ++i )
+    {
+        count += histogram[i];
+        if ( histogram[i] && static_cast<double>( count ) >= target )
+        {
+            return i == 0 ? 0 : ( 1 << i ) - 1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Per thread counters
+//------------------------------------------------------------------------------
+namespace {
+
+struct ThreadStats;
+
+std::mutex s_mutex;
+vector<ThreadStats*> s_threads;
+TraversalStats s_retired;  // threads that exited since the last collect
+
+struct ThreadStats {
+    TraversalStats stats;
+
+    ThreadStats()
+    {
+        std::lock_guard<std::mutex> lock( s_mutex );
+        s_threads.push_back( this );
+    }
+
+    ~ThreadStats()
+    {
+        std::lock_guard<std::mutex> lock( s_mutex );
+        s_retired.Add( stats );
+        s_threads.erase( std::find( s_threads.begin(), s_threads.end(), this ) );
+    }
+};
+
+#ifdef PT_TRAVERSAL_STATS
+thread_local ThreadStats t_stats;
+#endif
+
+}  // namespace
+
+#ifdef PT_TRAVERSAL_STATS
+void RecordTraversal( const TraversalCost& cost, bool hit )
+{
+    TraversalStats& stats = t_stats.stats;
+    ++stats.rays;
+    stats.nodes += cost.nodes;
+    stats.boxes += cost.boxes;
+    stats.primitives += cost.primitives;
+    stats.hits += hit;
+    ++stats.nodeHistogram[TraversalBucket( cost.nodes )];
+    ++stats.primitiveHistogram[TraversalBucket( cost.primitives )];
+}
+#endif
+
+TraversalStats CollectTraversalStats()
+{
+    std::lock_guard<std::mutex> lock( s_mutex );
+    TraversalStats total = s_retired;
+    s_retired            = TraversalStats();
+    for ( ThreadStats* thread : s_threads )
+    {
+        total.Add( thread->stats );
+        thread->stats = TraversalStats();
+    }
+    return total;
+}
+
+//------------------------------------------------------------------------------
+// Export
+//------------------------------------------------------------------------------
+static double PerRay( uint64_t value, uint64_t rays )
+{
+    return rays ? static_cast<double>( value ) / static_cast<double>( rays ) : 0.0;
+}
+
+bool WriteTraversalCsv( const string& path, const vector<TraversalStats>& frames )
+{
+    FILE* file = fopen( path.c_str(), "w" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    fprintf( file, "frame,rays,nodes_per_ray,boxes_per_ray,primitives_per_ray,hit_rate,nodes_p50,nodes_p95,primitives_p50,primitives_p95\n" );
+    for ( size_t i = 0; i < frames.size(); ++i )
+    {
+        const TraversalStats& frame = frames[i];
+        fprintf( file, "%d,%llu,%f,%f,%f,%f,%d,%d,%d,%d\n",
+                 static_cast<int>( i ),
+                 static_cast<unsigned long long>( frame.rays ),
+                 PerRay( frame.nodes, frame.rays ),
+                 PerRay( frame.boxes, frame.rays ),
+                 PerRay( frame.primitives, frame.rays ),
+                 PerRay( frame.hits, frame.rays ),
+                 HistogramPercentile( frame.nodeHistogram, 0.5 ),
+                 HistogramPercentile( frame.nodeHistogram, 0.95 ),
+                 HistogramPercentile( frame.primitiveHistogram, 0.5 ),
+                 HistogramPercentile( frame.primitiveHistogram, 0.95 ) );
+    }
+    return fclose( file ) == 0;
+}
+
+static void WriteHistogram( FILE* file, const char* name, const uint64_t* histogram )
+{
+    fprintf( file, "\"%s\": [", name );
+    for ( int i = 0; i < TRAVERSAL_BUCKETS; ++i )
+    {
+        fprintf( file, "%s%llu", i ? ", " : "", static_cast<unsigned long long>( histogram[i] ) );
+    }
+    fprintf( file, "]" );
+}
+
+bool WriteTraversalJson( const string& path, const BvhStats& bvh, const vector<TraversalStats>& frames )
+{
+    FILE* file = fopen( path.c_str(), "w" );
+    if ( !file )
+    {
+        return false;
+    }
+
+    fprintf( file, "{\n  \"bvh\": {\n" );
+    fprintf( file, "    \"nodes\": %d,\n    \"leaves\": %d,\n    \"depth\": %d,\n    \"mean_leaf_depth\": %f,\n", bvh.nodes, bvh.leaves, bvh.depth, bvh.meanLeafDepth );
+    fprintf( file, "    \"sah_cost\": %f,\n    \"overlap\": %f,\n    \"leaf_sizes\": [", bvh.sahCost, bvh.overlap );
+    for ( size_t i = 0; i < bvh.leafSizes.size(); ++i )
+    {
+        fprintf( file, "%s%d", i ? ", " : "", bvh.leafSizes[i] );
+    }
+    fprintf( file, "]\n  },\n" );
+
+    // bucket i > 0 holds [2^(i-1), 2^i - 1]
+    fprintf( file, "  \"buckets\": \"log2\",\n  \"frames\": [" );
+    for ( size_t i = 0; i < frames.size(); ++i )
+    {
+        const TraversalStats& frame = frames[i];
+        fprintf( file, "%s\n    { \"rays\": %llu, \"nodes\": %llu, \"boxes\": %llu, \"primitives\": %llu, \"hits\": %llu, ",
+                 i ? "," : "",
+                 static_cast<unsigned long long>( frame.rays ),
+                 static_cast<unsigned long long>( frame.nodes ),
+                 static_cast<unsigned long long>( frame.boxes ),
+                 static_cast<unsigned long long>( frame.primitives ),
+                 static_cast<unsigned long long>( frame.hits ) );
+        WriteHistogram( file, "node_histogram", frame.nodeHistogram );
+        fprintf( file, ", " );
+        WriteHistogram( file, "primitive_histogram", frame.primitiveHistogram );
+        fprintf( file, " }" );
+    }
+    fprintf( file, "\n  ]\n}\n" );
+    return fclose( file ) == 0;
+}
+
+}  // namespace pt
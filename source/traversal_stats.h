@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu/trace.h"
+#include "geomath/bvh.h"
+
+namespace pt {
+
+/// power of two buckets: 0, 1, 2-3, 4-7, ..., the last one is open ended,
+/// matches TRAVERSAL_BUCKETS in common.glsl
+static constexpr int TRAVERSAL_BUCKETS = 32;
+
+int TraversalBucket( int value );
+
+/// std430 layout of the TraversalStats buffer in common.glsl (binding 4), read back and
+/// cleared after every dispatch so the 32 bit sums do not overflow
+struct TraversalCounters {
+    uint32_t rays;
+    uint32_t nodes;
+    uint32_t boxes;
+    uint32_t primitives;
+    uint32_t hits;
+    uint32_t nodeHistogram[TRAVERSAL_BUCKETS];
+    uint32_t primitiveHistogram[TRAVERSAL_BUCKETS];
+};
+
+/// traversal work of every HitScene call over a frame
+struct TraversalStats {
+    uint64_t rays       = 0;
+    uint64_t nodes      = 0;
+    uint64_t boxes      = 0;
+    uint64_t primitives = 0;
+    uint64_t hits       = 0;
+    uint64_t nodeHistogram[TRAVERSAL_BUCKETS]      = {};  // rays by nodes visited
+    uint64_t primitiveHistogram[TRAVERSAL_BUCKETS] = {};  // rays by primitives tested
+
+    void Add( const TraversalStats& other );
+    void Add( const TraversalCounters& counters );
+};
+
+/// upper bound of the bucket that holds the given fraction of the rays
+int HistogramPercentile( const uint64_t* histogram, double fraction );
+
+#ifdef PT_TRAVERSAL_STATS
+/// counts one HitScene call on the calling thread
+void RecordTraversal( const TraversalCost& cost, bool hit );
+#endif
+
+/// sums and resets what RecordTraversal counted on all threads since the last call,
+/// call between frames, empty unless built with PT_TRAVERSAL_STATS
+TraversalStats CollectTraversalStats();
+
+/// one row per frame with the means and percentiles
+bool WriteTraversalCsv( const std::string& path, const std::vector<TraversalStats>& frames );
+
+/// build stats and every frame with its histograms
+bool WriteTraversalJson( const std::string& path, const BvhStats& bvh, const std::vector<TraversalStats>& frames );
+
+}  // namespace pt
@@ -1,6 +1,8 @@
 #include "print.h"
 
+#if defined( _WIN32 )
 #include <Windows.h>
+#endif
 
 #include <cstdarg>
 #include <cstdio>
@@ -28,6 +30,7 @@ void Print( Level level, const char* fmt, ... )
     char buffer2[2048];
     snprintf( buffer2, sizeof( buffer2 ), "[%s] %s\n", timebuf, buffer1 );
 
+#if defined( _WIN32 )
     // print to debugger
     OutputDebugStringA( buffer2 );
     // print to console
@@ -59,10 +62,35 @@ void Print( Level level, const char* fmt, ... )
     fprintf( ENDPOINT, buffer2 );
     SetConsoleTextAttribute( hConsole, defaultStyle );
 
-    if ( level >= Level::Error )
+    // only break when a debugger can catch it, batch renders must keep going
+    if ( level >= Level::Error && IsDebuggerPresent() )
     {
         __debugbreak();
     }
+#else
+    const char* style = "\033[0m";
+    switch ( level )
+    {
+        case Level::Fatal:
+        case Level::Error:
+            style = "\033[31m";
+            break;
+        case Level::Warning:
+            style = "\033[33m";
+            break;
+        case Level::Info:
+            style = "\033[34m";
+            break;
+        case Level::Success:
+            style = "\033[32m";
+            break;
+        default:
+            break;
+    }
+
+    fprintf( ENDPOINT, "%s%s\033[0m", style, buffer2 );
+    fflush( ENDPOINT );
+#endif
 }
 
 }  // namespace detail
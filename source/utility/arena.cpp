@@ -0,0 +1,67 @@
+#include "arena.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "universal/core_assert.h"
+
+namespace pt {
+
+Arena::Arena( MemTag tag, size_t blockSize )
+    : m_blockSize( blockSize ), m_memory( tag )
+{
+    core_assert( blockSize > 0 );
+}
+
+Arena::~Arena()
+{
+    Reset();
+}
+
+void* Arena::Allocate( size_t size, size_t alignment )
+{
+    core_assert( alignment && ( alignment & ( alignment - 1 ) ) == 0 );
+    if ( !m_blocks.empty() )
+    {
+        const Block& block   = m_blocks.back();
+        const uintptr_t base = reinterpret_cast<uintptr_t>( block.data );
+        const size_t aligned = ( ( base + m_offset + alignment - 1 ) & ~( alignment - 1 ) ) - base;
+        if ( aligned + size <= block.size )
+        {
+            m_offset = aligned + size;
+            m_used += size;
+            return block.data + aligned;
+        }
+    }
+
+    // requests larger than a block get one of their own, malloc is aligned for any standard type
+    const size_t blockSize = size + alignment > m_blockSize ? size + alignment : m_blockSize;
+    m_memory.Set( m_memory.GetBytes() + blockSize );
+    char* data = static_cast<char*>( malloc( blockSize ) );
+    if ( !data )
+    {
+        m_memory.Set( m_memory.GetBytes() - blockSize );
+        throw std::bad_alloc();
+    }
+    m_blocks.push_back( Block{ data, blockSize } );
+
+    const uintptr_t base = reinterpret_cast<uintptr_t>( data );
+    const size_t aligned = ( ( base + alignment - 1 ) & ~( alignment - 1 ) ) - base;
+    m_offset             = aligned + size;
+    m_used += size;
+    return data + aligned;
+}
+
+void Arena::Reset()
+{
+    for ( const Block& block : m_blocks )
+    {
+        free( block.data );
+    }
+    m_blocks.clear();
+    m_offset = 0;
+    m_used   = 0;
+    m_memory.Set( 0 );
+}
+
+}  // namespace pt
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "memory_stats.h"
+
+namespace pt {
+
+/// monotonic allocator: memory is carved out of large blocks and only returned
+/// all at once by Reset() or the destructor, objects are never destroyed,
+/// so only trivially destructible types belong in it. Not thread safe
+class Arena {
+   public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+    explicit Arena( MemTag tag, size_t blockSize = DEFAULT_BLOCK_SIZE );
+    ~Arena();
+
+    Arena( const Arena& ) = delete;
+    Arena& operator=( const Arena& ) = delete;
+
+    void* Allocate( size_t size, size_t alignment );
+
+    template<typename T, typename... Args>
+    T* New( Args&&... args )
+    {
+        return new ( Allocate( sizeof( T ), alignof( T ) ) ) T( std::forward<Args>( args )... );
+    }
+
+    template<typename T>
+    T* NewArray( size_t count )
+    {
+        return new ( Allocate( sizeof( T ) * count, alignof( T ) ) ) T[count];
+    }
+
+    /// frees every block, the arena can be used again afterwards
+    void Reset();
+
+    inline size_t GetUsedBytes() const { return m_used; }
+    inline size_t GetBlockCount() const { return m_blocks.size(); }
+
+   private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_blockSize;
+    size_t m_offset = 0;  // into the last block
+    size_t m_used   = 0;
+    MemTracker m_memory;
+};
+
+/// lets standard containers allocate from an arena, deallocation is a no-op
+/// so containers should be reserved up front rather than grown
+template<typename T>
+class ArenaAllocator {
+   public:
+    using value_type = T;
+
+    explicit ArenaAllocator( Arena& arena )
+        : m_arena( &arena )
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator( const ArenaAllocator<U>& other )
+        : m_arena( other.GetArena() )
+    {
+    }
+
+    T* allocate( size_t count ) { return static_cast<T*>( m_arena->Allocate( sizeof( T ) * count, alignof( T ) ) ); }
+    void deallocate( T*, size_t ) {}
+
+    inline Arena* GetArena() const { return m_arena; }
+
+    template<typename U>
+    bool operator==( const ArenaAllocator<U>& other ) const { return m_arena == other.GetArena(); }
+    template<typename U>
+    bool operator!=( const ArenaAllocator<U>& other ) const { return m_arena != other.GetArena(); }
+
+   private:
+    Arena* m_arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}  // namespace pt
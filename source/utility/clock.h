@@ -1,20 +1,14 @@
 #pragma once
 #include <chrono>
-#include <string>
+#include <cstdint>
 
 namespace pt {
 
-class ScopeClock {
-   public:
-    ScopeClock( const std::string& info );
-    ~ScopeClock();
+double GetMsSinceEpoch();
 
-   private:
-    std::chrono::system_clock::time_point m_begin;
-    std::chrono::system_clock::time_point m_end;
-    std::string m_info;
-};
+/// monotonic clock for timing phases, not affected by wall clock changes
+using SteadyClock = std::chrono::steady_clock;
 
-double GetMsSinceEpoch();
+int64_t NsSince( const SteadyClock::time_point& start );
 
 }  // namespace pt
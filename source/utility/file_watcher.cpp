@@ -0,0 +1,185 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+
+#if defined( __linux__ )
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#else
+#include <filesystem>
+#endif
+
+#include "universal/print.h"
+
+namespace pt {
+
+static std::string WithSlash( const std::string& dir )
+{
+    if ( dir.empty() )
+    {
+        return "./";
+    }
+    return dir.back() == '/' || dir.back() == '\\' ? dir : dir + '/';
+}
+
+static void AddOnce( std::vector<std::string>& paths, std::string path )
+{
+    if ( std::find( paths.begin(), paths.end(), path ) == paths.end() )
+    {
+        paths.push_back( std::move( path ) );
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    Close();
+}
+
+#if defined( __linux__ )
+
+bool FileWatcher::WatchDirectory( const std::string& dir )
+{
+    const std::string path = WithSlash( dir );
+    for ( const Directory& watched : m_directories )
+    {
+        if ( watched.path == path )
+        {
+            return true;
+        }
+    }
+
+    if ( m_fd < 0 && ( m_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ) < 0 )
+    {
+        Com_PrintError( "[watch] inotify_init1 failed (errno %d)", errno );
+        return false;
+    }
+
+    // written files and the renames editors save with, not the creation of an empty file
+    const int handle = inotify_add_watch( m_fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+    if ( handle < 0 )
+    {
+        Com_PrintError( "[watch] failed to watch '%s' (errno %d)", path.c_str(), errno );
+        return false;
+    }
+    m_directories.push_back( Directory{ path, handle } );
+    return true;
+}
+
+void FileWatcher::Close()
+{
+    if ( m_fd >= 0 )
+    {
+        close( m_fd );
+    }
+    m_fd = -1;
+    m_directories.clear();
+}
+
+void FileWatcher::Poll( std::vector<std::string>& outChanged )
+{
+    if ( m_fd < 0 )
+    {
+        return;
+    }
+
+    alignas( inotify_event ) char buffer[4096];
+    for ( ;; )
+    {
+        const ssize_t size = read( m_fd, buffer, sizeof( buffer ) );
+        if ( size <= 0 )
+        {
+            // EAGAIN once the queue is empty
+            return;
+        }
+        for ( ssize_t offset = 0; offset < size; )
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>( buffer + offset );
+            offset += sizeof( inotify_event ) + event->len;
+            if ( event->len == 0 || ( event->mask & IN_ISDIR ) )
+            {
+                continue;
+            }
+            for ( const Directory& dir : m_directories )
+            {
+                if ( dir.handle == event->wd )
+                {
+                    AddOnce( outChanged, dir.path + event->name );
+                    break;
+                }
+            }
+        }
+    }
+}
+
+#else
+
+static constexpr int SCAN_INTERVAL_MS = 250;
+
+void FileWatcher::Scan( const Directory& dir, std::vector<std::string>* outChanged )
+{
+    std::error_code error;
+    for ( const auto& entry : std::filesystem::directory_iterator( dir.path, error ) )
+    {
+        if ( !entry.is_regular_file( error ) )
+        {
+            continue;
+        }
+        const std::string path = dir.path + entry.path().filename().string();
+        const int64_t time     = static_cast<int64_t>( entry.last_write_time( error ).time_since_epoch().count() );
+        auto it                = m_times.find( path );
+        if ( it == m_times.end() || it->second != time )
+        {
+            m_times[path] = time;
+            if ( outChanged )
+            {
+                AddOnce( *outChanged, path );
+            }
+        }
+    }
+}
+
+bool FileWatcher::WatchDirectory( const std::string& dir )
+{
+    const std::string path = WithSlash( dir );
+    for ( const Directory& watched : m_directories )
+    {
+        if ( watched.path == path )
+        {
+            return true;
+        }
+    }
+
+    if ( !std::filesystem::is_directory( path ) )
+    {
+        Com_PrintError( "[watch] failed to watch '%s'", path.c_str() );
+        return false;
+    }
+    m_directories.push_back( Directory{ path, -1 } );
+    Scan( m_directories.back(), nullptr );
+    return true;
+}
+
+void FileWatcher::Close()
+{
+    m_directories.clear();
+    m_times.clear();
+}
+
+void FileWatcher::Poll( std::vector<std::string>& outChanged )
+{
+    if ( std::chrono::duration_cast<std::chrono::milliseconds>( SteadyClock::now() - m_lastScan ).count() < SCAN_INTERVAL_MS )
+    {
+        return;
+    }
+    m_lastScan = SteadyClock::now();
+    for ( const Directory& dir : m_directories )
+    {
+        Scan( dir, &outChanged );
+    }
+}
+
+#endif
+
+}  // namespace pt
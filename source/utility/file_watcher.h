@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.h"
+
+namespace pt {
+
+/// reports the files written in a set of directories. Linux gets inotify events, elsewhere
+/// Poll compares modification times a few times a second. Editors that save through a
+/// temporary file and a rename are seen as well, which is why directories are watched
+/// instead of the files themselves
+class FileWatcher {
+   public:
+    FileWatcher() = default;
+    ~FileWatcher();
+
+    FileWatcher( const FileWatcher& ) = delete;
+    FileWatcher& operator=( const FileWatcher& ) = delete;
+
+    /// watches the files directly inside dir, a directory that is already watched is ignored.
+    /// Returns false when dir cannot be watched
+    bool WatchDirectory( const std::string& dir );
+    void Close();
+
+    /// appends the paths (directory + file name) written since the last call, once each
+    void Poll( std::vector<std::string>& outChanged );
+
+   private:
+    struct Directory {
+        std::string path;  // ends with a '/'
+        int handle;        // inotify watch descriptor
+    };
+
+    std::vector<Directory> m_directories;
+#if defined( __linux__ )
+    int m_fd = -1;
+#else
+    /// last write time of every file seen, new and changed ones are reported
+    void Scan( const Directory& dir, std::vector<std::string>* outChanged );
+
+    std::unordered_map<std::string, int64_t> m_times;
+    SteadyClock::time_point m_lastScan;
+#endif
+};
+
+}  // namespace pt
@@ -0,0 +1,139 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "string_util.h"
+
+namespace pt {
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if defined( _WIN32 )
+
+void MappedFile::Open( const std::string& path )
+{
+    Close();
+    m_file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr );
+    if ( m_file == INVALID_HANDLE_VALUE )
+    {
+        m_file = nullptr;
+        throw std::runtime_error( va( "failed to open '%s'", path.c_str() ) );
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx( m_file, &size );
+    m_mapping = CreateFileMappingA( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    m_data    = m_mapping ? static_cast<const char*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) ) : nullptr;
+    if ( !m_data )
+    {
+        Close();
+        throw std::runtime_error( va( "failed to map '%s'", path.c_str() ) );
+    }
+    m_size = static_cast<size_t>( size.QuadPart );
+}
+
+void MappedFile::Close()
+{
+    if ( m_data )
+    {
+        UnmapViewOfFile( m_data );
+    }
+    if ( m_mapping )
+    {
+        CloseHandle( m_mapping );
+    }
+    if ( m_file )
+    {
+        CloseHandle( m_file );
+    }
+    m_data    = nullptr;
+    m_size    = 0;
+    m_mapping = nullptr;
+    m_file    = nullptr;
+}
+
+void MappedFile::Prefetch( size_t, size_t ) const
+{
+}
+
+void MappedFile::Release( size_t offset, size_t size ) const
+{
+    // unlocking pages that are not locked trims them from the working set
+    VirtualUnlock( const_cast<char*>( m_data + offset ), size );
+}
+
+#else
+
+void MappedFile::Open( const std::string& path )
+{
+    Close();
+    m_fd = open( path.c_str(), O_RDONLY );
+    if ( m_fd < 0 )
+    {
+        throw std::runtime_error( va( "failed to open '%s'", path.c_str() ) );
+    }
+
+    struct stat info;
+    void* data = MAP_FAILED;
+    if ( fstat( m_fd, &info ) == 0 && info.st_size > 0 )
+    {
+        data = mmap( nullptr, static_cast<size_t>( info.st_size ), PROT_READ, MAP_PRIVATE, m_fd, 0 );
+    }
+    if ( data == MAP_FAILED )
+    {
+        Close();
+        throw std::runtime_error( va( "failed to map '%s'", path.c_str() ) );
+    }
+    m_data = static_cast<const char*>( data );
+    m_size = static_cast<size_t>( info.st_size );
+}
+
+void MappedFile::Close()
+{
+    if ( m_data )
+    {
+        munmap( const_cast<char*>( m_data ), m_size );
+    }
+    if ( m_fd >= 0 )
+    {
+        close( m_fd );
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_fd   = -1;
+}
+
+// madvise wants page aligned ranges, the range grows to the pages it touches
+static void Advise( const char* data, size_t offset, size_t size, int advice )
+{
+    const size_t page  = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+    const size_t begin = offset / page * page;
+    madvise( const_cast<char*>( data + begin ), offset + size - begin, advice );
+}
+
+void MappedFile::Prefetch( size_t offset, size_t size ) const
+{
+    Advise( m_data, offset, size, MADV_WILLNEED );
+}
+
+void MappedFile::Release( size_t offset, size_t size ) const
+{
+    Advise( m_data, offset, size, MADV_DONTNEED );
+}
+
+#endif
+
+}  // namespace pt
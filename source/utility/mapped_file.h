@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace pt {
+
+/// read only mapping of a whole file, the OS reads the pages on first access
+/// and Release() hands clean pages back without closing the mapping
+class MappedFile {
+   public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    /// throws a runtime_error when the file cannot be opened or mapped
+    void Open( const std::string& path );
+    void Close();
+
+    /// hints that the range is read soon
+    void Prefetch( size_t offset, size_t size ) const;
+    /// drops the pages of the range from the process, they are read again on the next access
+    void Release( size_t offset, size_t size ) const;
+
+    inline const char* GetData() const { return m_data; }
+    inline size_t GetSize() const { return m_size; }
+    inline bool IsOpen() const { return m_data != nullptr; }
+
+   private:
+    const char* m_data = nullptr;
+    size_t m_size      = 0;
+#if defined( _WIN32 )
+    void* m_file    = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+}  // namespace pt
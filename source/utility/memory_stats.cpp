@@ -0,0 +1,186 @@
+#include "memory_stats.h"
+
+#include <atomic>
+#include <stdexcept>
+
+#include "string_util.h"
+#include "universal/core_assert.h"
+#include "universal/print.h"
+
+namespace pt {
+
+namespace {
+
+struct AtomicCounter {
+    std::atomic<int64_t> current{ 0 };
+    std::atomic<int64_t> peak{ 0 };
+};
+
+AtomicCounter s_counters[MemTag_Count];
+AtomicCounter s_total;
+std::atomic<int64_t> s_budget{ 0 };
+
+void RaisePeak( AtomicCounter& counter, int64_t value )
+{
+    int64_t peak = counter.peak.load( std::memory_order_relaxed );
+    while ( value > peak && !counter.peak.compare_exchange_weak( peak, value, std::memory_order_relaxed ) )
+    {
+    }
+}
+
+double ToMB( int64_t bytes )
+{
+    return bytes / ( 1024.0 * 1024.0 );
+}
+
+}  // namespace
+
+const char* MemTagToString( MemTag tag )
+{
+    switch ( tag )
+    {
+        case MemTag_GpuScene:
+            return "gpu scene";
+        case MemTag_BvhBuild:
+            return "bvh build";
+        case MemTag_Images:
+            return "images";
+        case MemTag_TextureArray:
+            return "texture array";
+        case MemTag_Clusters:
+            return "clusters";
+        default:
+            return "unknown";
+    }
+}
+
+void MemAlloc( MemTag tag, size_t bytes )
+{
+    core_assert( tag >= 0 && tag < MemTag_Count );
+    const int64_t size   = static_cast<int64_t>( bytes );
+    const int64_t budget = s_budget.load( std::memory_order_relaxed );
+    const int64_t total  = s_total.current.fetch_add( size, std::memory_order_relaxed ) + size;
+    if ( budget > 0 && total > budget )
+    {
+        s_total.current.fetch_sub( size, std::memory_order_relaxed );
+        throw std::runtime_error( va( "[memory] %.1f MB of %s exceeds the mem_budget of %.1f MB, %.1f MB already in use",
+                                      ToMB( size ),
+                                      MemTagToString( tag ),
+                                      ToMB( budget ),
+                                      ToMB( total - size ) ) );
+    }
+    RaisePeak( s_total, total );
+
+    AtomicCounter& counter = s_counters[tag];
+    RaisePeak( counter, counter.current.fetch_add( size, std::memory_order_relaxed ) + size );
+}
+
+void MemFree( MemTag tag, size_t bytes )
+{
+    core_assert( tag >= 0 && tag < MemTag_Count );
+    const int64_t size = static_cast<int64_t>( bytes );
+    s_counters[tag].current.fetch_sub( size, std::memory_order_relaxed );
+    s_total.current.fetch_sub( size, std::memory_order_relaxed );
+}
+
+MemCounter GetMemCounter( MemTag tag )
+{
+    core_assert( tag >= 0 && tag < MemTag_Count );
+    return MemCounter{ s_counters[tag].current.load(), s_counters[tag].peak.load() };
+}
+
+MemCounter GetMemTotal()
+{
+    return MemCounter{ s_total.current.load(), s_total.peak.load() };
+}
+
+void ResetMemPeaks()
+{
+    for ( AtomicCounter& counter : s_counters )
+    {
+        counter.peak = counter.current.load();
+    }
+    s_total.peak = s_total.current.load();
+}
+
+void SetMemBudget( int64_t bytes )
+{
+    s_budget = bytes;
+}
+
+int64_t GetMemBudget()
+{
+    return s_budget;
+}
+
+void PrintMemReport( const char* when )
+{
+    const MemCounter total = GetMemTotal();
+    Com_PrintInfo( "[memory] %s: %.2f MB in use, peak %.2f MB", when, ToMB( total.current ), ToMB( total.peak ) );
+    for ( int tag = 0; tag < MemTag_Count; ++tag )
+    {
+        const MemCounter counter = GetMemCounter( static_cast<MemTag>( tag ) );
+        Com_Printf( "[memory]   %-14s %10.2f MB, peak %10.2f MB", MemTagToString( static_cast<MemTag>( tag ) ), ToMB( counter.current ), ToMB( counter.peak ) );
+    }
+}
+
+MemTracker::MemTracker( MemTag tag, size_t bytes )
+    : m_tag( tag ), m_bytes( 0 )
+{
+    Set( bytes );
+}
+
+MemTracker::MemTracker( const MemTracker& other )
+    : m_tag( other.m_tag ), m_bytes( 0 )
+{
+    Set( other.m_bytes );
+}
+
+MemTracker::MemTracker( MemTracker&& other ) noexcept
+    : m_tag( other.m_tag ), m_bytes( other.m_bytes )
+{
+    other.m_bytes = 0;
+}
+
+MemTracker& MemTracker::operator=( const MemTracker& other )
+{
+    if ( this != &other )
+    {
+        Set( 0 );
+        m_tag = other.m_tag;
+        Set( other.m_bytes );
+    }
+    return *this;
+}
+
+MemTracker& MemTracker::operator=( MemTracker&& other ) noexcept
+{
+    if ( this != &other )
+    {
+        Set( 0 );
+        m_tag         = other.m_tag;
+        m_bytes       = other.m_bytes;
+        other.m_bytes = 0;
+    }
+    return *this;
+}
+
+MemTracker::~MemTracker()
+{
+    MemFree( m_tag, m_bytes );
+}
+
+void MemTracker::Set( size_t bytes )
+{
+    if ( bytes > m_bytes )
+    {
+        MemAlloc( m_tag, bytes - m_bytes );
+    }
+    else
+    {
+        MemFree( m_tag, m_bytes - bytes );
+    }
+    m_bytes = bytes;
+}
+
+}  // namespace pt
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace pt {
+
+enum MemTag {
+    MemTag_GpuScene,      // materials, geometries and nodes handed to the renderers
+    MemTag_BvhBuild,      // arena of the scene construction: geometry list, bvh nodes and partition buffers
+    MemTag_Images,        // decoded image data
+    MemTag_TextureArray,  // padded staging copy of the albedo maps for the gl texture array
+    MemTag_Clusters,      // out of core bvh clusters paged in from their file
+    MemTag_Count,
+};
+
+const char* MemTagToString( MemTag tag );
+
+struct MemCounter {
+    int64_t current;
+    int64_t peak;
+};
+
+/// bytes are counted where a subsystem takes and releases ownership, not per allocation,
+/// so the numbers are what the scene data needs, not the heap overhead
+void MemAlloc( MemTag tag, size_t bytes );
+void MemFree( MemTag tag, size_t bytes );
+
+MemCounter GetMemCounter( MemTag tag );
+/// the peak of the sum over all tags, not the sum of the peaks
+MemCounter GetMemTotal();
+
+/// the peaks start over from the current bytes
+void ResetMemPeaks();
+
+/// MemAlloc throws a runtime_error once the total would exceed the budget, 0 disables it
+void SetMemBudget( int64_t bytes );
+int64_t GetMemBudget();
+
+/// current and peak bytes of every tag on the console
+void PrintMemReport( const char* when );
+
+/// counts bytes that change over its lifetime, copies count their own bytes and a move
+/// hands them over, for containers whose owner sets the size rather than the allocator
+class MemTracker {
+   public:
+    explicit MemTracker( MemTag tag, size_t bytes = 0 );
+    MemTracker( const MemTracker& other );
+    MemTracker( MemTracker&& other ) noexcept;
+    MemTracker& operator=( const MemTracker& other );
+    MemTracker& operator=( MemTracker&& other ) noexcept;
+    ~MemTracker();
+
+    void Set( size_t bytes );
+    inline size_t GetBytes() const { return m_bytes; }
+
+   private:
+    MemTag m_tag;
+    size_t m_bytes;
+};
+
+}  // namespace pt
@@ -0,0 +1,173 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+namespace pt {
+
+namespace {
+
+/// threads parked on a condition variable between jobs, a job runs on the first
+/// workers threads and on the caller
+class ThreadPool {
+   public:
+    ~ThreadPool() { Shutdown(); }
+
+    void Run( int workers, const std::function<void()>& job )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while ( static_cast<int>( m_threads.size() ) < workers )
+        {
+            m_threads.emplace_back( &ThreadPool::WorkerMain, this, static_cast<int>( m_threads.size() ), m_generation );
+        }
+        m_job     = &job;
+        m_workers = workers;
+        m_pending = workers;
+        ++m_generation;
+        lock.unlock();
+        m_wake.notify_all();
+
+        job();
+
+        lock.lock();
+        m_done.wait( lock, [this]() { return m_pending == 0; } );
+        m_job = nullptr;
+    }
+
+    void Shutdown()
+    {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_quit = true;
+            threads.swap( m_threads );
+        }
+        m_wake.notify_all();
+        for ( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_quit = false;
+    }
+
+   private:
+    void WorkerMain( int index, uint64_t generation )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        for ( ;; )
+        {
+            m_wake.wait( lock, [&]() { return m_quit || m_generation != generation; } );
+            if ( m_quit )
+            {
+                return;
+            }
+            generation = m_generation;
+            if ( index >= m_workers )
+            {
+                continue;
+            }
+
+            const std::function<void()>& job = *m_job;
+            lock.unlock();
+            job();
+            lock.lock();
+            if ( --m_pending == 0 )
+            {
+                m_done.notify_one();
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_threads;
+    const std::function<void()>* m_job = nullptr;
+    uint64_t m_generation              = 0;
+    int m_workers                      = 0;
+    int m_pending                      = 0;
+    bool m_quit                        = false;
+};
+
+ThreadPool s_pool;
+std::mutex s_poolMutex;                // one ParallelFor at a time owns the pool
+thread_local bool s_inParallel = false;  // set on the pool threads and on the caller while a job runs
+
+}  // namespace
+
+int GetHardwareThreadCount()
+{
+    return std::max( 1, static_cast<int>( std::thread::hardware_concurrency() ) );
+}
+
+void ParallelFor( int count, int numThreads, const std::function<void( int )>& func )
+{
+    if ( numThreads <= 0 )
+    {
+        numThreads = GetHardwareThreadCount();
+    }
+    numThreads = std::min( numThreads, count );
+
+    // the pool is busy with the outer call, waiting for it would deadlock
+    if ( numThreads <= 1 || s_inParallel )
+    {
+        for ( int index = 0; index < count; ++index )
+        {
+            func( index );
+        }
+        return;
+    }
+
+    PROFILE_ZONE( "ParallelFor" );
+    std::atomic_int next( 0 );
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        PROFILE_ZONE( "ParallelFor worker" );
+        s_inParallel = true;
+        for ( int index = next++; index < count; index = next++ )
+        {
+            try
+            {
+                func( index );
+            }
+            catch ( ... )
+            {
+                std::lock_guard<std::mutex> lock( errorMutex );
+                if ( !error )
+                {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+        s_inParallel = false;
+    };
+
+    {
+        std::lock_guard<std::mutex> lock( s_poolMutex );
+        s_pool.Run( numThreads - 1, worker );
+    }
+
+    if ( error )
+    {
+        std::rethrow_exception( error );
+    }
+}
+
+void ParallelShutdown()
+{
+    std::lock_guard<std::mutex> lock( s_poolMutex );
+    s_pool.Shutdown();
+}
+
+}  // namespace pt
@@ -0,0 +1,19 @@
+#pragma once
+#include <functional>
+
+namespace pt {
+
+/// number of worker threads to use when the caller asks for 0 (auto)
+int GetHardwareThreadCount();
+
+/// calls func( index ) for every index in [0, count), items are handed out
+/// dynamically to numThreads threads (0 means one per hardware thread). The
+/// threads come from a pool that lives until ParallelShutdown or exit. The first
+/// exception thrown by func stops handing out items and is rethrown here once
+/// every thread is done. Nested calls run serially on the calling thread
+void ParallelFor( int count, int numThreads, const std::function<void( int )>& func );
+
+/// joins the pool threads, the next ParallelFor starts new ones
+void ParallelShutdown();
+
+}  // namespace pt
@@ -0,0 +1,141 @@
+#include "perf_counters.h"
+
+#if defined( __linux__ )
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pt {
+
+const char* PerfEventToString( PerfEvent event )
+{
+    switch ( event )
+    {
+        case PerfEvent_Cycles:
+            return "cycles";
+        case PerfEvent_Instructions:
+            return "instructions";
+        case PerfEvent_CacheReferences:
+            return "cache references";
+        case PerfEvent_CacheMisses:
+            return "cache misses";
+        case PerfEvent_L1dMisses:
+            return "l1d misses";
+        default:
+            return "unknown";
+    }
+}
+
+PerfCounters::PerfCounters()
+{
+    for ( int i = 0; i < PerfEvent_Count; ++i )
+    {
+        m_fds[i]       = -1;
+        m_available[i] = false;
+        m_values[i]    = 0;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    Stop();
+}
+
+#if defined( __linux__ )
+
+static int OpenEvent( PerfEvent event )
+{
+    perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size           = sizeof( attr );
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.disabled       = 1;
+    attr.inherit        = 1;  // the ParallelFor pool is restarted after this
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch ( event )
+    {
+        case PerfEvent_Cycles:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfEvent_Instructions:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PerfEvent_CacheReferences:
+            attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+            break;
+        case PerfEvent_CacheMisses:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PerfEvent_L1dMisses:
+            attr.type   = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+            break;
+        default:
+            return -1;
+    }
+    return static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+}
+
+void PerfCounters::Start()
+{
+    Stop();
+    for ( int i = 0; i < PerfEvent_Count; ++i )
+    {
+        m_fds[i]       = OpenEvent( static_cast<PerfEvent>( i ) );
+        m_available[i] = m_fds[i] >= 0;
+        m_values[i]    = 0;
+    }
+    for ( int fd : m_fds )
+    {
+        if ( fd >= 0 )
+        {
+            ioctl( fd, PERF_EVENT_IOC_RESET, 0 );
+            ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+        }
+    }
+}
+
+void PerfCounters::Stop()
+{
+    for ( int i = 0; i < PerfEvent_Count; ++i )
+    {
+        if ( m_fds[i] < 0 )
+        {
+            continue;
+        }
+
+        ioctl( m_fds[i], PERF_EVENT_IOC_DISABLE, 0 );
+        uint64_t data[3];  // value, time enabled, time running
+        if ( read( m_fds[i], data, sizeof( data ) ) == sizeof( data ) && data[2] > 0 )
+        {
+            m_values[i] = static_cast<uint64_t>( static_cast<double>( data[0] ) * data[1] / data[2] );
+        }
+        else
+        {
+            m_available[i] = false;
+        }
+        close( m_fds[i] );
+        m_fds[i] = -1;
+    }
+}
+
+#else
+
+void PerfCounters::Start()
+{
+}
+
+void PerfCounters::Stop()
+{
+}
+
+#endif
+
+}  // namespace pt
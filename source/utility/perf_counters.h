@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+
+namespace pt {
+
+enum PerfEvent {
+    PerfEvent_Cycles,
+    PerfEvent_Instructions,
+    PerfEvent_CacheReferences,  // last level cache accesses
+    PerfEvent_CacheMisses,      // last level cache misses
+    PerfEvent_L1dMisses,        // L1 data cache read misses
+    PerfEvent_Count,
+};
+
+const char* PerfEventToString( PerfEvent event );
+
+/// hardware counters of this process and of the threads it starts while they run, through
+/// perf_event_open on Linux. Events the kernel, the hardware or a virtual machine does not
+/// offer stay unavailable, and every event is unavailable on other platforms
+class PerfCounters {
+   public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters( const PerfCounters& ) = delete;
+    PerfCounters& operator=( const PerfCounters& ) = delete;
+
+    /// opens and zeroes the counters, threads started before are not counted
+    void Start();
+    /// reads and closes the counters, the values stay until the next Start
+    void Stop();
+
+    inline bool IsAvailable( PerfEvent event ) const { return m_available[event]; }
+    /// scaled up when the kernel had to multiplex the counters
+    inline uint64_t GetValue( PerfEvent event ) const { return m_values[event]; }
+
+   private:
+    int m_fds[PerfEvent_Count];
+    bool m_available[PerfEvent_Count];
+    uint64_t m_values[PerfEvent_Count];
+};
+
+}  // namespace pt
@@ -0,0 +1,231 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "string_util.h"
+#include "universal/print.h"
+
+namespace pt {
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct ProfileEvent {
+    const char* name;
+    int64_t startNs;
+    int64_t endNs;
+    int depth;
+};
+
+// 2 MB per thread, reserved when the thread first records so pushing never reallocates
+static constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+struct ThreadBuffer {
+    int tid;
+    bool inUse = false;  // guarded by the registry mutex, the events are only touched by the owner
+    vector<ProfileEvent> events;
+    int64_t dropped = 0;  // zones that ended after the buffer was full
+};
+
+// never destroyed, threads may still hand their buffers back during static destruction
+struct Registry {
+    std::mutex mutex;
+    vector<std::unique_ptr<ThreadBuffer>> buffers;
+    int64_t epoch = 0;
+    string output;
+};
+
+Registry& GetRegistry()
+{
+    static Registry* s_registry = new Registry;
+    return *s_registry;
+}
+
+// hands the buffer back when the thread exits so thread pools do not grow the trace by a track per task
+struct ThreadSlot {
+    ThreadBuffer* buffer = nullptr;
+    int depth            = 0;
+
+    ~ThreadSlot()
+    {
+        if ( buffer )
+        {
+            std::lock_guard<std::mutex> lock( GetRegistry().mutex );
+            buffer->inUse = false;
+        }
+    }
+};
+
+thread_local ThreadSlot t_slot;
+
+ThreadBuffer* AcquireBuffer()
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock( registry.mutex );
+    for ( auto& buffer : registry.buffers )
+    {
+        if ( !buffer->inUse )
+        {
+            buffer->inUse = true;
+            return buffer.get();
+        }
+    }
+
+    registry.buffers.push_back( std::make_unique<ThreadBuffer>() );
+    ThreadBuffer* buffer = registry.buffers.back().get();
+    buffer->tid          = static_cast<int>( registry.buffers.size() );
+    buffer->inUse        = true;
+    buffer->events.reserve( EVENTS_PER_THREAD );
+    return buffer;
+}
+
+int64_t ClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now().time_since_epoch() ).count();
+}
+
+}  // namespace
+
+namespace profiler_detail {
+
+std::atomic<bool> g_profilerEnabled( false );
+
+void ProfilerRecord( const char* name, int64_t startNs, int64_t endNs, int depth )
+{
+    if ( !t_slot.buffer )
+    {
+        t_slot.buffer = AcquireBuffer();
+    }
+    vector<ProfileEvent>& events = t_slot.buffer->events;
+    if ( events.size() == EVENTS_PER_THREAD )
+    {
+        ++t_slot.buffer->dropped;
+        return;
+    }
+    events.push_back( ProfileEvent{ name, startNs, endNs, depth } );
+}
+
+int64_t ProfilerNow()
+{
+    return ClockNs() - GetRegistry().epoch;
+}
+
+int& ProfilerDepth()
+{
+    return t_slot.depth;
+}
+
+}  // namespace profiler_detail
+
+void ProfilerStart( const string& outputPath )
+{
+    Registry& registry = GetRegistry();
+    {
+        std::lock_guard<std::mutex> lock( registry.mutex );
+        registry.epoch  = ClockNs();
+        registry.output = outputPath;
+    }
+
+    // the first buffer belongs to the thread that started profiling
+    if ( !t_slot.buffer )
+    {
+        t_slot.buffer = AcquireBuffer();
+    }
+    profiler_detail::g_profilerEnabled.store( true, std::memory_order_release );
+}
+
+bool ProfilerEnabled()
+{
+    return profiler_detail::g_profilerEnabled.load( std::memory_order_relaxed );
+}
+
+bool ProfilerWrite( const string& path )
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock( registry.mutex );
+
+    FILE* file = fopen( path.c_str(), "w" );
+    if ( !file )
+    {
+        Com_PrintError( "[profiler] failed to write '%s'", path.c_str() );
+        return false;
+    }
+
+    struct Total {
+        const char* name;
+        int count;
+        int64_t ns;
+    };
+    vector<Total> totals;
+
+    size_t eventCount = 0;
+    int64_t dropped   = 0;
+    fprintf( file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+    for ( const auto& buffer : registry.buffers )
+    {
+        fprintf( file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                 buffer->tid,
+                 buffer->tid == 1 ? "main" : va( "worker %d", buffer->tid - 1 ) );
+        for ( const ProfileEvent& event : buffer->events )
+        {
+            fprintf( file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %d}}",
+                     event.name,
+                     buffer->tid,
+                     event.startNs * 1.0e-3,
+                     ( event.endNs - event.startNs ) * 1.0e-3,
+                     event.depth );
+
+            // the summary covers the outermost zones, nested ones are already in their parent
+            if ( event.depth != 0 )
+            {
+                continue;
+            }
+            auto it = std::find_if( totals.begin(), totals.end(), [&]( const Total& total ) { return strcmp( total.name, event.name ) == 0; } );
+            if ( it == totals.end() )
+            {
+                totals.push_back( Total{ event.name, 0, 0 } );
+                it = totals.end() - 1;
+            }
+            ++it->count;
+            it->ns += event.endNs - event.startNs;
+        }
+        fprintf( file, "%s", &buffer == &registry.buffers.back() ? "\n" : ",\n" );
+        eventCount += buffer->events.size();
+        dropped += buffer->dropped;
+    }
+    fprintf( file, "]}\n" );
+    const bool written = fclose( file ) == 0;
+
+    std::sort( totals.begin(), totals.end(), []( const Total& a, const Total& b ) { return a.ns > b.ns; } );
+    Com_PrintInfo( "[profiler] %d zones on %d threads, wrote '%s'", static_cast<int>( eventCount ), static_cast<int>( registry.buffers.size() ), path.c_str() );
+    if ( dropped )
+    {
+        Com_PrintWarning( "[profiler] dropped %lld zones that did not fit the %d per thread", static_cast<long long>( dropped ), static_cast<int>( EVENTS_PER_THREAD ) );
+    }
+    for ( size_t i = 0; i < totals.size() && i < 16; ++i )
+    {
+        Com_Printf( "[profiler] %-24s %6d calls %12.3f ms", totals[i].name, totals[i].count, totals[i].ns * 1.0e-6 );
+    }
+    return written;
+}
+
+void ProfilerFinalize()
+{
+    if ( !ProfilerEnabled() )
+    {
+        return;
+    }
+    profiler_detail::g_profilerEnabled.store( false, std::memory_order_release );
+    ProfilerWrite( GetRegistry().output );
+}
+
+}  // namespace pt
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "universal/platform_defines.h"
+
+// zones are compiled in with the PT_PROFILER CMake option (on by default) and only record
+// after ProfilerStart, a disabled zone costs one load and a branch
+#if defined( PT_PROFILER )
+#define PROFILER IN_USE
+#else
+#define PROFILER NOT_IN_USE
+#endif
+
+#define PROFILE_CONCAT_INNER( a, b ) a##b
+#define PROFILE_CONCAT( a, b )       PROFILE_CONCAT_INNER( a, b )
+
+#if USING( PROFILER )
+/// times the rest of the enclosing scope, name must be a string literal
+#define PROFILE_ZONE( name ) ::pt::ProfileZone PROFILE_CONCAT( profileZone_, __LINE__ )( name )
+#else
+#define PROFILE_ZONE( name ) ( (void)0 )
+#endif
+
+namespace pt {
+
+namespace profiler_detail {
+extern std::atomic<bool> g_profilerEnabled;
+void ProfilerRecord( const char* name, int64_t startNs, int64_t endNs, int depth );
+int64_t ProfilerNow();
+int& ProfilerDepth();
+}  // namespace profiler_detail
+
+/// one zone of the trace, every thread writes into its own fixed size buffer without locking
+/// and drops the zones that do not fit, the buffers outlive their threads and are reused by
+/// the next thread that records
+class ProfileZone {
+   public:
+    explicit ProfileZone( const char* name )
+        : m_name( name )
+    {
+        if ( profiler_detail::g_profilerEnabled.load( std::memory_order_acquire ) )
+        {
+            m_depth = profiler_detail::ProfilerDepth()++;
+            m_start = profiler_detail::ProfilerNow();
+        }
+    }
+
+    ~ProfileZone()
+    {
+        if ( m_depth >= 0 )
+        {
+            profiler_detail::ProfilerRecord( m_name, m_start, profiler_detail::ProfilerNow(), m_depth );
+            --profiler_detail::ProfilerDepth();
+        }
+    }
+
+    ProfileZone( const ProfileZone& ) = delete;
+    ProfileZone& operator=( const ProfileZone& ) = delete;
+
+   private:
+    const char* m_name;
+    int64_t m_start = 0;
+    int m_depth     = -1;  // -1 when the profiler was off as the zone began
+};
+
+/// starts recording, ProfilerFinalize writes the trace to outputPath
+void ProfilerStart( const std::string& outputPath );
+
+bool ProfilerEnabled();
+
+/// chrome://tracing and Perfetto json with one track per thread and a summary of the
+/// outermost zones on the console, call when no other thread is recording
+bool ProfilerWrite( const std::string& path );
+
+/// stops recording and writes the trace to the path given to ProfilerStart, call once
+/// the threads that record are done. Does nothing when the profiler was not started
+void ProfilerFinalize();
+
+}  // namespace pt
@@ -1,6 +1,7 @@
 #include "string_util.h"
 
 #include <cstdarg>
+#include <cstring>
 
 namespace pt {
 
@@ -16,4 +17,43 @@ const char* va( const char* format, ... )
     return s_buffer;
 }
 
+bool IsIntFormat( const char* format )
+{
+    int conversions = 0;
+    for ( const char* c = format; *c; ++c )
+    {
+        if ( *c != '%' )
+        {
+            continue;
+        }
+        if ( *++c == '%' )
+        {
+            continue;
+        }
+        while ( *c && strchr( "-+ #0", *c ) )
+        {
+            ++c;
+        }
+        while ( *c >= '0' && *c <= '9' )
+        {
+            ++c;
+        }
+        if ( *c == '.' )
+        {
+            ++c;
+            while ( *c >= '0' && *c <= '9' )
+            {
+                ++c;
+            }
+        }
+        // '*' widths, length modifiers and every other conversion read arguments va is not given
+        if ( *c != 'd' && *c != 'i' && *c != 'u' )
+        {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
 }  // namespace pt
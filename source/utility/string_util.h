@@ -5,4 +5,8 @@ namespace pt {
 
 const char* va( const char* format, ... );
 
+/// true when format takes exactly one int (%d, %i or %u with flags, width and precision) and
+/// nothing else, %% included. User supplied patterns are checked with it before they reach va
+bool IsIntFormat( const char* format );
+
 }  // namespace pt
@@ -1,18 +1,33 @@
 #include "viewer.h"
 
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
 #include "../third_party/imgui/imgui.h"
 #include "application.h"
 #include "com_dvars.h"
 #include "common.h"
+#include "denoise.h"
+#include "frame_capture.h"
+#include "frame_timer.h"
 #include "glutil.h"
+#include "gpu_timer.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "postprocess.h"
 #include "renderer.h"
+#include "reprojection.h"
+#include "sampler.h"
 #include "scene_loader.h"
 #include "universal/core_assert.h"
 #include "universal/dvar_api.h"
 #include "universal/print.h"
 #include "utility/clock.h"
+#include "utility/memory_stats.h"
+#include "utility/profiler.h"
 #include "utility/string_util.h"
 
 // glfw3.h must be included after glad.h
@@ -32,9 +47,11 @@ namespace pt {
 
 using std::string;
 using std::vector;
+using Clock = std::chrono::steady_clock;
 
 static gl::Program g_PhongProgram;
 static gl::Program g_TiledRenderProgram;
+static gl::Program g_ReprojectProgram;
 static gl::Program g_FullScreenProgram;
 extern gl::Program g_ImguiProgram;
 
@@ -43,9 +60,19 @@ static GLuint g_QuadVbo;
 static GLuint g_GeomSsbo;
 static GLuint g_BBoxSsbo;
 static GLuint g_MatSsbo;
+static GLuint g_PrimSsbo;
+static BvhLayout g_BvhLayout;
 
 /// texture
 static GLuint g_Texture;
+static GLuint g_AlbedoAovTexture;
+static GLuint g_NormalAovTexture;
+static GLuint g_IdAovTexture;
+static GLuint g_DenoisedTexture;
+static GLuint g_HistoryTexture;
+static GLuint g_HistoryAlbedoTexture;
+static GLuint g_HistoryNormalTexture;
+static GLuint g_ReprojectedTexture;
 static GLuint g_ConstantBuffer;
 static GLuint g_EnvTexture;
 static GLuint g_AlbedoTexture;
@@ -53,6 +80,35 @@ static GLuint g_AlbedoTexture;
 /// texture arrays
 extern ImageArray g_AlbedoMaps;
 
+/// readback
+static constexpr int CAPTURE_RING_SIZE = 3;
+static gl::FrameCapture g_FrameCapture;
+
+// queries of a frame are read GPU_TIMER_RING_SIZE - 1 frames later
+static constexpr int GPU_TIMER_RING_SIZE = 4;
+static constexpr int GPU_TIMER_PASSES    = 8;
+static FrameTimeline g_Timeline;
+static gl::GpuTimerRing g_GpuTimers;
+
+static void UploadConstantBuffer( const ConstantBufferCache& cache )
+{
+    CpuTimer timer( g_Timeline, "upload" );
+    glNamedBufferData( g_ConstantBuffer, sizeof( ConstantBufferCache ), &cache, GL_DYNAMIC_DRAW );
+}
+
+// +set trace_output <path>, defaults to trace.json for the export button
+static void WriteTrace( const char* path )
+{
+    if ( g_Timeline.WriteChromeTrace( path ) )
+    {
+        Com_PrintSuccess( "[viewer] wrote '%s' (%d frames not timed on the gpu)", path, g_GpuTimers.GetDropped() );
+    }
+    else
+    {
+        Com_PrintError( "[viewer] failed to write '%s'", path );
+    }
+}
+
 static void SetTextureSamplerUniforms( gl::Program& program )
 {
     program.Use();
@@ -60,18 +116,54 @@ static void SetTextureSamplerUniforms( gl::Program& program )
     glUniform1i( glGetUniformLocation( handle, "outTexture" ), 0 );
     glUniform1i( glGetUniformLocation( handle, "envTexture" ), 1 );
     glUniform1i( glGetUniformLocation( handle, "albedoTexture" ), 2 );
+    glUniform1i( glGetUniformLocation( handle, "albedoAovTexture" ), 3 );
+    glUniform1i( glGetUniformLocation( handle, "normalAovTexture" ), 4 );
+    glUniform1i( glGetUniformLocation( handle, "idAovTexture" ), 5 );
     program.Stop();
 }
 
 Viewer::Viewer()
 {
-    m_showGui    = true;
-    m_dirty      = false;
-    m_tileOffset = ivec2( 0 );
+    m_showGui        = true;
+    m_dirty          = false;
+    m_screenshot     = false;
+    m_denoise        = false;
+    m_showDenoised   = false;
+    m_tileOffset     = ivec2( 0 );
+    m_previewSamples = 0;
+    m_cameraFile     = nullptr;
+    m_depthScale     = 1.0f;
+    m_frameCount     = 0;
+    m_dumpCount      = 0;
+    m_frameMsTotal   = 0.0;
+    m_reloadScript   = false;
+    m_reloadShaders  = false;
+    m_reloadAssets   = false;
+    m_lastChange     = 0.0;
+}
+
+static BvhLayout BvhLayoutFromDvar()
+{
+    BvhLayout layout = BvhLayout::Threaded;
+    if ( !BvhLayoutFromString( Dvar_GetString( bvh_layout ), layout ) )
+    {
+        Com_PrintWarning( "[viewer] unknown bvh_layout '%s', using threaded", Dvar_GetString( bvh_layout ) );
+    }
+    return layout;
+}
+
+// layout and counts the shaders are compiled for
+static void SetSceneStats( const GpuScene& scene )
+{
+    g_BvhLayout          = scene.layout;
+    g_SceneStats.height  = scene.height;
+    g_SceneStats.geomCnt = static_cast<int>( scene.geometries.size() );
+    g_SceneStats.bboxCnt = static_cast<int>( g_BvhLayout == BvhLayout::Pairs ? scene.nodes.size() : scene.bvhs.size() );
 }
 
 void Viewer::Initialize()
 {
+    PROFILE_ZONE( "Viewer::Initialize" );
     const char* scene_path = Dvar_GetString( scene );
     const int width        = Dvar_GetInt( wnd_width );
     const int height       = Dvar_GetInt( wnd_height );
@@ -80,21 +172,19 @@ void Viewer::Initialize()
     core_assert( width > 0 );
     core_assert( height > 0 );
 
-    Scene scene;
-    if ( !LuaLoadScene( scene_path, scene ) )
+    if ( !LuaLoadScene( scene_path, m_scene ) )
     {
         Com_PrintFatal( "failed to execute script %s", scene_path );
         return;
     }
 
-    GpuScene gpuScene;
-    ConstructScene( scene, gpuScene );
+    ConstructScene( m_scene, m_gpuScene );
 
-    InitCamera( scene.camera, gpuScene.bbox );
+    SetBvhLayout( m_gpuScene, BvhLayoutFromDvar() );
+    SetSceneStats( m_gpuScene );
 
-    g_SceneStats.height  = gpuScene.height;
-    g_SceneStats.geomCnt = static_cast<int>( gpuScene.geometries.size() );
-    g_SceneStats.bboxCnt = static_cast<int>( gpuScene.bvhs.size() );
+    InitCamera( m_scene.camera, m_gpuScene.bbox );
+    m_depthScale = glm::max( glm::length( m_gpuScene.bbox.max - m_gpuScene.bbox.min ), 1e-3f );
 
     CreateMainWindow( width, height );
 
@@ -111,17 +201,24 @@ void Viewer::Initialize()
     ImGui_ImplGlfw_InitForOpenGL( GetInternalWindow(), true );
     ImGui_ImplOpenGL3_Init( "#version 460 core" );
 
-    g_Texture = gl::CreateOutputTextureAndBind( width, height );
+    g_Texture          = gl::CreateOutputTextureAndBind( width, height );
+    g_AlbedoAovTexture = gl::CreateFeatureTextureAndBind( width, height, 1 );
+    g_NormalAovTexture = gl::CreateFeatureTextureAndBind( width, height, 2 );
+    g_IdAovTexture     = gl::CreateFeatureTextureAndBind( width, height, 7 );
+    glCreateTextures( GL_TEXTURE_2D, 1, &g_DenoisedTexture );
+    glTextureParameteri( g_DenoisedTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTextureParameteri( g_DenoisedTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTextureStorage2D( g_DenoisedTexture, 1, GL_RGBA32F, width, height );
+    m_cache.writeAovs = 1;
+
+    g_HistoryTexture       = gl::CreateFeatureTextureAndBind( width, height, 3 );
+    g_HistoryAlbedoTexture = gl::CreateFeatureTextureAndBind( width, height, 4 );
+    g_HistoryNormalTexture = gl::CreateFeatureTextureAndBind( width, height, 5 );
+    g_ReprojectedTexture   = gl::CreateFeatureTextureAndBind( width, height, 6 );
 
     Image image;
     g_EnvTexture = gl::CreateEnvTexture( DATA_DIR "env/stairs.hdr", image );
-    free( image.data );
-
-    g_AlbedoTexture = gl::Create3DTexture( g_AlbedoMaps );
-    for ( auto& albedo : g_AlbedoMaps.images )
-    {
-        free( albedo.data );
-    }
+    FreeImage( image );
 
     // shaders
     {
@@ -131,6 +228,47 @@ void Viewer::Initialize()
         createInfo.frag                    = DATA_DIR "shaders/imgui.frag";
         g_ImguiProgram.Create( createInfo );
     }
+    CreatePrograms();
+
+    // quad buffer
+    gl::CreateQuadVao( g_QuadVao, g_QuadVbo );
+
+    // constant buffer
+    glGenBuffers( 1, &g_ConstantBuffer );
+    glBindBufferBase( GL_UNIFORM_BUFFER, 0, g_ConstantBuffer );
+
+    UploadScene();
+    PrintMemReport( "scene uploaded" );
+
+    if ( Dvar_GetBool( hot_reload ) )
+    {
+        WatchSceneFiles();
+    }
+    else
+    {
+        m_scene = Scene();
+        ReleaseSceneGeometry( m_gpuScene );
+    }
+
+    g_FrameCapture.Initialize( CAPTURE_RING_SIZE );
+    g_GpuTimers.Initialize( GPU_TIMER_RING_SIZE, GPU_TIMER_PASSES );
+
+    m_lastTimestamp = GetMsSinceEpoch();
+}
+
+// the programs that depend on the scene, compiled again when a shader or the scene changes
+void Viewer::CreatePrograms()
+{
+    PROFILE_ZONE( "Viewer::CreatePrograms" );
+    {
+        gl::Program::CreateInfo createInfo = {};
+        createInfo.kind                    = gl::Program::Kind::Rasterize;
+        createInfo.vert                    = DATA_DIR "shaders/fullscreen.vert";
+        createInfo.frag                    = DATA_DIR "shaders/fullscreen.frag";
+        g_FullScreenProgram.Recreate( createInfo );
+
+        SetTextureSamplerUniforms( g_FullScreenProgram );
+    }
     {
         gl::Program::CreateInfo createInfo = {};
         createInfo.kind                    = gl::Program::Kind::Rasterize;
@@ -144,33 +282,261 @@ void Viewer::Initialize()
         gl::Program::CreateInfo createInfo = {};
         createInfo.defines.push_back( Define{ "BVH_COUNT", std::any( g_SceneStats.bboxCnt ) } );
         createInfo.defines.push_back( Define{ "GEOM_COUNT", std::any( g_SceneStats.geomCnt ) } );
-        createInfo.defines.push_back( Define{ "MATERIAL_COUNT", std::any( gpuScene.materials.size() ) } );
+        createInfo.defines.push_back( Define{ "MATERIAL_COUNT", std::any( m_gpuScene.materials.size() ) } );
+        if ( g_BvhLayout == BvhLayout::Pairs )
+        {
+            createInfo.defines.push_back( Define{ "BVH_PAIRS", std::any( 1 ) } );
+        }
         createInfo.kind = gl::Program::Kind::Compute;
         createInfo.comp = DATA_DIR "shaders/tiled.comp";
-        g_TiledRenderProgram.Create( createInfo );
+        g_TiledRenderProgram.Recreate( createInfo );
         SetTextureSamplerUniforms( g_TiledRenderProgram );
 
         createInfo.comp = DATA_DIR "shaders/phong.comp";
-        g_PhongProgram.Create( createInfo );
+        g_PhongProgram.Recreate( createInfo );
         SetTextureSamplerUniforms( g_PhongProgram );
+
+        createInfo.comp = DATA_DIR "shaders/reproject.comp";
+        g_ReprojectProgram.Recreate( createInfo );
     }
+}
 
-    // quad buffer
-    gl::CreateQuadVao( g_QuadVao, g_QuadVbo );
+// scene buffers and albedo maps, replaces the ones of the previous scene
+void Viewer::UploadScene()
+{
+    PROFILE_ZONE( "Viewer::UploadScene" );
+    glDeleteTextures( 1, &g_AlbedoTexture );
+    g_AlbedoTexture = gl::Create3DTexture( g_AlbedoMaps );
+    for ( auto& albedo : g_AlbedoMaps.images )
+    {
+        FreeImage( albedo );
+    }
 
-    // constant buffer
-    glGenBuffers( 1, &g_ConstantBuffer );
-    glBindBufferBase( GL_UNIFORM_BUFFER, 0, g_ConstantBuffer );
+    const GLuint buffers[] = { g_GeomSsbo, g_BBoxSsbo, g_MatSsbo, g_PrimSsbo };
+    glDeleteBuffers( ARRAYSIZE( buffers ), buffers );
 
-    // ssbo buffer
-    g_GeomSsbo = gl::CreateSSBO( gpuScene.geometries );
+    g_GeomSsbo = gl::CreateSSBO( m_gpuScene.geometries );
     gl::BindSSBOToSlot( g_GeomSsbo, 1 );
-    g_BBoxSsbo = gl::CreateSSBO( gpuScene.bvhs );
+    g_BBoxSsbo = g_BvhLayout == BvhLayout::Pairs ? gl::CreateSSBO( m_gpuScene.nodes ) : gl::CreateSSBO( m_gpuScene.bvhs );
     gl::BindSSBOToSlot( g_BBoxSsbo, 2 );
-    g_MatSsbo = gl::CreateSSBO( gpuScene.materials );
+    g_MatSsbo = gl::CreateSSBO( m_gpuScene.materials );
     gl::BindSSBOToSlot( g_MatSsbo, 3 );
+    g_PrimSsbo = gl::CreateSSBO( m_gpuScene.primitives );
+    gl::BindSSBOToSlot( g_PrimSsbo, 5 );
+}
 
-    m_lastTimestamp = GetMsSinceEpoch();
+// the folders of the script, the shaders and the meshes, watching folders also sees
+// the .mtl files and textures next to a mesh
+void Viewer::WatchSceneFiles()
+{
+    const char* path = Dvar_GetString( scene );
+    const char* end  = strrchr( path, '/' );
+    m_watcher.WatchDirectory( string( path, end ? end - path + 1 : 0 ) );
+    m_watcher.WatchDirectory( DATA_DIR "shaders/" );
+    for ( const SceneGeometry& geom : m_scene.geometries )
+    {
+        if ( geom.kind == SceneGeometry::Kind::Mesh )
+        {
+            const string mesh = DATA_DIR + geom.path;
+            m_watcher.WatchDirectory( mesh.substr( 0, mesh.find_last_of( '/' ) + 1 ) );
+        }
+    }
+}
+
+static bool StartsWith( const string& str, const string& prefix )
+{
+    return str.compare( 0, prefix.size(), prefix ) == 0;
+}
+
+static bool EndsWith( const string& str, const char* suffix )
+{
+    const size_t length = strlen( suffix );
+    return str.size() >= length && str.compare( str.size() - length, length, suffix ) == 0;
+}
+
+// swap, backup and probe files editors write next to the one being saved
+static bool IsEditorFile( const string& path )
+{
+    const size_t name = path.find_last_of( '/' ) + 1;
+    return path[name] == '.' || EndsWith( path, "~" ) || !std::filesystem::exists( path );
+}
+
+static bool InMeshFolder( const Scene& scene, const string& path )
+{
+    for ( const SceneGeometry& geom : scene.geometries )
+    {
+        const string mesh = DATA_DIR + geom.path;
+        if ( geom.kind == SceneGeometry::Kind::Mesh && StartsWith( path, mesh.substr( 0, mesh.find_last_of( '/' ) + 1 ) ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// waits for the writes to settle, editors touch a file more than once per save
+static constexpr double RELOAD_SETTLE_MS = 100.0;
+
+void Viewer::PollReload()
+{
+    vector<string> changed;
+    m_watcher.Poll( changed );
+    for ( const string& path : changed )
+    {
+        if ( IsEditorFile( path ) )
+        {
+            continue;
+        }
+        if ( StartsWith( path, DATA_DIR "shaders/" ) )
+        {
+            m_reloadShaders = true;
+        }
+        else if ( EndsWith( path, ".lua" ) )
+        {
+            m_reloadScript = true;
+        }
+        else if ( InMeshFolder( m_scene, path ) )
+        {
+            m_reloadAssets = true;
+        }
+        else
+        {
+            continue;
+        }
+        m_lastChange = GetMsSinceEpoch();
+    }
+
+    if ( !( m_reloadScript || m_reloadShaders || m_reloadAssets ) || GetMsSinceEpoch() - m_lastChange < RELOAD_SETTLE_MS )
+    {
+        return;
+    }
+
+    if ( m_reloadScript || m_reloadAssets )
+    {
+        ReloadScene( m_reloadAssets );
+    }
+    if ( m_reloadShaders )
+    {
+        const SteadyClock::time_point start = SteadyClock::now();
+        try
+        {
+            CreatePrograms();
+            Com_PrintSuccess( "[reload] shaders in %.2f ms", NsSince( start ) * 1e-6 );
+        }
+        catch ( const std::runtime_error& e )
+        {
+            Com_PrintError( "[reload] %s", e.what() );
+        }
+    }
+    m_reloadScript  = false;
+    m_reloadShaders = false;
+    m_reloadAssets  = false;
+
+    // restart the accumulation
+    m_dirty          = true;
+    m_previewSamples = 0;
+    m_showDenoised   = false;
+}
+
+// runs the script again and applies the difference to the scene: edited materials are written
+// to the material buffer, moved geometries refit the bvh and everything else, or any change
+// to a mesh, its materials or textures, builds the scene from scratch
+void Viewer::ReloadScene( bool assetsChanged )
+{
+    PROFILE_ZONE( "Viewer::ReloadScene" );
+    const SteadyClock::time_point start = SteadyClock::now();
+    const char* path                    = Dvar_GetString( scene );
+
+    Scene scene;
+    if ( !LuaLoadScene( path, scene ) )
+    {
+        Com_PrintError( "[reload] '%s' failed, keeping the current scene", path );
+        return;
+    }
+    const double scriptMs = NsSince( start ) * 1e-6;
+
+    SceneDiff diff = DiffScenes( m_scene, scene );
+    diff.topology  = diff.topology || assetsChanged;
+
+    string summary;
+    const auto addSummary = [&summary]( const char* part ) {
+        summary.append( summary.empty() ? "" : ", " ).append( part );
+    };
+    if ( diff.topology )
+    {
+        // ConstructScene adds the mesh textures to g_AlbedoMaps, the current ones are put back
+        // when the build fails
+        GpuScene gpuScene;
+        ImageArray albedoMaps;
+        std::swap( albedoMaps, g_AlbedoMaps );
+        try
+        {
+            ConstructScene( scene, gpuScene );
+        }
+        catch ( const std::runtime_error& e )
+        {
+            for ( auto& albedo : g_AlbedoMaps.images )
+            {
+                FreeImage( albedo );
+            }
+            g_AlbedoMaps = std::move( albedoMaps );
+            Com_PrintError( "[reload] %s, keeping the current scene", e.what() );
+            return;
+        }
+        SetBvhLayout( gpuScene, BvhLayoutFromDvar() );
+        m_gpuScene = std::move( gpuScene );
+        SetSceneStats( m_gpuScene );
+        UploadScene();
+        // the shaders are compiled for the counts of the scene
+        m_reloadShaders = true;
+        m_depthScale    = glm::max( glm::length( m_gpuScene.bbox.max - m_gpuScene.bbox.min ), 1e-3f );
+        addSummary( va( "rebuilt %d geometries", g_SceneStats.geomCnt ) );
+    }
+    else
+    {
+        if ( !diff.materials.empty() )
+        {
+            UpdateSceneMaterials( scene, diff, m_gpuScene );
+            for ( int material : diff.materials )
+            {
+                gl::UpdateSSBO( g_MatSsbo, m_gpuScene.materials, material, 1 );
+            }
+            addSummary( va( "%d materials", static_cast<int>( diff.materials.size() ) ) );
+        }
+        if ( !diff.geometries.empty() )
+        {
+            const int refit = RefitScene( m_scene, scene, diff, m_gpuScene );
+            gl::UpdateSSBO( g_GeomSsbo, m_gpuScene.geometries, 0, m_gpuScene.geometries.size() );
+            gl::UpdateSSBO( g_PrimSsbo, m_gpuScene.primitives, 0, m_gpuScene.primitives.size() );
+            if ( g_BvhLayout == BvhLayout::Pairs )
+            {
+                gl::UpdateSSBO( g_BBoxSsbo, m_gpuScene.nodes, 0, m_gpuScene.nodes.size() );
+            }
+            else
+            {
+                gl::UpdateSSBO( g_BBoxSsbo, m_gpuScene.bvhs, 0, m_gpuScene.bvhs.size() );
+            }
+            addSummary( va( "%d geometries refit", refit ) );
+        }
+    }
+
+    // the camera only jumps when the script moved it
+    if ( diff.camera )
+    {
+        InitCamera( scene.camera, m_gpuScene.bbox );
+        addSummary( "camera" );
+    }
+    if ( summary.empty() )
+    {
+        addSummary( "no changes" );
+    }
+    m_scene = std::move( scene );
+    if ( diff.topology )
+    {
+        WatchSceneFiles();
+    }
+
+    Com_PrintSuccess( "[reload] %s in %.2f ms (script %.2f ms)", summary.c_str(), NsSince( start ) * 1e-6, scriptMs );
 }
 
 void Viewer::CopyCameraToCache()
@@ -185,12 +551,51 @@ void Viewer::CopyCameraToCache()
 
 void Viewer::Finalize()
 {
+    g_GpuTimers.Finalize( g_Timeline );
+    if ( Dvar_GetString( trace_output )[0] )
+    {
+        WriteTrace( Dvar_GetString( trace_output ) );
+    }
+
+    g_FrameCapture.Finalize();
+    const gl::FrameCapture::Stats stats = g_FrameCapture.GetStats();
+    if ( stats.captured )
+    {
+        const double frameMs = m_frameMsTotal / glm::max( m_frameCount, 1 );
+        Com_Printf( "[capture] %d frames, avg frame %.2f ms, %d captured, %d written, %d failed",
+                    m_frameCount,
+                    frameMs,
+                    stats.captured,
+                    stats.encoded,
+                    stats.failed );
+        Com_Printf( "[capture] render thread: issue %.3f ms/capture, %d ring stalls (%.2f ms), encoder thread: %.2f ms/capture",
+                    stats.issueMs / stats.captured,
+                    stats.stalls,
+                    stats.stallMs,
+                    stats.encodeMs / glm::max( stats.encoded, 1 ) );
+    }
+
     glDeleteVertexArrays( 1, &g_QuadVao );
     glDeleteBuffers( 1, &g_QuadVbo );
     glDeleteBuffers( 1, &g_GeomSsbo );
     glDeleteBuffers( 1, &g_BBoxSsbo );
     glDeleteBuffers( 1, &g_MatSsbo );
+    glDeleteBuffers( 1, &g_PrimSsbo );
     glDeleteTextures( 1, &g_Texture );
+    glDeleteTextures( 1, &g_AlbedoAovTexture );
+    glDeleteTextures( 1, &g_NormalAovTexture );
+    glDeleteTextures( 1, &g_IdAovTexture );
+    glDeleteTextures( 1, &g_DenoisedTexture );
+    glDeleteTextures( 1, &g_HistoryTexture );
+    glDeleteTextures( 1, &g_HistoryAlbedoTexture );
+    glDeleteTextures( 1, &g_HistoryNormalTexture );
+    glDeleteTextures( 1, &g_ReprojectedTexture );
+
+    if ( m_cameraFile )
+    {
+        fclose( m_cameraFile );
+        m_cameraFile = nullptr;
+    }
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -237,7 +642,7 @@ void Viewer::HandleInput( float deltaTime )
     {
         if ( ImGui::IsKeyDown( GLFW_KEY_S ) )
         {
-            gl::SaveScreenshot();
+            m_screenshot = true;
         }
         else if ( ImGui::IsKeyDown( GLFW_KEY_R ) )
         {
@@ -245,6 +650,11 @@ void Viewer::HandleInput( float deltaTime )
             Dvar_SetInt( ssp, 128 );
             m_state = Render;
         }
+        else if ( ImGui::IsKeyPressed( GLFW_KEY_D, false ) )
+        {
+            m_denoise      = !m_showDenoised;
+            m_showDenoised = false;
+        }
         return;
     }
 
@@ -253,6 +663,11 @@ void Viewer::HandleInput( float deltaTime )
     {
         UpdateCamera( deltaTime );
     }
+
+    if ( m_dirty )
+    {
+        m_showDenoised = false;
+    }
 }
 
 void Viewer::UpdateCamera( float deltaTime )
@@ -322,7 +737,12 @@ void Viewer::DrawGui()
             }
             if ( ImGui::MenuItem( "Save Screen Shot", "Ctrl+S", false ) )
             {
-                gl::SaveScreenshot();
+                m_screenshot = true;
+            }
+            if ( ImGui::MenuItem( "Denoise", "Ctrl+D", m_showDenoised ) )
+            {
+                m_denoise      = !m_showDenoised;
+                m_showDenoised = false;
             }
             ImGui::EndMenu();
         }
@@ -337,12 +757,69 @@ void Viewer::DrawGui()
                          gl::g_ComputeGroup.y,
                          gl::g_ComputeGroup.z );
             ImGui::Text( "Triangle Count: %d", g_SceneStats.geomCnt );
-            ImGui::Text( "BBox Count: %d", g_SceneStats.bboxCnt );
+            ImGui::Text( "BBox Count: %d (%s)", g_SceneStats.bboxCnt, BvhLayoutToString( g_BvhLayout ) );
+            ImGui::Text( "Sampler: %s", SamplerKindToString( static_cast<Sampler::Kind>( m_cache.samplerKind ) ) );
+            ImGui::SliderFloat( "Exposure", static_cast<float*>( Dvar_GetPtr( exposure ) ), 0.0f, 4.0f );
+            ImGui::Combo( "Tonemap", static_cast<int*>( Dvar_GetPtr( tonemap ) ), "Linear\0ACES\0Reinhard\0" );
+            bool ditherEnabled = Dvar_GetBool( dither );
+            if ( ImGui::Checkbox( "Dither", &ditherEnabled ) )
+            {
+                Dvar_SetInt( dither, ditherEnabled );
+            }
+            bool previewEnabled = Dvar_GetBool( preview );
+            if ( ImGui::Checkbox( "Path Traced Preview", &previewEnabled ) )
+            {
+                Dvar_SetInt( preview, previewEnabled );
+            }
+            bool reprojectEnabled = Dvar_GetBool( reproject );
+            if ( ImGui::Checkbox( "Reproject", &reprojectEnabled ) )
+            {
+                Dvar_SetInt( reproject, reprojectEnabled );
+            }
+            ImGui::Text( "Preview Samples: %d", m_previewSamples );
+            AovView aovView = AovView::Color;
+            AovViewFromString( Dvar_GetString( aov_view ), aovView );
+            int aovIndex = static_cast<int>( aovView );
+            if ( ImGui::Combo( "AOV", &aovIndex, "Color\0Albedo\0Normal\0Depth\0Material\0Primitive\0Heat\0" ) )
+            {
+                Dvar_SetString( aov_view, AovViewToString( static_cast<AovView>( aovIndex ) ) );
+            }
             ImGui::Text( "Camera:" );
             const Camera& cam = m_cam;
             ImGui::Text( "  origin: %f, %f, %f", cam.pos.x, cam.pos.y, cam.pos.z );
             const vec3 lookAt = cam.pos + cam.fwd;
             ImGui::Text( "  lookAt: %f, %f, %f", lookAt.x, lookAt.y, lookAt.z );
+            if ( ImGui::CollapsingHeader( "Timings", ImGuiTreeNodeFlags_DefaultOpen ) )
+            {
+                for ( const FrameTimeline::Pass& pass : g_Timeline.GetPasses() )
+                {
+                    char overlay[64];
+                    snprintf( overlay, sizeof( overlay ), "%.3f ms (avg %.3f)", pass.lastMs, pass.averageMs );
+                    ImGui::PlotLines( va( "%s %s", pass.track == TimerTrack_Gpu ? "gpu" : "cpu", pass.name ),
+                                      pass.history,
+                                      FrameTimeline::HISTORY_SIZE,
+                                      pass.head,
+                                      overlay,
+                                      0.0f,
+                                      FLT_MAX,
+                                      ImVec2( 0.0f, 40.0f ) );
+                }
+                if ( ImGui::Button( "Export Trace" ) )
+                {
+                    WriteTrace( Dvar_GetString( trace_output )[0] ? Dvar_GetString( trace_output ) : "trace.json" );
+                }
+            }
+            if ( ImGui::CollapsingHeader( "Memory" ) )
+            {
+                constexpr float MB   = 1024.0f * 1024.0f;
+                const MemCounter sum = GetMemTotal();
+                ImGui::Text( "Total: %.2f MB, peak %.2f MB", sum.current / MB, sum.peak / MB );
+                for ( int tag = 0; tag < MemTag_Count; ++tag )
+                {
+                    const MemCounter counter = GetMemCounter( static_cast<MemTag>( tag ) );
+                    ImGui::Text( "  %s: %.2f MB, peak %.2f MB", MemTagToString( static_cast<MemTag>( tag ) ), counter.current / MB, counter.peak / MB );
+                }
+            }
             ImGui::End();
         }
 
@@ -362,21 +839,132 @@ void Viewer::RenderGui()
         return;
     }
 
+    g_GpuTimers.Begin( "imgui" );
     ImGui_ImplOpenGL3_RenderDrawData( ImGui::GetDrawData() );
+    g_GpuTimers.End();
+}
+
+// reads the accumulation and feature buffers back and shows the denoised frame,
+// this stalls the render loop for the read back and the cpu filter
+void Viewer::DenoiseFrame( int width, int height )
+{
+    const Clock::time_point start = Clock::now();
+    const size_t count            = static_cast<size_t>( width ) * height;
+    const GLsizei size            = static_cast<GLsizei>( count * sizeof( vec4 ) );
+    vector<vec4> accumulation( count );
+    vector<vec4> albedo( count );
+    vector<vec4> normal( count );
+    glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT );
+    glGetTextureImage( g_Texture, 0, GL_RGBA, GL_FLOAT, size, accumulation.data() );
+    glGetTextureImage( g_AlbedoAovTexture, 0, GL_RGBA, GL_FLOAT, size, albedo.data() );
+    glGetTextureImage( g_NormalAovTexture, 0, GL_RGBA, GL_FLOAT, size, normal.data() );
+
+    vector<float> rgb;
+    ResolveAccumulation( accumulation, rgb );
+    FeatureBuffers features;
+    ResolveFeatures( albedo, normal, width, height, features );
+    vector<float> denoised;
+    Denoise( rgb, features, DenoiseSettingsFromDvars(), denoised, Dvar_GetInt( threads ) );
+
+    // alpha is the sample count the fullscreen pass divides by
+    for ( size_t i = 0; i < count; ++i )
+    {
+        accumulation[i] = vec4( denoised[3 * i], denoised[3 * i + 1], denoised[3 * i + 2], 1.0f );
+    }
+    glTextureSubImage2D( g_DenoisedTexture, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, accumulation.data() );
+    m_showDenoised = true;
+
+    Com_Printf( "[denoise] %dx%d in %.2f ms", width, height, std::chrono::duration<double, std::milli>( Clock::now() - start ).count() );
+}
+
+// the images were written by a compute shader, no single barrier bit is documented to cover
+// glCopyImageSubData so the callers take both the image access and the texture update bits
+static void CopyTexture( GLuint src, GLuint dst, int width, int height )
+{
+    glCopyImageSubData( src, GL_TEXTURE_2D, 0, 0, 0, 0, dst, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1 );
+}
+
+// path traces the whole frame at one sample per pixel while interactive, a camera move
+// restarts the accumulation and, with reproject 1, merges the old one back in
+void Viewer::RenderPreview( int width, int height )
+{
+    const bool restart   = m_dirty || m_previewSamples == 0;
+    const bool reproject = m_dirty && m_previewSamples > 0 && Dvar_GetBool( reproject );
+    if ( restart && !reproject )
+    {
+        m_previewSamples = 0;
+    }
+
+    if ( reproject )
+    {
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT );
+        CopyTexture( g_Texture, g_HistoryTexture, width, height );
+        CopyTexture( g_AlbedoAovTexture, g_HistoryAlbedoTexture, width, height );
+        CopyTexture( g_NormalAovTexture, g_HistoryNormalTexture, width, height );
+    }
+
+    // the sample index keeps counting across reprojection so new samples do not repeat the history
+    m_cache.dirty       = restart;
+    m_cache.tileOffset  = ivec2( 0 );
+    m_cache.sampleIndex = m_previewSamples++;
+    g_TiledRenderProgram.Use();
+    UploadConstantBuffer( m_cache );
+    g_GpuTimers.Begin( "trace" );
+    glDispatchCompute( width, height, 1 );
+    g_GpuTimers.End();
+
+    if ( reproject )
+    {
+        const ReprojectionSettings settings = ReprojectionSettingsFromDvars();
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+        g_ReprojectProgram.Use();
+        glUniform3fv( g_ReprojectProgram.GetUniformLoc( "prevCamPos" ), 1, &m_prevCache.camPos.x );
+        glUniform3fv( g_ReprojectProgram.GetUniformLoc( "prevCamFwd" ), 1, &m_prevCache.camFwd.x );
+        glUniform3fv( g_ReprojectProgram.GetUniformLoc( "prevCamRight" ), 1, &m_prevCache.camRight.x );
+        glUniform3fv( g_ReprojectProgram.GetUniformLoc( "prevCamUp" ), 1, &m_prevCache.camUp.x );
+        glUniform1f( g_ReprojectProgram.GetUniformLoc( "prevCamFov" ), m_prevCache.camFov );
+        glUniform1f( g_ReprojectProgram.GetUniformLoc( "depthTolerance" ), settings.depthTolerance );
+        glUniform1f( g_ReprojectProgram.GetUniformLoc( "normalCosine" ), settings.normalCosine );
+        glUniform1f( g_ReprojectProgram.GetUniformLoc( "clampGamma" ), settings.clampGamma );
+        glUniform1f( g_ReprojectProgram.GetUniformLoc( "maxHistory" ), static_cast<float>( settings.maxHistory ) );
+        g_GpuTimers.Begin( "reproject" );
+        glDispatchCompute( width, height, 1 );
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT );
+        CopyTexture( g_ReprojectedTexture, g_Texture, width, height );
+        g_GpuTimers.End();
+    }
+
+    m_prevCache = m_cache;
 }
 
 void Viewer::Update()
 {
+    PROFILE_ZONE( "Viewer::Update" );
     const int width  = Dvar_GetInt( wnd_width );
     const int height = Dvar_GetInt( wnd_height );
 
     const double currentTimestamp = GetMsSinceEpoch();
-    float deltaTime               = static_cast<int>( currentTimestamp - m_lastTimestamp );
+    m_frameMsTotal += currentTimestamp - m_lastTimestamp;
+    ++m_frameCount;
+    float deltaTime = static_cast<int>( currentTimestamp - m_lastTimestamp );
     deltaTime                     = glm::max( deltaTime, 1.0f );
     m_lastTimestamp               = currentTimestamp;
-    HandleInput( deltaTime );
 
-    DrawGui();
+    g_Timeline.BeginFrame();
+    g_GpuTimers.BeginFrame( g_Timeline );
+    {
+        CpuTimer timer( g_Timeline, "input" );
+        HandleInput( deltaTime );
+    }
+    if ( Dvar_GetBool( hot_reload ) )
+    {
+        CpuTimer timer( g_Timeline, "reload" );
+        PollReload();
+    }
+    {
+        CpuTimer timer( g_Timeline, "gui" );
+        DrawGui();
+    }
 
     // viewport
     int display_w, display_h;
@@ -384,24 +972,55 @@ void Viewer::Update()
     glViewport( 0, 0, display_w, display_h );
     glClear( GL_COLOR_BUFFER_BIT );
     glActiveTexture( GL_TEXTURE0 );
-    glBindTexture( GL_TEXTURE_2D, g_Texture );
+    glBindTexture( GL_TEXTURE_2D, m_showDenoised ? g_DenoisedTexture : g_Texture );
     glActiveTexture( GL_TEXTURE1 );
     glBindTexture( GL_TEXTURE_2D, g_EnvTexture );
     glActiveTexture( GL_TEXTURE2 );
     glBindTexture( GL_TEXTURE_2D_ARRAY, g_AlbedoTexture );
+    glActiveTexture( GL_TEXTURE3 );
+    glBindTexture( GL_TEXTURE_2D, g_AlbedoAovTexture );
+    glActiveTexture( GL_TEXTURE4 );
+    glBindTexture( GL_TEXTURE_2D, g_NormalAovTexture );
+    glActiveTexture( GL_TEXTURE5 );
+    glBindTexture( GL_TEXTURE_2D, g_IdAovTexture );
+
+    // aovs are only written by the path tracer
+    AovView aovView = AovView::Color;
+    AovViewFromString( Dvar_GetString( aov_view ), aovView );
 
     ++m_cache.frame;
+    m_cache.samplerKind = glm::clamp( Dvar_GetInt( sampler ), 0, Sampler::Count - 1 );
+    m_cache.integrator  = glm::clamp( Dvar_GetInt( integrator ), 0, Integrator_Count - 1 );
+    m_cache.aoRadius    = Dvar_GetFloat( ao_radius ) > 0.0f ? Dvar_GetFloat( ao_radius ) : 0.1f * m_depthScale;
     CopyCameraToCache();
 
+    // +set record_camera <file> writes a camera path for +set camera_path
+    const char* cameraPath = Dvar_GetString( record_camera );
+    if ( cameraPath[0] && GetState() == Viewer::Interactive )
+    {
+        if ( !m_cameraFile && !( m_cameraFile = fopen( cameraPath, "w" ) ) )
+        {
+            Com_PrintError( "[viewer] failed to open '%s', camera is not recorded", cameraPath );
+            Dvar_SetString( record_camera, "" );
+        }
+        else
+        {
+            AppendCameraPath( m_cameraFile, m_cam );
+        }
+    }
+
     if ( GetState() == Viewer::Render )
     {
+        m_previewSamples = 0;
         g_TiledRenderProgram.Use();
         static int counter = 0;
-        counter            = ( counter + 1 ) % Dvar_GetInt( ssp );
+        const int spp      = Dvar_GetInt( ssp );
+        counter            = ( counter + 1 ) % spp;
 
         const int tileSize = Dvar_GetInt( tile );
 
-        m_cache.tileOffset = m_tileOffset;
+        m_cache.tileOffset  = m_tileOffset;
+        m_cache.sampleIndex = ( counter + spp - 1 ) % spp;
 
         if ( counter == 0 )
         {
@@ -418,24 +1037,69 @@ void Viewer::Update()
             }
         }
 
-        glNamedBufferData( g_ConstantBuffer, sizeof( ConstantBufferCache ), &m_cache, GL_DYNAMIC_DRAW );
+        UploadConstantBuffer( m_cache );
+        g_GpuTimers.Begin( "trace" );
         glDispatchCompute( tileSize, tileSize, 1 );
+        g_GpuTimers.End();
+    }
+    else if ( Dvar_GetBool( preview ) || aovView != AovView::Color )
+    {
+        RenderPreview( width, height );
     }
     else
     {
+        m_previewSamples = 0;
         g_PhongProgram.Use();
-        glNamedBufferData( g_ConstantBuffer, sizeof( ConstantBufferCache ), &m_cache, GL_DYNAMIC_DRAW );
+        UploadConstantBuffer( m_cache );
+        g_GpuTimers.Begin( "phong" );
         glDispatchCompute( width, height, 1 );
+        g_GpuTimers.End();
     }
 
     // NOTE: this slows things down!!!!
     glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
 
+    if ( m_denoise )
+    {
+        m_denoise = false;
+        DenoiseFrame( width, height );
+        glActiveTexture( GL_TEXTURE0 );
+        glBindTexture( GL_TEXTURE_2D, g_DenoisedTexture );
+    }
+
+    const TonemapSettings tonemap = TonemapSettingsFromDvars();
     g_FullScreenProgram.Use();
+    glUniform1f( g_FullScreenProgram.GetUniformLoc( "exposure" ), tonemap.exposure );
+    glUniform1i( g_FullScreenProgram.GetUniformLoc( "tonemapOperator" ), static_cast<int>( tonemap.op ) );
+    glUniform1i( g_FullScreenProgram.GetUniformLoc( "dither" ), tonemap.dither );
+    const float heatMax = Dvar_GetFloat( aov_heat_max );
+    glUniform1i( g_FullScreenProgram.GetUniformLoc( "aovView" ), m_showDenoised ? 0 : static_cast<int>( aovView ) );
+    glUniform1f( g_FullScreenProgram.GetUniformLoc( "depthScale" ), m_depthScale );
+    glUniform1f( g_FullScreenProgram.GetUniformLoc( "heatScale" ), heatMax > 0.0f ? heatMax : 4.0f * glm::log2( static_cast<float>( g_SceneStats.bboxCnt ) + 1.0f ) );
+    g_GpuTimers.Begin( "resolve" );
     glDrawArrays( GL_TRIANGLES, 0, 6 );
+    g_GpuTimers.End();
 
     m_cache.dirty = 0;
 
+    // capture before the gui is drawn on top
+    const int dumpEvery = Dvar_GetInt( dump_every );
+    if ( dumpEvery > 0 && !IsIntFormat( Dvar_GetString( dump_path ) ) )
+    {
+        Com_PrintError( "[viewer] dump_path '%s' needs exactly one integer conversion, frames are not dumped", Dvar_GetString( dump_path ) );
+        Dvar_SetInt( dump_every, 0 );
+    }
+    else if ( dumpEvery > 0 && m_frameCount % dumpEvery == 0 )
+    {
+        g_FrameCapture.CaptureFramebuffer( display_w, display_h, va( Dvar_GetString( dump_path ), m_dumpCount++ ) );
+    }
+    if ( m_screenshot )
+    {
+        g_FrameCapture.CaptureFramebuffer( display_w, display_h, "my.png" );
+        m_screenshot = false;
+    }
+    g_FrameCapture.Update();
+
     RenderGui();
 }
 
@@ -1,6 +1,10 @@
 #pragma once
+#include <cstdio>
+
 #include "camera.h"
 #include "constant_cache.h"
+#include "scene.h"
+#include "utility/file_watcher.h"
 
 namespace pt {
 
@@ -28,14 +32,41 @@ class Viewer {
     void RenderGui();
     void InitCamera( const SceneCamera& cam, const Box3& bbox );
     void CopyCameraToCache();
+    void DenoiseFrame( int width, int height );
+    void RenderPreview( int width, int height );
+    void CreatePrograms();
+    void UploadScene();
+    void WatchSceneFiles();
+    void PollReload();
+    void ReloadScene( bool assetsChanged );
 
     Camera m_cam;
     bool m_dirty;
     bool m_showGui;
+    bool m_screenshot;
+    bool m_denoise;       // denoise the accumulation at the end of this frame
+    bool m_showDenoised;  // until the camera moves or the denoiser is toggled off
     State m_state;
     ConstantBufferCache m_cache;
+    ConstantBufferCache m_prevCache;  // camera of the last preview frame
+    int m_previewSamples;
+    FILE* m_cameraFile;               // +set record_camera
+    float m_depthScale;               // hit distance shown as white in the depth view
     ivec2 m_tileOffset;
     double m_lastTimestamp;
+
+    int m_frameCount;
+    int m_dumpCount;
+    double m_frameMsTotal;
+
+    // +set hot_reload, the scene the buffers were built from is kept to diff edits against
+    Scene m_scene;
+    GpuScene m_gpuScene;
+    FileWatcher m_watcher;
+    bool m_reloadScript;
+    bool m_reloadShaders;
+    bool m_reloadAssets;
+    double m_lastChange;  // reloads wait until the files have not changed for a moment
 };
 
 }  // namespace pt